@@ -33,7 +33,17 @@ SOURCES += main.cpp\
     common.cpp \
     electroplatingboardcontrol.cpp \
     significantround.cpp \
-    impedanceplot.cpp
+    impedanceplot.cpp \
+    pulsemonitor.cpp \
+    measurementjournal.cpp \
+    electrodehistory.cpp \
+    impedanceexporter.cpp \
+    sessionfile.cpp \
+    deltacodec.cpp \
+    biquadbank.cpp \
+    triggersearch.cpp \
+    demodulator.cpp \
+    impedancecache.cpp
 
 HEADERS  += mainwindow.h \
     configurationwindow.h \
@@ -61,7 +71,17 @@ HEADERS  += mainwindow.h \
     common.h \
     electroplatingboardcontrol.h \
     significantround.h \
-    impedanceplot.h
+    impedanceplot.h \
+    pulsemonitor.h \
+    measurementjournal.h \
+    electrodehistory.h \
+    impedanceexporter.h \
+    sessionfile.h \
+    deltacodec.h \
+    biquadbank.h \
+    triggersearch.h \
+    demodulator.h \
+    impedancecache.h
 
 mac: {
 LIBS += -L$$PWD/../libraries/Mac/ -lokFrontPanel
@@ -0,0 +1,242 @@
+#include "biquadbank.h"
+#include "globalconstants.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#if defined(__AVX__)
+#define BIQUADBANK_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BIQUADBANK_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+    const size_t CacheLineBytes = 64;
+
+    // Four channels' worth of doubles, with just the arithmetic the sections need.  Every operation is done lane by lane,
+    // so the results are the same as the scalar code's.
+#if defined(BIQUADBANK_AVX)
+    struct Lanes {
+        __m256d v;
+    };
+    inline Lanes load(const double* p) { Lanes r; r.v = _mm256_loadu_pd(p); return r; }
+    inline void store(double* p, Lanes a) { _mm256_storeu_pd(p, a.v); }
+    inline Lanes splat(double x) { Lanes r; r.v = _mm256_set1_pd(x); return r; }
+    inline Lanes operator+(Lanes a, Lanes b) { Lanes r; r.v = _mm256_add_pd(a.v, b.v); return r; }
+    inline Lanes operator-(Lanes a, Lanes b) { Lanes r; r.v = _mm256_sub_pd(a.v, b.v); return r; }
+    inline Lanes operator*(Lanes a, Lanes b) { Lanes r; r.v = _mm256_mul_pd(a.v, b.v); return r; }
+#elif defined(BIQUADBANK_SSE2)
+    struct Lanes {
+        __m128d lo, hi;
+    };
+    inline Lanes load(const double* p) { Lanes r; r.lo = _mm_loadu_pd(p); r.hi = _mm_loadu_pd(p + 2); return r; }
+    inline void store(double* p, Lanes a) { _mm_storeu_pd(p, a.lo); _mm_storeu_pd(p + 2, a.hi); }
+    inline Lanes splat(double x) { Lanes r; r.lo = r.hi = _mm_set1_pd(x); return r; }
+    inline Lanes operator+(Lanes a, Lanes b) { Lanes r; r.lo = _mm_add_pd(a.lo, b.lo); r.hi = _mm_add_pd(a.hi, b.hi); return r; }
+    inline Lanes operator-(Lanes a, Lanes b) { Lanes r; r.lo = _mm_sub_pd(a.lo, b.lo); r.hi = _mm_sub_pd(a.hi, b.hi); return r; }
+    inline Lanes operator*(Lanes a, Lanes b) { Lanes r; r.lo = _mm_mul_pd(a.lo, b.lo); r.hi = _mm_mul_pd(a.hi, b.hi); return r; }
+#else
+    struct Lanes {
+        double v[4];
+    };
+    inline Lanes load(const double* p) { Lanes r; for (int i = 0; i < 4; ++i) r.v[i] = p[i]; return r; }
+    inline void store(double* p, Lanes a) { for (int i = 0; i < 4; ++i) p[i] = a.v[i]; }
+    inline Lanes splat(double x) { Lanes r; for (int i = 0; i < 4; ++i) r.v[i] = x; return r; }
+    inline Lanes operator+(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.v[i] += b.v[i]; return a; }
+    inline Lanes operator-(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.v[i] -= b.v[i]; return a; }
+    inline Lanes operator*(Lanes a, Lanes b) { for (int i = 0; i < 4; ++i) a.v[i] *= b.v[i]; return a; }
+#endif
+
+    // Runs one biquad over n samples of four channels, starting at 'x' (consecutive samples are 'stride' apart)
+    void biquadLanes(double* x, size_t stride, unsigned int n, const BiquadBank::Coefficients& c, double* state, size_t stateStride) {
+        const Lanes b0 = splat(c.b0), b1 = splat(c.b1), b2 = splat(c.b2), a1 = splat(c.a1), a2 = splat(c.a2);
+        Lanes x1 = load(state), x2 = load(state + stateStride);
+        Lanes y1 = load(state + 2 * stateStride), y2 = load(state + 3 * stateStride);
+        for (unsigned int t = 0; t < n; ++t, x += stride) {
+            Lanes in = load(x);
+            Lanes out = b2 * x2 + b1 * x1 + b0 * in - a2 * y2 - a1 * y1;
+            store(x, out);
+            x2 = x1;
+            x1 = in;
+            y2 = y1;
+            y1 = out;
+        }
+        store(state, x1);
+        store(state + stateStride, x2);
+        store(state + 2 * stateStride, y1);
+        store(state + 3 * stateStride, y2);
+    }
+
+    void highpassLanes(double* x, size_t stride, unsigned int n, double a, double b, double* state) {
+        const Lanes aa = splat(a), bb = splat(b);
+        Lanes s = load(state);
+        for (unsigned int t = 0; t < n; ++t, x += stride) {
+            Lanes in = load(x);
+            store(x, in - s);
+            s = aa * s + bb * in;
+        }
+        store(state, s);
+    }
+}
+
+//  ------------------------------------------------------------------------
+void AlignedDoubles::resize(size_t n) {
+    const size_t slack = CacheLineBytes / sizeof(double);
+    storage.assign(n + slack, 0.0);
+    uintptr_t address = reinterpret_cast<uintptr_t>(storage.data());
+    size_t offset = ((CacheLineBytes - address % CacheLineBytes) % CacheLineBytes) / sizeof(double);
+    aligned = storage.data() + offset;
+    length = n;
+}
+
+void AlignedDoubles::fill(double value) {
+    std::fill(aligned, aligned + length, value);
+}
+
+//  ------------------------------------------------------------------------
+BiquadBank::Coefficients BiquadBank::bandpass(double centerFreq, double q, double sampleFreq) {
+    double w0 = TWO_PI * centerFreq / sampleFreq;
+    double alpha = sin(w0) / (2.0 * q);
+    double a0 = 1.0 + alpha;
+
+    Coefficients c;
+    c.b0 = alpha / a0;
+    c.b1 = 0.0;
+    c.b2 = -alpha / a0;
+    c.a1 = -2.0 * cos(w0) / a0;
+    c.a2 = (1.0 - alpha) / a0;
+    return c;
+}
+
+BiquadBank::BiquadBank() :
+    channels(0),
+    channelStride(0)
+{
+}
+
+void BiquadBank::setNumChannels(unsigned int n) {
+    channels = n;
+    channelStride = (n + 3) & ~3u;
+    state.resize(sections.size() * 4 * channelStride);
+}
+
+void BiquadBank::clearSections() {
+    sections.clear();
+    state.resize(0);
+}
+
+void BiquadBank::insertSection(unsigned int section, Kind kind, const Coefficients& c) {
+    Section inserted;
+    inserted.kind = kind;
+    inserted.c = c;
+    sections.insert(sections.begin() + section, inserted);
+    // Existing sections keep their state; the new one's is zero
+    const size_t perSection = 4 * static_cast<size_t>(channelStride);
+    std::vector<double> previous(state.data(), state.data() + state.size());
+    state.resize(sections.size() * perSection);
+    std::copy(previous.begin(), previous.begin() + section * perSection, state.data());
+    std::copy(previous.begin() + section * perSection, previous.end(), state.data() + (section + 1) * perSection);
+}
+
+BiquadBank::Coefficients BiquadBank::highpassCoefficients(double a, double b) {
+    Coefficients c;
+    c.b0 = b;
+    c.b1 = c.b2 = c.a2 = 0.0;
+    c.a1 = a;
+    return c;
+}
+
+void BiquadBank::addBiquad(const Coefficients& c) {
+    insertSection(numSections(), Biquad, c);
+}
+
+void BiquadBank::addFirstOrderHighpass(double a, double b) {
+    insertSection(numSections(), FirstOrderHighpass, highpassCoefficients(a, b));
+}
+
+void BiquadBank::insertBiquad(unsigned int section, const Coefficients& c) {
+    insertSection(section, Biquad, c);
+}
+
+void BiquadBank::insertFirstOrderHighpass(unsigned int section, double a, double b) {
+    insertSection(section, FirstOrderHighpass, highpassCoefficients(a, b));
+}
+
+void BiquadBank::removeSection(unsigned int section) {
+    sections.erase(sections.begin() + section);
+    const size_t perSection = 4 * static_cast<size_t>(channelStride);
+    std::vector<double> previous(state.data(), state.data() + state.size());
+    previous.erase(previous.begin() + section * perSection, previous.begin() + (section + 1) * perSection);
+    state.resize(sections.size() * perSection);
+    std::copy(previous.begin(), previous.end(), state.data());
+}
+
+void BiquadBank::setBiquad(unsigned int section, const Coefficients& c) {
+    sections[section].kind = Biquad;
+    sections[section].c = c;
+}
+
+void BiquadBank::setFirstOrderHighpass(unsigned int section, double a, double b) {
+    sections[section].kind = FirstOrderHighpass;
+    sections[section].c = highpassCoefficients(a, b);
+}
+
+void BiquadBank::reset() {
+    state.fill(0.0);
+}
+
+void BiquadBank::process(double* samples, unsigned int length) {
+    for (unsigned int start = 0; start < length; start += TileLength) {
+        unsigned int n = std::min(TileLength, length - start);
+        double* tile = samples + static_cast<size_t>(start) * channelStride;
+
+        // Each group of four channels goes through every section while the tile is still in L1
+        for (unsigned int group = 0; group < channelStride; group += 4) {
+            for (unsigned int s = 0; s < sections.size(); ++s) {
+                double* st = sectionState(s) + group;
+                if (sections[s].kind == Biquad) {
+                    biquadLanes(tile + group, channelStride, n, sections[s].c, st, channelStride);
+                } else {
+                    highpassLanes(tile + group, channelStride, n, sections[s].c.a1, sections[s].c.b0, st);
+                }
+            }
+        }
+    }
+}
+
+void BiquadBank::processReference(double* samples, unsigned int length) {
+    for (unsigned int s = 0; s < sections.size(); ++s) {
+        const Coefficients& c = sections[s].c;
+        double* st = sectionState(s);
+        for (unsigned int channel = 0; channel < channelStride; ++channel) {
+            double* x = samples + channel;
+            if (sections[s].kind == Biquad) {
+                double x1 = st[channel], x2 = st[channelStride + channel];
+                double y1 = st[2 * channelStride + channel], y2 = st[3 * channelStride + channel];
+                for (unsigned int t = 0; t < length; ++t) {
+                    double in = x[t * channelStride];
+                    double out = c.b2 * x2 + c.b1 * x1 + c.b0 * in - c.a2 * y2 - c.a1 * y1;
+                    x[t * channelStride] = out;
+                    x2 = x1;
+                    x1 = in;
+                    y2 = y1;
+                    y1 = out;
+                }
+                st[channel] = x1;
+                st[channelStride + channel] = x2;
+                st[2 * channelStride + channel] = y1;
+                st[3 * channelStride + channel] = y2;
+            } else {
+                double s0 = st[channel];
+                for (unsigned int t = 0; t < length; ++t) {
+                    double in = x[t * channelStride];
+                    x[t * channelStride] = in - s0;
+                    s0 = c.a1 * s0 + c.b0 * in;
+                }
+                st[channel] = s0;
+            }
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef BIQUADBANK_H
+#define BIQUADBANK_H
+
+#include <vector>
+#include <cstddef>
+
+// A zero-filled array of doubles whose start is aligned to a cache line, so that SIMD loads never split a line and
+// arrays used by different threads never share one
+class AlignedDoubles {
+public:
+    AlignedDoubles() : aligned(nullptr), length(0) {}
+    AlignedDoubles(const AlignedDoubles&) = delete;
+    AlignedDoubles& operator=(const AlignedDoubles&) = delete;
+
+    void resize(size_t n); // Contents are zeroed
+    void fill(double value);
+    double* data() { return aligned; }
+    const double* data() const { return aligned; }
+    size_t size() const { return length; }
+
+private:
+    std::vector<double> storage;
+    double* aligned;
+    size_t length;
+};
+
+// Filters many channels at once with a cascade of IIR sections.
+//
+// Samples are channel-interleaved: sample t of channel c is at samples[t * stride() + c], where stride() is the number of
+// channels rounded up to a multiple of 4 (the padding channels are filtered too, and can be ignored).  Each section runs
+// across 4 channels at a time (one AVX register, or two SSE2 registers), with the section's state held in registers for a
+// tile of samples, and kept between calls to process(), so consecutive calls filter one continuous signal.
+//
+// Each section does exactly the same arithmetic, in the same order, as processReference() (which is plain scalar code), so
+// the two give bit-identical results as long as the compiler isn't allowed to contract a * b + c into a fused multiply-add
+// (GCC and Clang don't for the default x86-64 target; building with -mfma also needs -ffp-contract=off).
+class BiquadBank {
+public:
+    // Direct form I biquad: y[t] = b0 x[t] + b1 x[t-1] + b2 x[t-2] - a1 y[t-1] - a2 y[t-2]
+    struct Coefficients {
+        double b0, b1, b2, a1, a2;
+    };
+
+    // Band-pass at 'centerFreq' with quality factor 'q' (bandwidth = centerFreq / q) and 0 dB peak gain
+    static Coefficients bandpass(double centerFreq, double q, double sampleFreq);
+
+    BiquadBank();
+
+    void setNumChannels(unsigned int n); // Also resets the state
+    unsigned int numChannels() const { return channels; }
+    unsigned int stride() const { return channelStride; }
+
+    void clearSections();
+    void addBiquad(const Coefficients& c);
+    // First-order high-pass: y[t] = x[t] - s, then s = a s + b x[t]
+    void addFirstOrderHighpass(double a, double b);
+    unsigned int numSections() const { return static_cast<unsigned int>(sections.size()); }
+    void reset(); // Zeros every section's state, as if the signal had been 0 forever
+
+    // Editing the cascade: every section keeps its state except a newly inserted one, which starts from zero
+    void insertBiquad(unsigned int section, const Coefficients& c); // Before 'section' (numSections() to append)
+    void insertFirstOrderHighpass(unsigned int section, double a, double b);
+    void removeSection(unsigned int section);
+    void setBiquad(unsigned int section, const Coefficients& c); // New coefficients, same state (and same kind of section)
+    void setFirstOrderHighpass(unsigned int section, double a, double b);
+
+    void process(double* samples, unsigned int length); // In place, 'length' samples per channel
+    void processReference(double* samples, unsigned int length); // Same, one channel and sample at a time
+
+private:
+    enum Kind { Biquad, FirstOrderHighpass };
+
+    struct Section {
+        Kind kind;
+        Coefficients c; // For FirstOrderHighpass, a is in a1 and b in b0
+    };
+
+    static const unsigned int TileLength = 64; // Samples per channel filtered while a section's state stays in registers
+
+    unsigned int channels;
+    unsigned int channelStride;
+    std::vector<Section> sections;
+    AlignedDoubles state; // Per section: x[t-1], x[t-2], y[t-1], y[t-2] for every channel, each stride() doubles
+
+    void insertSection(unsigned int section, Kind kind, const Coefficients& c);
+    static Coefficients highpassCoefficients(double a, double b);
+    double* sectionState(unsigned int section) { return state.data() + static_cast<size_t>(section) * 4 * channelStride; }
+};
+
+#endif // BIQUADBANK_H
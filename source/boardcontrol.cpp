@@ -68,7 +68,7 @@ void BoardControl::updateLEDs() {
 */
 void BoardControl::updateDigitalOutputs() {
     if (okayToRunBoardCommands()) {
-        evalBoard->setTtlOut(digitalOutputs.values);
+        evalBoard->setTtlOutBits(digitalOutputs.values.bits());
 
         if (digitalOutputs.comparatorsEnabled) {
             for (unsigned int dacIndex = 0; dacIndex < NUM_BOARD_ANALOG_OUTPUTS; dacIndex++) {
@@ -479,7 +479,7 @@ void BoardControl::close() {
     updateLEDs();
 
     // Turn off digital outputs
-    memset(digitalOutputs.values, 0, sizeof(digitalOutputs.values));
+    digitalOutputs.clear();
     digitalOutputs.comparatorsEnabled = false;
     updateDigitalOutputs();
 
@@ -950,6 +950,9 @@ void BoardControl::setSaveFormat(SaveFormat format)
     case SaveFormatFilePerChannel:
         writer.reset(new FilePerChannelFormat(signalSources));
         break;
+    case SaveFormatIntanCompressed:
+        writer.reset(new CompressedSaveFormat());
+        break;
     default:
         writer.reset();
         break;
@@ -259,6 +259,7 @@ public:
     SignalSources signalSources;
     std::unique_ptr<SaveList> saveList;
     std::unique_ptr<SaveFormatWriter> writer;
+    std::unique_ptr<ImpedanceCaptureWriter> impedanceCapture; // When set, captures the raw samples behind each impedance measurement
     SaveFormatHeaderInfo header;
     void setSaveFormat(SaveFormat format);
     int getNumTempSensors() const;
@@ -3,6 +3,12 @@
 #include "oneelectrode.h"
 #include "settings.h"
 #include "electrodeimpedance.h"
+#include "measurementjournal.h"
+#include "electrodehistory.h"
+#include "impedancecache.h"
+#include "impedanceexporter.h"
+#include "sessionfile.h"
+#include "signalprocessor.h"
 #include <QFile>
 #include <QMessageBox>
 #include <QtCore>
@@ -16,99 +22,273 @@ DataProcessor::DataProcessor()
     for (int i = 0; i < 128; i++) {
         Electrodes[i] = new OneElectrode;
     }
+    History = new ElectrodeHistory(128);
+    Cache = new ImpedanceCache(128);
+    journal = new MeasurementJournal;
 }
 
 /* Destructor */
 DataProcessor::~DataProcessor()
 {
     //Free memory for 128 'OneElectrode' objects
+    delete journal;
+    delete Cache;
+    delete History;
     for (int i = 0; i < 128; i++) {
         delete Electrodes[i];
     }
 }
 
-/* Public - Gets the most recently measured impedances, returning both indices of electrodes whose impedances have been measured & impedances as complex numbers */
-QVector<ElectrodeImpedance> DataProcessor::get_impedances()
+
+/* Public - Adds 'value' to electrode 'index''s impedance history, and journals it, along with the headstage temperature and supply voltage trends if given */
+void DataProcessor::add_measurement(int index, std::complex<double> value, const SensorTrend *temperature, const SensorTrend *supplyVoltage)
 {
-    std::complex<double> impedances_tmp[128];
-    int valid[128];
-    QVector<ElectrodeImpedance> impedances;
+    //The first measurement on an electrode starts its clock
+    double time;
+    if (History->measurementCount(index) == 0) {
+        Electrodes[index]->start_time();
+        time = 0;
+    }
+    else
+        time = Electrodes[index]->get_elapsed_time();
 
-    //Initialize impedances' real and imaginary components to 0, and valid to 0
-    for (int i = 0; i < 128; i++) {
-        impedances_tmp[i].real(0);
-        impedances_tmp[i].imag(0);
-        valid[i] = 0;
+    History->addMeasurement(index, time, value);
+    journal->appendMeasurement(index, time, value);
+    if (temperature && supplyVoltage)
+        journal->appendSensorTrend(index, temperature->average, temperature->slope, supplyVoltage->average, supplyVoltage->slope);
+}
+
+
+/* Public - Adds a pulse of duration 'duration' to electrode 'index''s pulse history, journals it, and forgets its cached impedance reading */
+void DataProcessor::add_pulse(int index, double duration)
+{
+    //The pulse changes the electrode, so its last reading can't stand in for a new one
+    Cache->invalidate(index);
+
+    double time = Electrodes[index]->get_elapsed_time();
+    History->addPulse(index, time, duration);
+    journal->appendPulse(index, time, duration);
+}
+
+
+/* Public - Records the actual duration and delivered charge of electrode 'index''s most recent pulse, and journals it */
+void DataProcessor::finish_pulse(int index, double duration, double charge)
+{
+    History->finishPulse(index, duration, charge);
+    journal->appendPulseResult(index, duration, charge);
+}
+
+
+/* Public - Clears electrode 'index''s history, and journals it */
+void DataProcessor::reset_time(int index)
+{
+    Electrodes[index]->reset_time();
+    History->clear(index);
+    journal->appendReset(index);
+}
+
+
+/* Public - Start journaling to 'filename' (truncating it), beginning with a snapshot of every electrode's current history */
+bool DataProcessor::open_journal(QString filename)
+{
+    if (!journal->open(filename))
+        return false;
+
+    //Snapshot, so that recovering this journal also recovers anything recovered from an earlier one
+    journal_snapshot();
+    journal->commit();
+    return true;
+}
+
+
+/* Private - Journal every electrode's current history */
+void DataProcessor::journal_snapshot()
+{
+    //Walking the columns in row order keeps measurements in the order they were taken, across channels
+    const QVector<int> &measurementChannels = History->measurementChannelColumn();
+    const QVector<double> &measurementTimes = History->measurementTimeColumn();
+    const QVector<std::complex<double>> &measurementImpedances = History->measurementImpedanceColumn();
+    for (int row = 0; row < measurementChannels.size(); row++) {
+        if (measurementChannels.at(row) >= 0)
+            journal->appendMeasurement(measurementChannels.at(row), measurementTimes.at(row), measurementImpedances.at(row));
+    }
+    const QVector<int> &pulseChannels = History->pulseChannelColumn();
+    for (int row = 0; row < pulseChannels.size(); row++) {
+        int channel = pulseChannels.at(row);
+        if (channel < 0)
+            continue;
+        journal->appendPulse(channel, History->pulseTimeColumn().at(row), History->pulseDurationColumn().at(row));
+        journal->appendPulseResult(channel, History->pulseDurationColumn().at(row), History->pulseChargeColumn().at(row));
     }
+}
+
+
+/* Public - Commit and close the journal */
+void DataProcessor::close_journal()
+{
+    journal->close();
+}
+
 
-    //If this electrode has a non-empty impedance history, set it to valid, and get the most recently measured impedance on this electrode
+/* Public - Rebuild every electrode's history from the journal in 'filename' */
+bool DataProcessor::recover_journal(QString filename)
+{
+    QVector<MeasurementJournal::Record> records;
+    bool cleanShutdown;
+    if (!MeasurementJournal::read(filename, records, cleanShutdown))
+        return false;
+
+    History->clearAll();
     for (int i = 0; i < 128; i++) {
-        if (!Electrodes[i]->ImpedanceHistory.isEmpty()) {
-            valid[i] = 1;
-            impedances_tmp[i] = Electrodes[i]->get_current_impedance();
+        Electrodes[i]->reset_time();
+    }
+
+    //Replay every record in order; measurements and pulses interleave the same way they happened
+    for (int r = 0; r < records.size(); r++) {
+        const MeasurementJournal::Record &record = records.at(r);
+        if (record.channel < 0 || record.channel >= 128)
+            continue;
+
+        switch (record.type) {
+        case MeasurementJournal::ResetRecord:
+            Electrodes[record.channel]->reset_time();
+            History->clear(record.channel);
+            break;
+        case MeasurementJournal::MeasurementRecord:
+            History->addMeasurement(record.channel, record.value[0], std::complex<double>(record.value[1], record.value[2]));
+            break;
+        case MeasurementJournal::PulseRecord:
+            History->addPulse(record.channel, record.value[0], record.value[1]);
+            break;
+        case MeasurementJournal::PulseResultRecord:
+            History->finishPulse(record.channel, record.value[0], record.value[1]);
+            break;
+        case MeasurementJournal::SensorTrendRecord: //Logged alongside measurements, but not part of the history
+        default:
+            break;
         }
     }
 
-    //For all the valid electrodes, append the impedance and index to 'impedances' QVector
+    //Carry on each electrode's clock from its last recovered event
     for (int i = 0; i < 128; i++) {
-        if (valid[i] == 1) {
-            ElectrodeImpedance thisElectrode;
-            thisElectrode.impedance = impedances_tmp[i];
-            thisElectrode.index = i;
-            impedances.append(thisElectrode);
-        }
+        Electrodes[i]->resume_time(History->latestTime(i));
     }
-    return impedances;
+    return true;
 }
 
-/* Public - Save the current impedances to 'filename' */
-void DataProcessor::save_impedances(QString filename)
+
+/* Public - Returns true if 'filename' is a journal that wasn't closed cleanly (i.e., the program crashed) */
+bool DataProcessor::journal_needs_recovery(QString filename)
 {
-    //Save the current impedances to 'filename'.
-    QFile impedancesFile(filename);
-    if (!impedancesFile.open(QIODevice::WriteOnly)) {
-        QMessageBox::critical(0, "Cannot Save Impedances File",
-                              "Cannot open new csv file for writing.");
-        return;
-    }
+    if (!QFile::exists(filename))
+        return false;
+
+    QVector<MeasurementJournal::Record> records;
+    bool cleanShutdown;
+    if (!MeasurementJournal::read(filename, records, cleanShutdown))
+        return false;
+    return !cleanShutdown && !records.isEmpty();
+}
 
-    /* Save Impedances */
-    //Set up data stream
-    QDataStream outStream(&impedancesFile);
-    outStream.setVersion(QDataStream::Qt_4_8);
-    outStream.setByteOrder(QDataStream::LittleEndian);
-    outStream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+/* Public - Gets the most recently measured impedances, returning both indices of electrodes whose impedances have been measured & impedances as complex numbers */
+QVector<ElectrodeImpedance> DataProcessor::get_impedances()
+{
+    //ElectrodeHistory keeps this list up to date as measurements are added, so this is just a (shared) copy
+    return History->latestImpedances();
+}
 
-    //Write the 'label' row, listing the labels associated with each entry of data
-    QByteArray label = "Channel Number,Channel Name,Port,Enabled,Impedance Magnitude at 1000 Hz (ohms),Impedance Phase at 1000 Hz (degrees),Series RC equivalent R (Ohms),Series RC equivalent C (Farads)\n";
-    outStream.writeRawData(label.constData(), label.length());
+/* Public - Classify one electrode as good, open, or short from a quick impedance reading, recording the reason */
+void DataProcessor::screen_electrode(int index, std::complex<double> impedance, double minMagnitude, double maxMagnitude, double minPhase)
+{
+    OneElectrode *electrode = Electrodes[index];
+    double magnitude = std::abs(impedance);
+    double phase = std::arg(impedance) * RADIANS_TO_DEGREES;
+
+    electrode->ScreeningImpedance = impedance;
+    if (magnitude < minMagnitude) {
+        electrode->Status = ElectrodeShort;
+        electrode->StatusReason = QString("Short: impedance %1 ohms is below %2 ohms").arg(magnitude, 0, 'e', 2).arg(minMagnitude, 0, 'e', 2);
+    }
+    else if (magnitude > maxMagnitude) {
+        electrode->Status = ElectrodeOpen;
+        electrode->StatusReason = QString("Open: impedance %1 ohms is above %2 ohms").arg(magnitude, 0, 'e', 2).arg(maxMagnitude, 0, 'e', 2);
+    }
+    else if (phase < minPhase) {
+        electrode->Status = ElectrodeOpen;
+        electrode->StatusReason = QString("Open: phase %1 degrees is below %2 degrees (purely capacitive)").arg(phase, 0, 'f', 0).arg(minPhase, 0, 'f', 0);
+    }
+    else {
+        electrode->Status = ElectrodeGood;
+        electrode->StatusReason = "Good";
+    }
+}
 
-    //For each electrode with a non-empty impedance history, write data
-    for (int i = 0; i < 128; i++) {
-        if (!Electrodes[i]->ImpedanceHistory.empty()) {
-            std::complex<double> impedance = Electrodes[i]->get_current_impedance();
-            QByteArray data;
-            //Append channel number, channel name (identical to channel number), port, and enabled (always true) into 'data'
-            data.append(QString("A-%1,A-%2,Port A,1,").arg(QString::number(i), 3, QLatin1Char('0')).arg(QString::number(i), 3, QLatin1Char('0')));
 
-            //Append impedance magnitude into 'data'
-            data.append(QString("%1,").arg(QString::number(std::abs(impedance), 'e', 2)));
+/* Public - Save the current impedances to 'filename' */
+void DataProcessor::save_impedances(QString filename)
+{
+    //Save the current impedances to 'filename'. The delimiter follows the file's extension (.csv or .tsv)
+    ImpedanceExporter exporter(ImpedanceExporter::delimiterForFile(filename));
+    if (!exporter.exportLatest(filename, *History)) {
+        QMessageBox::critical(0, "Cannot Save Impedances File",
+                              "Cannot write impedances file: " + exporter.getErrorString());
+    }
+}
 
-            //Append impedance phase into 'data'
-            data.append(QString("%1,").arg(QString::number(std::arg(impedance) * RADIANS_TO_DEGREES, 'f', 0)));
+/* Public - Save every electrode's impedance history to 'filename', with the given columns (see ImpedanceExporter::Column) */
+void DataProcessor::save_impedance_history(QString filename, int columns)
+{
+    ImpedanceExporter exporter(ImpedanceExporter::delimiterForFile(filename));
+    if (!exporter.exportHistory(filename, *History, columns)) {
+        QMessageBox::critical(0, "Cannot Save Impedance History File",
+                              "Cannot write impedance history file: " + exporter.getErrorString());
+    }
+}
 
-            //Append equivalent R into 'data'
-            data.append(QString("%1,").arg(QString::number(impedance.real(), 'e', 2)));
+/* Public - Save every electrode's pulses to 'filename' */
+void DataProcessor::save_pulse_log(QString filename)
+{
+    ImpedanceExporter exporter(ImpedanceExporter::delimiterForFile(filename));
+    if (!exporter.exportPulses(filename, *History)) {
+        QMessageBox::critical(0, "Cannot Save Pulse Log File",
+                              "Cannot write pulse log file: " + exporter.getErrorString());
+    }
+}
 
-            //Append equivalent C into 'data'
-            double frequency = 1000;
-            data.append(QString("%1\n").arg(QString::number(1/(-2 * PI * frequency * impedance.imag()), 'e', 2)));
+/* Public - Save every electrode's impedance and pulse history to the session file 'filename' */
+void DataProcessor::save_session(QString filename)
+{
+    QString errorString;
+    if (!SessionFile::write(filename, *History, errorString)) {
+        QMessageBox::critical(0, "Cannot Save Session File",
+                              "Cannot write session file: " + errorString);
+    }
+}
 
-            //Write 'data' to file
-            outStream.writeRawData(data.constData(), data.length());
+/* Public - Replace every electrode's impedance and pulse history with the contents of the session file 'filename', and forget every cached impedance reading */
+bool DataProcessor::load_session(QString filename)
+{
+    //The session may be from other electrodes, so don't let readings taken before it stand in for new ones
+    Cache->invalidate_all();
+
+    SessionFileReader reader;
+    if (!reader.open(filename) || !reader.readAll(*History)) {
+        QMessageBox::critical(0, "Cannot Load Session File",
+                              "Cannot read session file: " + reader.getErrorString());
+        //readAll() may have cleared the history before failing, so keep the electrodes' clocks consistent with it
+        for (int i = 0; i < 128; i++) {
+            Electrodes[i]->resume_time(History->latestTime(i));
         }
+        return false;
+    }
+
+    //Carry on each electrode's clock from its last loaded event, and journal the loaded history in place of the old one
+    for (int i = 0; i < 128; i++) {
+        Electrodes[i]->resume_time(History->latestTime(i));
+        journal->appendReset(i);
     }
-    impedancesFile.close();
+    journal_snapshot();
+    return true;
 }
 
 /* Public - Save settings to 'filename' */
@@ -159,6 +339,21 @@ void DataProcessor::save_settings(QString filename, Settings &settings)
     outStream << (qint16) settings.selected;
     outStream << (qint16) settings.showGrid;
 
+    //Write pulse monitoring settings (added in version 1.1)
+    outStream << (qint16) settings.monitorPulses;
+    outStream << settings.chargeLimit;
+    outStream << settings.voltageLimit;
+    outStream << (qint16) settings.monitorAdcChannel;
+
+    //Write electrode screening settings (added in version 1.2)
+    outStream << (qint16) settings.screenBeforePlating;
+    outStream << settings.screenMinMagnitude;
+    outStream << settings.screenMaxMagnitude;
+    outStream << settings.screenMinPhase;
+
+    //Write impedance reading reuse settings (added in version 1.3)
+    outStream << settings.impedanceCacheMaxAge;
+
     settingsFile.close();
 }
 
@@ -198,7 +393,7 @@ void DataProcessor::load_settings(QString filename, Settings &settings)
     inStream >> tempQint16;
     versionSecondary = tempQint16;
 
-    //Eventually check version number here for compatibility issues - not currently necessary
+    //Fields added after version 1.0 are only read if the file's version includes them
 
     //Read automatic pulse settings
     inStream >> tempQint16;
@@ -233,5 +428,29 @@ void DataProcessor::load_settings(QString filename, Settings &settings)
     inStream >> tempQint16;
     settings.showGrid = tempQint16;
 
+    //Read pulse monitoring settings (added in version 1.1; older files leave the current values unchanged)
+    if (versionMain > 1 || (versionMain == 1 && versionSecondary >= 1)) {
+        inStream >> tempQint16;
+        settings.monitorPulses = (bool) tempQint16;
+        inStream >> settings.chargeLimit;
+        inStream >> settings.voltageLimit;
+        inStream >> tempQint16;
+        settings.monitorAdcChannel = tempQint16;
+    }
+
+    //Read electrode screening settings (added in version 1.2)
+    if (versionMain > 1 || (versionMain == 1 && versionSecondary >= 2)) {
+        inStream >> tempQint16;
+        settings.screenBeforePlating = (bool) tempQint16;
+        inStream >> settings.screenMinMagnitude;
+        inStream >> settings.screenMaxMagnitude;
+        inStream >> settings.screenMinPhase;
+    }
+
+    //Read impedance reading reuse settings (added in version 1.3)
+    if (versionMain > 1 || (versionMain == 1 && versionSecondary >= 3)) {
+        inStream >> settings.impedanceCacheMaxAge;
+    }
+
     settingsFile.close();
 }
@@ -2,25 +2,47 @@
 #define DATAPROCESSOR_H
 
 #include <QVector>
+#include <complex>
 #include "electrodeimpedance.h"
 
 /* DataProcessor is a class that saves impedances, and saves and loads settings */
 
 class OneElectrode;
+class ElectrodeHistory;
+class MeasurementJournal;
+class ImpedanceCache;
+struct SensorTrend;
 struct Settings;
 class DataProcessor
 {
 public:
     DataProcessor(); //Constructor
     ~DataProcessor(); //Destructor
+    void add_measurement(int index, std::complex<double> value, const SensorTrend *temperature = nullptr, const SensorTrend *supplyVoltage = nullptr); //Adds 'value' to electrode 'index''s impedance history, and journals it, along with the headstage temperature and supply voltage trends if given
+    void add_pulse(int index, double duration); //Adds a pulse of duration 'duration' to electrode 'index''s pulse history, journals it, and forgets its cached impedance reading
+    void finish_pulse(int index, double duration, double charge); //Records the actual duration and delivered charge of electrode 'index''s most recent pulse, and journals it
+    void reset_time(int index); //Clears electrode 'index''s history, and journals it
+    bool open_journal(QString filename); //Start journaling to 'filename' (truncating it), beginning with a snapshot of every electrode's current history
+    void close_journal(); //Commit and close the journal
+    bool recover_journal(QString filename); //Rebuild every electrode's history from the journal in 'filename'
+    static bool journal_needs_recovery(QString filename); //Returns true if 'filename' is a journal that wasn't closed cleanly (i.e., the program crashed)
     QVector<ElectrodeImpedance> get_impedances(); //Gets the most recently measured impedances, returning both indices of electrodes whose impedances have been measured & impedances as complex numbers
     void save_impedances(QString filename); //Save the current impedances to 'filename'
+    void save_impedance_history(QString filename, int columns); //Save every electrode's impedance history to 'filename', with the given columns (see ImpedanceExporter::Column)
+    void save_pulse_log(QString filename); //Save every electrode's pulses to 'filename'
+    void save_session(QString filename); //Save every electrode's impedance and pulse history to the session file 'filename'
+    bool load_session(QString filename); //Replace every electrode's impedance and pulse history with the contents of the session file 'filename', and forget every cached impedance reading
     void save_settings(QString filename, Settings &settings); //Save the current settings to 'filename'
     void load_settings(QString filename, Settings &settings); //Load settings from 'filename'
+    void screen_electrode(int index, std::complex<double> impedance, double minMagnitude, double maxMagnitude, double minPhase); //Classify one electrode as good, open, or short from a quick impedance reading, recording the reason
 
     OneElectrode *Electrodes[128];
+    ElectrodeHistory *History; //Impedance and pulse history of every electrode
+    ImpedanceCache *Cache; //Most recent impedance reading of every electrode that hasn't been pulsed since, for reuse instead of measuring again
 
 private:
+    void journal_snapshot(); //Journal every electrode's current history
+    MeasurementJournal *journal; //Append-only record of every measurement and pulse, for crash recovery
     int Selected; //Selected channel (0-127)
     bool DisplayMagnitudes; //True for magnitudes, false for phases
 };
@@ -0,0 +1,244 @@
+#include "deltacodec.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DELTACODEC_SSE2
+#include <emmintrin.h>
+#endif
+
+using std::runtime_error;
+
+namespace {
+    inline uint32_t zigzag(uint32_t delta) {
+        return (delta << 1) ^ static_cast<uint32_t>(static_cast<int32_t>(delta) >> 31);
+    }
+
+    inline uint32_t unzigzag(uint32_t value) {
+        return (value >> 1) ^ (0u - (value & 1));
+    }
+
+    inline unsigned int bitWidth(uint32_t value) {
+        unsigned int bits = 0;
+        while (value != 0) {
+            ++bits;
+            value >>= 1;
+        }
+        return bits;
+    }
+
+    inline void storeWord(uint8_t* out, uint32_t word) {
+        out[0] = static_cast<uint8_t>(word);
+        out[1] = static_cast<uint8_t>(word >> 8);
+        out[2] = static_cast<uint8_t>(word >> 16);
+        out[3] = static_cast<uint8_t>(word >> 24);
+    }
+
+    inline uint32_t loadWord(const uint8_t* in) {
+        return static_cast<uint32_t>(in[0]) | (static_cast<uint32_t>(in[1]) << 8) |
+               (static_cast<uint32_t>(in[2]) << 16) | (static_cast<uint32_t>(in[3]) << 24);
+    }
+
+    // Number of 32-bit words in each lane, for 'groups' deltas per lane of 'bits' bits each
+    inline unsigned int wordsPerLane(unsigned int groups, unsigned int bits) {
+        return (groups * bits + 31) / 32;
+    }
+
+    // Reads the header (bit width and first sample); returns the number of bytes read
+    size_t readHeader(const uint8_t* in, size_t available, unsigned int& bits, uint32_t& first) {
+        if (available < 2) {
+            throw runtime_error("Compressed data is truncated.");
+        }
+        bits = in[0];
+        if (bits > 32) {
+            throw runtime_error("Compressed data is corrupt.");
+        }
+        first = 0;
+        size_t pos = 1;
+        for (unsigned int shift = 0; ; shift += 7) {
+            if (pos >= available || shift > 28) {
+                throw runtime_error("Compressed data is corrupt.");
+            }
+            uint8_t byte = in[pos++];
+            first |= static_cast<uint32_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+        return pos;
+    }
+
+#if defined(DELTACODEC_SSE2)
+    // Unpacks, un-zigzags, and prefix-sums four deltas at a time
+    void unpackSSE2(const uint8_t* in, unsigned int groups, unsigned int bits, uint32_t first, uint32_t* samples) {
+        const __m128i* src = reinterpret_cast<const __m128i*>(in);
+        const unsigned int numWords = wordsPerLane(groups, bits);
+        const __m128i mask = _mm_set1_epi32(bits == 32 ? -1 : static_cast<int>((1u << bits) - 1));
+        const __m128i one = _mm_set1_epi32(1);
+        const __m128i zero = _mm_setzero_si128();
+        __m128i carry = _mm_set1_epi32(static_cast<int>(first));
+        __m128i word = _mm_loadu_si128(src);
+        unsigned int w = 0, bit = 0;
+
+        for (unsigned int g = 0; g < groups; ++g) {
+            __m128i v = _mm_srl_epi32(word, _mm_cvtsi32_si128(bit));
+            bit += bits;
+            if (bit >= 32) {
+                bit -= 32;
+                if (++w < numWords) {
+                    word = _mm_loadu_si128(src + w);
+                }
+                if (bit > 0) {
+                    v = _mm_or_si128(v, _mm_sll_epi32(word, _mm_cvtsi32_si128(bits - bit)));
+                }
+            }
+            v = _mm_and_si128(v, mask);
+
+            // Zigzag decode, then running sum across the four lanes, plus everything before them
+            __m128i d = _mm_xor_si128(_mm_srli_epi32(v, 1), _mm_sub_epi32(zero, _mm_and_si128(v, one)));
+            d = _mm_add_epi32(d, _mm_slli_si128(d, 4));
+            d = _mm_add_epi32(d, _mm_slli_si128(d, 8));
+            d = _mm_add_epi32(d, carry);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(samples + 4 * g), d);
+            carry = _mm_shuffle_epi32(d, 0xff);
+        }
+    }
+#else
+    void unpackScalar(const uint8_t* in, unsigned int groups, unsigned int bits, uint32_t first, uint32_t* samples) {
+        const uint64_t mask = (static_cast<uint64_t>(1) << bits) - 1;
+        for (unsigned int lane = 0; lane < 4; ++lane) {
+            uint64_t acc = 0;
+            unsigned int available = 0, w = 0;
+            for (unsigned int g = 0; g < groups; ++g) {
+                if (available < bits) {
+                    acc |= static_cast<uint64_t>(loadWord(in + 16 * w + 4 * lane)) << available;
+                    available += 32;
+                    ++w;
+                }
+                samples[4 * g + lane] = static_cast<uint32_t>(acc & mask);
+                acc >>= bits;
+                available -= bits;
+            }
+        }
+        uint32_t sum = first;
+        for (unsigned int i = 0; i < 4 * groups; ++i) {
+            sum += unzigzag(samples[i]);
+            samples[i] = sum;
+        }
+    }
+#endif
+}
+
+size_t DeltaCodec::maxEncodedSize(unsigned int n) {
+    return 1 + 5 + 16 * static_cast<size_t>((n + 3) / 4);
+}
+
+size_t DeltaCodec::encode(const uint32_t* samples, unsigned int n, uint8_t* out) {
+    if (n > MaxSamples) {
+        throw std::invalid_argument("Too many samples to compress in one run.");
+    }
+    uint32_t deltas[MaxSamples];
+    const unsigned int groups = (n + 3) / 4;
+    const uint32_t first = (n > 0) ? samples[0] : 0;
+
+    uint32_t previous = first;
+    uint32_t all = 0;
+    for (unsigned int i = 0; i < n; ++i) {
+        deltas[i] = zigzag(samples[i] - previous);
+        previous = samples[i];
+        all |= deltas[i];
+    }
+    for (unsigned int i = n; i < 4 * groups; ++i) {
+        deltas[i] = 0;
+    }
+    const unsigned int bits = bitWidth(all);
+
+    size_t pos = 0;
+    out[pos++] = static_cast<uint8_t>(bits);
+    uint32_t value = first;
+    do {
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        out[pos++] = (value != 0) ? (byte | 0x80) : byte;
+    } while (value != 0);
+
+    if (bits == 0) {
+        return pos;
+    }
+
+    // Pack each lane into its own bitstream of 32-bit words, interleaved with the other lanes
+    const unsigned int numWords = wordsPerLane(groups, bits);
+    for (unsigned int lane = 0; lane < 4; ++lane) {
+        uint64_t acc = 0;
+        unsigned int used = 0, w = 0;
+        for (unsigned int g = 0; g < groups; ++g) {
+            acc |= static_cast<uint64_t>(deltas[4 * g + lane]) << used;
+            used += bits;
+            if (used >= 32) {
+                storeWord(out + pos + 16 * w + 4 * lane, static_cast<uint32_t>(acc));
+                acc >>= 32;
+                used -= 32;
+                ++w;
+            }
+        }
+        if (used > 0) {
+            storeWord(out + pos + 16 * w + 4 * lane, static_cast<uint32_t>(acc));
+        }
+    }
+    return pos + 16 * static_cast<size_t>(numWords);
+}
+
+size_t DeltaCodec::decode(const uint8_t* in, size_t available, unsigned int n, uint32_t* samples) {
+    if (n > MaxSamples) {
+        throw std::invalid_argument("Too many samples to decompress in one run.");
+    }
+    unsigned int bits;
+    uint32_t first;
+    size_t pos = readHeader(in, available, bits, first);
+
+    if (bits == 0) {
+        std::fill(samples, samples + n, first);
+        return pos;
+    }
+
+    const unsigned int groups = (n + 3) / 4;
+    const size_t packedBytes = 16 * static_cast<size_t>(wordsPerLane(groups, bits));
+    if (available - pos < packedBytes) {
+        throw runtime_error("Compressed data is truncated.");
+    }
+
+    // Decode whole groups of four, then keep the first n
+    uint32_t decoded[MaxSamples];
+#if defined(DELTACODEC_SSE2)
+    unpackSSE2(in + pos, groups, bits, first, decoded);
+#else
+    unpackScalar(in + pos, groups, bits, first, decoded);
+#endif
+    memcpy(samples, decoded, n * sizeof(uint32_t));
+    return pos + packedBytes;
+}
+
+uint32_t DeltaCodec::firstSample(const uint8_t* in, size_t available) {
+    unsigned int bits;
+    uint32_t first;
+    readHeader(in, available, bits, first);
+    return first;
+}
+
+uint32_t DeltaCodec::checksum(const uint8_t* data, size_t length) {
+    const uint32_t modulus = 65521;
+    const size_t maxRun = 5552; // Largest run that can't overflow 32-bit sums before reducing
+    uint32_t a = 1, b = 0;
+    while (length > 0) {
+        size_t n = std::min(length, maxRun);
+        length -= n;
+        while (n-- > 0) {
+            a += *data++;
+            b += a;
+        }
+        a %= modulus;
+        b %= modulus;
+    }
+    return (b << 16) | a;
+}
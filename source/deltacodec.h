@@ -0,0 +1,39 @@
+#ifndef DELTACODEC_H
+#define DELTACODEC_H
+
+#include <cstdint>
+#include <cstddef>
+
+// Lossless compression of short runs of integer samples (e.g., one channel of one Rhd2000DataBlock), used by the
+// compressed save format.
+//
+// A run of n samples is stored as:
+//   uint8    bit width b (0 - 32) of the packed deltas
+//   varint   first sample (LEB128, 1 - 5 bytes)
+//   packed   deltas (sample[i] - sample[i - 1], modulo 2^32, with sample[-1] = first sample, so delta 0 is always 0),
+//            zigzag encoded, b bits each, padded with zero deltas to a multiple of 4
+//
+// Deltas are packed 'vertically': delta i goes in lane i % 4, each lane is a little-endian bitstream of 32-bit words, and
+// the four lanes are interleaved one word at a time.  That lets the decoder unpack four deltas with each SSE2 shift, and
+// prefix-sum them without leaving registers.  A constant run (b = 0) takes only 2 - 6 bytes.
+namespace DeltaCodec {
+    const unsigned int MaxSamples = 256; // Largest run encode() and decode() accept
+
+    // Largest number of bytes encode() can write for a run of n samples
+    size_t maxEncodedSize(unsigned int n);
+
+    // Encodes n samples into 'out', which must have room for maxEncodedSize(n) bytes.  Returns the number of bytes written.
+    size_t encode(const uint32_t* samples, unsigned int n, uint8_t* out);
+
+    // Decodes a run of n samples from 'in', reading no more than 'available' bytes.  Returns the number of bytes read.
+    // Throws std::runtime_error if the run is malformed or truncated.
+    size_t decode(const uint8_t* in, size_t available, unsigned int n, uint32_t* samples);
+
+    // Returns the first sample of an encoded run (without decoding the rest), or throws like decode()
+    uint32_t firstSample(const uint8_t* in, size_t available);
+
+    // Adler-32 checksum of 'length' bytes
+    uint32_t checksum(const uint8_t* data, size_t length);
+}
+
+#endif // DELTACODEC_H
@@ -0,0 +1,184 @@
+#include "demodulator.h"
+#include "globalconstants.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DEMODULATOR_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+#if defined(DEMODULATOR_SSE2)
+    // Sign-extends four 32-bit sums to 64 bits, and adds them in pairs
+    inline __m128i widenSum(__m128i sums) {
+        __m128i sign = _mm_srai_epi32(sums, 31);
+        return _mm_add_epi64(_mm_unpacklo_epi32(sums, sign), _mm_unpackhi_epi32(sums, sign));
+    }
+
+    // Same, for sums that are unsigned
+    inline __m128i widenSumUnsigned(__m128i sums) {
+        __m128i zero = _mm_setzero_si128();
+        return _mm_add_epi64(_mm_unpacklo_epi32(sums, zero), _mm_unpackhi_epi32(sums, zero));
+    }
+
+    inline int64_t horizontalSum(__m128i pair) {
+        int64_t lanes[2];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), pair);
+        return lanes[0] + lanes[1];
+    }
+
+    inline __m128i load(const int16_t* p) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    }
+#endif
+}
+
+FixedPointDemodulator::FixedPointDemodulator() :
+    k(0.0),
+    start(0),
+    length(0)
+{
+}
+
+void FixedPointDemodulator::setWindow(double radiansPerSample, int startIndex, int endIndex)
+{
+    const int n = (endIndex >= startIndex) ? endIndex - startIndex + 1 : 0;
+    if (radiansPerSample == k && startIndex == start && n == length) {
+        return;
+    }
+    k = radiansPerSample;
+    start = startIndex;
+    length = n;
+    for (int h = 0; h < NumHarmonics; ++h) {
+        const double kh = (h + 1) * k;
+        // A harmonic at or above the Nyquist frequency would alias onto something else, so it isn't measured
+        const int size = (h == 0 || kh < PI) ? n : 0;
+        cosTable[h].resize(size);
+        sinTable[h].resize(size);
+        for (int i = 0; i < size; ++i) {
+            double t = startIndex + i;
+            cosTable[h][i] = static_cast<int16_t>(std::lround(TableScale * cos(kh * t)));
+            sinTable[h][i] = static_cast<int16_t>(std::lround(-TableScale * sin(kh * t)));
+        }
+    }
+}
+
+// Sums over the window: always the fundamental's correlation, and with 'withQuality', everything else in Sums too.
+void FixedPointDemodulator::correlate(const uint16_t* codes, bool withQuality, Sums& sums) const
+{
+    const uint16_t* x = codes + start;
+    const bool harmonic2 = withQuality && !cosTable[1].empty();
+    const bool harmonic3 = withQuality && !cosTable[2].empty();
+    for (int h = 0; h < NumHarmonics; ++h) {
+        sums.i[h] = sums.q[h] = 0;
+    }
+    sums.sum = 0;
+    sums.sumSquares = 0;
+
+    // Each product is at most 32768 * 32767 in magnitude, so it (and the sum of two) fits in 32 bits; only a sum of two
+    // squares can reach 2^31, which still fits unsigned
+    int i = 0;
+#if defined(DEMODULATOR_SSE2)
+    const __m128i offset = _mm_set1_epi16(static_cast<short>(0x8000));
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i accI[NumHarmonics], accQ[NumHarmonics];
+    for (int h = 0; h < NumHarmonics; ++h) {
+        accI[h] = accQ[h] = _mm_setzero_si128();
+    }
+    __m128i accSum = _mm_setzero_si128(), accSquares = _mm_setzero_si128();
+
+    for (; i + 8 <= length; i += 8) {
+        // Flipping the top bit of an unsigned code subtracts 0x8000, leaving a signed 16-bit sample
+        __m128i v = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i)), offset);
+        accI[0] = _mm_add_epi64(accI[0], widenSum(_mm_madd_epi16(v, load(cosTable[0].data() + i))));
+        accQ[0] = _mm_add_epi64(accQ[0], widenSum(_mm_madd_epi16(v, load(sinTable[0].data() + i))));
+        if (withQuality) {
+            accSum = _mm_add_epi64(accSum, widenSum(_mm_madd_epi16(v, ones)));
+            accSquares = _mm_add_epi64(accSquares, widenSumUnsigned(_mm_madd_epi16(v, v)));
+            if (harmonic2) {
+                accI[1] = _mm_add_epi64(accI[1], widenSum(_mm_madd_epi16(v, load(cosTable[1].data() + i))));
+                accQ[1] = _mm_add_epi64(accQ[1], widenSum(_mm_madd_epi16(v, load(sinTable[1].data() + i))));
+            }
+            if (harmonic3) {
+                accI[2] = _mm_add_epi64(accI[2], widenSum(_mm_madd_epi16(v, load(cosTable[2].data() + i))));
+                accQ[2] = _mm_add_epi64(accQ[2], widenSum(_mm_madd_epi16(v, load(sinTable[2].data() + i))));
+            }
+        }
+    }
+    for (int h = 0; h < NumHarmonics; ++h) {
+        sums.i[h] = horizontalSum(accI[h]);
+        sums.q[h] = horizontalSum(accQ[h]);
+    }
+    sums.sum = horizontalSum(accSum);
+    sums.sumSquares = static_cast<uint64_t>(horizontalSum(accSquares));
+#endif
+    for (; i < length; ++i) {
+        int32_t v = static_cast<int32_t>(x[i]) - 0x8000;
+        sums.i[0] += v * cosTable[0][i];
+        sums.q[0] += v * sinTable[0][i];
+        if (withQuality) {
+            sums.sum += v;
+            sums.sumSquares += static_cast<uint64_t>(static_cast<int64_t>(v) * v);
+            if (harmonic2) {
+                sums.i[1] += v * cosTable[1][i];
+                sums.q[1] += v * sinTable[1][i];
+            }
+            if (harmonic3) {
+                sums.i[2] += v * cosTable[2][i];
+                sums.q[2] += v * sinTable[2][i];
+            }
+        }
+    }
+}
+
+std::complex<double> FixedPointDemodulator::amplitudeOf(const Sums& sums, int harmonic) const
+{
+    const double scale = 2.0 / (static_cast<double>(TableScale) * length);
+    return std::complex<double>(scale * static_cast<double>(sums.i[harmonic]), scale * static_cast<double>(sums.q[harmonic]));
+}
+
+std::complex<double> FixedPointDemodulator::amplitude(const uint16_t* codes) const
+{
+    if (length == 0) {
+        return std::complex<double>(0.0, 0.0);
+    }
+    Sums sums;
+    correlate(codes, false, sums);
+    return amplitudeOf(sums, 0);
+}
+
+std::complex<double> FixedPointDemodulator::amplitude(const uint16_t* codes, SignalQuality& quality) const
+{
+    quality = SignalQuality();
+    if (length == 0) {
+        return std::complex<double>(0.0, 0.0);
+    }
+    Sums sums;
+    correlate(codes, true, sums);
+    std::complex<double> fundamental = amplitudeOf(sums, 0);
+
+    // A sinusoid of amplitude A has power A^2 / 2; over whole periods, the mean, the test signal, its harmonics, and
+    // what's left (noise) are orthogonal, so their powers add up to the mean square
+    const double n = length;
+    const double mean = sums.sum / n;
+    const double variance = static_cast<double>(sums.sumSquares) / n - mean * mean;
+    const double signalPower = std::norm(fundamental) / 2.0;
+    const double harmonicPower = (std::norm(amplitudeOf(sums, 1)) + std::norm(amplitudeOf(sums, 2))) / 2.0;
+    const double residualPower = std::max(variance - signalPower, 0.0);
+    const double noisePower = std::max(residualPower - harmonicPower, 0.0);
+
+    quality.residualRms = sqrt(residualPower);
+    if (signalPower == 0.0 || variance <= 0.0) {
+        // A flat window (e.g., an amplifier railed at 0x0000 or 0xFFFF, or a dead channel) has no test signal at all
+        quality.snr = -std::numeric_limits<double>::infinity();
+    } else if (noisePower > 0.0) {
+        quality.snr = 10.0 * log10(signalPower / noisePower);
+    } else {
+        quality.snr = std::numeric_limits<double>::infinity();
+    }
+    quality.thd = (signalPower > 0.0) ? sqrt(harmonicPower / signalPower) : 0.0;
+    quality.valid = true;
+    return fundamental;
+}
@@ -0,0 +1,69 @@
+#ifndef DEMODULATOR_H
+#define DEMODULATOR_H
+
+#include <vector>
+#include <complex>
+#include <cstdint>
+
+// How clean a demodulated test signal was
+struct SignalQuality {
+    double residualRms; // RMS of what's left after removing the mean and the fitted test sinusoid (same units as the amplitude)
+    double snr; // Test signal power over noise power (everything but the mean, test signal, and its 2nd and 3rd harmonics), in dB; -infinity for a window with no test signal (e.g., flat), +infinity for one with no noise
+    double thd; // Total harmonic distortion: root-sum-square amplitude of the 2nd and 3rd harmonics over the test signal's
+    bool valid; // False if no reading was taken (e.g., the channel wasn't measured, or the measurement was canceled)
+
+    SignalQuality() : residualRms(0.0), snr(0.0), thd(0.0), valid(false) {}
+};
+
+// Measures the complex amplitude of one frequency in a window of raw 16-bit amplifier ADC codes, in integer arithmetic.
+//
+// The codes are correlated with cosine and sine tables rounded to multiples of 1 / TableScale, in 64-bit accumulators;
+// the 0x8000 offset is removed exactly (as an integer) and the only floating-point step is the final scaling.  The
+// result is 2 / N * sum((code[t] - 0x8000) * (cos(k t) - i sin(k t))) over the N samples in the window, in ADC steps,
+// as Rhd2000Config::ImpedanceFreq::amplitudeOfFreqComponent() computes it in microvolts.
+//
+// Rounding the tables is the only source of error: each part (real and imaginary) of the result differs from the
+// exact one by at most mean(|code[t] - 0x8000|) / TableScale, i.e., about 0.003% of the signal's average amplitude.
+// Eight samples are correlated at a time with SSE2 when it's available; the integer sums are exact either way, so
+// both give identical results.
+//
+// The same pass can also sum the codes, their squares, and their correlation with the 2nd and 3rd harmonics (those below
+// the Nyquist frequency), for a SignalQuality.  These assume the window holds a whole number of periods, as
+// ImpedanceFreq::calculateValues() makes it, so that the sinusoids are orthogonal over it.
+class FixedPointDemodulator {
+public:
+    static const int TableScale = 32767;
+
+    FixedPointDemodulator();
+
+    // Sets the frequency (k, in radians per sample) and the window (samples startIndex to endIndex, inclusive).  The
+    // tables are only rebuilt if these change.
+    void setWindow(double radiansPerSample, int startIndex, int endIndex);
+    int windowLength() const { return length; }
+
+    // 'codes' holds the whole waveform, starting at sample 0 (only the window is read)
+    std::complex<double> amplitude(const uint16_t* codes) const;
+    std::complex<double> amplitude(const uint16_t* codes, SignalQuality& quality) const; // residualRms is in ADC steps
+
+private:
+    static const int NumHarmonics = 3; // Fundamental, 2nd, 3rd
+
+    // Integer sums over the window
+    struct Sums {
+        int64_t i[NumHarmonics];
+        int64_t q[NumHarmonics];
+        int64_t sum; // Of (code - 0x8000)
+        uint64_t sumSquares;
+    };
+
+    double k;
+    int start;
+    int length;
+    std::vector<int16_t> cosTable[NumHarmonics]; // TableScale * cos(h k t), for t in the window (empty above Nyquist)
+    std::vector<int16_t> sinTable[NumHarmonics]; // -TableScale * sin(h k t)
+
+    void correlate(const uint16_t* codes, bool withQuality, Sums& sums) const;
+    std::complex<double> amplitudeOf(const Sums& sums, int harmonic) const;
+};
+
+#endif // DEMODULATOR_H
@@ -0,0 +1,279 @@
+#include "electrodehistory.h"
+#include <QtCore>
+
+
+/* Constructor */
+ElectrodeHistory::ElectrodeHistory(int channels)
+{
+    numChannels = channels;
+    measurementRows.resize(numChannels);
+    pulseRows.resize(numChannels);
+    latestSlot.fill(-1, numChannels);
+    deadMeasurements = 0;
+    deadPulses = 0;
+}
+
+
+/* Public - Get the number of channels in the store */
+int ElectrodeHistory::getNumChannels() const
+{
+    return numChannels;
+}
+
+
+/* Public - Reserve room for this many measurements and pulses in total, to avoid reallocating during long sessions */
+void ElectrodeHistory::reserve(int numMeasurements, int numPulses)
+{
+    measurementTime.reserve(numMeasurements);
+    measurementImpedance.reserve(numMeasurements);
+    measurementChannel.reserve(numMeasurements);
+    pulseTime.reserve(numPulses);
+    pulseDuration.reserve(numPulses);
+    pulseCharge.reserve(numPulses);
+    pulseChannel.reserve(numPulses);
+}
+
+
+/* Public - Append an impedance measurement to a channel's history */
+void ElectrodeHistory::addMeasurement(int channel, double time, std::complex<double> impedance)
+{
+    measurementRows[channel].append(measurementTime.size());
+    measurementTime.append(time);
+    measurementImpedance.append(impedance);
+    measurementChannel.append(channel);
+
+    //Update the latest impedance list in place; a channel's first measurement inserts it in channel order
+    if (latestSlot[channel] >= 0) {
+        latest[latestSlot[channel]].impedance = impedance;
+        return;
+    }
+    int slot = 0;
+    while (slot < latest.size() && latest.at(slot).index < channel)
+        slot++;
+    ElectrodeImpedance thisElectrode;
+    thisElectrode.index = channel;
+    thisElectrode.impedance = impedance;
+    latest.insert(slot, thisElectrode);
+    for (int i = slot; i < latest.size(); i++) {
+        latestSlot[latest.at(i).index] = i;
+    }
+}
+
+
+/* Public - Append a pulse to a channel's history */
+void ElectrodeHistory::addPulse(int channel, double time, double duration, double charge)
+{
+    pulseRows[channel].append(pulseTime.size());
+    pulseTime.append(time);
+    pulseDuration.append(duration);
+    pulseCharge.append(charge);
+    pulseChannel.append(channel);
+}
+
+
+/* Public - Set the actual duration and delivered charge of a channel's most recent pulse */
+void ElectrodeHistory::finishPulse(int channel, double duration, double charge)
+{
+    if (pulseRows.at(channel).isEmpty())
+        return;
+    int row = pulseRows.at(channel).last();
+    pulseDuration[row] = duration;
+    pulseCharge[row] = charge;
+}
+
+
+/* Public - Clear one channel's measurements and pulses */
+void ElectrodeHistory::clear(int channel)
+{
+    const QVector<int> &rows = measurementRows.at(channel);
+    for (int i = 0; i < rows.size(); i++) {
+        measurementChannel[rows.at(i)] = -1;
+    }
+    deadMeasurements += rows.size();
+    measurementRows[channel].clear();
+
+    const QVector<int> &pRows = pulseRows.at(channel);
+    for (int i = 0; i < pRows.size(); i++) {
+        pulseChannel[pRows.at(i)] = -1;
+    }
+    deadPulses += pRows.size();
+    pulseRows[channel].clear();
+
+    int slot = latestSlot.at(channel);
+    if (slot >= 0) {
+        latest.remove(slot);
+        latestSlot[channel] = -1;
+        for (int i = slot; i < latest.size(); i++) {
+            latestSlot[latest.at(i).index] = i;
+        }
+    }
+
+    //Reclaim the rows left behind once they make up more than half of the columns
+    if (deadMeasurements > measurementTime.size() / 2)
+        compactMeasurements();
+    if (deadPulses > pulseTime.size() / 2)
+        compactPulses();
+}
+
+
+/* Public - Clear every channel's measurements and pulses */
+void ElectrodeHistory::clearAll()
+{
+    measurementTime.resize(0);
+    measurementImpedance.resize(0);
+    measurementChannel.resize(0);
+    pulseTime.resize(0);
+    pulseDuration.resize(0);
+    pulseCharge.resize(0);
+    pulseChannel.resize(0);
+    for (int channel = 0; channel < numChannels; channel++) {
+        measurementRows[channel].clear();
+        pulseRows[channel].clear();
+        latestSlot[channel] = -1;
+    }
+    latest.clear();
+    deadMeasurements = 0;
+    deadPulses = 0;
+}
+
+
+/* Public - Get the number of measurements in a channel's history */
+int ElectrodeHistory::measurementCount(int channel) const
+{
+    return measurementRows.at(channel).size();
+}
+
+
+/* Public - Get the number of pulses in a channel's history */
+int ElectrodeHistory::pulseCount(int channel) const
+{
+    return pulseRows.at(channel).size();
+}
+
+
+/* Public - Returns true if a channel has at least one measurement */
+bool ElectrodeHistory::hasMeasurement(int channel) const
+{
+    return latestSlot.at(channel) >= 0;
+}
+
+
+/* Public - Get a channel's most recent impedance, or 0 if it has none */
+std::complex<double> ElectrodeHistory::latestImpedance(int channel) const
+{
+    int slot = latestSlot.at(channel);
+    if (slot < 0)
+        return 0;
+    return latest.at(slot).impedance;
+}
+
+
+/* Public - Get the time of a channel's last measurement or the end of its last pulse, whichever is later (0 if neither) */
+double ElectrodeHistory::latestTime(int channel) const
+{
+    double time = 0;
+    if (!measurementRows.at(channel).isEmpty())
+        time = measurementTime.at(measurementRows.at(channel).last());
+    if (!pulseRows.at(channel).isEmpty()) {
+        int row = pulseRows.at(channel).last();
+        time = qMax(time, pulseTime.at(row) + pulseDuration.at(row));
+    }
+    return time;
+}
+
+
+/* Public - Get the most recent impedance of every channel that has one, ordered by channel */
+const QVector<ElectrodeImpedance> &ElectrodeHistory::latestImpedances() const
+{
+    return latest;
+}
+
+
+/* Public - Get a view of a channel's impedance history */
+ElectrodeHistory::MeasurementView ElectrodeHistory::measurements(int channel) const
+{
+    MeasurementView view;
+    view.times = measurementTime.constData();
+    view.impedances = measurementImpedance.constData();
+    view.rows = measurementRows.at(channel).constData();
+    view.count = measurementRows.at(channel).size();
+    return view;
+}
+
+
+/* Public - Get a view of a channel's pulse history */
+ElectrodeHistory::PulseView ElectrodeHistory::pulses(int channel) const
+{
+    PulseView view;
+    view.times = pulseTime.constData();
+    view.durations = pulseDuration.constData();
+    view.charges = pulseCharge.constData();
+    view.rows = pulseRows.at(channel).constData();
+    view.count = pulseRows.at(channel).size();
+    return view;
+}
+
+
+/* Public - Get the number of rows in the measurement columns (including rows left behind by clear()) */
+int ElectrodeHistory::totalMeasurements() const
+{
+    return measurementTime.size();
+}
+
+
+/* Public - Get the number of rows in the pulse columns (including rows left behind by clear()) */
+int ElectrodeHistory::totalPulses() const
+{
+    return pulseTime.size();
+}
+
+
+/* Private - Remove the rows left behind by clear() from the measurement columns */
+void ElectrodeHistory::compactMeasurements()
+{
+    //Slide live rows down over dead ones, keeping their order, and rebuild each channel's row index as we go
+    for (int channel = 0; channel < numChannels; channel++) {
+        measurementRows[channel].resize(0);
+    }
+    int live = 0;
+    for (int row = 0; row < measurementTime.size(); row++) {
+        int channel = measurementChannel.at(row);
+        if (channel < 0)
+            continue;
+        measurementTime[live] = measurementTime.at(row);
+        measurementImpedance[live] = measurementImpedance.at(row);
+        measurementChannel[live] = channel;
+        measurementRows[channel].append(live);
+        live++;
+    }
+    measurementTime.resize(live);
+    measurementImpedance.resize(live);
+    measurementChannel.resize(live);
+    deadMeasurements = 0;
+}
+
+
+/* Private - Remove the rows left behind by clear() from the pulse columns */
+void ElectrodeHistory::compactPulses()
+{
+    for (int channel = 0; channel < numChannels; channel++) {
+        pulseRows[channel].resize(0);
+    }
+    int live = 0;
+    for (int row = 0; row < pulseTime.size(); row++) {
+        int channel = pulseChannel.at(row);
+        if (channel < 0)
+            continue;
+        pulseTime[live] = pulseTime.at(row);
+        pulseDuration[live] = pulseDuration.at(row);
+        pulseCharge[live] = pulseCharge.at(row);
+        pulseChannel[live] = channel;
+        pulseRows[channel].append(live);
+        live++;
+    }
+    pulseTime.resize(live);
+    pulseDuration.resize(live);
+    pulseCharge.resize(live);
+    pulseChannel.resize(live);
+    deadPulses = 0;
+}
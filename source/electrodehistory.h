@@ -0,0 +1,111 @@
+#ifndef ELECTRODEHISTORY_H
+#define ELECTRODEHISTORY_H
+
+#include <QVector>
+#include <complex>
+#include "electrodeimpedance.h"
+
+/* ElectrodeHistory is a class that stores the impedance measurements and pulses of every electrode in one columnar store
+ *
+ * Measurements and pulses from all channels are appended, in the order they happen, to a handful of contiguous columns
+ * (time, impedance, channel; time, duration, charge, channel). Each channel keeps an index of the rows that belong to it,
+ * so its history can be walked without copying through a MeasurementView or PulseView.
+ *
+ * The most recent impedance of every channel is kept up to date as measurements are added, both per channel (for O(1)
+ * lookups) and as a list ordered by channel (returned by latestImpedances() without rebuilding it).
+ *
+ * Clearing a channel only empties its row index; the rows it leaves behind are reclaimed by compacting the columns once they
+ * make up more than half of them.
+ *
+ * Views point directly into the columns, so they are only valid until the next call that adds or clears anything. */
+
+class ElectrodeHistory
+{
+
+public:
+    /* MeasurementView: Zero-copy view of one channel's impedance history, oldest first */
+    struct MeasurementView {
+        const double *times; //Time column
+        const std::complex<double> *impedances; //Impedance column
+        const int *rows; //This channel's rows in the columns
+        int count; //Number of measurements
+
+        int size() const { return count; }
+        bool isEmpty() const { return count == 0; }
+        double timeAt(int i) const { return times[rows[i]]; } //Time (in seconds) of measurement 'i'
+        std::complex<double> impedanceAt(int i) const { return impedances[rows[i]]; } //Complex impedance (in ohms) of measurement 'i'
+        double lastTime() const { return times[rows[count - 1]]; } //Time of the most recent measurement; the view must not be empty
+    };
+
+    /* PulseView: Zero-copy view of one channel's pulse history, oldest first */
+    struct PulseView {
+        const double *times; //Time column
+        const double *durations; //Duration column
+        const double *charges; //Charge column
+        const int *rows; //This channel's rows in the columns
+        int count; //Number of pulses
+
+        int size() const { return count; }
+        bool isEmpty() const { return count == 0; }
+        double timeAt(int i) const { return times[rows[i]]; } //Time (in seconds) pulse 'i' was applied
+        double durationAt(int i) const { return durations[rows[i]]; } //Duration (in seconds) of pulse 'i'
+        double chargeAt(int i) const { return charges[rows[i]]; } //Charge (in C) delivered by pulse 'i', or 0 if it wasn't monitored or was constant voltage
+    };
+
+    ElectrodeHistory(int numChannels = 128); //Constructor
+    int getNumChannels() const; //Get the number of channels in the store
+    void reserve(int numMeasurements, int numPulses); //Reserve room for this many measurements and pulses in total, to avoid reallocating during long sessions
+
+    void addMeasurement(int channel, double time, std::complex<double> impedance); //Append an impedance measurement to a channel's history
+    void addPulse(int channel, double time, double duration, double charge = 0); //Append a pulse to a channel's history
+    void finishPulse(int channel, double duration, double charge); //Set the actual duration and delivered charge of a channel's most recent pulse
+    void clear(int channel); //Clear one channel's measurements and pulses
+    void clearAll(); //Clear every channel's measurements and pulses
+
+    int measurementCount(int channel) const; //Get the number of measurements in a channel's history
+    int pulseCount(int channel) const; //Get the number of pulses in a channel's history
+    bool hasMeasurement(int channel) const; //Returns true if a channel has at least one measurement
+    std::complex<double> latestImpedance(int channel) const; //Get a channel's most recent impedance, or 0 if it has none
+    double latestTime(int channel) const; //Get the time of a channel's last measurement or the end of its last pulse, whichever is later (0 if neither)
+    const QVector<ElectrodeImpedance> &latestImpedances() const; //Get the most recent impedance of every channel that has one, ordered by channel
+
+    MeasurementView measurements(int channel) const; //Get a view of a channel's impedance history
+    PulseView pulses(int channel) const; //Get a view of a channel's pulse history
+
+    int totalMeasurements() const; //Get the number of rows in the measurement columns (including rows left behind by clear())
+    int totalPulses() const; //Get the number of rows in the pulse columns (including rows left behind by clear())
+    const QVector<double> &measurementTimeColumn() const { return measurementTime; } //Time of every measurement row
+    const QVector<std::complex<double>> &measurementImpedanceColumn() const { return measurementImpedance; } //Impedance of every measurement row
+    const QVector<int> &measurementChannelColumn() const { return measurementChannel; } //Channel of every measurement row, or -1 if cleared
+    const QVector<double> &pulseTimeColumn() const { return pulseTime; } //Time of every pulse row
+    const QVector<double> &pulseDurationColumn() const { return pulseDuration; } //Duration of every pulse row
+    const QVector<double> &pulseChargeColumn() const { return pulseCharge; } //Charge of every pulse row
+    const QVector<int> &pulseChannelColumn() const { return pulseChannel; } //Channel of every pulse row, or -1 if cleared
+
+private:
+    void compactMeasurements(); //Remove the rows left behind by clear() from the measurement columns
+    void compactPulses(); //Remove the rows left behind by clear() from the pulse columns
+
+    int numChannels; //Number of channels in the store
+
+    /* Measurement columns; one row per measurement, in the order they were added */
+    QVector<double> measurementTime; //Time of each measurement (in seconds, relative to its channel's InitialTime)
+    QVector<std::complex<double>> measurementImpedance; //Complex impedance (in ohms) of each measurement
+    QVector<int> measurementChannel; //Channel of each measurement, or -1 once the channel has been cleared
+    int deadMeasurements; //Number of measurement rows left behind by clear()
+
+    /* Pulse columns; one row per pulse, in the order they were applied */
+    QVector<double> pulseTime; //Time each pulse was applied (in seconds, relative to its channel's InitialTime)
+    QVector<double> pulseDuration; //Duration of each pulse (in seconds)
+    QVector<double> pulseCharge; //Charge delivered by each pulse (in C), or 0 if it wasn't monitored or was constant voltage
+    QVector<int> pulseChannel; //Channel of each pulse, or -1 once the channel has been cleared
+    int deadPulses; //Number of pulse rows left behind by clear()
+
+    /* Per-channel indexes */
+    QVector<QVector<int>> measurementRows; //Rows of each channel's measurements, oldest first
+    QVector<QVector<int>> pulseRows; //Rows of each channel's pulses, oldest first
+    QVector<int> latestSlot; //Position of each channel in 'latest', or -1 if it has no measurements
+    QVector<ElectrodeImpedance> latest; //Most recent impedance of every channel that has one, ordered by channel
+};
+
+#endif // ELECTRODEHISTORY_H
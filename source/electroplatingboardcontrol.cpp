@@ -24,9 +24,7 @@ ElectroplatingBoardControl::ElectroplatingBoardControl()
     rangeSel0 = 0;
     rangeSel1 = 0;
     setChannel(0);
-    for (int index = 0; index < 16; index++) {
-        digitalOutputs[index] = 0;
-    }
+    digitalOutputs = 0;
     resistors[0] = 100e6;
     resistors[1] = 10e6;
     resistors[2] = 1e6;
@@ -231,23 +229,101 @@ bool ElectroplatingBoardControl::getReferenceSelection()
 }
 
 
-/* Public - Get the values of the digital outputs for these settings */
-void ElectroplatingBoardControl::getDigitalOutputs(bool out[])
+/* Public - Get the values of the digital outputs for these settings, packed into a bitmask (bit i = digital output i) */
+int ElectroplatingBoardControl::getDigitalOutputs()
 {
-    bool value[16];
-    for (int i = 0; i < 16; i++) {
-        value[i] = 0;
-    }
-    value[0] = currentSinkEnable;
-    value[1] = currentSourceEnable;
-    value[2] = currentModeEnable;
-    value[3] = (getRangeSel0() == 1) ? true : false;
-    value[4] = (getRangeSel1() == 1) ? true : false;
-    value[5] = elecTest1;
-    value[6] = elecTest2;
-    value[7] = getReferenceSelection();
-
-    for (int i = 0; i < 16; i++) {
-        out[i] = value[i];
+    int value = 0;
+    if (currentSinkEnable)
+        value |= (1 << 0);
+    if (currentSourceEnable)
+        value |= (1 << 1);
+    if (currentModeEnable)
+        value |= (1 << 2);
+    if (getRangeSel0() == 1)
+        value |= (1 << 3);
+    if (getRangeSel1() == 1)
+        value |= (1 << 4);
+    if (elecTest1)
+        value |= (1 << 5);
+    if (elecTest2)
+        value |= (1 << 6);
+    if (getReferenceSelection())
+        value |= ReferenceSelectionMask;
+    return value;
+}
+
+
+/* Public - Get the pulse program for these settings, resolving it only if it isn't already cached */
+const PulseProgram &ElectroplatingBoardControl::compilePulseProgram(ElectroplatingMode mode, double value, int channel)
+{
+    for (int i = 0; i < pulseProgramCache.size(); i++) {
+        const PulseProgram &program = pulseProgramCache.at(i);
+        if (program.mode == mode && program.value == value && program.channel == channel)
+            return program;
     }
+
+    if (pulseProgramCache.size() >= MaxCachedPulsePrograms)
+        pulseProgramCache.removeFirst();
+    pulseProgramCache.append(resolvePulseProgram(mode, value, channel));
+    return pulseProgramCache.last();
+}
+
+
+/* Public - Discard all cached pulse programs */
+void ElectroplatingBoardControl::clearPulseProgramCache()
+{
+    pulseProgramCache.clear();
+}
+
+
+/* Public - Get the number of cached pulse programs */
+int ElectroplatingBoardControl::pulseProgramCacheSize() const
+{
+    return pulseProgramCache.size();
+}
+
+
+/* Private - Resolve a pulse program from scratch, leaving this object in zcheck mode on the given channel */
+PulseProgram ElectroplatingBoardControl::resolvePulseProgram(ElectroplatingMode mode, double value, int channel)
+{
+    PulseProgram program;
+    program.mode = mode;
+    program.value = value;
+    program.channel = channel;
+
+    //Plating state
+    if (mode == ConstantVoltage)
+        setVoltage(value);
+    else
+        setCurrent(value/1e9);
+    setPlatingChannel(channel);
+
+    program.dataSource = dataSource;
+    program.effectiveChannel = effectiveChannel;
+    program.resistorSelection = resistorSelection;
+    program.dacManualVolts = getDacManualActual();
+    program.actualValue = (mode == ConstantVoltage) ? getVoltageActual() : getCurrentActual();
+    program.platingOutputs = getDigitalOutputs();
+    program.platingReferenceSelection = getReferenceSelection();
+
+    //Zcheck state, once plating has ended
+    setZCheckChannel(channel);
+    program.zCheckOutputs = getDigitalOutputs();
+    program.zCheckReferenceSelection = getReferenceSelection();
+    program.referenceTransition = (program.platingReferenceSelection != program.zCheckReferenceSelection);
+
+    return program;
+}
+
+
+/* Public - Human-readable description of every resolved value */
+QString PulseProgram::toString() const
+{
+    QString description;
+    description += QString("Mode: %1, Value: %2, Channel: %3\n").arg(mode == ConstantVoltage ? "Constant Voltage" : "Constant Current").arg(value).arg(channel);
+    description += QString("Data Source: %1, Effective Channel: %2, Resistor Selection: %3\n").arg(dataSource).arg(effectiveChannel).arg(resistorSelection);
+    description += QString("DacManual: %1 V, Actual Value: %2\n").arg(dacManualVolts).arg(actualValue);
+    description += QString("Plating Outputs: 0x%1, ZCheck Outputs: 0x%2\n").arg(platingOutputs, 4, 16, QChar('0')).arg(zCheckOutputs, 4, 16, QChar('0'));
+    description += QString("REF_SEL: %1 -> %2 (%3)").arg(zCheckReferenceSelection).arg(platingReferenceSelection).arg(referenceTransition ? "settle required" : "no change");
+    return description;
 }
@@ -1,6 +1,10 @@
 #ifndef ELECTROPLATINGBOARDCONTROL_H
 #define ELECTROPLATINGBOARDCONTROL_H
 
+#include <QList>
+#include <QString>
+#include "configurationparameters.h"
+
 /* ElectroplatingBoardControl is a class that allows the setting and getting of various parameters used to control the electroplating board
  *
  * Calculations for the electroplating board
@@ -20,11 +24,36 @@
  * This class encapsulates the details of the operation of the conrol lines. Instead of setting them directly,
  * you set Voltage or Current and PlatingChannel or ZCheckChannel. */
 
+/* PulseProgram is the complete hardware state needed to deliver one pulse, resolved once from a (mode, value, channel) triple
+ * by ElectroplatingBoardControl::compilePulseProgram, and reused for every pulse with the same settings.
+ * All members are public so that a program can be inspected (or printed with toString) for verification. */
+struct PulseProgram
+{
+    ElectroplatingMode mode; //Constant current or constant voltage
+    double value; //Requested value, as passed to MainWindow::pulse: nA for constant current, V for constant voltage
+    int channel; //Headstage channel to be plated (0-127)
+
+    int dataSource; //Data source of the channel: 0 (Port A MISO 1) or 1 (Port A MISO 2)
+    int effectiveChannel; //Channel within the data source (0-63), passed to BoardControl::beginPlating
+    int resistorSelection; //Which of the four resistors is used (constant current only)
+    double dacManualVolts; //Best achievable DacManual voltage
+    double actualValue; //Best achievable value, given hardware constraints (A for constant current, V for constant voltage)
+    int platingOutputs; //Digital output bitmask while plating (bit i = digital output i)
+    int zCheckOutputs; //Digital output bitmask once plating has ended
+    bool platingReferenceSelection; //Value of the REF_SEL control line while plating
+    bool zCheckReferenceSelection; //Value of the REF_SEL control line once plating has ended
+    bool referenceTransition; //True if REF_SEL changes between impedance checking and plating, so the reference needs time to settle
+
+    QString toString() const; //Human-readable description of every resolved value
+};
+
 class ElectroplatingBoardControl
 {
 
 public:
     ElectroplatingBoardControl(); //Constructor
+
+    static const int ReferenceSelectionMask = 1 << 7; //Bit of the REF_SEL control line in a digital output bitmask
     void setCurrent(double value); //Set to current mode with the given current
     void setVoltage(double value); //Set to voltage mode with the given voltage
     void setPlatingChannel(int channel); //Set to plating mode, with the given channel (value)
@@ -37,7 +66,10 @@ public:
     int getRangeSel0(); //Get the value of the RANGE_SEL_0 control line
     int getRangeSel1(); //Get the value of the RANGE_SEL_1 control line
     bool getReferenceSelection(); //Get the value of the REF_SEL control line
-    void getDigitalOutputs(bool out[16]); //Get the values of the digital outputs for these settings
+    int getDigitalOutputs(); //Get the values of the digital outputs for these settings, packed into a bitmask (bit i = digital output i)
+    const PulseProgram &compilePulseProgram(ElectroplatingMode mode, double value, int channel); //Get the pulse program for these settings, resolving it only if it isn't already cached
+    void clearPulseProgramCache(); //Discard all cached pulse programs (e.g., at the start of a run)
+    int pulseProgramCacheSize() const; //Get the number of cached pulse programs
 
     bool currentSourceEnable; //Value of I_SOURCE_EN control line
     bool currentSinkEnable; //Value of I_SINK_EN control line
@@ -63,8 +95,13 @@ public:
     int rangeSel0; //Value of the RANGE_SEL_0 control line
     int rangeSel1; //Value of the RANGE_SEL_1 control line
     int channel; //Current ZCheck or Plating channel (0-127)
-    bool digitalOutputs[16]; //Values of the digital outputs for these settings
+    int digitalOutputs; //Values of the digital outputs for these settings, packed into a bitmask
     bool pulseReferenceSelection; //Value of the REF_SEL control line
+
+private:
+    PulseProgram resolvePulseProgram(ElectroplatingMode mode, double value, int channel); //Resolve a pulse program from scratch, leaving this object in zcheck mode on the given channel
+    static const int MaxCachedPulsePrograms = 32; //Once the cache is this full, the oldest program is discarded to make room
+    QList<PulseProgram> pulseProgramCache; //Programs resolved so far (oldest first); a run only uses a handful of distinct (mode, value, channel) triples
 };
 
 #endif // ELECTROPLATINGBOARDCONTROL_H
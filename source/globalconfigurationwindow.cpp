@@ -95,6 +95,87 @@ GlobalConfigurationWindow::GlobalConfigurationWindow(GlobalParameters *parameter
     targetImpedanceGroupBoxLayout->addWidget(noTargetZ);
     targetImpedanceGroupBox->setLayout(targetImpedanceGroupBoxLayout);
 
+    /* Set up "Pulse Monitoring" group box (containing "monitorPulses" check box and three rows of labels and line edits) */
+    QGroupBox *monitoringGroupBox = new QGroupBox(tr("Pulse Monitoring"));
+    QVBoxLayout *monitoringGroupBoxLayout = new QVBoxLayout;
+
+    //Create checkbox representing whether or not pulses should be monitored
+    monitorPulses = new QCheckBox(tr("Monitor pulses, ending them early when a limit is reached"));
+    monitoringGroupBoxLayout->addWidget(monitorPulses);
+
+    //Create row for charge limit
+    QHBoxLayout *chargeLimitRow = new QHBoxLayout;
+    QLabel *chargeLimitLabel = new QLabel(tr("Charge limit per constant current pulse (in nC, 0 for no limit)"));
+    chargeLimit = new QLineEdit;
+    chargeLimitRow->addWidget(chargeLimitLabel);
+    chargeLimitRow->addWidget(chargeLimit);
+    monitoringGroupBoxLayout->addLayout(chargeLimitRow);
+
+    //Create row for voltage limit
+    QHBoxLayout *voltageLimitRow = new QHBoxLayout;
+    QLabel *voltageLimitLabel = new QLabel(tr("Electrode voltage limit (in V, 0 for no limit)"));
+    voltageLimit = new QLineEdit;
+    voltageLimitRow->addWidget(voltageLimitLabel);
+    voltageLimitRow->addWidget(voltageLimit);
+    monitoringGroupBoxLayout->addLayout(voltageLimitRow);
+
+    //Create row for the ADC input that the electrode monitor output is wired to
+    QHBoxLayout *monitorAdcChannelRow = new QHBoxLayout;
+    QLabel *monitorAdcChannelLabel = new QLabel(tr("Electrode monitor ADC input (0-7)"));
+    monitorAdcChannel = new QLineEdit;
+    monitorAdcChannelRow->addWidget(monitorAdcChannelLabel);
+    monitorAdcChannelRow->addWidget(monitorAdcChannel);
+    monitoringGroupBoxLayout->addLayout(monitorAdcChannelRow);
+
+    monitoringGroupBox->setLayout(monitoringGroupBoxLayout);
+
+    /* Set up "Electrode Screening" group box (containing "screenBeforePlating" check box and three rows of labels and line edits) */
+    QGroupBox *screeningGroupBox = new QGroupBox(tr("Electrode Screening"));
+    QVBoxLayout *screeningGroupBoxLayout = new QVBoxLayout;
+
+    //Create checkbox representing whether or not electrodes should be screened before automatic plating
+    screenBeforePlating = new QCheckBox(tr("Screen electrodes before automatic plating, skipping opens and shorts"));
+    screeningGroupBoxLayout->addWidget(screenBeforePlating);
+
+    //Create row for the short circuit bound
+    QHBoxLayout *screenMinMagnitudeRow = new QHBoxLayout;
+    QLabel *screenMinMagnitudeLabel = new QLabel(tr("Short below impedance magnitude (in kOhms)"));
+    screenMinMagnitude = new QLineEdit;
+    screenMinMagnitudeRow->addWidget(screenMinMagnitudeLabel);
+    screenMinMagnitudeRow->addWidget(screenMinMagnitude);
+    screeningGroupBoxLayout->addLayout(screenMinMagnitudeRow);
+
+    //Create row for the open circuit bound
+    QHBoxLayout *screenMaxMagnitudeRow = new QHBoxLayout;
+    QLabel *screenMaxMagnitudeLabel = new QLabel(tr("Open above impedance magnitude (in kOhms)"));
+    screenMaxMagnitude = new QLineEdit;
+    screenMaxMagnitudeRow->addWidget(screenMaxMagnitudeLabel);
+    screenMaxMagnitudeRow->addWidget(screenMaxMagnitude);
+    screeningGroupBoxLayout->addLayout(screenMaxMagnitudeRow);
+
+    //Create row for the open circuit phase bound
+    QHBoxLayout *screenMinPhaseRow = new QHBoxLayout;
+    QLabel *screenMinPhaseLabel = new QLabel(tr("Open below impedance phase (in degrees)"));
+    screenMinPhase = new QLineEdit;
+    screenMinPhaseRow->addWidget(screenMinPhaseLabel);
+    screenMinPhaseRow->addWidget(screenMinPhase);
+    screeningGroupBoxLayout->addLayout(screenMinPhaseRow);
+
+    screeningGroupBox->setLayout(screeningGroupBoxLayout);
+
+    /* Set up "Impedance Readings" group box (containing "impedanceCacheMaxAge" label and line edit) */
+    QGroupBox *readingsGroupBox = new QGroupBox(tr("Impedance Readings"));
+    QHBoxLayout *readingsGroupBoxLayout = new QHBoxLayout;
+
+    //Create "Impedance Cache Max Age" label and line edit
+    QLabel *impedanceCacheMaxAgeLabel = new QLabel(tr("Reuse a reading with no pulse since before plating, for up to (in seconds, 0 to always measure)"));
+    impedanceCacheMaxAge = new QLineEdit;
+
+    //Add "Impedance Cache Max Age" label and line edit to the group box
+    readingsGroupBoxLayout->addWidget(impedanceCacheMaxAgeLabel);
+    readingsGroupBoxLayout->addWidget(impedanceCacheMaxAge);
+    readingsGroupBox->setLayout(readingsGroupBoxLayout);
+
     /* Set up "OK" and "cancel" buttons */
     QDialogButtonBox *buttonBox = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel);
     connect(buttonBox, SIGNAL(accepted()), this, SLOT(accept()));
@@ -105,6 +186,9 @@ GlobalConfigurationWindow::GlobalConfigurationWindow(GlobalParameters *parameter
     mainLayout->addWidget(delaysGroupBox);
     mainLayout->addWidget(electrodesGroupBox);
     mainLayout->addWidget(targetImpedanceGroupBox);
+    mainLayout->addWidget(monitoringGroupBox);
+    mainLayout->addWidget(screeningGroupBox);
+    mainLayout->addWidget(readingsGroupBox);
     mainLayout->addWidget(buttonBox);
 
     //Initialize each of the widgets with the value from parameters
@@ -123,6 +207,15 @@ GlobalConfigurationWindow::GlobalConfigurationWindow(GlobalParameters *parameter
         useTargetZ->setChecked(false);
         noTargetZ->setChecked(true);
     }
+    monitorPulses->setChecked(parameters->monitorPulses);
+    chargeLimit->setText(QString::number(parameters->chargeLimit));
+    voltageLimit->setText(QString::number(parameters->voltageLimit));
+    monitorAdcChannel->setText(QString::number(parameters->monitorAdcChannel));
+    screenBeforePlating->setChecked(parameters->screenBeforePlating);
+    screenMinMagnitude->setText(QString::number(parameters->screenMinMagnitude / 1000));
+    screenMaxMagnitude->setText(QString::number(parameters->screenMaxMagnitude / 1000));
+    screenMinPhase->setText(QString::number(parameters->screenMinPhase));
+    impedanceCacheMaxAge->setText(QString::number(parameters->impedanceCacheMaxAge));
 
     setLayout(mainLayout);
     exec();
@@ -139,6 +232,15 @@ void GlobalConfigurationWindow::accept() {
     params->channels063Present = channels063Present->isChecked();
     params->channels64127Present = channels64127Present->isChecked();
     params->useTargetZ = useTargetZ->isChecked();
+    params->monitorPulses = monitorPulses->isChecked();
+    params->chargeLimit = chargeLimit->text().toFloat();
+    params->voltageLimit = voltageLimit->text().toFloat();
+    params->monitorAdcChannel = qBound(0, monitorAdcChannel->text().toInt(), 7);
+    params->screenBeforePlating = screenBeforePlating->isChecked();
+    params->screenMinMagnitude = screenMinMagnitude->text().toFloat() * 1000;
+    params->screenMaxMagnitude = screenMaxMagnitude->text().toFloat() * 1000;
+    params->screenMinPhase = screenMinPhase->text().toFloat();
+    params->impedanceCacheMaxAge = qMax(0.0f, impedanceCacheMaxAge->text().toFloat());
 
     done(Accepted);
 }
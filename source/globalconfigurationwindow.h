@@ -18,7 +18,7 @@ public:
 private:
     void accept(); //Reimplemented slot that is called when the user accepts the dialog. Passes current user inputs into 'params' structure, so they are accessible by the parent
     void reject(); //Reimplemented slot that is called when the user rejects the dialog
-    GlobalParameters *params; //Structure that holds the max number of pulses, various delays, whether or not channels 0-63 or 64-127 are present, and whether or not to use the target impedance
+    GlobalParameters *params; //Structure that holds the max number of pulses, various delays, whether or not channels 0-63 or 64-127 are present, whether or not to use the target impedance, pulse monitoring limits, electrode screening bounds, and how long an impedance reading may be reused
     QLineEdit *maxPulses;
     QLineEdit *delayMeasurementPulse;
     QLineEdit *delayPulseMeasurement;
@@ -28,6 +28,15 @@ private:
     QCheckBox *channels64127Present;
     QRadioButton *useTargetZ;
     QRadioButton *noTargetZ;
+    QCheckBox *monitorPulses;
+    QLineEdit *chargeLimit;
+    QLineEdit *voltageLimit;
+    QLineEdit *monitorAdcChannel;
+    QCheckBox *screenBeforePlating;
+    QLineEdit *screenMinMagnitude;
+    QLineEdit *screenMaxMagnitude;
+    QLineEdit *screenMinPhase;
+    QLineEdit *impedanceCacheMaxAge;
 
 };
 
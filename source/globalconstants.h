@@ -4,11 +4,24 @@
 // Saved settings file constants
 #define SETTINGS_FILE_MAGIC_NUMBER  0x183ca924
 #define SETTINGS_FILE_MAIN_VERSION_NUMBER  1
-#define SETTINGS_FILE_SECONDARY_VERSION_NUMBER  0
+#define SETTINGS_FILE_SECONDARY_VERSION_NUMBER  3
+
+// Saved session file constants
+#define SESSION_FILE_MAGIC_NUMBER  0x5e5510f2
+#define SESSION_FILE_MAIN_VERSION_NUMBER  1
+#define SESSION_FILE_SECONDARY_VERSION_NUMBER  0
 
 const double PI = 3.14159265359;
 const double TWO_PI = 6.28318530718;
 const double DEGREES_TO_RADIANS = 0.0174532925199;
 const double RADIANS_TO_DEGREES = 57.2957795132;
 
+// Coupling ratio (test signal on an adjacent channel relative to the measured channel) above which two electrodes are considered bridged
+const double BRIDGE_COUPLING_THRESHOLD = 0.5;
+
+// SNR (in dB) of the impedance test signal below which a reading taken during automatic plating is measured again
+const double MIN_MEASUREMENT_SNR = 20.0;
+// Most times a low-SNR reading is measured again; the reading with the best SNR is kept
+const int MAX_NOISY_REMEASUREMENTS = 2;
+
 #endif // GLOBALCONSTANTS_H
@@ -1,7 +1,7 @@
 #ifndef GLOBALPARAMETERS_H
 #define GLOBALPARAMETERS_H
 
-/* Structure that holds the max number of pulses, various delays, whether or not channels 0-63 or 64-127 are present, and whether or not to use the target impedance */
+/* Structure that holds the max number of pulses, various delays, whether or not channels 0-63 or 64-127 are present, whether or not to use the target impedance, pulse monitoring limits, electrode screening bounds, and how long an impedance reading may be reused */
 struct GlobalParameters {
     int maxPulses;
     float delayMeasurementPulse;
@@ -11,6 +11,15 @@ struct GlobalParameters {
     bool channels063Present;
     bool channels64127Present;
     bool useTargetZ;
+    bool monitorPulses;
+    float chargeLimit;
+    float voltageLimit;
+    int monitorAdcChannel;
+    bool screenBeforePlating;
+    float screenMinMagnitude;
+    float screenMaxMagnitude;
+    float screenMinPhase;
+    float impedanceCacheMaxAge;
 };
 
 
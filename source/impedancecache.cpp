@@ -0,0 +1,132 @@
+#include "impedancecache.h"
+
+/* Constructor */
+ImpedanceConditions::ImpedanceConditions() :
+    sampleRate(0),
+    testFrequency(0),
+    lowerBandwidth(0),
+    upperBandwidth(0),
+    dspCutoffFreq(0),
+    dspEnabled(false)
+{
+}
+
+
+/* Public - Returns true if a reading taken under 'other' would be the same as one taken under these conditions */
+bool ImpedanceConditions::operator==(const ImpedanceConditions &other) const
+{
+    return sampleRate == other.sampleRate &&
+           testFrequency == other.testFrequency &&
+           lowerBandwidth == other.lowerBandwidth &&
+           upperBandwidth == other.upperBandwidth &&
+           dspEnabled == other.dspEnabled &&
+           (!dspEnabled || dspCutoffFreq == other.dspCutoffFreq);
+}
+
+
+/* Constructor */
+ImpedanceCache::ImpedanceCache(int numElectrodes) :
+    entries(numElectrodes),
+    numHits(0),
+    numLookups(0)
+{
+    clock.start();
+    invalidate_all();
+}
+
+
+/* Public - Remember a reading of electrode 'index', taken now under 'conditions' */
+void ImpedanceCache::store(int index, std::complex<double> impedance, const SignalQuality &quality, const ImpedanceConditions &conditions)
+{
+    check_conditions(conditions);
+
+    Entry &entry = entries[index];
+    entry.valid = true;
+    entry.time = clock.elapsed();
+    entry.impedance = impedance;
+    entry.quality = quality;
+}
+
+
+/* Public - If electrode 'index' was read under 'conditions' within the last 'maxAge' seconds, with no pulse since, and the reading was actually taken with an SNR of at least 'minSnr' dB, return true and that reading */
+bool ImpedanceCache::lookup(int index, double maxAge, double minSnr, const ImpedanceConditions &conditions, std::complex<double> &impedance, SignalQuality &quality)
+{
+    check_conditions(conditions);
+    numLookups++;
+
+    double readingAge = age(index);
+    if (readingAge < 0 || readingAge > maxAge)
+        return false;
+    if (!entries[index].quality.valid || entries[index].quality.snr < minSnr)
+        return false;
+
+    impedance = entries[index].impedance;
+    quality = entries[index].quality;
+    numHits++;
+    return true;
+}
+
+
+/* Public - Seconds since electrode 'index' was last read, or -1 if there's no reading to reuse */
+double ImpedanceCache::age(int index) const
+{
+    if (!entries[index].valid)
+        return -1;
+    return (clock.elapsed() - entries[index].time) / 1000.0;
+}
+
+
+/* Public - Forget electrode 'index''s reading (e.g., because it's being pulsed) */
+void ImpedanceCache::invalidate(int index)
+{
+    entries[index].valid = false;
+}
+
+
+/* Public - Forget every reading */
+void ImpedanceCache::invalidate_all()
+{
+    for (int i = 0; i < entries.size(); i++)
+        entries[i].valid = false;
+}
+
+
+/* Public - Number of lookups that returned a reading */
+int ImpedanceCache::hits() const
+{
+    return numHits;
+}
+
+
+/* Public - Number of lookups */
+int ImpedanceCache::lookups() const
+{
+    return numLookups;
+}
+
+
+/* Public - Fraction of lookups that returned a reading, or 0 if there haven't been any */
+double ImpedanceCache::hit_rate() const
+{
+    if (numLookups == 0)
+        return 0;
+    return (double) numHits / numLookups;
+}
+
+
+/* Public - Zero the hit and lookup counts */
+void ImpedanceCache::reset_statistics()
+{
+    numHits = 0;
+    numLookups = 0;
+}
+
+
+/* Private - Forget every reading if 'newConditions' differ from the ones they were taken under */
+void ImpedanceCache::check_conditions(const ImpedanceConditions &newConditions)
+{
+    if (newConditions != conditions) {
+        invalidate_all();
+        conditions = newConditions;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef IMPEDANCECACHE_H
+#define IMPEDANCECACHE_H
+
+#include <QVector>
+#include <QElapsedTimer>
+#include <complex>
+#include "demodulator.h"
+
+/* ImpedanceCache is a class that remembers each electrode's most recent impedance reading, so that it can be reused
+ * instead of measuring again when nothing could have changed it since.
+ *
+ * A reading stops being reusable when:
+ *  - its electrode is pulsed (invalidate)
+ *  - it is older than the age the caller asks for (lookup's maxAge)
+ *  - its SNR is below the one the caller asks for (lookup's minSnr; e.g., a caller that would measure a noisy reading again)
+ *  - the conditions it was measured under (sample rate, test frequency, bandwidth) change, which drops every reading
+ *
+ * Ages are measured with a monotonic clock. Every lookup counts as a hit or a miss, for hit_rate(). */
+
+/* ImpedanceConditions: Board settings an impedance reading depends on */
+struct ImpedanceConditions {
+    double sampleRate; //Amplifier sample rate (in Hz)
+    double testFrequency; //Actual impedance test frequency (in Hz)
+    double lowerBandwidth; //Actual amplifier lower bandwidth (in Hz)
+    double upperBandwidth; //Actual amplifier upper bandwidth (in Hz)
+    double dspCutoffFreq; //Actual DSP cutoff frequency (in Hz); only compared if dspEnabled
+    bool dspEnabled; //True if the DSP high-pass filter is enabled
+
+    ImpedanceConditions();
+    bool operator==(const ImpedanceConditions &other) const;
+    bool operator!=(const ImpedanceConditions &other) const { return !(*this == other); }
+};
+
+class ImpedanceCache
+{
+public:
+    ImpedanceCache(int numElectrodes); //Constructor
+    void store(int index, std::complex<double> impedance, const SignalQuality &quality, const ImpedanceConditions &conditions); //Remember a reading of electrode 'index', taken now under 'conditions'
+    bool lookup(int index, double maxAge, double minSnr, const ImpedanceConditions &conditions, std::complex<double> &impedance, SignalQuality &quality); //If electrode 'index' was read under 'conditions' within the last 'maxAge' seconds, with no pulse since, and the reading was actually taken with an SNR of at least 'minSnr' dB, return true and that reading
+    double age(int index) const; //Seconds since electrode 'index' was last read, or -1 if there's no reading to reuse
+    void invalidate(int index); //Forget electrode 'index''s reading (e.g., because it's being pulsed)
+    void invalidate_all(); //Forget every reading
+    int hits() const; //Number of lookups that returned a reading
+    int lookups() const; //Number of lookups
+    double hit_rate() const; //Fraction of lookups that returned a reading, or 0 if there haven't been any
+    void reset_statistics(); //Zero the hit and lookup counts
+
+private:
+    struct Entry {
+        bool valid; //False if there's no reading to reuse
+        qint64 time; //When the reading was taken (in ms, on 'clock')
+        std::complex<double> impedance;
+        SignalQuality quality;
+    };
+
+    void check_conditions(const ImpedanceConditions &newConditions); //Forget every reading if 'newConditions' differ from the ones they were taken under
+
+    QVector<Entry> entries; //One per electrode
+    ImpedanceConditions conditions; //Conditions every valid reading was taken under
+    QElapsedTimer clock; //Monotonic clock that reading times are measured on
+    int numHits;
+    int numLookups;
+};
+
+#endif // IMPEDANCECACHE_H
@@ -0,0 +1,302 @@
+#include "impedanceexporter.h"
+#include "electrodehistory.h"
+#include "globalconstants.h"
+#include <QtCore>
+#include <complex>
+#include <stdio.h>
+#include <string.h>
+#include <locale.h>
+#if defined(__APPLE__)
+#include <xlocale.h>
+#endif
+
+//Largest number of bytes a single field can take (a channel name, a number, or a header label)
+#define MAX_FIELD_LENGTH 256
+
+
+/* Constructor */
+ImpedanceExporter::ImpedanceExporter(Delimiter delimiter, int chunk)
+{
+    separator = (delimiter == TabSeparated) ? '\t' : ',';
+    chunkSize = chunk;
+    buffer.resize(chunkSize + MAX_FIELD_LENGTH);
+    used = 0;
+    writeFailed = false;
+}
+
+
+/* Destructor */
+ImpedanceExporter::~ImpedanceExporter()
+{
+    if (file.isOpen())
+        close();
+}
+
+
+/* Public - Returns TabSeparated for .tsv and .txt files, CommaSeparated otherwise */
+ImpedanceExporter::Delimiter ImpedanceExporter::delimiterForFile(const QString &filename)
+{
+    QString suffix = QFileInfo(filename).suffix().toLower();
+    if (suffix == "tsv" || suffix == "txt")
+        return TabSeparated;
+    return CommaSeparated;
+}
+
+
+/* Public - Export each channel's most recent impedance, in the format of Intan's RHD2000 interface software */
+bool ImpedanceExporter::exportLatest(const QString &filename, const ElectrodeHistory &history)
+{
+    if (!open(filename))
+        return false;
+
+    //Write the 'label' row, listing the labels associated with each entry of data
+    const char *labels[] = {"Channel Number", "Channel Name", "Port", "Enabled", "Impedance Magnitude at 1000 Hz (ohms)",
+                            "Impedance Phase at 1000 Hz (degrees)", "Series RC equivalent R (Ohms)", "Series RC equivalent C (Farads)"};
+    for (int i = 0; i < 8; i++) {
+        if (i > 0)
+            appendDelimiter();
+        appendText(labels[i]);
+    }
+    appendNewline();
+
+    //For each electrode with a non-empty impedance history, write data
+    const QVector<ElectrodeImpedance> &latest = history.latestImpedances();
+    for (int i = 0; i < latest.size(); i++) {
+        std::complex<double> impedance = latest.at(i).impedance;
+        //Channel number, channel name (identical to channel number), port, and enabled (always true)
+        appendChannelName(latest.at(i).index);
+        appendDelimiter();
+        appendChannelName(latest.at(i).index);
+        appendDelimiter();
+        appendText("Port A");
+        appendDelimiter();
+        appendText("1");
+        appendDelimiter();
+
+        //Impedance magnitude, phase, and equivalent R and C
+        appendNumber(std::abs(impedance), 'e', 2);
+        appendDelimiter();
+        appendNumber(std::arg(impedance) * RADIANS_TO_DEGREES, 'f', 0);
+        appendDelimiter();
+        appendNumber(impedance.real(), 'e', 2);
+        appendDelimiter();
+        appendNumber(1/(-2 * PI * 1000 * impedance.imag()), 'e', 2);
+        appendNewline();
+    }
+    return close();
+}
+
+
+/* Public - Export every measurement of every channel, one row per measurement, grouped by channel */
+bool ImpedanceExporter::exportHistory(const QString &filename, const ElectrodeHistory &history, int columns)
+{
+    if (!open(filename))
+        return false;
+
+    //Label row, with only the selected columns
+    const char *labels[] = {"Channel Number", "Time (s)", "Impedance Magnitude at 1000 Hz (ohms)", "Impedance Phase at 1000 Hz (degrees)",
+                            "Series RC equivalent R (Ohms)", "Series RC equivalent C (Farads)"};
+    bool first = true;
+    for (int c = 0; c < 6; c++) {
+        if (!(columns & (1 << c)))
+            continue;
+        if (!first)
+            appendDelimiter();
+        appendText(labels[c]);
+        first = false;
+    }
+    appendNewline();
+
+    for (int channel = 0; channel < history.getNumChannels(); channel++) {
+        ElectrodeHistory::MeasurementView measurements = history.measurements(channel);
+        for (int i = 0; i < measurements.size(); i++) {
+            std::complex<double> impedance = measurements.impedanceAt(i);
+            first = true;
+            if (columns & ChannelColumn) {
+                appendChannelName(channel);
+                first = false;
+            }
+            if (columns & TimeColumn) {
+                if (!first)
+                    appendDelimiter();
+                appendNumber(measurements.timeAt(i), 'f', 3);
+                first = false;
+            }
+            if (columns & MagnitudeColumn) {
+                if (!first)
+                    appendDelimiter();
+                appendNumber(std::abs(impedance), 'e', 2);
+                first = false;
+            }
+            if (columns & PhaseColumn) {
+                if (!first)
+                    appendDelimiter();
+                appendNumber(std::arg(impedance) * RADIANS_TO_DEGREES, 'f', 0);
+                first = false;
+            }
+            if (columns & ResistanceColumn) {
+                if (!first)
+                    appendDelimiter();
+                appendNumber(impedance.real(), 'e', 2);
+                first = false;
+            }
+            if (columns & CapacitanceColumn) {
+                if (!first)
+                    appendDelimiter();
+                appendNumber(1/(-2 * PI * 1000 * impedance.imag()), 'e', 2);
+            }
+            appendNewline();
+        }
+    }
+    return close();
+}
+
+
+/* Public - Export every pulse of every channel, one row per pulse, grouped by channel */
+bool ImpedanceExporter::exportPulses(const QString &filename, const ElectrodeHistory &history)
+{
+    if (!open(filename))
+        return false;
+
+    const char *labels[] = {"Channel Number", "Time (s)", "Duration (s)", "Charge (C)"};
+    for (int i = 0; i < 4; i++) {
+        if (i > 0)
+            appendDelimiter();
+        appendText(labels[i]);
+    }
+    appendNewline();
+
+    for (int channel = 0; channel < history.getNumChannels(); channel++) {
+        ElectrodeHistory::PulseView pulses = history.pulses(channel);
+        for (int i = 0; i < pulses.size(); i++) {
+            appendChannelName(channel);
+            appendDelimiter();
+            appendNumber(pulses.timeAt(i), 'f', 3);
+            appendDelimiter();
+            appendNumber(pulses.durationAt(i), 'e', 3);
+            appendDelimiter();
+            appendNumber(pulses.chargeAt(i), 'e', 3);
+            appendNewline();
+        }
+    }
+    return close();
+}
+
+
+/* Public - Get a description of the last error */
+QString ImpedanceExporter::getErrorString() const
+{
+    return errorString;
+}
+
+
+/* Private - Open 'filename' for writing, and empty the buffer */
+bool ImpedanceExporter::open(const QString &filename)
+{
+    file.setFileName(filename);
+    if (!file.open(QIODevice::WriteOnly)) {
+        errorString = file.errorString();
+        return false;
+    }
+    used = 0;
+    writeFailed = false;
+    return true;
+}
+
+
+/* Private - Write what's left in the buffer, and close the file; returns false if any write failed */
+bool ImpedanceExporter::close()
+{
+    if (used > 0 && file.write(buffer.constData(), used) != used)
+        writeFailed = true;
+    used = 0;
+    if (writeFailed)
+        errorString = file.errorString();
+    file.close();
+    return !writeFailed;
+}
+
+
+/* Private - Write the buffer to the file once it holds at least one chunk */
+void ImpedanceExporter::flushIfFull()
+{
+    if (used < chunkSize)
+        return;
+    if (file.write(buffer.constData(), used) != used)
+        writeFailed = true;
+    used = 0;
+}
+
+
+/* Private - Append a string */
+void ImpedanceExporter::appendText(const char *text)
+{
+    int length = (int) strlen(text);
+    if (length > MAX_FIELD_LENGTH)
+        length = MAX_FIELD_LENGTH;
+    memcpy(buffer.data() + used, text, length);
+    used += length;
+    flushIfFull();
+}
+
+
+/* Private - Append a channel name (e.g., A-005) */
+void ImpedanceExporter::appendChannelName(int channel)
+{
+    int length = snprintf(buffer.data() + used, MAX_FIELD_LENGTH, "A-%03d", channel);
+    used += qMin(length, MAX_FIELD_LENGTH - 1);
+    flushIfFull();
+}
+
+
+/* Private - Append a number, formatted like QString::number(value, format, precision) */
+void ImpedanceExporter::appendNumber(double value, char format, int precision)
+{
+    char *field = buffer.data() + used;
+    int length = formatNumber(field, MAX_FIELD_LENGTH, value, format, precision);
+    length = qBound(0, length, MAX_FIELD_LENGTH - 1); //Truncated if absurdly long (e.g., 1e300 in 'f' format)
+
+    //Older Windows C runtimes always write three exponent digits (1.41e+005); QString::number() writes at least two
+    if (format == 'e' && length >= 5 && field[length - 5] == 'e' && field[length - 3] == '0') {
+        field[length - 3] = field[length - 2];
+        field[length - 2] = field[length - 1];
+        length--;
+    }
+
+    used += length;
+    flushIfFull();
+}
+
+
+/* Private - snprintf() 'value' into 'field' as "%.*e" or "%.*f" in the C locale */
+int ImpedanceExporter::formatNumber(char *field, int size, double value, char format, int precision)
+{
+    //Not in LC_NUMERIC, which QCoreApplication sets from the environment, so a comma-decimal locale would split fields in a .csv
+    const char *pattern = (format == 'e') ? "%.*e" : "%.*f";
+#if defined(_WIN32)
+    static _locale_t cLocale = _create_locale(LC_NUMERIC, "C");
+    return _snprintf_l(field, size, pattern, cLocale, precision, value);
+#else
+    static locale_t cLocale = newlocale(LC_NUMERIC_MASK, "C", (locale_t) 0);
+    locale_t previousLocale = uselocale(cLocale);
+    int length = snprintf(field, size, pattern, precision, value);
+    uselocale(previousLocale);
+    return length;
+#endif
+}
+
+
+/* Private - Append the field separator */
+void ImpedanceExporter::appendDelimiter()
+{
+    buffer.data()[used++] = separator;
+    flushIfFull();
+}
+
+
+/* Private - End a row */
+void ImpedanceExporter::appendNewline()
+{
+    buffer.data()[used++] = '\n';
+    flushIfFull();
+}
@@ -0,0 +1,68 @@
+#ifndef IMPEDANCEEXPORTER_H
+#define IMPEDANCEEXPORTER_H
+
+#include <QString>
+#include <QFile>
+#include <QByteArray>
+
+/* ImpedanceExporter is a class that writes impedances and pulses from an ElectrodeHistory to delimited text files
+ *
+ * Rows are formatted straight into one reusable buffer, which is written to the file in chunks of 'chunkSize' bytes.
+ * Numbers are formatted in place with snprintf() in the C locale, whatever LC_NUMERIC is, exactly as QString::number()
+ * formats them with the same format and precision, so files match those written before this class existed. */
+
+class ElectrodeHistory;
+
+class ImpedanceExporter
+{
+
+public:
+    /* Delimiter: Field separator of the exported file */
+    enum Delimiter {
+        CommaSeparated, //.csv
+        TabSeparated //.tsv
+    };
+
+    /* Column: Columns that can be selected for exportHistory(); combine with | */
+    enum Column {
+        ChannelColumn = 0x01, //Channel number (e.g., A-005)
+        TimeColumn = 0x02, //Time of the measurement (in seconds, relative to the channel's InitialTime)
+        MagnitudeColumn = 0x04, //Impedance magnitude (ohms)
+        PhaseColumn = 0x08, //Impedance phase (degrees)
+        ResistanceColumn = 0x10, //Series RC equivalent R (ohms)
+        CapacitanceColumn = 0x20, //Series RC equivalent C (farads)
+        AllColumns = 0x3f
+    };
+
+    ImpedanceExporter(Delimiter delimiter = CommaSeparated, int chunkSize = 1 << 20); //Constructor
+    ~ImpedanceExporter(); //Destructor
+
+    static Delimiter delimiterForFile(const QString &filename); //Returns TabSeparated for .tsv and .txt files, CommaSeparated otherwise
+
+    bool exportLatest(const QString &filename, const ElectrodeHistory &history); //Export each channel's most recent impedance, in the format of Intan's RHD2000 interface software
+    bool exportHistory(const QString &filename, const ElectrodeHistory &history, int columns = AllColumns); //Export every measurement of every channel, one row per measurement, grouped by channel
+    bool exportPulses(const QString &filename, const ElectrodeHistory &history); //Export every pulse of every channel, one row per pulse, grouped by channel
+    QString getErrorString() const; //Get a description of the last error
+
+private:
+    bool open(const QString &filename); //Open 'filename' for writing, and empty the buffer
+    bool close(); //Write what's left in the buffer, and close the file; returns false if any write failed
+    void flushIfFull(); //Write the buffer to the file once it holds at least one chunk
+
+    void appendText(const char *text); //Append a string
+    void appendChannelName(int channel); //Append a channel name (e.g., A-005)
+    void appendNumber(double value, char format, int precision); //Append a number, formatted like QString::number(value, format, precision) ('e' or 'f' only)
+    static int formatNumber(char *field, int size, double value, char format, int precision); //snprintf() 'value' into 'field' as "%.*e" or "%.*f" in the C locale
+    void appendDelimiter(); //Append the field separator
+    void appendNewline(); //End a row
+
+    char separator; //Field separator (',' or '\t')
+    int chunkSize; //Number of bytes to collect before each write
+    QByteArray buffer; //Reusable output buffer; capacity is chunkSize plus room for one row
+    int used; //Number of bytes of 'buffer' in use
+    QFile file; //File being written
+    bool writeFailed; //True if any write to 'file' failed
+    QString errorString; //Description of the last error
+};
+
+#endif // IMPEDANCEEXPORTER_H
@@ -23,8 +23,11 @@
 #include "signalsources.h"
 #include "signalchannel.h"
 #include "rhd2000registers.h"
+#include "saveformat.h"
+#include "signalprocessor.h"
 #include <QtCore>
 #include <iostream>
+#include <algorithm>
 
 using Rhd2000RegisterInternals::typed_register_t;
 using std::vector;
@@ -32,14 +35,16 @@ using std::deque;
 using std::complex;
 using std::unique_ptr;
 
-#define RADIANS_TO_DEGREES  57.2957795132
-
 //  ------------------------------------------------------------------------
 
+unique_ptr<EncoderPool> ImpedanceMeasureController::workerPool;
+
 ImpedanceMeasureController::ImpedanceMeasureController(BoardControl& bc, ProgressWrapper& progressWrapper_, BoardControl::CALLBACK_FUNCTION_IDLE callback_, bool continuation) :
     boardControl(bc),
     progress(progressWrapper_),
-    callback(callback_)
+    callback(callback_),
+    numThreads(0),
+    sensors(nullptr)
 {
     if (!continuation) {
         boardControl.leds.startProgressCounter();
@@ -50,30 +55,34 @@ ImpedanceMeasureController::ImpedanceMeasureController(BoardControl& bc, Progres
     const unsigned int numChannels = rhd2164ChipPresent ? 64 : 32;
 }
 
+ImpedanceMeasureController::~ImpedanceMeasureController()
+{
+}
+
 void ImpedanceMeasureController::advanceLEDs() {
     // Advance LED display
     boardControl.leds.incProgressCounter();
     boardControl.updateLEDs();
 }
 
-bool ImpedanceMeasureController::measureAmplitudesForAllCapacitances(const std::vector<unsigned int>& channels, std::vector<std::vector<std::vector<std::complex<double> > > >& measuredAmplitudes)
+bool ImpedanceMeasureController::measureAmplitudesForAllCapacitances(const std::vector<unsigned int>& channels, Rhd2000Config::AmplitudeMatrix& measuredAmplitudes, bool measureAdjacent, int firstCapRange, int lastCapRange)
 {
     unsigned int old_numBlocks = boardControl.read.numUsbBlocksToRead;
     boardControl.read.numUsbBlocksToRead = boardControl.impedance.numBlocks;
 
-    vector<double> amplifierData(SAMPLES_PER_DATA_BLOCK * boardControl.impedance.numBlocks, 0);
+    vector<uint16_t> amplifierCodes(SAMPLES_PER_DATA_BLOCK * boardControl.impedance.numBlocks, 0);
 
     // We execute three complete electrode impedance measurements: one each with
     // Cseries set to 0.1 pF, 1 pF, and 10 pF.  Then we select the best measurement
     // for each channel so that we achieve a wide impedance measurement range.
-    for (int capRange = 0; capRange < 3; ++capRange) {
+    // (A quick measurement may restrict this to fewer capacitor values.)
+    for (int capRange = firstCapRange; capRange <= lastCapRange; ++capRange) {
 
         boardControl.auxCmds.chipRegisters.setZcheckScale(static_cast<Rhd2000Registers::ZcheckCs>(capRange));
 
         // Check all channels across all active data streams.
         for (unsigned int i = 0; i < channels.size(); ++i) {
             unsigned int channel = channels[i];
-            unsigned int channelIndex = channel % 32;
 
             //progress.setValue(progress.value() + 1);
             if (progress.wasCanceled()) {
@@ -88,17 +97,22 @@ bool ImpedanceMeasureController::measureAmplitudesForAllCapacitances(const std::
 
             boardControl.readBlocks();
 
-            for (unsigned int source = 0; source < MAX_NUM_BOARD_DATA_SOURCES; ++source) {
-                Rhd2000Config::DataSourceControl& dsource = boardControl.dataStreams.physicalDataStreams[source];
-                Rhd2000Config::DataStreamConfig* ds = dsource.getStreamForChannel(channel);
-                if (ds != nullptr) {
-                    int stream = ds->index;
-
-                    getAmplifierData(boardControl.read.dataQueue, stream, channelIndex, amplifierData);
+            // The temperature sensor and supply voltage are sampled on AuxCmd2 throughout, so every run adds to their trends
+            if (sensors != nullptr) {
+                for (unsigned int block = 0; block < boardControl.read.dataQueue.size(); ++block) {
+                    sensors->calculateTemps(*boardControl.read.dataQueue[block]);
+                }
+            }
 
-                    // Measure complex amplitude of frequency component.
-                    complex<double> z = boardControl.impedance.amplitudeOfFreqComponent(amplifierData.data());
-                    measuredAmplitudes[source][channel][capRange] = z;
+            for (unsigned int source = 0; source < MAX_NUM_BOARD_DATA_SOURCES; ++source) {
+                storeAmplitude(source, channel, capRange, amplifierCodes, measuredAmplitudes);
+
+                // Every amplifier channel is sampled on every run, so the adjacent channels come for free
+                if (measureAdjacent) {
+                    if (channel > 0) {
+                        storeAmplitude(source, channel - 1, capRange, amplifierCodes, measuredAmplitudes);
+                    }
+                    storeAmplitude(source, channel + 1, capRange, amplifierCodes, measuredAmplitudes);
                 }
             }
 
@@ -113,33 +127,134 @@ bool ImpedanceMeasureController::measureAmplitudesForAllCapacitances(const std::
     return true;
 }
 
-void ImpedanceMeasureController::findBestImpedances(vector<vector<vector<std::complex<double> > > >& measuredAmplitudes, vector<vector<complex<double> > >& bestZ) {
-    bestZ.resize(measuredAmplitudes.size());
-    for (unsigned int source = 0; source < MAX_NUM_BOARD_DATA_SOURCES; ++source) {
-        unsigned int numChannels = static_cast<unsigned int>(measuredAmplitudes[source].size());
-        if (numChannels > 0) {
-            bestZ[source].resize(numChannels, 0);
-
-            for (unsigned int channel = 0; channel < numChannels; ++channel) {
-                bestZ[source][channel] = boardControl.impedance.calculateBestImpedanceOneAmplifier(measuredAmplitudes[source][channel]);
+// Measures the complex amplitude of the impedance test frequency on one channel of one data source, from the data
+// in the read queue.  Does nothing if the data source has no chip, or the channel is out of range.
+void ImpedanceMeasureController::storeAmplitude(int source, unsigned int channel, int capRange, vector<uint16_t>& amplifierCodes, Rhd2000Config::AmplitudeMatrix& measuredAmplitudes)
+{
+    if (channel >= measuredAmplitudes.numChannels(source)) {
+        return;
+    }
+    unsigned int amplifier = measuredAmplitudes.index(source, channel);
+
+    Rhd2000Config::DataSourceControl& dsource = boardControl.dataStreams.physicalDataStreams[source];
+    Rhd2000Config::DataStreamConfig* ds = dsource.getStreamForChannel(channel);
+    if (ds != nullptr) {
+        int stream = ds->index;
+
+        getAmplifierCodes(boardControl.read.dataQueue, stream, channel % 32, amplifierCodes);
+
+        // Measure complex amplitude of frequency component (in fixed point, straight from the ADC codes), and how
+        // clean it was, in the same pass.
+        complex<double> z = boardControl.impedance.amplitudeOfFreqComponent(amplifierCodes.data(), measuredQualities[capRange][amplifier]);
+        measuredAmplitudes.set(amplifier, capRange, z);
+
+        // Capturing is a side line: if the capture file can't be written, stop capturing rather than abort the measurement
+        if (boardControl.impedanceCapture) {
+            try {
+                boardControl.impedanceCapture->captureWindow(boardControl, stream, channel % 32, source, channel, capRange, z);
+            } catch (std::exception& e) {
+                std::cerr << "Impedance capture stopped: " << e.what() << std::endl;
+                boardControl.impedanceCapture.reset();
             }
         }
     }
 }
 
-void ImpedanceMeasureController::storeBestImpedances(std::vector<std::vector<std::complex<double> > >& bestZ) {
+// Returns the largest amplitude on a channel adjacent to 'channel', relative to the amplitude on 'channel'.
+// Uses the Cseries setting that gave the largest amplitude on 'channel', since that has the best signal-to-noise ratio.
+double ImpedanceMeasureController::couplingRatio(const Rhd2000Config::AmplitudeMatrix& measuredAmplitudes, unsigned int source, unsigned int channel)
+{
+    unsigned int amplifier = measuredAmplitudes.index(source, channel);
+    int bestCap = 0;
+    for (int capRange = 1; capRange < 3; ++capRange) {
+        if (std::abs(measuredAmplitudes.at(amplifier, capRange)) > std::abs(measuredAmplitudes.at(amplifier, bestCap))) {
+            bestCap = capRange;
+        }
+    }
+
+    double reference = std::abs(measuredAmplitudes.at(amplifier, bestCap));
+    if (reference == 0.0) {
+        return 0.0;
+    }
+
+    double ratio = 0.0;
+    if (channel > 0) {
+        ratio = std::max(ratio, std::abs(measuredAmplitudes.at(amplifier - 1, bestCap)) / reference);
+    }
+    if (channel + 1 < measuredAmplitudes.numChannels(source)) {
+        ratio = std::max(ratio, std::abs(measuredAmplitudes.at(amplifier + 1, bestCap)) / reference);
+    }
+    return ratio;
+}
+
+void ImpedanceMeasureController::setNumThreads(unsigned int numThreads_) {
+    numThreads = numThreads_;
+}
+
+void ImpedanceMeasureController::setSensorStorage(TemperatureStorage* storage) {
+    sensors = storage;
+}
+
+// Calculates the best impedance of amplifiers begin..end-1 (see ImpedanceFreq::calculateBestImpedances).  Every
+// amplifier is independent, so a large range is split into contiguous slices, one per worker; each worker writes only
+// its own slice of 'best', and run() joins them all before we return.  'best' must already be sized to the matrix.
+void ImpedanceMeasureController::findBestImpedances(const Rhd2000Config::AmplitudeMatrix& measuredAmplitudes, unsigned int begin, unsigned int end, Rhd2000Config::ImpedanceArrays& best) {
+    // Each amplifier takes about 100 ns, and handing a job to the pool about 10 us, so a slice this size keeps the hand-off
+    // under a few percent of the work.  (A board has at most a few hundred amplifiers, so in practice this only runs in parallel
+    // for sweeps merged across boards.)
+    const unsigned int MinAmplifiersPerWorker = 4096;
+
+    unsigned int threads = numThreads;
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    unsigned int count = end - begin;
+    unsigned int numWorkers = std::min(threads, std::max(count / MinAmplifiersPerWorker, 1u));
+
+    if (numWorkers <= 1) {
+        boardControl.impedance.calculateBestImpedances(measuredAmplitudes, begin, end, best);
+    } else {
+        if (!workerPool || workerPool->numThreads() != numWorkers) {
+            workerPool.reset(new EncoderPool(numWorkers));
+        }
+        workerPool->run(numWorkers, [&](unsigned int worker) {
+            unsigned int sliceBegin = begin + static_cast<unsigned int>((static_cast<unsigned long long>(count) * worker) / numWorkers);
+            unsigned int sliceEnd = begin + static_cast<unsigned int>((static_cast<unsigned long long>(count) * (worker + 1)) / numWorkers);
+            boardControl.impedance.calculateBestImpedances(measuredAmplitudes, sliceBegin, sliceEnd, best);
+        });
+    }
+}
+
+// Copies every amplifier's best impedance to its SignalChannel.  The amplifier channels are found in one pass over the
+// signal sources, rather than a search per channel.
+void ImpedanceMeasureController::storeBestImpedances(const Rhd2000Config::AmplitudeMatrix& measuredAmplitudes, const Rhd2000Config::ImpedanceArrays& best) {
+    SignalChannel* amplifierChannels[MAX_NUM_DATA_STREAMS][32] = {}; // [stream][chip channel]
+    for (unsigned int i = 0; i < boardControl.signalSources.signalPort.size(); ++i) {
+        SignalGroup& group = boardControl.signalSources.signalPort[i];
+        for (int j = 0; j < group.numChannels(); ++j) {
+            SignalChannel& signalChannel = group.channel[j];
+            if (signalChannel.signalType == AmplifierSignal &&
+                    signalChannel.boardStream >= 0 && signalChannel.boardStream < static_cast<int>(MAX_NUM_DATA_STREAMS) &&
+                    signalChannel.chipChannel >= 0 && signalChannel.chipChannel < 32 &&
+                    amplifierChannels[signalChannel.boardStream][signalChannel.chipChannel] == nullptr) {
+                // The first match, as findAmplifierChannel() would return
+                amplifierChannels[signalChannel.boardStream][signalChannel.chipChannel] = &signalChannel;
+            }
+        }
+    }
+
     for (unsigned int source = 0; source < MAX_NUM_BOARD_DATA_SOURCES; ++source) {
         Rhd2000Config::DataSourceControl& dsource = boardControl.dataStreams.physicalDataStreams[source];
 
-        for (int channelInDatasource = 0; channelInDatasource < 64; ++channelInDatasource) {
+        for (unsigned int channelInDatasource = 0; channelInDatasource < measuredAmplitudes.numChannels(source); ++channelInDatasource) {
             int channel = channelInDatasource % 32;
             Rhd2000Config::DataStreamConfig* ds = dsource.getStreamForChannel(channelInDatasource);
             if (ds != nullptr) {
-                int stream = ds->index;
-                SignalChannel *signalChannel = boardControl.signalSources.findAmplifierChannel(stream, channel);
+                SignalChannel *signalChannel = amplifierChannels[ds->index][channel];
                 if (signalChannel) {
-                    signalChannel->electrodeImpedanceMagnitude = std::abs(bestZ[source][channelInDatasource]);
-                    signalChannel->electrodeImpedancePhase = RADIANS_TO_DEGREES * std::arg(bestZ[source][channelInDatasource]);
+                    unsigned int amplifier = measuredAmplitudes.index(source, channelInDatasource);
+                    signalChannel->electrodeImpedanceMagnitude = best.magnitude[amplifier];
+                    signalChannel->electrodeImpedancePhase = best.phase[amplifier];
                 }
             }
         }
@@ -149,7 +264,7 @@ void ImpedanceMeasureController::storeBestImpedances(std::vector<std::vector<std
 // All the board-related work for impedance measurement.
 // Sets up the board, runs the measurement (which results in amplitudes only) for all specified channels, and restores the board to pre-measurement state
 // Doesn't convert the measurements to impedances
-bool ImpedanceMeasureController::setupAndMeasureAmplitudes(const std::vector<unsigned int>& channels, std::vector<std::vector<std::vector<std::complex<double> > > >& measuredAmplitudes) {
+bool ImpedanceMeasureController::setupAndMeasureAmplitudes(const std::vector<unsigned int>& channels, Rhd2000Config::AmplitudeMatrix& measuredAmplitudes, bool measureAdjacent, int firstCapRange, int lastCapRange) {
     // Disable external fast settling, since this interferes with DAC commands in AuxCmd1.
     bool externalFastSettle = boardControl.fastSettle.external;
     boardControl.fastSettle.external = false;
@@ -158,7 +273,7 @@ bool ImpedanceMeasureController::setupAndMeasureAmplitudes(const std::vector<uns
     // Disable auxiliary digital output control during impedance measurements.
     boardControl.disableAuxDigOut();
 
-    boardControl.digitalOutputs.values[15] = 1;
+    boardControl.digitalOutputs.values.set(15, true);
     boardControl.updateDigitalOutputs();
 
     // Turn LEDs on to indicate that data acquisition is running.
@@ -174,7 +289,11 @@ bool ImpedanceMeasureController::setupAndMeasureAmplitudes(const std::vector<uns
 
     boardControl.beginImpedanceMeasurement();
 
-    bool good = measureAmplitudesForAllCapacitances(channels, measuredAmplitudes);
+    if (boardControl.impedanceCapture) {
+        boardControl.impedanceCapture->beginSweep();
+    }
+
+    bool good = measureAmplitudesForAllCapacitances(channels, measuredAmplitudes, measureAdjacent, firstCapRange, lastCapRange);
 
     // Switch back to flatline
     boardControl.endImpedanceMeasurement();
@@ -183,7 +302,7 @@ bool ImpedanceMeasureController::setupAndMeasureAmplitudes(const std::vector<uns
 
     boardControl.flush();
 
-    boardControl.digitalOutputs.values[15] = 0;
+    boardControl.digitalOutputs.values.set(15, false);
     boardControl.updateDigitalOutputs();
 
     // Re-enable external fast settling, if selected.
@@ -196,26 +315,26 @@ bool ImpedanceMeasureController::setupAndMeasureAmplitudes(const std::vector<uns
     return good;
 }
 
-// Create matrix of complex of size (MAX_NUM_BOARD_DATA_SOURCES x number of channels x 3) to store complex amplitudes
-// of all amplifier channels at three different Cseries values.
-vector<vector<vector<complex<double>>>> ImpedanceMeasureController::createAmplitudeMatrix() {
-    vector<vector<vector<complex<double> > > > measuredAmplitudes; // [datasource][channel][capacitance]
-    measuredAmplitudes.resize(MAX_NUM_BOARD_DATA_SOURCES);
+// Create a matrix to store complex amplitudes of all amplifier channels of every data source at three different
+// Cseries values.  Also clears measuredQualities, and gives it the same shape.
+Rhd2000Config::AmplitudeMatrix ImpedanceMeasureController::createAmplitudeMatrix() {
+    vector<unsigned int> numChannels(MAX_NUM_BOARD_DATA_SOURCES, 0);
     for (unsigned int i = 0; i < MAX_NUM_BOARD_DATA_SOURCES; ++i) {
-        int numChannels = boardControl.dataStreams.physicalDataStreams[i].getNumChannels();
-        if (numChannels > 0) {
-            measuredAmplitudes[i].resize(numChannels);
-            for (int j = 0; j < numChannels; ++j) {
-                measuredAmplitudes[i][j].resize(3);
-            }
-        }
+        numChannels[i] = boardControl.dataStreams.physicalDataStreams[i].getNumChannels();
+    }
+
+    Rhd2000Config::AmplitudeMatrix measuredAmplitudes;
+    measuredAmplitudes.resize(numChannels);
+    for (int capRange = 0; capRange < Rhd2000Config::AmplitudeMatrix::NumCapRanges; ++capRange) {
+        measuredQualities[capRange].assign(measuredAmplitudes.size(), SignalQuality());
     }
     return measuredAmplitudes;
 }
 
-// Execute an electrode impedance measurement procedure for one channels.
-complex<double> ImpedanceMeasureController::measureOneImpedance(Rhd2000EvalBoard::BoardDataSource datasource, unsigned int channel) {
-    vector<vector<vector<complex<double> > > > measuredAmplitudes = createAmplitudeMatrix(); // [datasource][channel][capacitance]
+// Execute an electrode impedance measurement procedure for one channels.  If 'quality' isn't null, it's set to the
+// quality of the reading the impedance was calculated from.
+complex<double> ImpedanceMeasureController::measureOneImpedance(Rhd2000EvalBoard::BoardDataSource datasource, unsigned int channel, SignalQuality* quality) {
+    Rhd2000Config::AmplitudeMatrix measuredAmplitudes = createAmplitudeMatrix();
 
     // Create an array of channels to measure
     vector<unsigned int> channels;
@@ -224,17 +343,93 @@ complex<double> ImpedanceMeasureController::measureOneImpedance(Rhd2000EvalBoard
     bool good = setupAndMeasureAmplitudes(channels, measuredAmplitudes);
 
     // And now, store the acquired data
-    if (good) {
-        return boardControl.impedance.calculateBestImpedanceOneAmplifier(measuredAmplitudes[datasource][channel]);
+    if (good && channel < measuredAmplitudes.numChannels(datasource)) {
+        unsigned int amplifier = measuredAmplitudes.index(datasource, channel);
+        Rhd2000Config::ImpedanceArrays best;
+        best.resize(measuredAmplitudes.size());
+        findBestImpedances(measuredAmplitudes, amplifier, amplifier + 1, best);
+        if (quality != nullptr) {
+            *quality = measuredQualities[best.capRange[amplifier]][amplifier];
+        }
+        return best.at(amplifier);
     }
     else {
+        if (quality != nullptr) {
+            *quality = SignalQuality();
+        }
         return complex<double>(0, 0);
     }
 }
 
+// Execute an electrode impedance measurement procedure for one channel on every data source at once (e.g., the plated
+// channel and its partner on the other MISO stream), together with a coupling check on the adjacent channels.
+// The Zcheck channel applies to all chips, and all amplifier channels are sampled on every run, so this takes
+// exactly as many board runs as measureOneImpedance.
+PairedImpedanceMeasurement ImpedanceMeasureController::measurePairedImpedances(unsigned int channel) {
+    Rhd2000Config::AmplitudeMatrix measuredAmplitudes = createAmplitudeMatrix();
+
+    vector<unsigned int> channels;
+    channels.push_back(channel);
+
+    bool good = setupAndMeasureAmplitudes(channels, measuredAmplitudes, true);
+
+    PairedImpedanceMeasurement result;
+    result.impedances.resize(MAX_NUM_BOARD_DATA_SOURCES, complex<double>(0, 0));
+    result.couplingRatios.resize(MAX_NUM_BOARD_DATA_SOURCES, 0.0);
+    result.qualities.resize(MAX_NUM_BOARD_DATA_SOURCES);
+    if (good) {
+        // One pass over the whole matrix (the adjacent channels' amplitudes are in it anyway), rather than one per source
+        Rhd2000Config::ImpedanceArrays best;
+        best.resize(measuredAmplitudes.size());
+        findBestImpedances(measuredAmplitudes, 0, measuredAmplitudes.size(), best);
+        for (unsigned int source = 0; source < MAX_NUM_BOARD_DATA_SOURCES; ++source) {
+            if (channel < measuredAmplitudes.numChannels(source)) {
+                unsigned int amplifier = measuredAmplitudes.index(source, channel);
+                result.impedances[source] = best.at(amplifier);
+                result.couplingRatios[source] = couplingRatio(measuredAmplitudes, source, channel);
+                result.qualities[source] = measuredQualities[best.capRange[amplifier]][amplifier];
+            }
+        }
+    }
+    return result;
+}
+
+// Execute an impedance measurement of all channels for screening electrodes.
+// Every chip measures the same channel on each run, so this takes one run per channel index and Cseries value.
+// All three Cseries values are used, and each amplifier's impedance is taken from the one in whose range it falls:
+// 0.1 pF alone distinguishes opens, but saturates on low impedances, so it can't be relied on to find shorts.
+// Results are indexed [datasource][channel].
+bool ImpedanceMeasureController::screenImpedances(vector<vector<complex<double> > >& impedances) {
+    Rhd2000Config::AmplitudeMatrix measuredAmplitudes = createAmplitudeMatrix();
+
+    const unsigned int maxChannel = rhd2164ChipPresent ? 64 : 32;
+    vector<unsigned int> channels(maxChannel, 0);
+    for (unsigned int i = 0; i < maxChannel; ++i) {
+        channels[i] = i;
+    }
+
+    bool good = setupAndMeasureAmplitudes(channels, measuredAmplitudes);
+
+    impedances.resize(MAX_NUM_BOARD_DATA_SOURCES);
+    if (good) {
+        Rhd2000Config::ImpedanceArrays best;
+        best.resize(measuredAmplitudes.size());
+        findBestImpedances(measuredAmplitudes, 0, measuredAmplitudes.size(), best);
+
+        for (unsigned int source = 0; source < MAX_NUM_BOARD_DATA_SOURCES; ++source) {
+            impedances[source].resize(measuredAmplitudes.numChannels(source));
+            for (unsigned int channel = 0; channel < measuredAmplitudes.numChannels(source); ++channel) {
+                impedances[source][channel] = best.at(measuredAmplitudes.index(source, channel));
+            }
+        }
+    }
+
+    return good;
+}
+
 // Execute an electrode impedance measurement procedure for all channels.
 bool ImpedanceMeasureController::runImpedanceMeasurementRealBoard() {
-    vector<vector<vector<complex<double> > > > measuredAmplitudes = createAmplitudeMatrix(); // [datasource][channel][capacitance]
+    Rhd2000Config::AmplitudeMatrix measuredAmplitudes = createAmplitudeMatrix();
 
     // Create an array of channels to measure
     const unsigned int maxChannel = rhd2164ChipPresent ? 64 : 32;
@@ -251,29 +446,25 @@ bool ImpedanceMeasureController::runImpedanceMeasurementRealBoard() {
 
     // And now, store the acquired data
     if (good) {
-        vector<vector<complex<double> > > bestZ;
-        findBestImpedances(measuredAmplitudes, bestZ);
-        storeBestImpedances(bestZ);
+        Rhd2000Config::ImpedanceArrays best;
+        best.resize(measuredAmplitudes.size());
+        findBestImpedances(measuredAmplitudes, 0, measuredAmplitudes.size(), best);
+        storeBestImpedances(measuredAmplitudes, best);
     }
 
     return good;
 }
 
 // Reads numBlocks blocks of raw USB data stored in a queue of Rhd2000DataBlock
-// objects, extracts the amplifier data in units of microvolts.
-void ImpedanceMeasureController::getAmplifierData(deque<unique_ptr<Rhd2000DataBlock>> &dataQueue, int stream, int channel, vector<double>& amplifierData)
+// objects, extracts one amplifier channel's raw ADC codes (which the impedance
+// demodulation scales to microvolts itself).
+void ImpedanceMeasureController::getAmplifierCodes(deque<unique_ptr<Rhd2000DataBlock>> &dataQueue, int stream, int channel, vector<uint16_t>& amplifierCodes)
 {
-
     for (unsigned int block = 0; block < dataQueue.size(); ++block) {
-        Rhd2000DataBlock& dataBlock = *dataQueue[block];
-
-        // Load and scale RHD2000 amplifier waveforms
-        // (sampled at amplifier sampling rate)
+        const int* raw = dataQueue[block]->amplifierData[stream][channel].data();
+        uint16_t* codes = amplifierCodes.data() + block * SAMPLES_PER_DATA_BLOCK;
         for (unsigned int t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            // Amplifier waveform units = microvolts
-
-            //dataBlock.print(std::cout, 0);
-            amplifierData[block * SAMPLES_PER_DATA_BLOCK + t] = Rhd2000DataBlock::amplifierADCToMicroVolts(dataBlock.amplifierData[stream][channel][t]);
+            codes[t] = static_cast<uint16_t>(raw[t]);
         }
     }
 }
@@ -23,6 +23,8 @@
 #define IMPEDANCEMEASURECONTROLLER_H
 
 class Rhd2000DataBlock;
+class EncoderPool;
+class TemperatureStorage;
 
 namespace Rhd2000RegisterInternals {
     struct typed_register_t;
@@ -32,7 +34,9 @@ namespace Rhd2000RegisterInternals {
 #include <deque>
 #include <complex>
 #include <memory>
+#include <cstdint>
 #include "boardcontrol.h"
+#include "demodulator.h"
 
 class ProgressWrapper {
 public:
@@ -45,26 +49,55 @@ public:
     virtual bool wasCanceled() const = 0;
 };
 
+/** \brief Result of ImpedanceMeasureController::measurePairedImpedances.
+
+    Both vectors are indexed by data source; entries for data sources without a chip are 0.
+ */
+struct PairedImpedanceMeasurement {
+    /// Impedance of the measured channel on each data source (i.e., the plated channel and its partner on the other stream).
+    std::vector<std::complex<double> > impedances;
+    /** \brief Largest test-frequency amplitude seen on an adjacent channel (channel - 1 or channel + 1),
+        relative to the amplitude on the measured channel of the same data source.
+
+        Adjacent channels don't have the test current applied, so this is near 0 unless the electrodes are bridged.
+     */
+    std::vector<double> couplingRatios;
+    /// Quality of the reading each impedance was calculated from (i.e., at the Cseries value it was calculated with).
+    std::vector<SignalQuality> qualities;
+};
+
 class ImpedanceMeasureController {
 public:
     ImpedanceMeasureController(BoardControl& bc, ProgressWrapper& progressWrapper_, BoardControl::CALLBACK_FUNCTION_IDLE callback_, bool continuation=false);
+    ~ImpedanceMeasureController();
 
     bool runImpedanceMeasurementRealBoard();
-    std::complex<double> measureOneImpedance(Rhd2000EvalBoard::BoardDataSource datasource, unsigned int channel);
+    std::complex<double> measureOneImpedance(Rhd2000EvalBoard::BoardDataSource datasource, unsigned int channel, SignalQuality* quality = nullptr);
+    PairedImpedanceMeasurement measurePairedImpedances(unsigned int channel);
+    bool screenImpedances(std::vector<std::vector<std::complex<double> > >& impedances);
+
+    void setNumThreads(unsigned int numThreads); // For calculating impedances from amplitudes; 0 (the default) uses one per core, for large enough sweeps; 1 runs serially
+    void setSensorStorage(TemperatureStorage* storage); // Fed the temperature and supply voltage readings of every data block measured; nullptr (the default) for none
 
 private:
     BoardControl& boardControl;
     ProgressWrapper& progress;
     bool rhd2164ChipPresent;
     BoardControl::CALLBACK_FUNCTION_IDLE *callback;
+    std::vector<SignalQuality> measuredQualities[Rhd2000Config::AmplitudeMatrix::NumCapRanges]; // [capacitance][amplifier], indexed like the AmplitudeMatrix
+    static std::unique_ptr<EncoderPool> workerPool; // Shared by every controller (one is created per reading), so its threads are only started once
+    unsigned int numThreads;
+    TemperatureStorage* sensors;
 
-    bool setupAndMeasureAmplitudes(const std::vector<unsigned int>& channels, std::vector<std::vector<std::vector<std::complex<double> > > >& measuredAmplitudes);
-    bool measureAmplitudesForAllCapacitances(const std::vector<unsigned int>& channels, std::vector<std::vector<std::vector<std::complex<double> > > >& measuredAmplitudes);
-    void findBestImpedances(std::vector<std::vector<std::vector<std::complex<double> > > >& measuredAmplitudes, std::vector<std::vector<std::complex<double> > >& bestZ);
-    void storeBestImpedances(std::vector<std::vector<std::complex<double> > >& bestZ);
+    bool setupAndMeasureAmplitudes(const std::vector<unsigned int>& channels, Rhd2000Config::AmplitudeMatrix& measuredAmplitudes, bool measureAdjacent = false, int firstCapRange = 0, int lastCapRange = 2);
+    bool measureAmplitudesForAllCapacitances(const std::vector<unsigned int>& channels, Rhd2000Config::AmplitudeMatrix& measuredAmplitudes, bool measureAdjacent, int firstCapRange, int lastCapRange);
+    void storeAmplitude(int source, unsigned int channel, int capRange, std::vector<uint16_t>& amplifierCodes, Rhd2000Config::AmplitudeMatrix& measuredAmplitudes);
+    double couplingRatio(const Rhd2000Config::AmplitudeMatrix& measuredAmplitudes, unsigned int source, unsigned int channel);
+    void findBestImpedances(const Rhd2000Config::AmplitudeMatrix& measuredAmplitudes, unsigned int begin, unsigned int end, Rhd2000Config::ImpedanceArrays& best);
+    void storeBestImpedances(const Rhd2000Config::AmplitudeMatrix& measuredAmplitudes, const Rhd2000Config::ImpedanceArrays& best);
     void advanceLEDs();
-    void getAmplifierData(std::deque<std::unique_ptr<Rhd2000DataBlock>> &dataQueue, int stream, int channel, std::vector<double>& amplifierData);
-    std::vector<std::vector<std::vector<std::complex<double>>>> createAmplitudeMatrix();
+    void getAmplifierCodes(std::deque<std::unique_ptr<Rhd2000DataBlock>> &dataQueue, int stream, int channel, std::vector<uint16_t>& amplifierCodes);
+    Rhd2000Config::AmplitudeMatrix createAmplitudeMatrix();
 };
 
 #endif // IMPEDANCEMEASURECONTROLLER_H
@@ -15,11 +15,15 @@
 #include "dataprocessor.h"
 #include "complex.h"
 #include "oneelectrode.h"
+#include "electrodehistory.h"
+#include "impedanceexporter.h"
 #include "boardcontrol.h"
 #include "impedancemeasurecontroller.h"
+#include "impedancecache.h"
 #include "electroplatingboardcontrol.h"
 #include "significantround.h"
 #include "impedanceplot.h"
+#include "pulsemonitor.h"
 
 #if defined WIN32
     #include <windows.h>
@@ -313,12 +317,23 @@ MainWindow::MainWindow(QWidget *parent)
     saveSettingsAction = new QAction(tr("Save Settings"), this);
     loadSettingsAction = new QAction(tr("Load Settings"), this);
     saveImpedancesAction = new QAction(tr("Save Impedances"), this);
+    saveImpedanceHistoryAction = new QAction(tr("Save Impedance History"), this);
+    savePulseLogAction = new QAction(tr("Save Pulse Log"), this);
+    saveSessionAction = new QAction(tr("Save Session"), this);
+    loadSessionAction = new QAction(tr("Load Session"), this);
+    captureImpedanceWaveformsAction = new QAction(tr("Capture Impedance Waveforms"), this);
+    captureImpedanceWaveformsAction->setCheckable(true);
 
     //Connect "Settings" actions to their respective slots
     connect(configureAction, SIGNAL(triggered()), this, SLOT(configure()));
     connect(saveSettingsAction, SIGNAL(triggered()), this, SLOT(saveSettings()));
     connect(loadSettingsAction, SIGNAL(triggered()), this, SLOT(loadSettings()));
     connect(saveImpedancesAction, SIGNAL(triggered()), this, SLOT(saveImpedances()));
+    connect(saveImpedanceHistoryAction, SIGNAL(triggered()), this, SLOT(saveImpedanceHistory()));
+    connect(savePulseLogAction, SIGNAL(triggered()), this, SLOT(savePulseLog()));
+    connect(saveSessionAction, SIGNAL(triggered()), this, SLOT(saveSession()));
+    connect(loadSessionAction, SIGNAL(triggered()), this, SLOT(loadSession()));
+    connect(captureImpedanceWaveformsAction, SIGNAL(toggled(bool)), this, SLOT(captureImpedanceWaveforms(bool)));
 
     //Create "Help" actions
     intanWebsiteAction = new QAction(tr("Visit Intan Website..."), this);
@@ -335,6 +350,13 @@ MainWindow::MainWindow(QWidget *parent)
     settingsMenu->addAction(loadSettingsAction);
     settingsMenu->addSeparator();
     settingsMenu->addAction(saveImpedancesAction);
+    settingsMenu->addAction(saveImpedanceHistoryAction);
+    settingsMenu->addAction(savePulseLogAction);
+    settingsMenu->addSeparator();
+    settingsMenu->addAction(saveSessionAction);
+    settingsMenu->addAction(loadSessionAction);
+    settingsMenu->addSeparator();
+    settingsMenu->addAction(captureImpedanceWaveformsAction);
 
     //Add "Help" actions to menu and add menu to menu bar
     helpMenu = menuBar()->addMenu(tr("Help"));
@@ -355,6 +377,23 @@ MainWindow::MainWindow(QWidget *parent)
     //Create data processor
     dataProcessor = new DataProcessor();
 
+    //If the last session crashed, offer to recover its measurements from the journal, then start journaling this session
+    QString journalDir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(journalDir);
+    QString journalFilename = QDir(journalDir).filePath("electroplating.journal");
+    if (DataProcessor::journal_needs_recovery(journalFilename)) {
+        QMessageBox::StandardButton recover = QMessageBox::question(this, tr("Recover Measurements"),
+                                                                    tr("The previous session did not close normally. Recover its impedance measurements and pulses?"),
+                                                                    QMessageBox::Yes | QMessageBox::No, QMessageBox::Yes);
+        if (recover == QMessageBox::Yes) {
+            if (!dataProcessor->recover_journal(journalFilename))
+                QMessageBox::warning(this, tr("Recover Measurements"), tr("The measurement journal could not be read."));
+        }
+    }
+    if (!dataProcessor->open_journal(journalFilename))
+        QMessageBox::warning(this, tr("Measurement Journal"), tr("Could not open measurement journal file ") + journalFilename +
+                             tr(". Measurements will not be recoverable if the program closes unexpectedly."));
+
     //Connect final signals & slots
     connect(manualConfigureButton, SIGNAL(clicked()), this, SLOT(manualConfigureSlot()));
     connect(manualApplyButton, SIGNAL(clicked()), this, SLOT(manualApplySlot()));
@@ -506,6 +545,15 @@ void MainWindow::saveSettings()
     settings->channels0to63 = globalParameters->channels063Present;
     settings->channels64to127 = globalParameters->channels64127Present;
     settings->useTargetImpedance = globalParameters->useTargetZ;
+    settings->monitorPulses = globalParameters->monitorPulses;
+    settings->chargeLimit = globalParameters->chargeLimit;
+    settings->voltageLimit = globalParameters->voltageLimit;
+    settings->monitorAdcChannel = globalParameters->monitorAdcChannel;
+    settings->screenBeforePlating = globalParameters->screenBeforePlating;
+    settings->screenMinMagnitude = globalParameters->screenMinMagnitude;
+    settings->screenMaxMagnitude = globalParameters->screenMaxMagnitude;
+    settings->screenMinPhase = globalParameters->screenMinPhase;
+    settings->impedanceCacheMaxAge = globalParameters->impedanceCacheMaxAge;
 
     //State of GUI
     settings->selected = selectedChannelSpinBox->value();
@@ -562,6 +610,15 @@ void MainWindow::loadSettings()
     globalParameters->channels063Present = settings->channels0to63;
     globalParameters->channels64127Present = settings->channels64to127;
     globalParameters->useTargetZ = settings->useTargetImpedance;
+    globalParameters->monitorPulses = settings->monitorPulses;
+    globalParameters->chargeLimit = settings->chargeLimit;
+    globalParameters->voltageLimit = settings->voltageLimit;
+    globalParameters->monitorAdcChannel = settings->monitorAdcChannel;
+    globalParameters->screenBeforePlating = settings->screenBeforePlating;
+    globalParameters->screenMinMagnitude = settings->screenMinMagnitude;
+    globalParameters->screenMaxMagnitude = settings->screenMaxMagnitude;
+    globalParameters->screenMinPhase = settings->screenMinPhase;
+    globalParameters->impedanceCacheMaxAge = settings->impedanceCacheMaxAge;
 
     //State of GUI
     selectedChannelSpinBox->setValue(settings->selected);
@@ -582,7 +639,7 @@ void MainWindow::saveImpedances()
     QString saveImpedancesFileName;
     saveImpedancesFileName = QFileDialog::getSaveFileName(this,
                                                           tr("Save Impedance Data As"), ".",
-                                                          tr("Comma Separated Values File (*.csv)"));
+                                                          tr("Comma Separated Values File (*.csv);;Tab Separated Values File (*.tsv)"));
 
     //If user canceled the save operation, return
     if (saveImpedancesFileName.length() == 0)
@@ -593,6 +650,121 @@ void MainWindow::saveImpedances()
 }
 
 
+/* Save every channel's impedance history to a .csv or .tsv file */
+void MainWindow::saveImpedanceHistory()
+{
+    //Get filename
+    QString fileName = QFileDialog::getSaveFileName(this,
+                                                    tr("Save Impedance History As"), ".",
+                                                    tr("Comma Separated Values File (*.csv);;Tab Separated Values File (*.tsv)"));
+
+    //If user canceled the save operation, return
+    if (fileName.length() == 0)
+        return;
+
+    //Save impedance history; magnitude and phase are always included, equivalent R and C on request
+    int columns = ImpedanceExporter::ChannelColumn | ImpedanceExporter::TimeColumn | ImpedanceExporter::MagnitudeColumn | ImpedanceExporter::PhaseColumn;
+    if (QMessageBox::question(this, tr("Save Impedance History"), tr("Include series RC equivalent R and C columns?"),
+                              QMessageBox::Yes | QMessageBox::No, QMessageBox::No) == QMessageBox::Yes)
+        columns |= ImpedanceExporter::ResistanceColumn | ImpedanceExporter::CapacitanceColumn;
+    dataProcessor->save_impedance_history(fileName, columns);
+}
+
+
+/* Save every channel's pulses to a .csv or .tsv file */
+void MainWindow::savePulseLog()
+{
+    //Get filename
+    QString fileName = QFileDialog::getSaveFileName(this,
+                                                    tr("Save Pulse Log As"), ".",
+                                                    tr("Comma Separated Values File (*.csv);;Tab Separated Values File (*.tsv)"));
+
+    //If user canceled the save operation, return
+    if (fileName.length() == 0)
+        return;
+
+    dataProcessor->save_pulse_log(fileName);
+}
+
+
+/* Save every channel's impedance and pulse history to a .eps session file */
+void MainWindow::saveSession()
+{
+    //Get filename
+    QString fileName = QFileDialog::getSaveFileName(this,
+                                                    tr("Save Session As"), ".",
+                                                    tr("Electroplating Session File (*.eps)"));
+
+    //If user canceled the save operation, return
+    if (fileName.length() == 0)
+        return;
+
+    dataProcessor->save_session(fileName);
+}
+
+
+/* Replace every channel's impedance and pulse history with the contents of a .eps session file */
+void MainWindow::loadSession()
+{
+    //Get filename
+    QString fileName = QFileDialog::getOpenFileName(this,
+                                                    tr("Select Session File"), ".",
+                                                    tr("Electroplating Session File (*.eps)"));
+
+    //If user canceled the load operation, return
+    if (fileName.isEmpty())
+        return;
+
+    dataProcessor->load_session(fileName);
+    redrawImpedance();
+}
+
+
+/* Start or stop capturing the raw samples behind every impedance measurement to a .rhi file */
+void MainWindow::captureImpedanceWaveforms(bool capture)
+{
+    if (!capture) {
+        if (!boardControl->impedanceCapture)
+            return;
+        QString summary = tr("Captured %1 measurement windows.").arg(boardControl->impedanceCapture->windowsCaptured());
+        if (boardControl->impedanceCapture->windowsDropped() > 0)
+            summary += tr(" %1 were skipped to keep capturing from slowing measurements down.").arg(boardControl->impedanceCapture->windowsDropped());
+        try {
+            boardControl->impedanceCapture->close();
+        }
+        catch (std::exception &e) {
+            QMessageBox::critical(this, tr("Cannot Save Impedance Waveforms"), tr("Cannot write capture file: ") + e.what());
+        }
+        boardControl->impedanceCapture.reset();
+        QMessageBox::information(this, tr("Impedance Waveforms Captured"), summary);
+        return;
+    }
+
+    //Get filename
+    QString fileName = QFileDialog::getSaveFileName(this,
+                                                    tr("Capture Impedance Waveforms As"), ".",
+                                                    tr("Intan Impedance Capture File (*.rhi)"));
+
+    //If user canceled, leave capturing off
+    if (fileName.length() == 0) {
+        captureImpedanceWaveformsAction->setChecked(false);
+        return;
+    }
+
+    std::unique_ptr<ImpedanceCaptureWriter> writer(new ImpedanceCaptureWriter());
+    try {
+        writer->open(toFileName(fileName.toStdWString()), *boardControl->saveList);
+        writer->writeHeader(boardControl->header);
+    }
+    catch (std::exception &e) {
+        QMessageBox::critical(this, tr("Cannot Save Impedance Waveforms"), tr("Cannot write capture file: ") + e.what());
+        captureImpedanceWaveformsAction->setChecked(false);
+        return;
+    }
+    boardControl->impedanceCapture = std::move(writer);
+}
+
+
 /* Open Intan's website in the user's default internet browser */
 void MainWindow::openIntanWebsite()
 {
@@ -650,10 +822,13 @@ void MainWindow::manualApplySlot()
     manualProgress->setValue(0);
 
     //Clear this channel's history
-    dataProcessor->Electrodes[selectedChannelSpinBox->value()]->reset_time();
+    dataProcessor->reset_time(selectedChannelSpinBox->value());
+
+    //Pulse programs are resolved afresh for each run
+    ebc->clearPulseProgramCache();
 
-    //Measure before pulsing
-    readImpedance(selectedChannelSpinBox->value(), manualProgress);
+    //Measure before pulsing (reusing a recent enough reading, if there's been no pulse since)
+    readImpedance(selectedChannelSpinBox->value(), manualProgress, false, false, globalParameters->impedanceCacheMaxAge);
 
     //Delay before pulsing
     manualProgress->setLabelText("Delaying Before Pulse");
@@ -677,7 +852,7 @@ void MainWindow::manualApplySlot()
     manualProgress->setLabelText("Measuring Post-Pulse Impedance");
     manualProgress->setValue(4);
     QApplication::processEvents();
-    readImpedance(selectedChannelSpinBox->value(), manualProgress);
+    readImpedance(selectedChannelSpinBox->value(), manualProgress, true);
 
     //Delete progress dialog
     delete manualProgress;
@@ -734,8 +909,31 @@ void MainWindow::automaticRunSlot()
         automaticProgress->setMaximum(channelEnd - channelStart);
     }
 
+    //Pulse programs are resolved afresh for each run
+    ebc->clearPulseProgramCache();
+
+    //Screen the channels first, so we don't waste pulses on electrodes that can never reach the target
+    bool screened = false;
+    if (globalParameters->screenBeforePlating) {
+        automaticProgress->setLabelText("Screening Electrodes");
+        QApplication::processEvents();
+        screened = screenElectrodes(channelStart, channelEnd, automaticProgress);
+        if (!screened && !automaticProgress->wasCanceled())
+            qDebug() << "Screening failed; plating every channel without skipping any";
+    }
+
     //Plate the appropriate channels
     for (int i = channelStart; i < channelEnd; i++) {
+        if (automaticProgress->wasCanceled())
+            break;
+
+        //Skip electrodes that failed screening
+        if (screened &&
+                (dataProcessor->Electrodes[i]->Status == ElectrodeOpen || dataProcessor->Electrodes[i]->Status == ElectrodeShort)) {
+            qDebug() << "Skipping channel" << i << "-" << dataProcessor->Electrodes[i]->StatusReason;
+            continue;
+        }
+
         //Update progress dialog
         automaticProgress->setLabelText("Plating Channel " + QString::number(i) + " Automatically");
         automaticProgress->setValue(i - channelStart);
@@ -802,7 +1000,7 @@ void MainWindow::readAllImpedancesSlot()
         }
 
         //Clear the history for the electrode and measure it.
-        dataProcessor->Electrodes[i]->reset_time();
+        dataProcessor->reset_time(i);
         readImpedance(i, readAllProgress);
 
         //Update the display
@@ -852,7 +1050,7 @@ void MainWindow::continuousZScanSlot()
     continuousProgress->setValue(0);
 
     //Reset the history
-    dataProcessor->Electrodes[selectedChannelSpinBox->value()]->reset_time();
+    dataProcessor->reset_time(selectedChannelSpinBox->value());
 
     while (true) {
         //Update progress dialog
@@ -990,6 +1188,8 @@ void MainWindow::scanPort()
 
     // Configure SignalProcessor object for the required number of data streams
     signalProcessor->allocateMemory(boardControl->evalBoard->getNumEnabledDataStreams());
+    //Plating only ever looks at amplifier channels, so don't decode anything else
+    signalProcessor->setDecodedSignals(SignalProcessor::DecodeAmplifier);
 }
 
 
@@ -1035,6 +1235,15 @@ void MainWindow::initializeParams()
     globalParameters->channels063Present = true;
     globalParameters->channels64127Present = true;
     globalParameters->useTargetZ = true;
+    globalParameters->monitorPulses = false;
+    globalParameters->chargeLimit = 0;
+    globalParameters->voltageLimit = 0;
+    globalParameters->monitorAdcChannel = 0;
+    globalParameters->screenBeforePlating = false;
+    globalParameters->screenMinMagnitude = 10e3;
+    globalParameters->screenMaxMagnitude = 10e6;
+    globalParameters->screenMinPhase = -85;
+    globalParameters->impedanceCacheMaxAge = 30;
 }
 
 
@@ -1061,6 +1270,15 @@ void MainWindow::initializeSettings()
     settings->channels0to63 = true;
     settings->channels64to127 = true;
     settings->useTargetImpedance = true;
+    settings->monitorPulses = false;
+    settings->chargeLimit = 0;
+    settings->voltageLimit = 0;
+    settings->monitorAdcChannel = 0;
+    settings->screenBeforePlating = false;
+    settings->screenMinMagnitude = 10e3;
+    settings->screenMaxMagnitude = 10e6;
+    settings->screenMinPhase = -85;
+    settings->impedanceCacheMaxAge = 30;
 
     settings->selected = 0;
     settings->displayMagnitudes = true;
@@ -1079,12 +1297,12 @@ void MainWindow::redrawImpedance()
     //display the current impedance as text
     QString str = "";
 
-    OneElectrode *electrode = dataProcessor->Electrodes[selectedChannelSpinBox->value()];
-    if (electrode->ImpedanceHistory.size() == 0)
+    int selected = selectedChannelSpinBox->value();
+    if (!dataProcessor->History->hasMeasurement(selected))
         selectedChannelSpinBoxLabel->setText("N/A");
     else {
         if (magnitudeButton->isChecked()) {
-            double z = std::abs(electrode->get_current_impedance());
+            double z = std::abs(dataProcessor->History->latestImpedance(selected));
             if (z < 1000)
                 str = QString::number(significantRound(z)) + " Ohms";
             else if (z < 1e6)
@@ -1093,7 +1311,7 @@ void MainWindow::redrawImpedance()
                 str = QString::number(significantRound(z / 1e6)) + " MOhms";
         }
         else {
-            double theta = std::arg(electrode->get_current_impedance());
+            double theta = std::arg(dataProcessor->History->latestImpedance(selected));
             str = QString::number(significantRound(theta * RADIANS_TO_DEGREES)) + " degrees";
         }
         selectedChannelSpinBoxLabel->setText(str);
@@ -1172,26 +1390,27 @@ void MainWindow::drawAllImpedances()
 void MainWindow::drawImpedanceHistory()
 {
     //Set x axis scale
-    OneElectrode *electrode = new OneElectrode;
-    electrode = dataProcessor->Electrodes[selectedChannelSpinBox->value()];
-    if (electrode->MeasurementTimes.size() == 0 || electrode->MeasurementTimes.last() < 1) {
+    ElectrodeHistory::MeasurementView measurements = dataProcessor->History->measurements(selectedChannelSpinBox->value());
+    ElectrodeHistory::PulseView pulses = dataProcessor->History->pulses(selectedChannelSpinBox->value());
+    if (measurements.isEmpty() || measurements.lastTime() < 1) {
         Zhistory->setDomain(true, 1);
     }
     else {
-        Zhistory->setDomain(true, electrode->MeasurementTimes.last());
+        Zhistory->setDomain(true, measurements.lastTime());
     }
 
     //Set y axis scale
     //If this channel has no impedances stored, just show the default scaling
-    if (electrode->ImpedanceHistory.size() == 0) {
+    if (measurements.isEmpty()) {
         Zhistory->setRange(false);
     }
     //If this channel does have impedances stored, find the minimum y value, convert it to the lowest exponent, and set the range to that.
     else {
-        double ymin = std::abs(electrode->ImpedanceHistory.first());
-        for (int i = 0; i < electrode->ImpedanceHistory.size(); i++) {
-            if ((std::abs(electrode->ImpedanceHistory.at(i)) < ymin) && (std::abs(electrode->ImpedanceHistory.at(i)) > 1))
-                ymin = std::abs(electrode->ImpedanceHistory.at(i));
+        double ymin = std::abs(measurements.impedanceAt(0));
+        for (int i = 0; i < measurements.size(); i++) {
+            double z = std::abs(measurements.impedanceAt(i));
+            if ((z < ymin) && (z > 1))
+                ymin = z;
         }
         if (ymin < 10000) {
             Zhistory->setRange(false, floor(log10(ymin)), 7);
@@ -1202,26 +1421,26 @@ void MainWindow::drawImpedanceHistory()
 
     //Draw green target impedance line
     double targetImpedanceOhms = targetImpedance->text().toDouble() * 1000;
-    if (electrode->MeasurementTimes.size() == 0 || electrode->MeasurementTimes.last() < 1) {
+    if (measurements.isEmpty() || measurements.lastTime() < 1) {
         Zhistory->plotLine(0, targetImpedanceOhms, 1 + 1, targetImpedanceOhms, Qt::green);
     }
     else {
-        Zhistory->plotLine(0, targetImpedanceOhms, electrode->MeasurementTimes.last() + 1, targetImpedanceOhms, Qt::green);
+        Zhistory->plotLine(0, targetImpedanceOhms, measurements.lastTime() + 1, targetImpedanceOhms, Qt::green);
     }
     //Draw each point
-    for (int i = 0; i < electrode->ImpedanceHistory.size(); i++) {
+    for (int i = 0; i < measurements.size(); i++) {
         ClipState state = InRange;
-        if (std::abs(electrode->ImpedanceHistory.at(i)) >= 10000000)
+        if (std::abs(measurements.impedanceAt(i)) >= 10000000)
             state = ClipHigh;
-        Zhistory->plotPoint(electrode->MeasurementTimes.at(i), std::abs(electrode->ImpedanceHistory.at(i)), state, true);
+        Zhistory->plotPoint(measurements.timeAt(i), std::abs(measurements.impedanceAt(i)), state, true);
     }
     //Draw a blue line connecting each point
-    for (int i = 0; i < electrode->ImpedanceHistory.size() - 1; i++) {
-        Zhistory->plotLine(electrode->MeasurementTimes.at(i), std::abs(electrode->ImpedanceHistory.at(i)), electrode->MeasurementTimes.at(i + 1), std::abs(electrode->ImpedanceHistory.at(i + 1)), Qt::blue);
+    for (int i = 0; i < measurements.size() - 1; i++) {
+        Zhistory->plotLine(measurements.timeAt(i), std::abs(measurements.impedanceAt(i)), measurements.timeAt(i + 1), std::abs(measurements.impedanceAt(i + 1)), Qt::blue);
     }
     //Draw red pulse lines
-    for (int i = 0; i < electrode->PulseDurations.size(); i++) {
-        Zhistory->plotLine(electrode->PulseTimes.at(i), 5, electrode->PulseTimes.at(i) + electrode->PulseDurations.at(i), 5, Qt::red);
+    for (int i = 0; i < pulses.size(); i++) {
+        Zhistory->plotLine(pulses.timeAt(i), 5, pulses.timeAt(i) + pulses.durationAt(i), 5, Qt::red);
     }
 
     Zhistory->redrawPlot();
@@ -1256,9 +1475,35 @@ void MainWindow::updateAutomaticLabels()
 }
 
 
-/* Read one impedance */
-void MainWindow::readImpedance(int index, QProgressDialog *progress)
+/* Read one impedance, optionally also checking it and its partner channel on the other stream for bridges to adjacent channels in the same board run (the partner is only logged),
+ * and optionally measuring again (up to MAX_NOISY_REMEASUREMENTS times, keeping the reading with the best SNR) if the reading's SNR is below MIN_MEASUREMENT_SNR.
+ * If 'maxAge' is positive, and the electrode was read within the last 'maxAge' seconds under the same board settings with no pulse since, that reading is
+ * added to its history again instead of measuring (not when checking neighbors, since the cached reading has no coupling check) */
+void MainWindow::readImpedance(int index, QProgressDialog *progress, bool checkNeighbors, bool remeasureNoisy, double maxAge)
 {
+    int datasource = index / 64;
+    int channel = index % 64;
+
+    bool okay_to_read;
+    if (datasource == 0)
+        okay_to_read = globalParameters->channels063Present;
+    else
+        okay_to_read = globalParameters->channels64127Present;
+
+    //A noisy reading isn't reused if a fresh one would be measured again until it's clean
+    std::complex<double> cachedImpedance;
+    SignalQuality cachedQuality;
+    double minSnr = remeasureNoisy ? MIN_MEASUREMENT_SNR : -HUGE_VAL;
+    if (okay_to_read && !checkNeighbors && maxAge > 0 &&
+            dataProcessor->Cache->lookup(index, maxAge, minSnr, currentImpedanceConditions(), cachedImpedance, cachedQuality)) {
+        qDebug() << "Channel" << index << "reusing impedance read" << dataProcessor->Cache->age(index) << "s ago (cache hit rate"
+                 << dataProcessor->Cache->hits() << "/" << dataProcessor->Cache->lookups() << ")";
+        addMeasurement(index, cachedImpedance);
+        dataProcessor->Electrodes[index]->Quality = cachedQuality;
+        redrawImpedance();
+        return;
+    }
+
     bool enabled[] = {true, true, false, false, false, false, false, false};
 
     boardControl->dataStreams.configureDataStreams(enabled);
@@ -1274,25 +1519,93 @@ void MainWindow::readImpedance(int index, QProgressDialog *progress)
     }
 
     firstRead = false;
+    impedanceMeasureController->setSensorStorage(&signalProcessor->temperature);
+
+    //Only a reading that was actually taken can be noisy; one that wasn't (e.g., canceled) isn't measured again
+    int remeasurements = remeasureNoisy ? MAX_NOISY_REMEASUREMENTS : 0;
+
+    if (okay_to_read && checkNeighbors) {
+        PairedImpedanceMeasurement paired = impedanceMeasureController->measurePairedImpedances(channel);
+        for (int i = 0; i < remeasurements && paired.qualities[datasource].valid && paired.qualities[datasource].snr < MIN_MEASUREMENT_SNR && !progress->wasCanceled(); i++) {
+            qDebug() << "Channel" << index << "reading is noisy (SNR" << paired.qualities[datasource].snr << "dB); measuring again";
+            PairedImpedanceMeasurement again = impedanceMeasureController->measurePairedImpedances(channel);
+            if (again.qualities[datasource].valid && again.qualities[datasource].snr > paired.qualities[datasource].snr)
+                paired = again;
+        }
+        addMeasurement(index, paired.impedances[datasource]);
+        dataProcessor->Electrodes[index]->CouplingRatio = paired.couplingRatios[datasource];
+        dataProcessor->Electrodes[index]->Quality = paired.qualities[datasource];
+        if (paired.qualities[datasource].valid) //A canceled or failed reading is never reused
+            dataProcessor->Cache->store(index, paired.impedances[datasource], paired.qualities[datasource], currentImpedanceConditions());
+        if (paired.couplingRatios[datasource] > BRIDGE_COUPLING_THRESHOLD)
+            qDebug() << "Channel" << index << "appears to be bridged to an adjacent channel (coupling ratio" << paired.couplingRatios[datasource] << ")";
+
+        //The partner channel on the other stream was measured in the same run, but only for the bridge check; it isn't
+        //added to the partner's history (nobody asked to measure that electrode)
+        int partnerSource = 1 - datasource;
+        bool partnerPresent = (partnerSource == 0) ? globalParameters->channels063Present : globalParameters->channels64127Present;
+        if (partnerPresent && paired.qualities[partnerSource].valid) {
+            int partnerIndex = partnerSource * 64 + channel;
+            qDebug() << "Partner channel" << partnerIndex << "read" << std::abs(paired.impedances[partnerSource]) << "Ohms at"
+                     << std::arg(paired.impedances[partnerSource]) * RADIANS_TO_DEGREES << "degrees (coupling ratio" << paired.couplingRatios[partnerSource] << ")";
+            if (paired.couplingRatios[partnerSource] > BRIDGE_COUPLING_THRESHOLD)
+                qDebug() << "Channel" << partnerIndex << "appears to be bridged to an adjacent channel (coupling ratio" << paired.couplingRatios[partnerSource] << ")";
+        }
+    }
 
-    int datasource = index / 64;
-    int channel = index % 64;
+    else if (okay_to_read) {
+        SignalQuality quality;
+        std::complex<double> impedance = impedanceMeasureController->measureOneImpedance((Rhd2000EvalBoard::BoardDataSource)datasource, channel, &quality);
+        for (int i = 0; i < remeasurements && quality.valid && quality.snr < MIN_MEASUREMENT_SNR && !progress->wasCanceled(); i++) {
+            qDebug() << "Channel" << index << "reading is noisy (SNR" << quality.snr << "dB); measuring again";
+            SignalQuality againQuality;
+            std::complex<double> again = impedanceMeasureController->measureOneImpedance((Rhd2000EvalBoard::BoardDataSource)datasource, channel, &againQuality);
+            if (againQuality.valid && againQuality.snr > quality.snr) {
+                impedance = again;
+                quality = againQuality;
+            }
+        }
+        addMeasurement(index, impedance);
+        dataProcessor->Electrodes[index]->Quality = quality;
+        if (quality.valid) //A canceled or failed reading is never reused
+            dataProcessor->Cache->store(index, impedance, quality, currentImpedanceConditions());
+    }
 
-    bool okay_to_read;
-    if (datasource == 0)
-        okay_to_read = globalParameters->channels063Present;
     else
-        okay_to_read = globalParameters->channels64127Present;
+        dataProcessor->reset_time(index);
+
+    redrawImpedance();
+}
 
-    if (okay_to_read) {
-        std::complex<double> impedance = impedanceMeasureController->measureOneImpedance((Rhd2000EvalBoard::BoardDataSource)datasource, channel);
-        dataProcessor->Electrodes[index]->add_measurement(impedance);
-    }
 
+/* Add an impedance reading to electrode 'index''s history, journaling it with the headstage temperature and supply voltage trends of its chip
+ * (fed by every impedance measurement; see ImpedanceMeasureController::setSensorStorage) */
+void MainWindow::addMeasurement(int index, std::complex<double> impedance)
+{
+    //The temperature sensor is per chip, and read on the chip's first data stream
+    Rhd2000Config::DataStreamConfig *stream = boardControl->dataStreams.physicalDataStreams[index / 64].firstDataStream;
+    TemperatureStorage &sensors = signalProcessor->temperature;
+    if (stream != nullptr && (int) stream->index < sensors.numStreams() && sensors.temperatureTrend(stream->index).length > 0) {
+        SensorTrend temperature = sensors.temperatureTrend(stream->index);
+        SensorTrend supplyVoltage = sensors.supplyVoltageTrend(stream->index);
+        dataProcessor->add_measurement(index, impedance, &temperature, &supplyVoltage);
+    }
     else
-        dataProcessor->Electrodes[index]->reset_time();
+        dataProcessor->add_measurement(index, impedance);
+}
 
-    redrawImpedance();
+
+/* Board settings that impedance readings currently depend on (a cached reading taken under different ones isn't reused) */
+ImpedanceConditions MainWindow::currentImpedanceConditions()
+{
+    ImpedanceConditions conditions;
+    conditions.sampleRate = boardControl->boardSampleRate;
+    conditions.testFrequency = boardControl->impedance.actualImpedanceFreq;
+    conditions.lowerBandwidth = boardControl->bandWidth.actualLowerBandwidth;
+    conditions.upperBandwidth = boardControl->bandWidth.actualUpperBandwidth;
+    conditions.dspCutoffFreq = boardControl->bandWidth.actualDspCutoffFreq;
+    conditions.dspEnabled = boardControl->bandWidth.dspEnabled;
+    return conditions;
 }
 
 
@@ -1300,80 +1613,130 @@ void MainWindow::readImpedance(int index, QProgressDialog *progress)
 void MainWindow::pulse(int selected, ElectroplatingMode mode, double value, double duration)
 {
     //Record that we are pulsing
-    dataProcessor->Electrodes[selected]->add_pulse(duration);
+    dataProcessor->add_pulse(selected, duration);
 
-    //Figure out settings
-    if (mode == ConstantVoltage) {
-        ebc->setVoltage(value);
-        boardControl->analogOutputs.setDacManualVolts(ebc->getDacManualActual());
-    }
-    else {
-        ebc->setCurrent(value/1e9);
-        boardControl->analogOutputs.setDacManualVolts(ebc->getDacManualActual());
-    }
+    //Figure out settings (resolved once per (mode, value, channel), then reused for every pulse)
+    const PulseProgram &program = ebc->compilePulseProgram(mode, value, selected);
+    boardControl->analogOutputs.setDacManualVolts(program.dacManualVolts);
 
     //Plating below. Note that we set up the chip first, set the digital outputs, pulse, set the digital
     //outputs to turn plating off, set the chip. IN THAT ORDER. Settings digital outputs is instantaneous,
     //sending information to the board takes time.
 
     //Start plating
-    ebc->setPlatingChannel(selected);
     boardControl->updateAnalogOutputSource(0);
     boardControl->updateDACManual();
-    boardControl->beginPlating(ebc->effectiveChannel);
-    bool out[16];
-    ebc->getDigitalOutputs(out);
-    bool wait = setRefDigitalOutput(out);
-    boardControl->updateDigitalOutputs();
-    if (wait)
+    boardControl->beginPlating(program.effectiveChannel);
+    if (referenceChanges(program.platingOutputs)) {
+        setRefDigitalOutput(program.platingOutputs);
+        boardControl->updateDigitalOutputs();
         sleep(globalParameters->delayChangeRef * 1000);
 
-    ebc->getDigitalOutputs(out);
-    setNonrefDigitalValues(out);
-    boardControl->updateDigitalOutputs();
+        setNonrefDigitalValues(program.platingOutputs);
+        boardControl->updateDigitalOutputs();
+    }
+    else
+        setAllDigitalOutputs(program.platingOutputs);
 
-    //Plate for the given duration
-    sleep(duration * 1000);
+    //Plate for the given duration (or until a monitoring limit is reached)
+    if (globalParameters->monitorPulses)
+        monitorPulse(program, selected, duration);
+    else
+        sleep(duration * 1000);
 
     //Stop plating
-    ebc->setZCheckChannel(selected);
+    if (referenceChanges(program.zCheckOutputs)) {
+        setNonrefDigitalValues(program.zCheckOutputs);
+        boardControl->updateDigitalOutputs();
 
-    ebc->getDigitalOutputs(out);
-    setNonrefDigitalValues(out);
-    boardControl->updateDigitalOutputs();
+        setRefDigitalOutput(program.zCheckOutputs);
+        boardControl->updateDigitalOutputs();
+    }
+    else
+        setAllDigitalOutputs(program.zCheckOutputs);
+
+    //Leave DacManual at 0 V or 0 current (REF_SEL is always low in zcheck mode)
+    boardControl->evalBoard->setDacManual(0);
+
+    boardControl->endImpedanceMeasurement();
+}
+
+
+/* Plate while streaming the electrode monitor ADC input, ending early if a charge (constant current only) or voltage limit is reached; returns the actual duration */
+double MainWindow::monitorPulse(const PulseProgram &program, int selected, double duration)
+{
+    int adcChannel = qBound(0, globalParameters->monitorAdcChannel, 7);
+    PulseMonitor monitor(program, boardControl->boardSampleRate, duration,
+                         globalParameters->chargeLimit * 1e-9, globalParameters->voltageLimit);
+
+    //Read one data block at a time, so a limit is acted on within one block (60 samples)
+    unsigned int numUsbBlocksToRead = boardControl->read.numUsbBlocksToRead;
+    boardControl->read.numUsbBlocksToRead = 1;
+    boardControl->flush();
+    boardControl->read.emptyQueue();
+
+    QElapsedTimer timer;
+    timer.start();
+    boardControl->runContinuously();
+
+    while (!monitor.isDone()) {
+        int result = boardControl->readBlocks();
+        if (result < 0) {
+            qDebug() << "Pulse monitoring stopped early: couldn't read from board (" << result << ")";
+            break;
+        }
+
+        while (!boardControl->read.dataQueue.empty() && !monitor.isDone()) {
+            const std::vector<int> &adcData = boardControl->read.dataQueue.front()->boardAdcData[adcChannel];
+            for (unsigned int t = 0; t < adcData.size(); t++) {
+                if (!monitor.addSample(Rhd2000DataBlock::boardADCToVolts(adcData[t])))
+                    break;
+            }
+            boardControl->read.dataQueue.pop_front();
+        }
+
+        //Don't plate indefinitely if data stops arriving
+        if (timer.elapsed() > (duration + 1) * 1000) {
+            qDebug() << "Pulse monitoring stopped early: no data from board";
+            break;
+        }
+        QApplication::processEvents();
+    }
 
-    ebc->getDigitalOutputs(out);
-    setRefDigitalOutput(out);
+    //Switch plating off before stopping and flushing (which take time), so a tripped limit isn't overshot;
+    //pulse() then settles the reference as usual
+    setNonrefDigitalValues(program.zCheckOutputs);
     boardControl->updateDigitalOutputs();
+    boardControl->evalBoard->setDacManual(0);
 
-    //Leave DacManual at 0 V or 0 current
-    if (ebc->getReferenceSelection())
-        boardControl->evalBoard->setDacManual(3.3);
-    else
-        boardControl->evalBoard->setDacManual(0);
+    boardControl->stop();
+    boardControl->flush();
+    boardControl->read.emptyQueue();
+    boardControl->read.numUsbBlocksToRead = numUsbBlocksToRead;
 
-    boardControl->endImpedanceMeasurement();
+    double actualDuration = monitor.isDone() ? monitor.getElapsedTime() : timer.elapsed() / 1000.0;
+    dataProcessor->finish_pulse(selected, actualDuration, monitor.getCharge());
+    if (monitor.getStopReason() == PulseMonitor::ChargeLimitReached || monitor.getStopReason() == PulseMonitor::VoltageLimitReached)
+        qDebug() << "Pulse on channel" << selected << "ended after" << actualDuration << "s:" << monitor.getStopReasonText();
+    return actualDuration;
+}
+
+
+/* Returns true if applying the given digital outputs would change the vref digital output */
+bool MainWindow::referenceChanges(int values)
+{
+    return (boardControl->digitalOutputs.values.changedMask(values) & ElectroplatingBoardControl::ReferenceSelectionMask) != 0;
 }
 
 
 /* Sets the vref digital output; pausing if the reference changes from 0 V to 3.3 V or vice versa */
-bool MainWindow::setRefDigitalOutput(bool values[16])
+bool MainWindow::setRefDigitalOutput(int values)
 {
     bool result = false;
-    bool boolValues[16];
-    for (int i = 0; i < 16; i++) {
-        if (boardControl->digitalOutputs.values[i] == 1)
-            boolValues[i] = true;
-        else
-            boolValues[i] = false;
-    }
     //If REF_sel CHANGES
-    if (boolValues[7] != values[7]) {
+    if (referenceChanges(values)) {
         //Change just that, and let it equilibrate
-        if (values[7] == true)
-            boardControl->digitalOutputs.values[7] = 1;
-        else
-            boardControl->digitalOutputs.values[7] = 0;
+        boardControl->digitalOutputs.values.toggleMask(ElectroplatingBoardControl::ReferenceSelectionMask);
         sleep(globalParameters->delayChangeRef * 1000);
         result = true;
     }
@@ -1382,22 +1745,73 @@ bool MainWindow::setRefDigitalOutput(bool values[16])
 
 
 /* Sets the digital outputs, excluding the reference voltage */
-void MainWindow::setNonrefDigitalValues(bool values[16])
+void MainWindow::setNonrefDigitalValues(int values)
+{
+    boardControl->digitalOutputs.values.assign(values, ~ElectroplatingBoardControl::ReferenceSelectionMask);
+}
+
+
+/* Sets all digital outputs, including the reference voltage, and sends them to the board in a single write (only valid when the reference doesn't need to settle) */
+void MainWindow::setAllDigitalOutputs(int values)
 {
-    bool tmp[16];
-    for (int i = 0; i < 16; i++) {
-        tmp[i] = values[i];
+    boardControl->digitalOutputs.values.assign(values);
+    boardControl->updateDigitalOutputs();
+}
+
+
+/* Classify channels channelStart..channelEnd-1 as good, open, or short from one impedance reading each, with all channels read together; returns false (leaving them Unscreened) if the readings couldn't be taken */
+bool MainWindow::screenElectrodes(int channelStart, int channelEnd, QProgressDialog *progress)
+{
+    //Forget the results of any earlier screening (e.g., of a different array), so a failed screen leaves nothing stale behind
+    for (int i = channelStart; i < channelEnd; i++) {
+        dataProcessor->Electrodes[i]->Status = Unscreened;
+        dataProcessor->Electrodes[i]->StatusReason = "Not screened";
     }
-    if (boardControl->digitalOutputs.values[7] == 1)
-        tmp[7] = true;
-    else
-        tmp[7] = false;
-    for (int i = 0; i < 16; i++) {
-        if (tmp[i])
-            boardControl->digitalOutputs.values[i] = 1;
-        else
-            boardControl->digitalOutputs.values[i] = 0;
+
+    bool enabled[] = {true, true, false, false, false, false, false, false};
+
+    boardControl->dataStreams.configureDataStreams(enabled);
+    boardControl->updateDataStreams();
+
+    QtProgressWrapper progressWrapper(*progress);
+    ImpedanceMeasureController impedanceMeasureController(*boardControl, progressWrapper, nullptr, !firstRead);
+    firstRead = false;
+    impedanceMeasureController.setSensorStorage(&signalProcessor->temperature);
+
+    //One run per channel index and capacitor measures both data sources at once; each reading comes from the capacitor
+    //whose range it falls in, so that shorts are as distinguishable as opens
+    std::vector<std::vector<std::complex<double> > > impedances;
+    bool good = impedanceMeasureController.screenImpedances(impedances);
+
+    //Reading impedances this way leaves the LEDs on, so turn them off
+    int ledArray[8] = {0,0,0,0,0,0,0,0};
+    boardControl->evalBoard->setLedDisplay(ledArray);
+
+    if (!good)
+        return false;
+
+    int numOpen = 0;
+    int numShort = 0;
+    for (int i = channelStart; i < channelEnd; i++) {
+        int datasource = i / 64;
+        int channel = i % 64;
+        bool present = (datasource == 0) ? globalParameters->channels063Present : globalParameters->channels64127Present;
+        if (!present || channel >= (int) impedances[datasource].size()) {
+            dataProcessor->Electrodes[i]->Status = Unscreened;
+            dataProcessor->Electrodes[i]->StatusReason = "Not present";
+            continue;
+        }
+
+        dataProcessor->screen_electrode(i, impedances[datasource][channel], globalParameters->screenMinMagnitude,
+                                        globalParameters->screenMaxMagnitude, globalParameters->screenMinPhase);
+        if (dataProcessor->Electrodes[i]->Status == ElectrodeOpen)
+            numOpen++;
+        else if (dataProcessor->Electrodes[i]->Status == ElectrodeShort)
+            numShort++;
     }
+    qDebug() << "Screening found" << numOpen << "open and" << numShort << "shorted electrodes";
+
+    return true;
 }
 
 
@@ -1409,9 +1823,10 @@ void MainWindow::plateOneAutomatically(int index, QProgressDialog *progress)
     //Don't want people hitting other buttons while plating
     setAllEnabled(false);
 
-    //Clear history for the given electrode, and take a reading before we start
-    dataProcessor->Electrodes[index]->reset_time();
-    readImpedance(index, progress);
+    //Clear history for the given electrode, and take a reading before we start (reusing a recent enough reading, e.g. from
+    //reading all impedances, if there's been no pulse since)
+    dataProcessor->reset_time(index);
+    readImpedance(index, progress, false, true, globalParameters->impedanceCacheMaxAge);
 
     //Make sure at start that target impedance hasn't already been reached
     if (globalParameters->useTargetZ) {
@@ -1471,9 +1886,10 @@ void MainWindow::plateOneAutomatically(int index, QProgressDialog *progress)
         if (progress->wasCanceled())
             break;
 
-        //Measure
+        //Measure (checking the channel's neighbors for bridges in the same run, and measuring again if the reading is noisy,
+        //so that a noisy outlier doesn't end plating early)
         QApplication::processEvents();
-        readImpedance(index, progress);
+        readImpedance(index, progress, true, true);
         QApplication::processEvents();
 
         //Refresh figure...
@@ -1493,6 +1909,10 @@ bool MainWindow::keepGoing(int count, int index)
         //Hit the maximum number of pulses; time to stop
         return false;
     }
+    else if (dataProcessor->Electrodes[index]->CouplingRatio > BRIDGE_COUPLING_THRESHOLD) {
+        //Plating has bridged this electrode to a neighbor; more plating will only make it worse
+        return false;
+    }
     else {
         if (globalParameters->useTargetZ) {
             //Keep going as long as the impedance is above the target
@@ -26,6 +26,8 @@ class QLineEdit;
 class BoardControl;
 class ElectroplatingBoardControl;
 class SignalSources;
+struct PulseProgram;
+struct ImpedanceConditions;
 
 class MainWindow : public QMainWindow
 {
@@ -43,6 +45,11 @@ private slots:
     void saveSettings(); //Save settings to .set file
     void loadSettings(); //Load settings from a .set file
     void saveImpedances(); //Save impedances to a .csv file
+    void saveImpedanceHistory(); //Save every channel's impedance history to a .csv or .tsv file
+    void savePulseLog(); //Save every channel's pulses to a .csv or .tsv file
+    void saveSession(); //Save every channel's impedance and pulse history to a .eps session file
+    void loadSession(); //Replace every channel's impedance and pulse history with the contents of a .eps session file
+    void captureImpedanceWaveforms(bool capture); //Start or stop capturing the raw samples behind every impedance measurement to a .rhi file
     void openIntanWebsite(); //Open Intan's website in the user's default internet browser
     void about(); //Pop up dialog displaying information about this program
     void manualConfigureSlot(); //Open a new Configuration Window, and pass it manualParameters to save (if OK is clicked)
@@ -70,10 +77,16 @@ private:
     void drawImpedanceHistory(); //Draw "Zhistory" impedances plot
     void updateManualLabels(); //Update mainwindow's labels when Manual values are changed
     void updateAutomaticLabels(); //Update mainwindow's labels when Automatic values are changed
-    void readImpedance(int index, QProgressDialog *progress); //Read one impedance
+    void readImpedance(int index, QProgressDialog *progress, bool checkNeighbors = false, bool remeasureNoisy = false, double maxAge = 0); //Read one impedance, optionally also checking it and its partner channel on the other stream for bridges to adjacent channels in the same board run (the partner is only logged), optionally measuring again if the reading's SNR is low, and optionally reusing a cached reading up to 'maxAge' seconds old
+    ImpedanceConditions currentImpedanceConditions(); //Board settings that impedance readings currently depend on
+    void addMeasurement(int index, std::complex<double> impedance); //Add an impedance reading to electrode 'index''s history, journaling it with the headstage temperature and supply voltage trends of its chip
     void pulse(int selected, ElectroplatingMode mode, double value, double duration); //Pulse either current or voltage (depending on mode), on the "selected" channel, with the "value" magnitude, for "duration" seconds
-    bool setRefDigitalOutput(bool values[16]); //Sets the vref digital output; pausing if the reference changes from 0 V to 3.3 V or vice versa
-    void setNonrefDigitalValues(bool values[16]); //Sets the digital outputs, excluding the reference voltage
+    double monitorPulse(const PulseProgram &program, int selected, double duration); //Plate while streaming the electrode monitor ADC input, ending early if a charge (constant current only) or voltage limit is reached; returns the actual duration
+    bool referenceChanges(int values); //Returns true if applying the given digital outputs (packed into a bitmask) would change the vref digital output
+    bool setRefDigitalOutput(int values); //Sets the vref digital output; pausing if the reference changes from 0 V to 3.3 V or vice versa
+    void setNonrefDigitalValues(int values); //Sets the digital outputs, excluding the reference voltage
+    void setAllDigitalOutputs(int values); //Sets all digital outputs in a single board write; only used when the reference doesn't change
+    bool screenElectrodes(int channelStart, int channelEnd, QProgressDialog *progress); //Classify channels channelStart..channelEnd-1 as good, open, or short from one impedance reading each, with all channels read together; returns false (leaving them Unscreened) if the readings couldn't be taken
     void plateOneAutomatically(int index, QProgressDialog *progress); //Plate one channel automatically, with a maximum number of loops 'maxPulses'
     bool keepGoing(int count, int index); //Helper function used to determine if we should keep looping
     void setAllEnabled(bool enabled); //Enable or disable all user-interactable widgets
@@ -139,6 +152,11 @@ private:
     QAction *saveSettingsAction;
     QAction *loadSettingsAction;
     QAction *saveImpedancesAction;
+    QAction *saveImpedanceHistoryAction;
+    QAction *savePulseLogAction;
+    QAction *saveSessionAction;
+    QAction *loadSessionAction;
+    QAction *captureImpedanceWaveformsAction;
     QAction *intanWebsiteAction;
     QAction *aboutAction;
 
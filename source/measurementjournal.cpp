@@ -0,0 +1,270 @@
+#include "measurementjournal.h"
+
+#include <QtCore>
+#include <QtEndian>
+#include <QDateTime>
+#include <string.h>
+
+#if defined WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+#define JOURNAL_FILE_MAGIC_NUMBER  0x2d5e71a3
+#define JOURNAL_FILE_VERSION_NUMBER  1
+
+
+/* Constructor */
+MeasurementJournal::MeasurementJournal(int interval)
+{
+    commitInterval = interval;
+    appended = 0;
+    committed = 0;
+    stopping = false;
+}
+
+
+/* Destructor; commits everything still pending and closes the file cleanly */
+MeasurementJournal::~MeasurementJournal()
+{
+    close();
+}
+
+
+/* Public - Start a new journal in 'filename' (truncating it), and start the writer thread */
+bool MeasurementJournal::open(const QString &filename)
+{
+    close();
+
+    file.setFileName(filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "Cannot open measurement journal" << filename << "for writing";
+        return false;
+    }
+
+    //Write header: magic number, version, record size, reserved
+    char header[HeaderSize];
+    memset(header, 0, sizeof(header));
+    qToLittleEndian<quint32>(JOURNAL_FILE_MAGIC_NUMBER, (uchar*) header);
+    qToLittleEndian<quint16>(JOURNAL_FILE_VERSION_NUMBER, (uchar*) header + 4);
+    qToLittleEndian<quint32>(RecordSize, (uchar*) header + 8);
+    file.write(header, sizeof(header));
+    file.flush();
+    syncFile();
+
+    pending.clear();
+    pending.reserve(256 * RecordSize);
+    appended = 0;
+    committed = 0;
+    stopping = false;
+    writer = std::thread(&MeasurementJournal::writerLoop, this);
+    return true;
+}
+
+
+/* Public - Commit everything still pending, record a clean shutdown, and close the file */
+void MeasurementJournal::close()
+{
+    if (!writer.joinable())
+        return;
+
+    append(CleanShutdownRecord, 0);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    pendingChanged.notify_all();
+    writer.join();
+    file.close();
+}
+
+
+/* Public - Returns true if the journal is open */
+bool MeasurementJournal::isOpen() const
+{
+    return writer.joinable();
+}
+
+
+/* Public - Record that a channel's history was cleared */
+void MeasurementJournal::appendReset(int channel)
+{
+    append(ResetRecord, channel);
+}
+
+
+/* Public - Record an impedance measurement */
+void MeasurementJournal::appendMeasurement(int channel, double time, std::complex<double> impedance)
+{
+    append(MeasurementRecord, channel, time, impedance.real(), impedance.imag());
+}
+
+
+/* Public - Record the headstage sensor trends of a channel's most recent measurement */
+void MeasurementJournal::appendSensorTrend(int channel, double temperature, double temperatureSlope, double supplyVoltage, double supplyVoltageSlope)
+{
+    append(SensorTrendRecord, channel, temperature, temperatureSlope, supplyVoltage, supplyVoltageSlope);
+}
+
+
+/* Public - Record a pulse */
+void MeasurementJournal::appendPulse(int channel, double time, double duration)
+{
+    append(PulseRecord, channel, time, duration);
+}
+
+
+/* Public - Record the actual duration and charge of a channel's most recent pulse */
+void MeasurementJournal::appendPulseResult(int channel, double duration, double charge)
+{
+    append(PulseResultRecord, channel, duration, charge);
+}
+
+
+/* Public - Block until every record appended so far has been written and synced */
+void MeasurementJournal::commit()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    qint64 target = appended;
+    commitDone.wait(lock, [this, target] { return committed >= target || !writer.joinable(); });
+}
+
+
+/* Public - Read every intact record from 'filename'; returns false if it isn't a journal */
+bool MeasurementJournal::read(const QString &filename, QVector<Record> &records, bool &cleanShutdown)
+{
+    records.clear();
+    cleanShutdown = false;
+
+    QFile journalFile(filename);
+    if (!journalFile.open(QIODevice::ReadOnly) || journalFile.size() < HeaderSize)
+        return false;
+
+    //Map the whole file if we can, since recovery touches every byte once
+    qint64 size = journalFile.size();
+    QByteArray contents;
+    const char *data = (const char*) journalFile.map(0, size);
+    if (data == nullptr) {
+        contents = journalFile.readAll();
+        data = contents.constData();
+        size = contents.size();
+    }
+
+    if (qFromLittleEndian<quint32>((const uchar*) data) != JOURNAL_FILE_MAGIC_NUMBER ||
+            qFromLittleEndian<quint32>((const uchar*) data + 8) != (quint32) RecordSize)
+        return false;
+
+    qint64 numRecords = (size - HeaderSize) / RecordSize;
+    records.reserve(numRecords);
+    for (qint64 i = 0; i < numRecords; i++) {
+        const char *record = data + HeaderSize + i * RecordSize;
+        char copy[RecordSize];
+        memcpy(copy, record, RecordSize);
+        memset(copy + 4, 0, 4);
+        quint32 storedChecksum = qFromLittleEndian<quint32>((const uchar*) record + 4);
+        quint32 actualChecksum = checksum(copy, RecordSize);
+        if (storedChecksum != actualChecksum)
+            break; //Torn write from a crash; nothing after this can be trusted
+
+        Record decoded;
+        decoded.type = (RecordType) qFromLittleEndian<quint16>((const uchar*) record);
+        decoded.channel = qFromLittleEndian<quint16>((const uchar*) record + 2);
+        decoded.wallClockTime = qFromLittleEndian<qint64>((const uchar*) record + 8);
+        for (int v = 0; v < 4; v++) {
+            quint64 bits = qFromLittleEndian<quint64>((const uchar*) record + 16 + 8 * v);
+            memcpy(&decoded.value[v], &bits, sizeof(double));
+        }
+        records.append(decoded);
+    }
+
+    cleanShutdown = !records.isEmpty() && records.last().type == CleanShutdownRecord;
+    return true;
+}
+
+
+/* Private - Encode a record into the pending buffer, and wake the writer */
+void MeasurementJournal::append(RecordType type, int channel, double v0, double v1, double v2, double v3)
+{
+    if (!writer.joinable())
+        return;
+
+    char record[RecordSize];
+    qToLittleEndian<quint16>(type, (uchar*) record);
+    qToLittleEndian<quint16>(channel, (uchar*) record + 2);
+    qToLittleEndian<qint64>(QDateTime::currentMSecsSinceEpoch(), (uchar*) record + 8);
+    double values[4] = {v0, v1, v2, v3};
+    for (int v = 0; v < 4; v++) {
+        quint64 bits;
+        memcpy(&bits, &values[v], sizeof(double));
+        qToLittleEndian<quint64>(bits, (uchar*) record + 16 + 8 * v);
+    }
+    memset(record + 4, 0, 4);
+    qToLittleEndian<quint32>(checksum(record, RecordSize), (uchar*) record + 4);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.append(record, RecordSize);
+        appended++;
+    }
+    pendingChanged.notify_one();
+}
+
+
+/* Private - Writer thread: commit pending records in groups until the journal is closed */
+void MeasurementJournal::writerLoop()
+{
+    QByteArray batch;
+    batch.reserve(256 * RecordSize);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        pendingChanged.wait(lock, [this] { return !pending.isEmpty() || stopping; });
+
+        //Group commit: give other records up to commitInterval ms to arrive, so they share one sync
+        if (!stopping)
+            pendingChanged.wait_for(lock, std::chrono::milliseconds(commitInterval), [this] { return stopping; });
+
+        batch.swap(pending);
+        qint64 target = appended;
+        bool finished = stopping;
+        lock.unlock();
+
+        if (!batch.isEmpty()) {
+            if (file.write(batch) != batch.size())
+                qDebug() << "Measurement journal write failed:" << file.errorString();
+            file.flush();
+            syncFile();
+            batch.resize(0);
+        }
+
+        lock.lock();
+        committed = target;
+        commitDone.notify_all();
+        if (finished && pending.isEmpty())
+            break;
+    }
+}
+
+
+/* Private - Force the file's contents to disk */
+void MeasurementJournal::syncFile()
+{
+#if defined WIN32
+    _commit(file.handle());
+#else
+    fsync(file.handle());
+#endif
+}
+
+
+/* Private - FNV-1a checksum */
+quint32 MeasurementJournal::checksum(const char *data, int length)
+{
+    quint32 hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uchar) data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
@@ -0,0 +1,86 @@
+#ifndef MEASUREMENTJOURNAL_H
+#define MEASUREMENTJOURNAL_H
+
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+#include <QVector>
+#include <complex>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/* MeasurementJournal is a class that appends every measurement and pulse event to a binary file as it happens, so that
+ * a session's history survives a crash
+ *
+ * The file is a 16-byte header followed by fixed-size, little-endian, 48-byte records:
+ * quint16 type, quint16 channel, quint32 checksum (FNV-1a of the record, with this field set to 0), qint64 wall clock time (ms since epoch),
+ * double value[4] (meaning depends on the type; see RecordType)
+ *
+ * Appending only copies a record into memory, so it never waits on the disk. A writer thread commits records in groups:
+ * it waits up to commitInterval ms after the first pending record for others to arrive, then writes them all and syncs
+ * the file once. A record is therefore durable at most commitInterval ms (plus one sync) after it is appended.
+ *
+ * Recovery reads records until the end of the file, or until the first record that is incomplete or fails its checksum
+ * (i.e., the one being written when the crash happened). */
+
+class MeasurementJournal
+{
+
+public:
+    /* RecordType: Type of a record, and the meaning of its values */
+    enum RecordType {
+        ResetRecord = 1, //History of 'channel' was cleared (no values)
+        MeasurementRecord = 2, //Impedance measured: value = {time (s), real (ohms), imaginary (ohms), 0}
+        PulseRecord = 3, //Pulse applied: value = {time (s), duration (s), 0, 0}
+        PulseResultRecord = 4, //Most recent pulse finished: value = {actual duration (s), charge (C), 0, 0}
+        CleanShutdownRecord = 5, //Journal was closed normally (no values)
+        SensorTrendRecord = 6 //Headstage sensors when the preceding measurement was taken: value = {temperature (C), its slope (C per data block), supply voltage (V), its slope (V per data block)}
+    };
+
+    /* Record: One decoded journal record */
+    struct Record {
+        RecordType type;
+        int channel;
+        qint64 wallClockTime;
+        double value[4];
+    };
+
+    static const int HeaderSize = 16; //Size of the file header, in bytes
+    static const int RecordSize = 48; //Size of each record, in bytes
+
+    MeasurementJournal(int commitInterval = 100); //Constructor
+    ~MeasurementJournal(); //Destructor; commits everything still pending and closes the file cleanly
+
+    bool open(const QString &filename); //Start a new journal in 'filename' (truncating it), and start the writer thread
+    void close(); //Commit everything still pending, record a clean shutdown, and close the file
+    bool isOpen() const; //Returns true if the journal is open
+
+    void appendReset(int channel); //Record that a channel's history was cleared
+    void appendMeasurement(int channel, double time, std::complex<double> impedance); //Record an impedance measurement
+    void appendSensorTrend(int channel, double temperature, double temperatureSlope, double supplyVoltage, double supplyVoltageSlope); //Record the headstage sensor trends of a channel's most recent measurement
+    void appendPulse(int channel, double time, double duration); //Record a pulse
+    void appendPulseResult(int channel, double duration, double charge); //Record the actual duration and charge of a channel's most recent pulse
+    void commit(); //Block until every record appended so far has been written and synced
+
+    static bool read(const QString &filename, QVector<Record> &records, bool &cleanShutdown); //Read every intact record from 'filename'; returns false if it isn't a journal
+
+private:
+    void append(RecordType type, int channel, double v0 = 0, double v1 = 0, double v2 = 0, double v3 = 0); //Encode a record into the pending buffer, and wake the writer
+    void writerLoop(); //Writer thread: commit pending records in groups until the journal is closed
+    void syncFile(); //Force the file's contents to disk
+    static quint32 checksum(const char *data, int length); //FNV-1a checksum
+
+    int commitInterval; //Maximum time (in ms) a record waits in memory before being committed
+    QFile file; //Journal file, only touched by the writer thread while it is running
+    QByteArray pending; //Records appended but not yet handed to the writer
+    qint64 appended; //Number of records appended so far
+    qint64 committed; //Number of records written and synced so far
+    bool stopping; //Set to make the writer thread commit what's left and exit
+    std::mutex mutex; //Protects pending, appended, committed, stopping
+    std::condition_variable pendingChanged; //Signaled when records are appended, or when stopping
+    std::condition_variable commitDone; //Signaled after each group commit
+    std::thread writer; //Writer thread
+};
+
+#endif // MEASUREMENTJOURNAL_H
@@ -1,6 +1,5 @@
 #include "oneelectrode.h"
 #include <complex>
-#include <QVector>
 #include <QtCore>
 
 
@@ -10,53 +9,39 @@ OneElectrode::OneElectrode()
     elapsedTimer = new QElapsedTimer;
     elapsedTimer->start();
     reset_time();
+    Status = Unscreened;
+    ScreeningImpedance = 0;
 }
 
 
-/* Clears history and sets InitialTime */
-void OneElectrode::reset_time()
+/* Destructor */
+OneElectrode::~OneElectrode()
 {
-    elapsedTimer->restart();
-    InitialTime = elapsedTimer->elapsed();
-
-    ImpedanceHistory.remove(0, ImpedanceHistory.size());
-    MeasurementTimes.remove(0, MeasurementTimes.size());
-    PulseTimes.remove(0, PulseTimes.size());
-    PulseDurations.remove(0, PulseDurations.size());
+    delete elapsedTimer;
 }
 
 
-/* Adds 'value' to the list of impedance measurements */
-void OneElectrode::add_measurement(std::complex<double> value)
+/* Sets InitialTime to now, and clears CouplingRatio and Quality */
+void OneElectrode::reset_time()
 {
-    double time;
-    ImpedanceHistory.append(value);
-    if (MeasurementTimes.isEmpty()) {
-        elapsedTimer->restart();
-        InitialTime = elapsedTimer->elapsed();
-        time = 0;
-    }
-    else
-        time = get_elapsed_time();
-
-    MeasurementTimes.append(time);
+    start_time();
+    CouplingRatio = 0;
+    Quality = SignalQuality();
 }
 
 
-/* Adds a pulse of duration 'duration' to the list of pulses */
-void OneElectrode::add_pulse(double duration)
+/* Sets InitialTime to now (used when the first measurement is added) */
+void OneElectrode::start_time()
 {
-    double time;
-    time = get_elapsed_time();
-    PulseTimes.append(time);
-    PulseDurations.append(duration);
+    elapsedTimer->restart();
+    InitialTime = elapsedTimer->elapsed();
 }
 
 
-/* Return Impedance History */
-std::complex<double> OneElectrode::get_current_impedance()
+/* Sets InitialTime so that new measurements and pulses follow on from 'lastTime' (used when recovering a session) */
+void OneElectrode::resume_time(double lastTime)
 {
-    return ImpedanceHistory.last();
+    InitialTime = elapsedTimer->elapsed() - lastTime * 1000;
 }
 
 
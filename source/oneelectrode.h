@@ -1,28 +1,39 @@
 #ifndef ONEELECTRODE_H
 #define ONEELECTRODE_H
-#include <QVector>
+#include <QString>
 #include <complex>
+#include "demodulator.h"
 
 class QElapsedTimer;
 
-/* One Electrode is a class built to store the data from one electrode
- * Used for storing data from the given electrode only, no control functions. */
+/* One Electrode is a class built to store the state of one electrode
+ * Used for storing data from the given electrode only, no control functions.
+ * Its impedance and pulse history are kept with every other electrode's in DataProcessor's ElectrodeHistory. */
+
+/* ElectrodeStatus: Result of the screening pass run before automatic plating */
+enum ElectrodeStatus {
+    Unscreened, //Not screened yet (or its channels aren't present)
+    ElectrodeGood, //Within the screening bounds; will be plated
+    ElectrodeOpen, //Impedance too high, or purely capacitive; excluded from automatic plating
+    ElectrodeShort //Impedance too low; excluded from automatic plating
+};
 
 class OneElectrode
 {
 public:
     OneElectrode(); //Constructor
-    void reset_time(); //Clears history and sets InitialTime
-    void add_measurement(std::complex<double> value); //Adds 'value' to the list of impedance measurements
-    void add_pulse(double duration); //Adds a pulse of duration 'duration' to the list of pulses
-    std::complex<double> get_current_impedance(); //Return Impedance History
+    ~OneElectrode(); //Destructor
+    void reset_time(); //Sets InitialTime to now, and clears CouplingRatio and Quality
+    void start_time(); //Sets InitialTime to now (used when the first measurement is added)
+    void resume_time(double lastTime); //Sets InitialTime so that new measurements and pulses follow on from 'lastTime' (used when recovering a session)
     double get_elapsed_time(); //Return the amount of elapsed time since InitialTime
 
-    QVector<std::complex<double>> ImpedanceHistory; //Array of measured complex impedance values (also see MeasurementTimes)
-    QVector<double> MeasurementTimes; //Array of times (in seconds) when impedance was measured (also see ImpedanceHistory, InitialTime)
-    QVector<double> PulseTimes; //Array of times (in seconds) when pulses were applied (also see PulseDurations, InitialTime)
-    QVector<double> PulseDurations; //Array of durations of applied pulses (also see PulseTimes)
-    double InitialTime; //Absolute time that corresponds to 0. Reset this with reset_time(). All MeasurementTimes and PulseTimes are seconds after this (also see MeasurementTimes, PulseTimes, reset_time)
+    ElectrodeStatus Status; //Result of the most recent screening pass (not cleared by reset_time)
+    QString StatusReason; //Why the electrode was classified as it was by the most recent screening pass
+    std::complex<double> ScreeningImpedance; //Quick impedance reading used by the most recent screening pass
+    SignalQuality Quality; //Residual RMS (uV), SNR (dB), and harmonic distortion of the most recent impedance reading; cleared by reset_time
+    double CouplingRatio; //Largest test signal on an adjacent channel relative to this one at the last neighbor check, or 0 if not checked (see ImpedanceMeasureController::measurePairedImpedances)
+    double InitialTime; //Absolute time that corresponds to 0. Reset this with reset_time(). All measurement and pulse times are seconds after this (also see ElectrodeHistory, reset_time)
 
 private:
     QElapsedTimer *elapsedTimer;
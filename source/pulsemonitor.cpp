@@ -0,0 +1,98 @@
+#include "pulsemonitor.h"
+#include "electroplatingboardcontrol.h"
+
+#include <QtCore>
+#include <cmath>
+
+
+/* Constructor */
+PulseMonitor::PulseMonitor(const PulseProgram &program, double sampleRate, double duration_, double chargeLimit_, double voltageLimit_)
+{
+    constantCurrent = (program.mode == ConstantCurrent);
+    current = constantCurrent ? fabs(program.actualValue) : 0;
+    referenceVoltage = program.platingReferenceSelection ? 3.3 : 0;
+    samplePeriod = 1 / sampleRate;
+    duration = duration_;
+    chargeLimit = constantCurrent ? chargeLimit_ : 0;
+    voltageLimit = voltageLimit_;
+    charge = 0;
+    peakVoltage = 0;
+    numSamples = 0;
+    stopReason = (duration <= 0) ? DurationReached : NotStopped;
+}
+
+
+/* Public - Accumulate one board ADC sample (in V); returns false once the pulse should end */
+bool PulseMonitor::addSample(double adcVolts)
+{
+    if (stopReason != NotStopped)
+        return false;
+
+    double voltage = fabs(adcVolts - referenceVoltage);
+    if (voltage > peakVoltage)
+        peakVoltage = voltage;
+
+    if (constantCurrent)
+        charge += current * samplePeriod;
+    numSamples++;
+
+    if (voltageLimit > 0 && voltage >= voltageLimit)
+        stopReason = VoltageLimitReached;
+    else if (chargeLimit > 0 && charge >= chargeLimit)
+        stopReason = ChargeLimitReached;
+    else if (getElapsedTime() >= duration)
+        stopReason = DurationReached;
+
+    return stopReason == NotStopped;
+}
+
+
+/* Public - Returns true once the duration or either limit has been reached */
+bool PulseMonitor::isDone() const
+{
+    return stopReason != NotStopped;
+}
+
+
+/* Public - Get the charge delivered so far (in C) */
+double PulseMonitor::getCharge() const
+{
+    return charge;
+}
+
+
+/* Public - Get the largest electrode voltage magnitude seen so far (in V) */
+double PulseMonitor::getPeakVoltage() const
+{
+    return peakVoltage;
+}
+
+
+/* Public - Get the time plated so far (in s), counted in samples */
+double PulseMonitor::getElapsedTime() const
+{
+    return numSamples * samplePeriod;
+}
+
+
+/* Public - Get the reason the pulse ended, or NotStopped if it hasn't */
+PulseMonitor::StopReason PulseMonitor::getStopReason() const
+{
+    return stopReason;
+}
+
+
+/* Public - Get a human-readable description of the reason the pulse ended */
+QString PulseMonitor::getStopReasonText() const
+{
+    switch (stopReason) {
+    case DurationReached:
+        return "Duration reached";
+    case ChargeLimitReached:
+        return QString("Charge limit reached (%1 nC)").arg(charge * 1e9);
+    case VoltageLimitReached:
+        return QString("Voltage limit reached (%1 V)").arg(peakVoltage);
+    default:
+        return "Not stopped";
+    }
+}
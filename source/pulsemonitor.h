@@ -0,0 +1,54 @@
+#ifndef PULSEMONITOR_H
+#define PULSEMONITOR_H
+
+#include <QString>
+
+/* PulseMonitor is a class that follows a pulse while it is being applied, one board ADC sample at a time
+ *
+ * The electroplating board's electrode monitor output is wired to one of the evaluation board's ADC inputs.
+ * Each sample is converted to the electrode voltage (relative to the reference selected by REF_SEL), which is checked
+ * against the voltage limit. Charge is only known when the board regulates the current:
+ *
+ * Constant current: charge = |currentActual| * time, which is checked against the charge limit
+ * Constant voltage: nothing measured during the pulse gives the current (and an electrode's |Z| at the impedance test
+ *                   frequency says little about its DC current), so charge isn't tracked, and only the voltage limit applies
+ *
+ * Elapsed time is counted in samples, so it follows the board's clock rather than the host's. */
+
+struct PulseProgram;
+
+class PulseMonitor
+{
+
+public:
+    enum StopReason {
+        NotStopped,
+        DurationReached,
+        ChargeLimitReached,
+        VoltageLimitReached
+    };
+
+    PulseMonitor(const PulseProgram &program, double sampleRate, double duration, double chargeLimit, double voltageLimit); //Constructor
+    bool addSample(double adcVolts); //Accumulate one board ADC sample (in V); returns false once the pulse should end
+    bool isDone() const; //Returns true once the duration or either limit has been reached
+    double getCharge() const; //Get the charge delivered so far (in C), or 0 for constant voltage pulses
+    double getPeakVoltage() const; //Get the largest electrode voltage magnitude seen so far (in V)
+    double getElapsedTime() const; //Get the time plated so far (in s), counted in samples
+    StopReason getStopReason() const; //Get the reason the pulse ended, or NotStopped if it hasn't
+    QString getStopReasonText() const; //Get a human-readable description of the reason the pulse ended
+
+private:
+    bool constantCurrent; //True for constant current pulses, false for constant voltage pulses
+    double current; //Regulated current magnitude (in A), constant current only
+    double referenceVoltage; //Voltage of the reference selected by REF_SEL while plating (0 or 3.3 V)
+    double samplePeriod; //Time between samples (in s)
+    double duration; //Maximum pulse duration (in s)
+    double chargeLimit; //Charge at which to end the pulse (in C), or 0 for no limit; constant current only
+    double voltageLimit; //Electrode voltage magnitude at which to end the pulse (in V), or 0 for no limit
+    double charge; //Charge delivered so far (in C)
+    double peakVoltage; //Largest electrode voltage magnitude seen so far (in V)
+    long numSamples; //Number of samples accumulated so far
+    StopReason stopReason; //Why the pulse ended, or NotStopped
+};
+
+#endif // PULSEMONITOR_H
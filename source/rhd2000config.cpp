@@ -24,14 +24,12 @@
 #include "boardcontrol.h"
 #include <string.h>
 #include <QtCore>
+#include "globalconstants.h"
 
 using std::vector;
 using std::complex;
 using Rhd2000RegisterInternals::typed_register_t;
 
-const double TWO_PI = 6.28318530718;
-const double DEGREES_TO_RADIANS = 0.0174532925199;
-
 
 /** \brief This namespace contains classes for configuring various parts of the RHD2000 evaluation board.
 
@@ -42,6 +40,32 @@ const double DEGREES_TO_RADIANS = 0.0174532925199;
     how it's configured.
  */
 namespace Rhd2000Config {
+    //  ------------------------------------------------------------------------
+    /** \brief Sizes the matrix for the given number of channels on each data source, and zeroes every amplitude.
+
+        @param[in] numChannels  Number of amplifier channels on each of the MAX_NUM_BOARD_DATA_SOURCES data sources (0 if there's no chip).
+     */
+    void AmplitudeMatrix::resize(const vector<unsigned int>& numChannels) {
+        sourceOffset.assign(MAX_NUM_BOARD_DATA_SOURCES + 1, 0);
+        for (unsigned int source = 0; source < MAX_NUM_BOARD_DATA_SOURCES; ++source) {
+            sourceOffset[source + 1] = sourceOffset[source] + numChannels[source];
+        }
+        for (int capRange = 0; capRange < NumCapRanges; ++capRange) {
+            real[capRange].assign(size(), 0.0);
+            imag[capRange].assign(size(), 0.0);
+        }
+    }
+
+    /** \brief Sizes the arrays for \p n amplifiers.
+     */
+    void ImpedanceArrays::resize(unsigned int n) {
+        real.resize(n);
+        imag.resize(n);
+        magnitude.resize(n);
+        phase.resize(n);
+        capRange.resize(n);
+    }
+
     //  ------------------------------------------------------------------------
     /** \brief Constructor
 
@@ -116,32 +140,6 @@ namespace Rhd2000Config {
     }
 
 
-    /*
-        Given a measured complex impedance that is the result of an electrode impedance in parallel
-        with a parasitic capacitance (i.e., due to the amplifier input capacitance and other
-        capacitances associated with the chip bondpads), this function factors out the effect of the
-        parasitic capacitance to return the acutal electrode impedance.
-
-        The electrode has impedance Z_electrode, the parallel capacitor has impedance 1/j*w*C.
-        (Where w is the angular frequency, w = 2*pi*f
-
-        The combined impedance can be calculated by:
-            1/Z_combined = 1/Z_electrode + 1/Z_capacitor
-
-        Solving for this,
-            1/Z_electrode = 1/Z_combined - 1/Z_capacitor
-        In particular, Z_combined = z_measured, and 1/Z_capacitor = j*w*C,
-        so 1/Z_electrode = 1/Z_measured - jwc
-    */
-    complex<double> ImpedanceFreq::factorOutParallelCapacitance(complex<double> zMeasured, double parasiticCapacitance)
-    {
-        const complex<double> ONE(1, 0);
-
-        complex<double> jwc(0, TWO_PI * actualImpedanceFreq * parasiticCapacitance);
-        complex<double> one_over_Zelectrode = ONE / zMeasured - jwc;
-        return ONE / one_over_Zelectrode;
-    }
-
     // This is a purely empirical function to correct observed errors in the real component
     // of measured electrode impedances at sampling rates below 15 kS/s.  At low sampling rates,
     // it is difficult to approximate a smooth sine wave with the on-chip voltage DAC and 10 kHz
@@ -160,30 +158,27 @@ namespace Rhd2000Config {
         return complex<double>(impedanceR, impedanceX);
     }
 
-    /** \brief Calculates the best impedance for a given amplifier, given measured amplitudes for the three capacitor values.
+    /** \brief Picks which of the three capacitor values' readings to calculate an amplifier's impedance from, given the
+        squared magnitudes (std::norm) of its amplitudes.
 
-        This function picks one of the capacitors (preferring voltage readings that are closest to 250uV),
-        then uses the amplitude value for that reading to calculate impedance, and corrects for known board parasitics.
+        Prefers the largest amplitude that's still within the amplifier's linear range.  Comparing squared magnitudes
+        picks the same reading as comparing magnitudes, without a square root per reading.
 
-        @param[in] measuredAmplitudes   Measured amplitudes of the waveform for the given amplifier, for each of the three capacitor values.
-        @returns the best value of impedance
+        @param[in] norms    Squared magnitudes of the measured amplitudes (in microvolts squared), for each of the three capacitor values.
+        @returns the capacitor value (a Rhd2000Registers::ZcheckCs value) whose reading is best
      */
-    complex<double> ImpedanceFreq::calculateBestImpedanceOneAmplifier(vector<complex<double> >& measuredAmplitudes) {
+    int ImpedanceFreq::bestCapRangeFromNorms(const double norms[AmplitudeMatrix::NumCapRanges]) {
         const double MAX_AMPLITUDE = 3000; // Above this, we're worried about non-linearity
-        int bestAmplitudeIndex;
+        const double MAX_NORM = MAX_AMPLITUDE * MAX_AMPLITUDE;
+        int bestAmplitudeIndex = -1;
         //double saturationVoltage = approximateSaturationVoltage(actualImpedanceFreq, bandwidth.actualUpperBandwidth);
 
-        double amplitude[3];
-        for (int i = 0; i < 3; i++) {
-            amplitude[i] = std::abs(measuredAmplitudes[i]);
-        }
-
-        double currentAmplitude = 0;
+        double currentNorm = 0;
         for (int i = 0; i < 3; i++) {
             // Find the largest that's smaller than MAX_AMPLITUDE
-            if ((amplitude[i] < MAX_AMPLITUDE) && (amplitude[i] > currentAmplitude)) {
+            if ((norms[i] < MAX_NORM) && (norms[i] > currentNorm)) {
                 bestAmplitudeIndex = i;
-                currentAmplitude = amplitude[i];
+                currentNorm = norms[i];
             }
         }
 
@@ -201,7 +196,7 @@ namespace Rhd2000Config {
             // Find the smallest
             bestAmplitudeIndex = 0;
             for (int i = 1; i < 3; i++) {
-                if (amplitude[i] < amplitude[bestAmplitudeIndex]) {
+                if (norms[i] < norms[bestAmplitudeIndex]) {
                     bestAmplitudeIndex = i;
                 }
             }
@@ -215,37 +210,166 @@ namespace Rhd2000Config {
 //            }
 //        }
 
-        double Cseries = Rhd2000Registers::getCapacitance(static_cast<Rhd2000Registers::ZcheckCs>(bestAmplitudeIndex));
+        return bestAmplitudeIndex;
+    }
 
-        const double dacVoltageAmplitude = 128 * (1.225 / 256);  // this assumes the DAC amplitude was set to 128
+    /** \brief Picks which of the three capacitor values' readings to calculate a given amplifier's impedance from.
 
-        // Calculate current amplitude produced by on-chip voltage DAC
-        double current = TWO_PI * actualImpedanceFreq * dacVoltageAmplitude * Cseries;
+        See bestCapRangeFromNorms for how.
 
+        @param[in] measuredAmplitudes   Measured amplitudes of the waveform for the given amplifier, for each of the three capacitor values.
+        @returns the capacitor value (a Rhd2000Registers::ZcheckCs value) whose reading is best
+     */
+    int ImpedanceFreq::bestCapRange(const vector<complex<double> >& measuredAmplitudes) {
+        double norms[AmplitudeMatrix::NumCapRanges];
+        for (int i = 0; i < AmplitudeMatrix::NumCapRanges; i++) {
+            norms[i] = measuredAmplitudes[i].real() * measuredAmplitudes[i].real() + measuredAmplitudes[i].imag() * measuredAmplitudes[i].imag();
+        }
+        return bestCapRangeFromNorms(norms);
+    }
+
+    /** \brief Calculates the best impedance for a given amplifier, given measured amplitudes for the three capacitor values.
+
+        This function picks one of the capacitors (see bestCapRange), then uses the amplitude value for that reading
+        to calculate impedance, and corrects for known board parasitics.
+
+        @param[in] measuredAmplitudes   Measured amplitudes of the waveform for the given amplifier, for each of the three capacitor values.
+        @returns the best value of impedance
+     */
+    complex<double> ImpedanceFreq::calculateBestImpedanceOneAmplifier(vector<complex<double> >& measuredAmplitudes) {
+        int bestAmplitudeIndex = bestCapRange(measuredAmplitudes);
+        return calculateImpedanceOneAmplifier(measuredAmplitudes[bestAmplitudeIndex], bestAmplitudeIndex);
+    }
+
+    /** \brief Calculates the impedance for a given amplifier from the amplitude measured with one capacitor value.
+
+        Corrects for known board parasitics.  The result is only accurate if the amplitude is within the
+        amplifier's linear range; see calculateBestImpedanceOneAmplifier for choosing among several capacitor values.
+
+        @param[in] measuredAmplitude    Measured amplitude of the waveform for the given amplifier.
+        @param[in] capRange             Capacitor value used for the measurement (a Rhd2000Registers::ZcheckCs value).
+        @returns the impedance
+     */
+    complex<double> ImpedanceFreq::calculateImpedanceOneAmplifier(complex<double> measuredAmplitude, int capRange) {
+        double r, x;
+        applyCalibration(calibration(), capRange, measuredAmplitude.real(), measuredAmplitude.imag(), r, x);
+
+        // Perform empirical resistance correction to improve accuracy at sample rates below
+        // 15 kS/s.
+        // NOTE: After refining the impedance measurement algorithm, Intan has determined this empirical correction is no longer necessary for accurate measurements
+        //return empiricalResistanceCorrection(complex<double>(r, x));
+        return complex<double>(r, x);
+    }
+
+    /*
+        Calculates the parts of the impedance calculation that are the same for every amplifier at the current
+        impedance frequency and sample rate: the factor that converts a measured amplitude to an impedance for each
+        capacitor value, and the admittance of the on-chip parasitic capacitance.
+    */
+    ImpedanceFreq::Calibration ImpedanceFreq::calibration() {
+        Calibration cal;
+
+        const double dacVoltageAmplitude = 128 * (1.225 / 256);  // this assumes the DAC amplitude was set to 128
         double relativeFreq = actualImpedanceFreq / boardSampleRate;
-        // Calculate impedance magnitude from calculated current and measured voltage.
-        // 1.0e-6 converts uV to V
-        // divide by current to convert voltage to impedance
-        // 18.0 * relativeFreq * relativeFreq + 1.0 is an empirical adjustment
-        double magnitudeMultiplier = (1.0e-6 / current) * (18.0 * relativeFreq * relativeFreq + 1.0);
 
         // Calculate impedance phase, with small correction factor accounting for the
         // 3-command SPI pipeline delay.
         double phaseAdder = DEGREES_TO_RADIANS * (360.0 * (3.0 / getPeriod()));
-        complex<double> correction = std::polar(magnitudeMultiplier, phaseAdder);
 
-        complex<double> zCorrected1 = measuredAmplitudes[bestAmplitudeIndex] * correction;
+        for (int capRange = 0; capRange < AmplitudeMatrix::NumCapRanges; capRange++) {
+            double Cseries = Rhd2000Registers::getCapacitance(static_cast<Rhd2000Registers::ZcheckCs>(capRange));
+
+            // Calculate current amplitude produced by on-chip voltage DAC
+            double current = TWO_PI * actualImpedanceFreq * dacVoltageAmplitude * Cseries;
+
+            // Calculate impedance magnitude from calculated current and measured voltage.
+            // 1.0e-6 converts uV to V
+            // divide by current to convert voltage to impedance
+            // 18.0 * relativeFreq * relativeFreq + 1.0 is an empirical adjustment
+            double magnitudeMultiplier = (1.0e-6 / current) * (18.0 * relativeFreq * relativeFreq + 1.0);
+            cal.correction[capRange] = std::polar(magnitudeMultiplier, phaseAdder);
+        }
 
-        // Factor out on-chip parasitic capacitance from impedance measurement.
         const double parasiticCapacitance = 14.0e-12;  // 15 pF: an estimate of on-chip parasitic capacitance,
         // including 10 pF of amplifier input capacitance.
-        complex<double> zCorrected2 = factorOutParallelCapacitance(zCorrected1, parasiticCapacitance);
+        cal.parasiticAdmittance = TWO_PI * actualImpedanceFreq * parasiticCapacitance;
+        return cal;
+    }
 
-        // Perform empirical resistance correction to improve accuracy at sample rates below
-        // 15 kS/s.
-        // NOTE: After refining the impedance measurement algorithm, Intan has determined this empirical correction is no longer necessary for accurate measurements
-        //return empiricalResistanceCorrection(zCorrected2);
-        return zCorrected2;
+    /*
+        Converts one measured amplitude (re + j im, in microvolts) to an impedance (r + j x, in ohms), given the
+        capacitor value it was measured with.
+
+        The amplitude is first scaled and rotated by the capacitor value's correction.  That gives the result
+        of the electrode impedance in parallel with a parasitic capacitance (i.e., due to the amplifier input
+        capacitance and other capacitances associated with the chip bondpads), which is then factored out.
+
+        The electrode has impedance Z_electrode, the parallel capacitor has impedance 1/j*w*C.
+        (Where w is the angular frequency, w = 2*pi*f
+
+        The combined impedance can be calculated by:
+            1/Z_combined = 1/Z_electrode + 1/Z_capacitor
+
+        Solving for this,
+            1/Z_electrode = 1/Z_combined - 1/Z_capacitor
+        In particular, Z_combined = z_measured, and 1/Z_capacitor = j*w*C,
+        so 1/Z_electrode = 1/Z_measured - jwc
+
+        This is written out in real arithmetic so that calculateBestImpedances() can do it for many amplifiers in one loop.
+    */
+    void ImpedanceFreq::applyCalibration(const Calibration& cal, int capRange, double re, double im, double& r, double& x)
+    {
+        const complex<double>& correction = cal.correction[capRange];
+        double zr = re * correction.real() - im * correction.imag();
+        double zi = re * correction.imag() + im * correction.real();
+
+        // 1/Z_measured - jwc
+        double zNorm = zr * zr + zi * zi;
+        double yr = zr / zNorm;
+        double yi = -zi / zNorm - cal.parasiticAdmittance;
+
+        double yNorm = yr * yr + yi * yi;
+        r = yr / yNorm;
+        x = -yi / yNorm;
+    }
+
+    /** \brief Calculates the best impedance of amplifiers begin..end-1 of an AmplitudeMatrix.
+
+        Does for each amplifier what calculateBestImpedanceOneAmplifier does (the same calculation), and also
+        fills in the magnitude, phase and chosen capacitor value.  The per-frequency constants are calculated once,
+        and each amplifier is independent of the others, so disjoint ranges can be calculated on different threads
+        (into the same ImpedanceArrays, which must already be sized to amplitudes.size()).
+
+        @param[in] amplitudes   Measured amplitudes
+        @param[in] begin        First amplifier to calculate
+        @param[in] end          One past the last amplifier to calculate
+        @param[out] best        Results; only entries begin..end-1 are written
+     */
+    void ImpedanceFreq::calculateBestImpedances(const AmplitudeMatrix& amplitudes, unsigned int begin, unsigned int end, ImpedanceArrays& best) {
+        const Calibration cal = calibration();
+
+        const double* re[AmplitudeMatrix::NumCapRanges];
+        const double* im[AmplitudeMatrix::NumCapRanges];
+        for (int capRange = 0; capRange < AmplitudeMatrix::NumCapRanges; capRange++) {
+            re[capRange] = amplitudes.real[capRange].data();
+            im[capRange] = amplitudes.imag[capRange].data();
+        }
+
+        for (unsigned int i = begin; i < end; i++) {
+            double norms[AmplitudeMatrix::NumCapRanges];
+            for (int capRange = 0; capRange < AmplitudeMatrix::NumCapRanges; capRange++) {
+                norms[capRange] = re[capRange][i] * re[capRange][i] + im[capRange][i] * im[capRange][i];
+            }
+            int capRange = bestCapRangeFromNorms(norms);
+
+            double r, x;
+            applyCalibration(cal, capRange, re[capRange][i], im[capRange][i], r, x);
+            best.real[i] = r;
+            best.imag[i] = x;
+            best.magnitude[i] = sqrt(r * r + x * x);
+            best.phase[i] = RADIANS_TO_DEGREES * atan2(x, r);
+            best.capRange[i] = capRange;
+        }
     }
 
 
@@ -305,6 +429,44 @@ namespace Rhd2000Config {
         return z * 2.0 / (double)length;
     }
 
+    /** \brief Calculates the amplitude (magnitude and phase) of the input sinusoid, from raw amplifier ADC codes.
+
+        Same as amplitudeOfFreqComponent(double*) on the codes converted to microvolts, but done in fixed point
+        (see FixedPointDemodulator), with the offset and scale applied once, to the result.  Each of the real and
+        imaginary parts is within mean(|amplitude|) / FixedPointDemodulator::TableScale of the floating-point result,
+        where the mean is over the samples' amplitudes (in microvolts) between the start and end indices.
+
+        @param[in] codes    Input waveform, as Rhd2000DataBlock::amplifierData codes.  Should range from 0..endIndex
+
+        @returns    The real and imaginary amplitudes (in microvolts) of a selected frequency component in codes, between a start index and end index.
+        */
+    complex<double> ImpedanceFreq::amplitudeOfFreqComponent(const uint16_t* codes)
+    {
+        const double microVoltsPerStep = Rhd2000DataBlock::amplifierADCToMicroVolts(0x8001);
+
+        demodulator.setWindow(TWO_PI * actualImpedanceFreq / boardSampleRate, startIndex, endIndex);
+        return demodulator.amplitude(codes) * microVoltsPerStep;
+    }
+
+    /** \brief Calculates the amplitude of the input sinusoid, as amplitudeOfFreqComponent(const uint16_t*), and how clean it was.
+
+        The quality figures come from the same pass over the data (see FixedPointDemodulator).
+
+        @param[in] codes        Input waveform, as Rhd2000DataBlock::amplifierData codes.  Should range from 0..endIndex
+        @param[out] quality     Residual RMS (in microvolts) after removing the fitted sinusoid, SNR, and harmonic distortion
+
+        @returns    The real and imaginary amplitudes (in microvolts) of a selected frequency component in codes, between a start index and end index.
+        */
+    complex<double> ImpedanceFreq::amplitudeOfFreqComponent(const uint16_t* codes, SignalQuality& quality)
+    {
+        const double microVoltsPerStep = Rhd2000DataBlock::amplifierADCToMicroVolts(0x8001);
+
+        demodulator.setWindow(TWO_PI * actualImpedanceFreq / boardSampleRate, startIndex, endIndex);
+        complex<double> amplitude = demodulator.amplitude(codes, quality) * microVoltsPerStep;
+        quality.residualRms *= microVoltsPerStep;
+        return amplitude;
+    }
+
 
     //  ------------------------------------------------------------------------
     BandWidth::BandWidth() {
@@ -379,6 +541,76 @@ namespace Rhd2000Config {
         values[index] = 1;
     }
 
+    //  ------------------------------------------------------------------------
+    DigitalOutputState::DigitalOutputState(uint16_t bits_) :
+        value(bits_)
+    {
+    }
+
+    /** \brief Returns all 16 digital output values, packed one bit per output.
+     */
+    uint16_t DigitalOutputState::bits() const {
+        return value;
+    }
+
+    /** \brief Returns the value of a single digital output.
+
+        @param[in] line     Digital output (0-15).
+     */
+    bool DigitalOutputState::get(unsigned int line) const {
+        return ((value >> line) & 1) != 0;
+    }
+
+    /** \brief Sets the value of a single digital output.
+
+        @param[in] line     Digital output (0-15).
+        @param[in] v        New value.
+     */
+    void DigitalOutputState::set(unsigned int line, bool v) {
+        if (v) {
+            setMask(1 << line);
+        }
+        else {
+            clearMask(1 << line);
+        }
+    }
+
+    /** \brief Sets (to 1) all digital outputs whose bits are set in \p mask.
+     */
+    void DigitalOutputState::setMask(uint16_t mask) {
+        value |= mask;
+    }
+
+    /** \brief Clears (to 0) all digital outputs whose bits are set in \p mask.
+     */
+    void DigitalOutputState::clearMask(uint16_t mask) {
+        value &= ~mask;
+    }
+
+    /** \brief Toggles all digital outputs whose bits are set in \p mask.
+     */
+    void DigitalOutputState::toggleMask(uint16_t mask) {
+        value ^= mask;
+    }
+
+    /** \brief Copies the digital outputs selected by \p mask from \p newBits, leaving the others unchanged.
+     */
+    void DigitalOutputState::assign(uint16_t newBits, uint16_t mask) {
+        value = (value & ~mask) | (newBits & mask);
+    }
+
+    /** \brief Returns a mask of the digital outputs that would change if \p newBits were assigned.
+     */
+    uint16_t DigitalOutputState::changedMask(uint16_t newBits) const {
+        return value ^ newBits;
+    }
+
+    /** \brief Resets all digital outputs to 0.
+     */
+    void DigitalOutputState::clear() {
+        value = 0;
+    }
+
     //  ------------------------------------------------------------------------
     DigitalOutputControl::DigitalOutputControl() {
         clear();
@@ -394,7 +626,7 @@ namespace Rhd2000Config {
         8-15 are controlled directly, so this will not affect the digital outputs.
      */
     void DigitalOutputControl::clear() {
-        memset(values, 0, sizeof(values));
+        values.clear();
     }
 
     /** \brief Set the threshold for one of the comparators.
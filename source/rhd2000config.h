@@ -25,12 +25,59 @@
 #include "rhd2000evalboard.h"
 #include "rhd2000registers.h"
 #include "rhd2000datablock.h"
+#include "demodulator.h"
 #include <complex>
+#include <cstdint>
 
 class BoardControl;
 
 namespace Rhd2000Config {
     struct BandWidth;
+
+    /** \brief Complex amplitudes measured on many amplifiers, at each of the three capacitor values, as a structure of arrays.
+
+        Amplifiers are numbered consecutively across data sources: channel c of data source s is amplifier
+        index(s, c) = sourceOffset[s] + c.  The amplitude of amplifier i at capacitor value capRange is
+        (real[capRange][i], imag[capRange][i]).  Keeping each component in its own contiguous array lets
+        ImpedanceFreq::calculateBestImpedances() work through any range of amplifiers with unit-stride loads.
+     */
+    struct AmplitudeMatrix {
+        static const int NumCapRanges = 3;
+
+        /// Real parts, in microvolts, one array per capacitor value (a Rhd2000Registers::ZcheckCs value).
+        std::vector<double> real[NumCapRanges];
+        /// Imaginary parts, in microvolts, one array per capacitor value.
+        std::vector<double> imag[NumCapRanges];
+        /// Index of each data source's channel 0; entry MAX_NUM_BOARD_DATA_SOURCES is the total number of amplifiers.
+        std::vector<unsigned int> sourceOffset;
+
+        void resize(const std::vector<unsigned int>& numChannels);
+        unsigned int size() const { return sourceOffset.empty() ? 0 : sourceOffset.back(); }
+        unsigned int numChannels(unsigned int source) const { return sourceOffset[source + 1] - sourceOffset[source]; }
+        unsigned int index(unsigned int source, unsigned int channel) const { return sourceOffset[source] + channel; }
+
+        std::complex<double> at(unsigned int i, int capRange) const { return std::complex<double>(real[capRange][i], imag[capRange][i]); }
+        void set(unsigned int i, int capRange, std::complex<double> amplitude) { real[capRange][i] = amplitude.real(); imag[capRange][i] = amplitude.imag(); }
+    };
+
+    /** \brief Best impedance of each amplifier of an AmplitudeMatrix (indexed the same way), as a structure of arrays.
+     */
+    struct ImpedanceArrays {
+        /// Real part, in ohms.
+        std::vector<double> real;
+        /// Imaginary part, in ohms.
+        std::vector<double> imag;
+        /// Magnitude, in ohms.
+        std::vector<double> magnitude;
+        /// Phase, in degrees.
+        std::vector<double> phase;
+        /// Capacitor value the impedance was calculated from (see ImpedanceFreq::bestCapRange).
+        std::vector<int> capRange;
+
+        void resize(unsigned int n);
+        std::complex<double> at(unsigned int i) const { return std::complex<double>(real[i], imag[i]); }
+    };
+
     /** \brief Frequency configuration for impedance measurements.
 
         See \ref impedancePage "here" for an overview of impedance measurements.
@@ -68,7 +115,12 @@ namespace Rhd2000Config {
         void calculateValues();
 
         std::complex<double> amplitudeOfFreqComponent(double* data);
+        std::complex<double> amplitudeOfFreqComponent(const uint16_t* codes);
+        std::complex<double> amplitudeOfFreqComponent(const uint16_t* codes, SignalQuality& quality);
+        int bestCapRange(const std::vector<std::complex<double> >& measuredAmplitudes);
+        void calculateBestImpedances(const AmplitudeMatrix& amplitudes, unsigned int begin, unsigned int end, ImpedanceArrays& best);
         std::complex<double> calculateBestImpedanceOneAmplifier(std::vector<std::complex<double> >& measuredAmplitudes);
+        std::complex<double> calculateImpedanceOneAmplifier(std::complex<double> measuredAmplitude, int capRange);
 
         double approximateSaturationVoltage(double actualZFreq, double highCutoff);
 
@@ -77,9 +129,19 @@ namespace Rhd2000Config {
         double& boardSampleRate;
         const BandWidth& bandwidth;
 
+        FixedPointDemodulator demodulator;
+
+        // Everything calculateImpedanceOneAmplifier() needs that doesn't depend on the amplifier, for one test frequency
+        struct Calibration {
+            std::complex<double> correction[AmplitudeMatrix::NumCapRanges]; // Converts microvolts to ohms, with the SPI pipeline phase delay
+            double parasiticAdmittance; // Imaginary part of j * w * C of the on-chip parasitic capacitance
+        };
+        Calibration calibration();
+        static int bestCapRangeFromNorms(const double norms[AmplitudeMatrix::NumCapRanges]);
+        static void applyCalibration(const Calibration& cal, int capRange, double re, double im, double& r, double& x);
+
         double getPeriod();
         void updateImpedanceFrequency();
-        std::complex<double> factorOutParallelCapacitance(std::complex<double> zIn, double parasiticCapacitance);
         std::complex<double> empiricalResistanceCorrection(std::complex<double> zIn);
     };
 
@@ -228,6 +290,33 @@ namespace Rhd2000Config {
         /** \endcond */
     };
 
+    /** \brief Packed state of the 16 digital outputs on the RHD2000 evaluation board.
+
+        Bit i corresponds to digital output i.  Each of the mask operations changes all of the
+        lines selected by the mask in a single step, and the whole state is written to the board
+        in a single transfer by BoardControl::updateDigitalOutputs, so lines that change together
+        in memory also change together on the board.
+    */
+    class DigitalOutputState {
+    public:
+        DigitalOutputState(uint16_t bits_ = 0);
+
+        uint16_t bits() const;
+        bool get(unsigned int line) const;
+        void set(unsigned int line, bool v);
+
+        void setMask(uint16_t mask);
+        void clearMask(uint16_t mask);
+        void toggleMask(uint16_t mask);
+        void assign(uint16_t newBits, uint16_t mask = 0xFFFF);
+        uint16_t changedMask(uint16_t newBits) const;
+
+        void clear();
+
+    private:
+        uint16_t value;
+    };
+
     /** \brief Functionality to control digital outputs on the RHD2000 evaluation board.
     
         Note: this configures digital outputs in memory; you need to call 
@@ -277,12 +366,12 @@ namespace Rhd2000Config {
             See ThresholdComparatorConfig for details.
          */
         ThresholdComparatorConfig comparators[8];
-        /** \brief Digital output values (0 or 1).
+        /** \brief Digital output values, packed one bit per output.
             
-            If DigitalOutputControl::comparatorsEnabled = true, only values 8-15 are used
-            as digital outputs; values 0-7 are controlled by the threshold comparators.
+            If DigitalOutputControl::comparatorsEnabled = true, only bits 8-15 are used
+            as digital outputs; bits 0-7 are controlled by the threshold comparators.
          */
-        int values[16];
+        DigitalOutputState values;
 
         /** \brief Chooses whether to use threshold comparators, and whether 8 or 16 outputs are user controllable.
 
@@ -1195,6 +1195,16 @@ void Rhd2000EvalBoard::setTtlOut(int ttlOutArray[])
     dev->UpdateWireIns();
 }
 
+/** \brief Sets the 16 bits of the digital TTL output lines in a single write.
+
+    @param[in] ttlOut  Values to set, packed one bit per output (bit i = digital output i).
+*/
+void Rhd2000EvalBoard::setTtlOutBits(int ttlOut)
+{
+    dev->SetWireInValue(WireInTtlOut, ttlOut & 0xFFFF);
+    dev->UpdateWireIns();
+}
+
 /** \brief Reads the 16 bits of the digital TTL input lines on the FPGA into a length-16 integer array.
 
     @param[out] ttlInArray  Array of length 16 to receive the values.
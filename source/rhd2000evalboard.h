@@ -218,6 +218,7 @@ public:
     //@{
     virtual void clearTtlOut();
     virtual void setTtlOut(int ttlOutArray[]);
+    virtual void setTtlOutBits(int ttlOut);
     virtual void getTtlIn(int ttlInArray[]);
     //@}
 
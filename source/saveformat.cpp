@@ -29,6 +29,8 @@
 #include "streams.h"
 #include "common.h"
 #include <sys/stat.h>
+#include <algorithm>
+#include "deltacodec.h"
 
 
 using std::cerr;
@@ -47,6 +49,27 @@ using std::exception;
 #define DATA_FILE_MAIN_VERSION_NUMBER  1
 #define DATA_FILE_SECONDARY_VERSION_NUMBER  4
 
+// Compressed (.rhc) file constants
+#define COMPRESSED_FILE_MAGIC_NUMBER  0xc6912703
+#define COMPRESSED_FILE_MAIN_VERSION_NUMBER  1
+#define COMPRESSED_FILE_SECONDARY_VERSION_NUMBER  0
+#define COMPRESSED_INDEX_MAGIC_NUMBER  0x1dc0a5e8
+#define COMPRESSED_TRAILER_SIZE  16
+#define COMPRESSED_INDEX_ENTRY_SIZE  16
+
+// Impedance capture file (.rhi) constants
+#define IMPEDANCE_CAPTURE_MAGIC_NUMBER  0xc6912704
+#define IMPEDANCE_CAPTURE_MAIN_VERSION_NUMBER  1
+#define IMPEDANCE_CAPTURE_SECONDARY_VERSION_NUMBER  0
+#define IMPEDANCE_CAPTURE_INDEX_MAGIC_NUMBER  0x1dc0a5e9
+#define IMPEDANCE_CAPTURE_TRAILER_SIZE  16
+#define IMPEDANCE_CAPTURE_INDEX_ENTRY_SIZE  24
+#define IMPEDANCE_CAPTURE_WINDOW_HEADER_SIZE  72
+#define IMPEDANCE_CAPTURE_NUM_BUFFERS  4
+
+// Number of buffers for the large streams that carry most of a recording (one I/O thread each); other streams write synchronously
+#define LARGE_STREAM_NUM_BUFFERS  2
+
 //  ------------------------------------------------------------------------
 bool operator<(const Version& a, const Version& b) {
     if (a.major < b.major) {
@@ -201,11 +224,11 @@ int SaveFormatWriter::bytesPerBlock(const SaveList& saveList) {
     return logic->bytesPerBlock(saveList);
 }
 
-void SaveFormatWriter::createFileStream(const FILENAME& fullpath, std::unique_ptr<BinaryWriter>& file, unsigned int bufferSize) {
+void SaveFormatWriter::createFileStream(const FILENAME& fullpath, std::unique_ptr<BinaryWriter>& file, unsigned int bufferSize, unsigned int numBuffers) {
     unique_ptr<FileOutStream> fs(new FileOutStream());
     fs->open(fullpath);
 
-    unique_ptr<BinaryWriter> bs(new BinaryWriter(std::move(fs), bufferSize));
+    unique_ptr<BinaryWriter> bs(new BinaryWriter(std::move(fs), bufferSize, numBuffers));
     file.reset(bs.release());
 }
 
@@ -270,7 +293,7 @@ void IntanSaveFormat::open(const FILENAME& saveFileBaseName, const SaveList&) {
             endsInDotRHD = true;
         }
     }
-    createFileStream(endsInDotRHD ? saveFileBaseName : saveFileBaseName + _T(".rhd"), save, 256 * KILO);
+    createFileStream(endsInDotRHD ? saveFileBaseName : saveFileBaseName + _T(".rhd"), save, 256 * KILO, LARGE_STREAM_NUM_BUFFERS);
 }
 
 void IntanSaveFormat::close() {
@@ -294,24 +317,23 @@ int IntanSaveFormat::writeBlockInternal(const SaveList& saveList, const Rhd2000D
     int numWordsWritten = 0;
 
     // Save timestamp data
-    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-        *save << ((int32_t)dataBlock.timeStamp[t]) - ((int32_t)timestampOffset);
-    }
+    save->writeInt32(dataBlock.timeStamp.data(), SAMPLES_PER_DATA_BLOCK, -timestampOffset);
     numWordsWritten += 2 * SAMPLES_PER_DATA_BLOCK;
 
     // Save amplifier data
     for (i = 0; i < saveList.amplifier.size(); ++i) {
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            *save << (uint16_t) dataBlock.amplifierData[saveList.amplifier.at(i)->boardStream][saveList.amplifier.at(i)->chipChannel][t];
-        }
+        save->writeUInt16(dataBlock.amplifierData[saveList.amplifier.at(i)->boardStream][saveList.amplifier.at(i)->chipChannel].data(), SAMPLES_PER_DATA_BLOCK);
     }
 	numWordsWritten += static_cast<unsigned int>(saveList.amplifier.size()) * SAMPLES_PER_DATA_BLOCK;
 
     // Save auxiliary input data
+    scratch.resize(SAMPLES_PER_DATA_BLOCK / 4);
     for (i = 0; i < saveList.auxInput.size(); ++i) {
+        const vector<int>& auxData = dataBlock.auxiliaryData[saveList.auxInput.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2];
         for (t = 0; t < SAMPLES_PER_DATA_BLOCK; t += 4) {
-            *save << (uint16_t) dataBlock.auxiliaryData[saveList.auxInput.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][t + saveList.auxInput.at(i)->chipChannel + 1];
+            scratch[t / 4] = auxData[t + saveList.auxInput.at(i)->chipChannel + 1];
         }
+        save->writeUInt16(scratch.data(), scratch.size());
     }
 	numWordsWritten += static_cast<unsigned int>(saveList.auxInput.size()) * SAMPLES_PER_DATA_BLOCK;
 
@@ -333,9 +355,7 @@ int IntanSaveFormat::writeBlockInternal(const SaveList& saveList, const Rhd2000D
 
     // Save board ADC data
     for (i = 0; i < saveList.boardAdc.size(); ++i) {
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            *save << (uint16_t) dataBlock.boardAdcData[saveList.boardAdc.at(i)->nativeChannelNumber][t];
-        }
+        save->writeUInt16(dataBlock.boardAdcData[saveList.boardAdc.at(i)->nativeChannelNumber].data(), SAMPLES_PER_DATA_BLOCK);
     }
 	numWordsWritten += static_cast<unsigned int>(saveList.boardAdc.size()) * SAMPLES_PER_DATA_BLOCK;
 
@@ -343,19 +363,15 @@ int IntanSaveFormat::writeBlockInternal(const SaveList& saveList, const Rhd2000D
     if (saveList.boardDigIn) {
         // If ANY digital inputs are enabled, we save ALL 16 channels, since
         // we are writing 16-bit chunks of data.
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            *save << (uint16_t)dataBlock.ttlIn[t];
-            ++numWordsWritten;
-        }
+        save->writeUInt16(dataBlock.ttlIn.data(), SAMPLES_PER_DATA_BLOCK);
+        numWordsWritten += SAMPLES_PER_DATA_BLOCK;
     }
 
     // Save board digital output data
     if (saveList.boardDigOut) {
         // Save all 16 channels, since we are writing 16-bit chunks of data.
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) { 
-            *save << (uint16_t)dataBlock.ttlOut[t];
-            ++numWordsWritten;
-        }
+        save->writeUInt16(dataBlock.ttlOut.data(), SAMPLES_PER_DATA_BLOCK);
+        numWordsWritten += SAMPLES_PER_DATA_BLOCK;
     }
 
     return numWordsWritten;
@@ -390,7 +406,391 @@ bool IntanSaveFormat::saveTemperature(const SaveList& saveList) {
 
 
 //  ------------------------------------------------------------------------
-MultiFileFormatWriter::MultiFileFormatWriter()
+CompressedSaveFormat::CompressedSaveFormat() :
+    payloadLength(0)
+{
+    // Blocks are never larger than in a .rhd file, so IntanSaveFormatLogic gives an upper bound on the size of the file
+    logic.reset(new IntanSaveFormatLogic());
+}
+
+CompressedSaveFormat::~CompressedSaveFormat() {
+    try {
+        close();
+    } catch (exception& e) {
+        cerr << "Error writing file: " << e.what() << endl;
+    }
+}
+
+void CompressedSaveFormat::open(const FILENAME& saveFileBaseName, const SaveList&) {
+    bool endsInDotRHC = false;
+    if (saveFileBaseName.length() >= 4) {
+        if (saveFileBaseName.substr(saveFileBaseName.length() - 4) == _T(".rhc")) {
+            endsInDotRHC = true;
+        }
+    }
+    blockIndex.clear();
+    createFileStream(endsInDotRHC ? saveFileBaseName : saveFileBaseName + _T(".rhc"), save, 256 * KILO, LARGE_STREAM_NUM_BUFFERS);
+}
+
+// Writes the block index and trailer, and closes the file
+void CompressedSaveFormat::close() {
+    if (save) {
+        uint64_t indexOffset = save->position();
+        for (unsigned int i = 0; i < blockIndex.size(); ++i) {
+            *save << blockIndex[i].offset;
+            *save << blockIndex[i].firstTimestamp;
+            *save << blockIndex[i].length;
+        }
+        *save << indexOffset;
+        *save << (uint32_t)blockIndex.size();
+        *save << (uint32_t)COMPRESSED_INDEX_MAGIC_NUMBER;
+
+        unique_ptr<BinaryWriter> closing(std::move(save));
+        closing->flush();
+    }
+    blockIndex.clear();
+}
+
+void CompressedSaveFormat::writeHeader(const SaveFormatHeaderInfo& header) {
+    checkOpen();
+    *save << (uint32_t)COMPRESSED_FILE_MAGIC_NUMBER;
+    *save << (uint16_t)COMPRESSED_FILE_MAIN_VERSION_NUMBER;
+    *save << (uint16_t)COMPRESSED_FILE_SECONDARY_VERSION_NUMBER;
+    writeHeaderInternal(*save, header);
+}
+
+bool CompressedSaveFormat::isOpen() const {
+    return save.get() != nullptr;
+}
+
+bool CompressedSaveFormat::saveTemperature(const SaveList& saveList) {
+    return saveList.saveTemp;
+}
+
+void CompressedSaveFormat::encodeRun(const uint32_t* values, unsigned int n) {
+    size_t needed = payloadLength + DeltaCodec::maxEncodedSize(n);
+    if (payload.size() < needed) {
+        payload.resize(2 * needed);
+    }
+    payloadLength += DeltaCodec::encode(values, n, payload.data() + payloadLength);
+}
+
+// Returns the number of (16-bit) words written, rounded up, so that writeQueueOfBlocks() reports compressed bytes
+int CompressedSaveFormat::writeBlockInternal(const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, const vector<double>& tempAvg)
+{
+    int t;
+    unsigned int i;
+
+    payloadLength = 0;
+    samples.resize(SAMPLES_PER_DATA_BLOCK);
+
+    // Timestamp data
+    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        samples[t] = dataBlock.timeStamp[t] - timestampOffset;
+    }
+    encodeRun(samples.data(), SAMPLES_PER_DATA_BLOCK);
+    int32_t firstTimestamp = static_cast<int32_t>(samples[0]);
+
+    // Amplifier data; each channel's samples are already contiguous, so they're encoded in place
+    for (i = 0; i < saveList.amplifier.size(); ++i) {
+        const vector<int>& data = dataBlock.amplifierData[saveList.amplifier.at(i)->boardStream][saveList.amplifier.at(i)->chipChannel];
+        encodeRun(reinterpret_cast<const uint32_t*>(data.data()), SAMPLES_PER_DATA_BLOCK);
+    }
+
+    // Auxiliary input data (1/4 amplifier sampling rate)
+    for (i = 0; i < saveList.auxInput.size(); ++i) {
+        const vector<int>& auxData = dataBlock.auxiliaryData[saveList.auxInput.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2];
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; t += 4) {
+            samples[t / 4] = auxData[t + saveList.auxInput.at(i)->chipChannel + 1];
+        }
+        encodeRun(samples.data(), SAMPLES_PER_DATA_BLOCK / 4);
+    }
+
+    // Supply voltage data (one sample per channel per block), as one run across channels
+    for (i = 0; i < saveList.supplyVoltage.size(); ++i) {
+        samples[i] = static_cast<uint16_t>(dataBlock.auxiliaryData[saveList.supplyVoltage.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][28]);
+    }
+    encodeRun(samples.data(), static_cast<unsigned int>(saveList.supplyVoltage.size()));
+
+    // Temperature sensor data if saveTemp == true, in degrees C multiplied by 100, as one run across sensors
+    if (saveList.saveTemp) {
+        for (i = 0; i < saveList.tempSensor.size(); ++i) {
+            samples[i] = static_cast<uint16_t>(static_cast<int16_t>(100.0 * tempAvg[saveList.tempSensor.at(i)->boardStream]));
+        }
+        encodeRun(samples.data(), static_cast<unsigned int>(saveList.tempSensor.size()));
+    }
+
+    // Board ADC data
+    for (i = 0; i < saveList.boardAdc.size(); ++i) {
+        const vector<int>& data = dataBlock.boardAdcData[saveList.boardAdc.at(i)->nativeChannelNumber];
+        encodeRun(reinterpret_cast<const uint32_t*>(data.data()), SAMPLES_PER_DATA_BLOCK);
+    }
+
+    // Board digital input data; all 16 channels if any are enabled
+    if (saveList.boardDigIn) {
+        encodeRun(reinterpret_cast<const uint32_t*>(dataBlock.ttlIn.data()), SAMPLES_PER_DATA_BLOCK);
+    }
+
+    // Board digital output data; all 16 channels
+    if (saveList.boardDigOut) {
+        encodeRun(reinterpret_cast<const uint32_t*>(dataBlock.ttlOut.data()), SAMPLES_PER_DATA_BLOCK);
+    }
+
+    BlockIndexEntry entry;
+    entry.offset = save->position();
+    entry.firstTimestamp = firstTimestamp;
+    entry.length = static_cast<uint32_t>(payloadLength);
+    blockIndex.push_back(entry);
+
+    *save << (uint32_t)payloadLength;
+    *save << DeltaCodec::checksum(payload.data(), payloadLength);
+    save->writeBytes(reinterpret_cast<const char*>(payload.data()), payloadLength);
+
+    return static_cast<int>((8 + payloadLength + 1) / 2);
+}
+
+//  ------------------------------------------------------------------------
+// Little-endian stores into a payload being built
+static inline void storeUInt16(uint8_t* p, uint16_t value) {
+    p[0] = static_cast<uint8_t>(value);
+    p[1] = static_cast<uint8_t>(value >> 8);
+}
+
+static inline void storeUInt32(uint8_t* p, uint32_t value) {
+    storeUInt16(p, static_cast<uint16_t>(value));
+    storeUInt16(p + 2, static_cast<uint16_t>(value >> 16));
+}
+
+static inline void storeUInt64(uint8_t* p, uint64_t value) {
+    storeUInt32(p, static_cast<uint32_t>(value));
+    storeUInt32(p + 4, static_cast<uint32_t>(value >> 32));
+}
+
+static inline void storeDouble(uint8_t* p, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    storeUInt64(p, bits);
+}
+
+ImpedanceCaptureWriter::ImpedanceCaptureWriter(double overheadBudget_) :
+    sweep(0),
+    overheadBudget(overheadBudget_),
+    captureSeconds(0.0),
+    dropped(0)
+{
+}
+
+ImpedanceCaptureWriter::~ImpedanceCaptureWriter() {
+    try {
+        close();
+    } catch (exception& e) {
+        cerr << "Error writing file: " << e.what() << endl;
+    }
+}
+
+void ImpedanceCaptureWriter::open(const FILENAME& saveFileBaseName, const SaveList&) {
+    bool endsInDotRHI = false;
+    if (saveFileBaseName.length() >= 4) {
+        if (saveFileBaseName.substr(saveFileBaseName.length() - 4) == _T(".rhi")) {
+            endsInDotRHI = true;
+        }
+    }
+    windowIndex.clear();
+    sweep = 0;
+    captureSeconds = 0.0;
+    dropped = 0;
+
+    // More buffers than usual, so that a slow disk shows up as pending buffers (and dropped windows) before a write has to wait
+    unique_ptr<FileOutStream> fs(new FileOutStream());
+    fs->open(endsInDotRHI ? saveFileBaseName : saveFileBaseName + _T(".rhi"));
+    save.reset(new BinaryWriter(std::move(fs), 64 * KILO, IMPEDANCE_CAPTURE_NUM_BUFFERS));
+    sweepBegan = std::chrono::steady_clock::now();
+}
+
+// Writes the window index and trailer, and closes the file
+void ImpedanceCaptureWriter::close() {
+    if (save) {
+        uint64_t indexOffset = save->position();
+        for (unsigned int i = 0; i < windowIndex.size(); ++i) {
+            *save << windowIndex[i].offset;
+            *save << windowIndex[i].sweep;
+            *save << windowIndex[i].dataSource;
+            *save << windowIndex[i].channel;
+            *save << windowIndex[i].capRange;
+            *save << (uint8_t)0;
+            *save << (uint16_t)0;
+            *save << windowIndex[i].numSamples;
+        }
+        *save << indexOffset;
+        *save << (uint32_t)windowIndex.size();
+        *save << (uint32_t)IMPEDANCE_CAPTURE_INDEX_MAGIC_NUMBER;
+
+        unique_ptr<BinaryWriter> closing(std::move(save));
+        closing->flush();
+    }
+    windowIndex.clear();
+}
+
+void ImpedanceCaptureWriter::writeHeader(const SaveFormatHeaderInfo& header) {
+    checkOpen();
+    *save << (uint32_t)IMPEDANCE_CAPTURE_MAGIC_NUMBER;
+    *save << (uint16_t)IMPEDANCE_CAPTURE_MAIN_VERSION_NUMBER;
+    *save << (uint16_t)IMPEDANCE_CAPTURE_SECONDARY_VERSION_NUMBER;
+    writeHeaderInternal(*save, header);
+}
+
+bool ImpedanceCaptureWriter::isOpen() const {
+    return save.get() != nullptr;
+}
+
+// Each sweep gets its own time budget, so the idle time between sweeps can't be saved up and spent capturing every window of
+// a later one
+void ImpedanceCaptureWriter::beginSweep() {
+    ++sweep;
+    captureSeconds = 0.0;
+    sweepBegan = std::chrono::steady_clock::now();
+}
+
+bool ImpedanceCaptureWriter::captureWindow(BoardControl& boardControl, int stream, int chipChannel, unsigned int dataSource, unsigned int channel, int capRange, std::complex<double> amplitude) {
+    checkOpen();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Drop the window rather than take more than our share of the time, or wait for the disk
+    double elapsed = std::chrono::duration<double>(start - sweepBegan).count();
+    if (captureSeconds > overheadBudget * elapsed || save->stream().buffersPending() >= IMPEDANCE_CAPTURE_NUM_BUFFERS - 1) {
+        ++dropped;
+        return false;
+    }
+
+    const deque<unique_ptr<Rhd2000DataBlock>>& dataQueue = boardControl.read.dataQueue;
+    const unsigned int numBlocks = static_cast<unsigned int>(dataQueue.size());
+    size_t needed = IMPEDANCE_CAPTURE_WINDOW_HEADER_SIZE + numBlocks * DeltaCodec::maxEncodedSize(SAMPLES_PER_DATA_BLOCK);
+    if (payload.size() < needed) {
+        payload.resize(needed);
+    }
+
+    uint8_t* p = payload.data();
+    storeUInt32(p, sweep);
+    storeUInt16(p + 4, static_cast<uint16_t>(dataSource));
+    storeUInt16(p + 6, static_cast<uint16_t>(channel));
+    p[8] = static_cast<uint8_t>(capRange);
+    p[9] = p[10] = p[11] = 0;
+    int64_t timeCaptured = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    storeUInt64(p + 12, static_cast<uint64_t>(timeCaptured));
+    storeDouble(p + 20, boardControl.boardSampleRate);
+    storeDouble(p + 28, boardControl.impedance.desiredImpedanceFreq);
+    storeDouble(p + 36, boardControl.impedance.actualImpedanceFreq);
+    storeUInt32(p + 44, static_cast<uint32_t>(boardControl.impedance.startIndex));
+    storeUInt32(p + 48, static_cast<uint32_t>(boardControl.impedance.endIndex));
+    storeDouble(p + 52, amplitude.real());
+    storeDouble(p + 60, amplitude.imag());
+    storeUInt32(p + 68, numBlocks * SAMPLES_PER_DATA_BLOCK);
+    size_t length = IMPEDANCE_CAPTURE_WINDOW_HEADER_SIZE;
+
+    // Raw samples; each block's are already contiguous, so they're encoded in place
+    for (unsigned int block = 0; block < numBlocks; ++block) {
+        const vector<int>& data = dataQueue[block]->amplifierData[stream][chipChannel];
+        length += DeltaCodec::encode(reinterpret_cast<const uint32_t*>(data.data()), SAMPLES_PER_DATA_BLOCK, payload.data() + length);
+    }
+
+    WindowIndexEntry entry;
+    entry.offset = save->position();
+    entry.sweep = sweep;
+    entry.dataSource = static_cast<uint16_t>(dataSource);
+    entry.channel = static_cast<uint16_t>(channel);
+    entry.capRange = static_cast<uint8_t>(capRange);
+    entry.numSamples = numBlocks * SAMPLES_PER_DATA_BLOCK;
+    windowIndex.push_back(entry);
+
+    *save << (uint32_t)length;
+    *save << DeltaCodec::checksum(payload.data(), length);
+    save->writeBytes(reinterpret_cast<const char*>(payload.data()), length);
+
+    captureSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+// Windows are written by captureWindow(); a capture file doesn't hold data blocks
+int ImpedanceCaptureWriter::writeBlockInternal(const SaveList&, const Rhd2000DataBlock&, int, const vector<double>&) {
+    throw std::logic_error("An impedance capture file holds measurement windows, not data blocks; use captureWindow().");
+}
+
+//  ------------------------------------------------------------------------
+EncoderPool::EncoderPool(unsigned int numThreads) :
+    job(nullptr),
+    jobTasks(0),
+    nextTask(0),
+    tasksDone(0),
+    generation(0),
+    stopping(false)
+{
+    for (unsigned int i = 0; i < numThreads; ++i) {
+        workers.push_back(std::thread(&EncoderPool::workerLoop, this));
+    }
+}
+
+EncoderPool::~EncoderPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    jobReady.notify_all();
+    for (unsigned int i = 0; i < workers.size(); ++i) {
+        workers[i].join();
+    }
+}
+
+void EncoderPool::run(unsigned int numTasks, const std::function<void(unsigned int)>& task) {
+    std::unique_lock<std::mutex> lock(mutex);
+    job = &task;
+    jobTasks = numTasks;
+    nextTask = 0;
+    tasksDone = 0;
+    error = nullptr;
+    ++generation;
+    jobReady.notify_all();
+
+    jobDone.wait(lock, [this] { return tasksDone == jobTasks; });
+    job = nullptr;
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void EncoderPool::workerLoop() {
+    unsigned int seenGeneration = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        jobReady.wait(lock, [&] { return stopping || (generation != seenGeneration && nextTask < jobTasks); });
+        if (stopping) {
+            return;
+        }
+        // Take tasks until there are none left in this job
+        while (nextTask < jobTasks) {
+            unsigned int taskIndex = nextTask++;
+            const std::function<void(unsigned int)>& task = *job;
+            lock.unlock();
+            std::exception_ptr taskError;
+            try {
+                task(taskIndex);
+            } catch (...) {
+                taskError = std::current_exception();
+            }
+            lock.lock();
+            if (taskError && !error) {
+                error = taskError;
+            }
+            if (++tasksDone == jobTasks) {
+                jobDone.notify_one();
+            }
+        }
+        seenGeneration = generation;
+    }
+}
+
+//  ------------------------------------------------------------------------
+MultiFileFormatWriter::MultiFileFormatWriter() :
+    numEncoderThreads(0)
 {
 }
 
@@ -408,6 +808,78 @@ void MultiFileFormatWriter::writeHeader(const SaveFormatHeaderInfo& header) {
     writeHeaderInternal(*infoFile, header);
 }
 
+void MultiFileFormatWriter::setNumEncoderThreads(unsigned int numThreads) {
+    numEncoderThreads = numThreads;
+    encoderPool.reset();
+}
+
+int MultiFileFormatWriter::encodeTimestamps(const Rhd2000DataBlock& dataBlock, int timestampOffset) {
+    timestampFile->writeInt32(dataBlock.timeStamp.data(), SAMPLES_PER_DATA_BLOCK, -timestampOffset);
+    return 2 * SAMPLES_PER_DATA_BLOCK;
+}
+
+int MultiFileFormatWriter::writeBlockInternal(const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, const vector<double>&) {
+    outputs.clear();
+    listOutputs(saveList, outputs);
+
+    int numWordsWritten = 0;
+    for (unsigned int o = 0; o < outputs.size(); ++o) {
+        numWordsWritten += encodeOutput(outputs[o], saveList, dataBlock, timestampOffset, scratch);
+    }
+    return numWordsWritten;
+}
+
+// Encodes the queue in parallel: output o belongs to worker (o % numWorkers), and each worker encodes every block of the
+// queue, in order, into the outputs it owns.  No two workers ever touch the same file, and run() joins them all before
+// we return, so flushing (and the next call) see every file complete.
+int MultiFileFormatWriter::writeQueueOfBlocks(BoardControl& boardControl, deque<unique_ptr<Rhd2000DataBlock>> &dataQueue, int timestampOffset, const std::vector<double>&) {
+    checkOpen();
+    const SaveList& saveList = *boardControl.saveList;
+
+    outputs.clear();
+    listOutputs(saveList, outputs);
+
+    unsigned int numThreads = numEncoderThreads;
+    if (numThreads == 0) {
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    unsigned int numWorkers = std::min(numThreads, static_cast<unsigned int>(outputs.size()));
+
+    int numWordsWritten = 0;
+    if (numWorkers <= 1 || dataQueue.empty()) {
+        for (unsigned int block = 0; block < dataQueue.size(); ++block) {
+            for (unsigned int o = 0; o < outputs.size(); ++o) {
+                numWordsWritten += encodeOutput(outputs[o], saveList, *dataQueue[block], timestampOffset, scratch);
+            }
+        }
+    } else {
+        if (!encoderPool || encoderPool->numThreads() != numWorkers) {
+            encoderPool.reset(new EncoderPool(numWorkers));
+        }
+        workerScratch.resize(numWorkers);
+        workerWords.assign(numWorkers, 0);
+
+        encoderPool->run(numWorkers, [&](unsigned int worker) {
+            int words = 0;
+            for (unsigned int block = 0; block < dataQueue.size(); ++block) {
+                for (unsigned int o = worker; o < outputs.size(); o += numWorkers) {
+                    words += encodeOutput(outputs[o], saveList, *dataQueue[block], timestampOffset, workerScratch[worker]);
+                }
+            }
+            workerWords[worker] = words;
+        });
+
+        for (unsigned int worker = 0; worker < numWorkers; ++worker) {
+            numWordsWritten += workerWords[worker];
+        }
+    }
+
+    flush(saveList);
+
+    // Return total number of bytes written to binary output stream
+    return (2 * numWordsWritten);
+}
+
 // Create filename (appended to the specified path) for timestamp data
 // and open timestamp save file.
 void MultiFileFormatWriter::createTimestampFile(const FILENAME& path)
@@ -447,7 +919,7 @@ void FilePerSignalFormat::open(const FILENAME& subdirPath, const SaveList& saveL
 void FilePerSignalFormat::createSignalTypeFiles(const FILENAME& path, const SaveList& saveList)
 {
     if (saveList.amplifier.size() > 0) {
-        createFileStream(path + _T("/") + _T("amplifier") + _T(".dat"), amplifierFile, 256 * KILO);
+        createFileStream(path + _T("/") + _T("amplifier") + _T(".dat"), amplifierFile, 256 * KILO, LARGE_STREAM_NUM_BUFFERS);
     }
     if (saveList.auxInput.size() > 0) {
         createFileStream(path + _T("/") + _T("auxiliary") + _T(".dat"), auxInputFile, 16 * KILO);
@@ -483,75 +955,85 @@ bool FilePerSignalFormat::isOpen() const {
     return timestampFile.get() != nullptr; // Just checking one, as we open/close them all together.  We could be more thorough.
 }
 
-int FilePerSignalFormat::writeBlockInternal(const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, const vector<double>&)
+void FilePerSignalFormat::listOutputs(const SaveList& saveList, vector<Output>& outputs)
 {
-    int t;
-    unsigned int i;
+    // Amplifier data is by far the largest, so list it first to give it a worker of its own
+    if (saveList.amplifier.size() > 0) outputs.push_back(Output(Output::Amplifier, 0));
+    outputs.push_back(Output(Output::Timestamp, 0));
+    if (saveList.auxInput.size() > 0) outputs.push_back(Output(Output::AuxInput, 0));
+    if (saveList.supplyVoltage.size() > 0) outputs.push_back(Output(Output::SupplyVoltage, 0));
+    if (saveList.boardAdc.size() > 0) outputs.push_back(Output(Output::BoardAdc, 0));
+    if (saveList.boardDigIn) outputs.push_back(Output(Output::BoardDigitalIn, 0));
+    if (saveList.boardDigOut) outputs.push_back(Output(Output::BoardDigitalOut, 0));
+}
 
-    int numWordsWritten = 0;
+int FilePerSignalFormat::encodeOutput(const Output& output, const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, vector<int>& scratch)
+{
+    int t, tAux;
+    unsigned int i;
+    size_t n = 0;
 
-    int tAux;
-    // Save timestamp data
-    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-        *timestampFile << ((int32_t)dataBlock.timeStamp[t]) - ((int32_t)timestampOffset);
-    }
-    numWordsWritten += 2 * SAMPLES_PER_DATA_BLOCK;
+    // This format interleaves channels within each file, so gather each signal type (sample-major) into 'scratch' and write
+    // it in one bulk write
+    switch (output.kind) {
+    case Output::Timestamp:
+        return encodeTimestamps(dataBlock, timestampOffset);
 
-    // Save amplifier data
-    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-        for (i = 0; i < saveList.amplifier.size(); ++i) {
-            *amplifierFile << (int16_t) (dataBlock.amplifierData[saveList.amplifier.at(i)->boardStream][saveList.amplifier.at(i)->chipChannel][t] - 32768);
+    case Output::Amplifier:
+        scratch.resize(SAMPLES_PER_DATA_BLOCK * saveList.amplifier.size());
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            for (i = 0; i < saveList.amplifier.size(); ++i) {
+                scratch[n++] = dataBlock.amplifierData[saveList.amplifier.at(i)->boardStream][saveList.amplifier.at(i)->chipChannel][t];
+            }
         }
-    }
-	numWordsWritten += static_cast<unsigned int>(saveList.amplifier.size()) * SAMPLES_PER_DATA_BLOCK;
+        amplifierFile->writeInt16(scratch.data(), n, -32768);
+        return static_cast<int>(n);
 
-    // Save auxiliary input data
-    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-        tAux = 4 * (int)floor((double)t / 4.0);
-        for (i = 0; i < saveList.auxInput.size(); ++i) {
-            *auxInputFile << (uint16_t) dataBlock.auxiliaryData[saveList.auxInput.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][tAux + saveList.auxInput.at(i)->chipChannel + 1];
+    case Output::AuxInput:
+        scratch.resize(SAMPLES_PER_DATA_BLOCK * saveList.auxInput.size());
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            tAux = 4 * (t / 4);
+            for (i = 0; i < saveList.auxInput.size(); ++i) {
+                scratch[n++] = dataBlock.auxiliaryData[saveList.auxInput.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][tAux + saveList.auxInput.at(i)->chipChannel + 1];
+            }
         }
-    }
-	numWordsWritten += static_cast<unsigned int>(saveList.auxInput.size()) * SAMPLES_PER_DATA_BLOCK;
+        auxInputFile->writeUInt16(scratch.data(), n);
+        return static_cast<int>(n);
 
-    // Save supply voltage data
-    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-        for (i = 0; i < saveList.supplyVoltage.size(); ++i) {
-            *supplyFile << (uint16_t) dataBlock.auxiliaryData[saveList.supplyVoltage.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][28];
+    case Output::SupplyVoltage:
+        scratch.resize(SAMPLES_PER_DATA_BLOCK * saveList.supplyVoltage.size());
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            for (i = 0; i < saveList.supplyVoltage.size(); ++i) {
+                scratch[n++] = dataBlock.auxiliaryData[saveList.supplyVoltage.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][28];
+            }
         }
-    }
-	numWordsWritten += static_cast<unsigned int>(saveList.supplyVoltage.size()) * SAMPLES_PER_DATA_BLOCK;
+        supplyFile->writeUInt16(scratch.data(), n);
+        return static_cast<int>(n);
 
     // Not saving temperature data in this save format.
 
-    // Save board ADC data
-    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-        for (i = 0; i < saveList.boardAdc.size(); ++i) {
-            *adcInputFile << (uint16_t) dataBlock.boardAdcData[saveList.boardAdc.at(i)->nativeChannelNumber][t];
-        }
-    }
-	numWordsWritten += static_cast<unsigned int>(saveList.boardAdc.size()) * SAMPLES_PER_DATA_BLOCK;
-
-    // Save board digital input data
-    if (saveList.boardDigIn) {
+    case Output::BoardAdc:
+        scratch.resize(SAMPLES_PER_DATA_BLOCK * saveList.boardAdc.size());
         for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            // If ANY digital inputs are enabled, we save ALL 16 channels, since
-            // we are writing 16-bit chunks of data.
-            *digitalInputFile << (uint16_t)dataBlock.ttlIn[t];
-            ++numWordsWritten;
+            for (i = 0; i < saveList.boardAdc.size(); ++i) {
+                scratch[n++] = dataBlock.boardAdcData[saveList.boardAdc.at(i)->nativeChannelNumber][t];
+            }
         }
-    }
+        adcInputFile->writeUInt16(scratch.data(), n);
+        return static_cast<int>(n);
 
-    // Save board digital output data
-    if (saveList.boardDigOut) {
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            // Save all 16 channels, since we are writing 16-bit chunks of data.
-            *digitalOutputFile << (uint16_t)dataBlock.ttlOut[t];
-            ++numWordsWritten;
-        }
-    }
+    case Output::BoardDigitalIn:
+        // If ANY digital inputs are enabled, we save ALL 16 channels, since
+        // we are writing 16-bit chunks of data.
+        digitalInputFile->writeUInt16(dataBlock.ttlIn.data(), SAMPLES_PER_DATA_BLOCK);
+        return SAMPLES_PER_DATA_BLOCK;
 
-    return numWordsWritten;
+    case Output::BoardDigitalOut:
+        // Save all 16 channels, since we are writing 16-bit chunks of data.
+        digitalOutputFile->writeUInt16(dataBlock.ttlOut.data(), SAMPLES_PER_DATA_BLOCK);
+        return SAMPLES_PER_DATA_BLOCK;
+    }
+    return 0;
 }
 
 int FilePerSignalLogic::bytesPerBlockAux(const SaveList& saveList) {
@@ -598,6 +1080,25 @@ void FilePerChannelFormat::open(const FILENAME& subdirPath, const SaveList&) {
     createInfoFile(subdirPath + _T("/") + _T("info.rhd"));
 }
 
+// Name of the file (in directory 'path') holding one channel's data, in the "One File Per Channel" format
+static FILENAME channelFileName(const FILENAME& path, const SignalChannel& channel)
+{
+    FILENAME nativeChannelName = toFileName(channel.nativeChannelName);
+    switch (channel.signalType) {
+    case AmplifierSignal:
+        return path + _T("/") + _T("amp-") + nativeChannelName + _T(".dat");
+    case AuxInputSignal:
+        return path + _T("/") + _T("aux-") + nativeChannelName + _T(".dat");
+    case SupplyVoltageSignal:
+        return path + _T("/") + _T("vdd-") + nativeChannelName + _T(".dat");
+    case BoardAdcSignal:
+    case BoardDigInSignal:
+    case BoardDigOutSignal:
+    default:
+        return path + _T("/") + _T("board-") + nativeChannelName + _T(".dat");
+    }
+}
+
 // Create filenames (appended to the specified path) for each waveform
 // and open individual save data files for all enabled waveforms.
 void FilePerChannelFormat::createSaveFiles(const FILENAME& path)
@@ -607,31 +1108,8 @@ void FilePerChannelFormat::createSaveFiles(const FILENAME& path)
             SignalChannel* currentChannel = signalSources.signalPort[port].channelByNativeOrder(index);
             // Only create filenames for enabled channels.
             if (currentChannel->enabled) {
-                FILENAME name;
-                FILENAME nativeChannelName = toFileName(currentChannel->nativeChannelName);
-                switch (currentChannel->signalType) {
-                case AmplifierSignal:
-                    name = path + _T("/") + _T("amp-") + nativeChannelName + _T(".dat");
-                    break;
-                case AuxInputSignal:
-                    name = path + _T("/") + _T("aux-") + nativeChannelName + _T(".dat");
-                    break;
-                case SupplyVoltageSignal:
-                    name = path + _T("/") + _T("vdd-") + nativeChannelName + _T(".dat");
-                    break;
-                case BoardAdcSignal:
-                    name = path + _T("/") + _T("board-") + nativeChannelName + _T(".dat");
-                    break;
-                case BoardDigInSignal:
-                    name = path + _T("/") + _T("board-") + nativeChannelName + _T(".dat");
-                    break;
-                case BoardDigOutSignal:
-                    name = path + _T("/") + _T("board-") + nativeChannelName + _T(".dat");
-                    break;
-                }
-
                 unique_ptr<BinaryWriter> tmp;
-                createFileStream(name, tmp, 4 * KILO);
+                createFileStream(channelFileName(path, *currentChannel), tmp, 4 * KILO);
                 currentChannel->saveFile.reset(tmp.release());
             }
         }
@@ -661,80 +1139,74 @@ bool FilePerChannelFormat::isOpen() const {
     return timestampFile.get() != nullptr; // Just checking one, as we open/close them all together.  We could be more thorough.
 }
 
-int FilePerChannelFormat::writeBlockInternal(const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, const vector<double>&)
+void FilePerChannelFormat::listOutputs(const SaveList& saveList, vector<Output>& outputs)
 {
-    int t, j;
     unsigned int i;
-
-    int numWordsWritten = 0;
-
-    // Save timestamp data
-    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-        *timestampFile << ((int32_t)dataBlock.timeStamp[t]) - ((int32_t)timestampOffset);
-    }
-    numWordsWritten += 2 * SAMPLES_PER_DATA_BLOCK;
-
-    // Save amplifier data to dataStreamBufferArray; In in effort to increase write speed we will
-    // collect amplifier data from all data blocks and then write all data at the end of this function.
-    for (i = 0; i < saveList.amplifier.size(); ++i) {
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            *saveList.amplifier.at(i)->saveFile << (int16_t)
-                (dataBlock.amplifierData[saveList.amplifier.at(i)->boardStream][saveList.amplifier.at(i)->chipChannel][t] - 32768);
-        }
-        numWordsWritten += SAMPLES_PER_DATA_BLOCK;
+    outputs.push_back(Output(Output::Timestamp, 0));
+    for (i = 0; i < saveList.amplifier.size(); ++i) outputs.push_back(Output(Output::Amplifier, i));
+    for (i = 0; i < saveList.auxInput.size(); ++i) outputs.push_back(Output(Output::AuxInput, i));
+    for (i = 0; i < saveList.supplyVoltage.size(); ++i) outputs.push_back(Output(Output::SupplyVoltage, i));
+    // Not saving temperature data in this save format.
+    for (i = 0; i < saveList.boardAdc.size(); ++i) outputs.push_back(Output(Output::BoardAdc, i));
+    for (i = 0; i < saveList.boardDigitalIn.size(); ++i) outputs.push_back(Output(Output::BoardDigitalIn, i));
+    if (saveList.boardDigOut) {
+        for (i = 0; i < NUM_DIGITAL_OUTPUTS; ++i) outputs.push_back(Output(Output::BoardDigitalOut, i));
     }
+}
 
-    // Save auxiliary input data
-    for (i = 0; i < saveList.auxInput.size(); ++i) {
+int FilePerChannelFormat::encodeOutput(const Output& output, const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, vector<int>& scratch)
+{
+    int t, j;
+    const unsigned int i = output.index;
+    scratch.resize(SAMPLES_PER_DATA_BLOCK);
+
+    switch (output.kind) {
+    case Output::Timestamp:
+        return encodeTimestamps(dataBlock, timestampOffset);
+
+    case Output::Amplifier:
+        // Each channel's samples are already contiguous, so they go out in one bulk write
+        saveList.amplifier.at(i)->saveFile->writeInt16(
+            dataBlock.amplifierData[saveList.amplifier.at(i)->boardStream][saveList.amplifier.at(i)->chipChannel].data(), SAMPLES_PER_DATA_BLOCK, -32768);
+        break;
+
+    case Output::AuxInput:
+    {
+        const vector<int>& auxData = dataBlock.auxiliaryData[saveList.auxInput.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2];
         for (t = 0; t < SAMPLES_PER_DATA_BLOCK; t += 4) {
             for (j = 0; j < 4; ++j) {   // Aux data is sampled at 1/4 amplifier sampling rate; write each sample 4 times
-                *(saveList.auxInput.at(i)->saveFile) << (uint16_t)
-                    dataBlock.auxiliaryData[saveList.auxInput.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][t + saveList.auxInput.at(i)->chipChannel + 1];
+                scratch[t + j] = auxData[t + saveList.auxInput.at(i)->chipChannel + 1];
             }
         }
-        numWordsWritten += SAMPLES_PER_DATA_BLOCK;
+        saveList.auxInput.at(i)->saveFile->writeUInt16(scratch.data(), SAMPLES_PER_DATA_BLOCK);
+        break;
     }
 
-    // Save supply voltage data
-    for (i = 0; i < saveList.supplyVoltage.size(); ++i) {
-        for (j = 0; j < SAMPLES_PER_DATA_BLOCK; ++j) {   // Vdd data is sampled at 1/60 amplifier sampling rate; write each sample 60 times
-            *saveList.supplyVoltage.at(i)->saveFile << (uint16_t)
-                dataBlock.auxiliaryData[saveList.supplyVoltage.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][28];
-        }
-        numWordsWritten += SAMPLES_PER_DATA_BLOCK;
-    }
+    case Output::SupplyVoltage:
+        // Vdd data is sampled at 1/60 amplifier sampling rate; write each sample 60 times
+        std::fill(scratch.begin(), scratch.end(), dataBlock.auxiliaryData[saveList.supplyVoltage.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][28]);
+        saveList.supplyVoltage.at(i)->saveFile->writeUInt16(scratch.data(), SAMPLES_PER_DATA_BLOCK);
+        break;
 
-    // Not saving temperature data in this save format.
+    case Output::BoardAdc:
+        saveList.boardAdc.at(i)->saveFile->writeUInt16(dataBlock.boardAdcData[saveList.boardAdc.at(i)->nativeChannelNumber].data(), SAMPLES_PER_DATA_BLOCK);
+        break;
 
-    // Save board ADC data
-    for (i = 0; i < saveList.boardAdc.size(); ++i) {
+    case Output::BoardDigitalIn:
         for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            *saveList.boardAdc.at(i)->saveFile << (uint16_t)
-                dataBlock.boardAdcData[saveList.boardAdc.at(i)->nativeChannelNumber][t];
+            scratch[t] = (dataBlock.ttlIn[t] & (1 << saveList.boardDigitalIn.at(i)->nativeChannelNumber)) != 0;
         }
-        numWordsWritten += SAMPLES_PER_DATA_BLOCK;
-    }
+        saveList.boardDigitalIn.at(i)->saveFile->writeUInt16(scratch.data(), SAMPLES_PER_DATA_BLOCK);
+        break;
 
-    // Save board digital input data
-    for (i = 0; i < saveList.boardDigitalIn.size(); ++i) {
+    case Output::BoardDigitalOut:
         for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            *saveList.boardDigitalIn.at(i)->saveFile << (uint16_t)
-                ((dataBlock.ttlIn[t] & (1 << saveList.boardDigitalIn.at(i)->nativeChannelNumber)) != 0);
+            scratch[t] = (dataBlock.ttlOut[t] & (1 << i)) != 0;
         }
-        numWordsWritten += SAMPLES_PER_DATA_BLOCK;
+        saveList.boardDigitalOut.at(i)->saveFile->writeUInt16(scratch.data(), SAMPLES_PER_DATA_BLOCK);
+        break;
     }
-
-    // Save board digital output data
-    if (saveList.boardDigOut) {
-        for (i = 0; i < NUM_DIGITAL_OUTPUTS; ++i) {
-            for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-                *saveList.boardDigitalOut.at(i)->saveFile << (uint16_t)
-                    ((dataBlock.ttlOut[t] & (1 << i)) != 0);
-            }
-            numWordsWritten += SAMPLES_PER_DATA_BLOCK;
-        }
-    }
-    return numWordsWritten;
+    return SAMPLES_PER_DATA_BLOCK;
 }
 
 int FilePerChannelFormatLogic::bytesPerBlockAux(const SaveList& saveList) {
@@ -790,10 +1262,10 @@ void SaveFormatReader::readHeaderInternal(BinaryReader &inStream, SaveFormatHead
     inStream >> header.note2;
     inStream >> header.note3;
 
+    numTempSensorsSaved = 0;
     if (header.version >= Version(1, 1)) { // version 1.1 addition
         inStream >> itmp;
-        // Ignore for now
-        //    int16_t saveNumTempSensors = saveTemperature(*header.boardControl.saveList) ? header.boardControl.getNumTempSensors() : 0;
+        numTempSensorsSaved = itmp;
     }
 
     if (header.version >= Version(1, 3)) { // version 1.3 addition
@@ -839,10 +1311,43 @@ void SaveFormatReader::readBlock(Rhd2000DataBlock& dataBlock, std::vector<double
 }
 
 //  ------------------------------------------------------------------------
+// Little-endian loads from raw file bytes (which needn't be aligned)
+static inline uint16_t loadUInt16(const char* p) {
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<uint16_t>(b[0] | (b[1] << 8));
+}
+
+static inline int32_t loadInt32(const char* p) {
+    const unsigned char* b = reinterpret_cast<const unsigned char*>(p);
+    return static_cast<int32_t>(static_cast<uint32_t>(b[0]) | (static_cast<uint32_t>(b[1]) << 8) |
+                                (static_cast<uint32_t>(b[2]) << 16) | (static_cast<uint32_t>(b[3]) << 24));
+}
+
+static inline uint64_t loadUInt64(const char* p) {
+    return static_cast<uint32_t>(loadInt32(p)) | (static_cast<uint64_t>(static_cast<uint32_t>(loadInt32(p + 4))) << 32);
+}
+
+static inline double loadDouble(const char* p) {
+    uint64_t bits = loadUInt64(p);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+static void checkIndex(const vector<SignalChannel*>& channels, unsigned int index) {
+    if (index >= channels.size()) {
+        throw std::out_of_range("No such channel was saved.");
+    }
+}
 
-IntanSaveFormatReader::IntanSaveFormatReader()
+//  ------------------------------------------------------------------------
+
+IntanSaveFormatReader::IntanSaveFormatReader() :
+    dataStart(0),
+    fileSize(0)
 {
     logic.reset(new IntanSaveFormatLogic());
+    memset(&layout, 0, sizeof(layout));
 }
 
 IntanSaveFormatReader::~IntanSaveFormatReader() {
@@ -850,7 +1355,11 @@ IntanSaveFormatReader::~IntanSaveFormatReader() {
 }
 
 void IntanSaveFormatReader::open(const FILENAME& saveFileName) {
-    createFileStream(saveFileName, save);
+    unique_ptr<InStream> in = openInStream(saveFileName);
+    if (!in) {
+        throw std::runtime_error("Cannot open file for reading.");
+    }
+    save.reset(new BinaryReader(std::move(in)));
 }
 
 void IntanSaveFormatReader::close() {
@@ -863,13 +1372,27 @@ void IntanSaveFormatReader::readHeader(SaveFormatHeaderInfo& header) {
 
     saveList.import(header.boardControl.signalSources);
     saveList.setDigOutFromChannels(header.boardControl.signalSources);
+    saveList.saveTemp = (numTempSensorsSaved > 0);
+
+    // Lay out a block exactly as IntanSaveFormat::writeBlockInternal() writes it
+    const uint64_t wordsPerChannel = SAMPLES_PER_DATA_BLOCK;
+    layout.amplifier = 4 * SAMPLES_PER_DATA_BLOCK;
+    layout.auxInput = layout.amplifier + 2 * wordsPerChannel * saveList.amplifier.size();
+    layout.supplyVoltage = layout.auxInput + 2 * (SAMPLES_PER_DATA_BLOCK / 4) * saveList.auxInput.size();
+    layout.temperature = layout.supplyVoltage + 2 * saveList.supplyVoltage.size();
+    layout.boardAdc = layout.temperature + (saveList.saveTemp ? 2 * saveList.tempSensor.size() : 0);
+    layout.boardDigIn = layout.boardAdc + 2 * wordsPerChannel * saveList.boardAdc.size();
+    layout.boardDigOut = layout.boardDigIn + (saveList.boardDigIn ? 2 * wordsPerChannel : 0);
+    layout.size = layout.boardDigOut + (saveList.boardDigOut ? 2 * wordsPerChannel : 0);
+
+    dataStart = save->position();
+    fileSize = dataStart + save->bytesRemaining();
 }
 
 unsigned int IntanSaveFormatReader::numBlocksRemaining() {
     uint64_t bytesRemaining = save->bytesRemaining();
-    unsigned int blockSize = logic->bytesPerBlock(saveList);
-    if (bytesRemaining % blockSize == 0) {
-        return static_cast<unsigned int>(bytesRemaining / blockSize);
+    if (bytesRemaining % layout.size == 0) {
+        return static_cast<unsigned int>(bytesRemaining / layout.size);
     }
     else {
         throw std::invalid_argument("Error in parser - invalid number of blocks detected.");
@@ -880,75 +1403,785 @@ bool IntanSaveFormatReader::isOpen() const {
     return save.get() != nullptr;
 }
 
+bool IntanSaveFormatReader::isMapped() {
+    return save && save->mappedData() != nullptr;
+}
+
+unsigned int IntanSaveFormatReader::numBlocks() {
+    return static_cast<unsigned int>((fileSize - dataStart) / layout.size);
+}
+
+void IntanSaveFormatReader::seekToBlock(unsigned int block) {
+    checkOpen();
+    if (block > numBlocks()) {
+        throw std::out_of_range("Block number is past the end of the file.");
+    }
+    save->seek(dataStart + block * layout.size);
+}
+
+unsigned int IntanSaveFormatReader::findBlock(int32_t timestamp) {
+    checkOpen();
+    uint64_t position = save->position();
+
+    // Last block whose first timestamp is <= 'timestamp'
+    unsigned int low = 0, high = numBlocks();
+    while (low < high) {
+        unsigned int mid = (low + high) / 2;
+        int32_t first;
+        save->seek(dataStart + mid * layout.size);
+        *save >> first;
+        if (first <= timestamp) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    save->seek(position);
+    return (low > 0) ? low - 1 : 0;
+}
+
+void IntanSaveFormatReader::prefetch(unsigned int firstBlock, unsigned int count) {
+    checkOpen();
+    save->prefetch(dataStart + firstBlock * layout.size, count * layout.size);
+}
+
+const char* IntanSaveFormatReader::blockRange(unsigned int firstBlock, unsigned int count) {
+    checkOpen();
+    const char* mapped = save->mappedData();
+    if (mapped == nullptr) {
+        throw std::runtime_error("File is not memory mapped.");
+    }
+    if (static_cast<uint64_t>(firstBlock) + count > numBlocks()) {
+        throw std::out_of_range("Block range is past the end of the file.");
+    }
+    return mapped + dataStart + firstBlock * layout.size;
+}
+
+SampleView<int32_t> IntanSaveFormatReader::timestamps(unsigned int firstBlock, unsigned int count) {
+    return SampleView<int32_t>(blockRange(firstBlock, count), layout.size, SAMPLES_PER_DATA_BLOCK, count);
+}
+
+SampleView<uint16_t> IntanSaveFormatReader::samples(SignalType type, unsigned int index, unsigned int firstBlock, unsigned int count) {
+    const char* range = blockRange(firstBlock, count);
+    switch (type) {
+    case AmplifierSignal:
+        checkIndex(saveList.amplifier, index);
+        return SampleView<uint16_t>(range + layout.amplifier + 2 * SAMPLES_PER_DATA_BLOCK * index, layout.size, SAMPLES_PER_DATA_BLOCK, count);
+    case AuxInputSignal:
+        checkIndex(saveList.auxInput, index);
+        return SampleView<uint16_t>(range + layout.auxInput + 2 * (SAMPLES_PER_DATA_BLOCK / 4) * index, layout.size, SAMPLES_PER_DATA_BLOCK / 4, count);
+    case SupplyVoltageSignal:
+        checkIndex(saveList.supplyVoltage, index);
+        return SampleView<uint16_t>(range + layout.supplyVoltage + 2 * index, layout.size, 1, count);
+    case BoardAdcSignal:
+        checkIndex(saveList.boardAdc, index);
+        return SampleView<uint16_t>(range + layout.boardAdc + 2 * SAMPLES_PER_DATA_BLOCK * index, layout.size, SAMPLES_PER_DATA_BLOCK, count);
+    case BoardDigInSignal:
+        if (!saveList.boardDigIn) {
+            throw std::out_of_range("Digital inputs were not saved.");
+        }
+        return SampleView<uint16_t>(range + layout.boardDigIn, layout.size, SAMPLES_PER_DATA_BLOCK, count);
+    case BoardDigOutSignal:
+    default:
+        if (!saveList.boardDigOut) {
+            throw std::out_of_range("Digital outputs were not saved.");
+        }
+        return SampleView<uint16_t>(range + layout.boardDigOut, layout.size, SAMPLES_PER_DATA_BLOCK, count);
+    }
+}
+
+SampleView<int16_t> IntanSaveFormatReader::temperatures(unsigned int index, unsigned int firstBlock, unsigned int count) {
+    if (!saveList.saveTemp) {
+        throw std::out_of_range("Temperatures were not saved.");
+    }
+    checkIndex(saveList.tempSensor, index);
+    return SampleView<int16_t>(blockRange(firstBlock, count) + layout.temperature + 2 * index, layout.size, 1, count);
+}
+
+// Parses a whole block at once, straight out of the mapping if the file is mapped
 void IntanSaveFormatReader::readBlockInternal(Rhd2000DataBlock &dataBlock, vector<double>& tempAvg)
 {
     unsigned int t, i;
-    int32_t tmpI32;
-    uint16_t tmpU16;
-    int16_t tmpI16;
+    const char* block;
+    const char* mapped = save->mappedData();
+    if (mapped != nullptr) {
+        uint64_t position = save->position();
+        if (save->bytesRemaining() < layout.size) {
+            throw std::runtime_error("No more data");
+        }
+        block = mapped + position;
+        save->seek(position + layout.size);
+    } else {
+        buffer.resize(layout.size);
+        save->readBytes(buffer.data(), layout.size);
+        block = buffer.data();
+    }
 
-    // Save timestamp data
+    // Timestamp data
     for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-        *save >> tmpI32;
-        dataBlock.timeStamp[t] = tmpI32;
+        dataBlock.timeStamp[t] = loadInt32(block + 4 * t);
     }
 
-    // Save amplifier data
+    // Amplifier data
+    const char* p = block + layout.amplifier;
     for (i = 0; i < saveList.amplifier.size(); ++i) {
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            *save >> tmpU16;
-            dataBlock.amplifierData[saveList.amplifier.at(i)->boardStream][saveList.amplifier.at(i)->chipChannel][t] = tmpU16;
+        vector<int>& data = dataBlock.amplifierData[saveList.amplifier.at(i)->boardStream][saveList.amplifier.at(i)->chipChannel];
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t, p += 2) {
+            data[t] = loadUInt16(p);
         }
     }
 
-    // Save auxiliary input data
+    // Auxiliary input data
     for (i = 0; i < saveList.auxInput.size(); ++i) {
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; t += 4) {
-            *save >> tmpU16;
-            dataBlock.auxiliaryData[saveList.auxInput.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][t + saveList.auxInput.at(i)->chipChannel + 1] = tmpU16;
+        vector<int>& auxData = dataBlock.auxiliaryData[saveList.auxInput.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2];
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; t += 4, p += 2) {
+            auxData[t + saveList.auxInput.at(i)->chipChannel + 1] = loadUInt16(p);
         }
     }
 
-    // Save supply voltage data
-    for (i = 0; i < saveList.supplyVoltage.size(); ++i) {
-        *save >> tmpU16;
-        dataBlock.auxiliaryData[saveList.supplyVoltage.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][28] = tmpU16;
+    // Supply voltage data
+    for (i = 0; i < saveList.supplyVoltage.size(); ++i, p += 2) {
+        dataBlock.auxiliaryData[saveList.supplyVoltage.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][28] = loadUInt16(p);
     }
 
-    // Save temperature sensor data if saveTemp == true
-    // Save as temperature in degrees C, multiplied by 100 and rounded to the nearest
+    // Temperature sensor data, saved as temperature in degrees C, multiplied by 100 and rounded to the nearest
     // signed integer.
     if (saveList.saveTemp) {
-        for (i = 0; i < saveList.tempSensor.size(); ++i) {
-            *save >> tmpI16;
-            tempAvg[saveList.tempSensor.at(i)->boardStream] = tmpI16 / 100.0;
+        for (i = 0; i < saveList.tempSensor.size(); ++i, p += 2) {
+            tempAvg[saveList.tempSensor.at(i)->boardStream] = static_cast<int16_t>(loadUInt16(p)) / 100.0;
         }
     }
 
-    // Save board ADC data
+    // Board ADC data
     for (i = 0; i < saveList.boardAdc.size(); ++i) {
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            *save >> tmpU16;
-            dataBlock.boardAdcData[saveList.boardAdc.at(i)->nativeChannelNumber][t] = tmpU16;
+        vector<int>& data = dataBlock.boardAdcData[saveList.boardAdc.at(i)->nativeChannelNumber];
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t, p += 2) {
+            data[t] = loadUInt16(p);
         }
     }
 
-    // Save board digital input data
+    // Board digital input data (all 16 channels, if any were saved)
     if (saveList.boardDigIn) {
-        // If ANY digital inputs are enabled, we save ALL 16 channels, since
-        // we are writing 16-bit chunks of data.
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            *save >> tmpU16;
-            dataBlock.ttlIn[t] = tmpU16;
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t, p += 2) {
+            dataBlock.ttlIn[t] = loadUInt16(p);
         }
     }
 
-    // Save board digital output data
+    // Board digital output data (all 16 channels)
     if (saveList.boardDigOut) {
-        // Save all 16 channels, since we are writing 16-bit chunks of data.
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t, p += 2) {
+            dataBlock.ttlOut[t] = loadUInt16(p);
+        }
+    }
+}
+
+//  ------------------------------------------------------------------------
+
+FilePerChannelFormatReader::FilePerChannelFormatReader() :
+    numBlocksInFiles(0),
+    nextBlock(0)
+{
+    logic.reset(new FilePerChannelFormatLogic());
+}
+
+FilePerChannelFormatReader::~FilePerChannelFormatReader() {
+    close();
+}
+
+void FilePerChannelFormatReader::open(const FILENAME& subdirPath) {
+    close();
+    unique_ptr<InStream> in = openInStream(subdirPath + _T("/") + _T("info.rhd"));
+    if (!in) {
+        throw std::runtime_error("Cannot open info.rhd for reading.");
+    }
+    infoFile.reset(new BinaryReader(std::move(in)));
+    path = subdirPath;
+}
+
+void FilePerChannelFormatReader::close() {
+    infoFile.reset();
+    timestampFile.reset();
+    amplifierFiles.clear();
+    auxInputFiles.clear();
+    supplyFiles.clear();
+    boardAdcFiles.clear();
+    digitalInputFiles.clear();
+    digitalOutputFiles.clear();
+    numBlocksInFiles = 0;
+    nextBlock = 0;
+}
+
+void FilePerChannelFormatReader::openChannelFiles(const vector<SignalChannel*>& channels, vector<unique_ptr<BinaryReader>>& files) {
+    files.clear();
+    for (unsigned int i = 0; i < channels.size(); ++i) {
+        unique_ptr<InStream> in = openInStream(channelFileName(path, *channels[i]));
+        if (!in) {
+            throw std::runtime_error("Cannot open a channel's data file for reading.");
+        }
+        numBlocksInFiles = std::min(numBlocksInFiles, static_cast<unsigned int>(in->bytesRemaining() / (2 * SAMPLES_PER_DATA_BLOCK)));
+        files.push_back(unique_ptr<BinaryReader>(new BinaryReader(std::move(in))));
+    }
+}
+
+void FilePerChannelFormatReader::readHeader(SaveFormatHeaderInfo& header) {
+    checkOpen();
+    readHeaderInternal(*infoFile, header);
+
+    saveList.import(header.boardControl.signalSources);
+    saveList.setDigOutFromChannels(header.boardControl.signalSources);
+
+    unique_ptr<InStream> in = openInStream(path + _T("/") + _T("time") + _T(".dat"));
+    if (!in) {
+        throw std::runtime_error("Cannot open time.dat for reading.");
+    }
+    // A recording cut short may have a partial block at the end of some files; only whole blocks in every file count
+    numBlocksInFiles = static_cast<unsigned int>(in->bytesRemaining() / (4 * SAMPLES_PER_DATA_BLOCK));
+    timestampFile.reset(new BinaryReader(std::move(in)));
+
+    openChannelFiles(saveList.amplifier, amplifierFiles);
+    openChannelFiles(saveList.auxInput, auxInputFiles);
+    openChannelFiles(saveList.supplyVoltage, supplyFiles);
+    openChannelFiles(saveList.boardAdc, boardAdcFiles);
+    openChannelFiles(saveList.boardDigitalIn, digitalInputFiles);
+    if (saveList.boardDigOut) {
+        openChannelFiles(saveList.boardDigitalOut, digitalOutputFiles);
+    }
+    nextBlock = 0;
+}
+
+unsigned int FilePerChannelFormatReader::numBlocksRemaining() {
+    return numBlocksInFiles - nextBlock;
+}
+
+bool FilePerChannelFormatReader::isOpen() const {
+    return infoFile.get() != nullptr;
+}
+
+bool FilePerChannelFormatReader::isMapped() {
+    return timestampFile && timestampFile->mappedData() != nullptr;
+}
+
+void FilePerChannelFormatReader::seekToBlock(unsigned int block) {
+    if (block > numBlocksInFiles) {
+        throw std::out_of_range("Block number is past the end of the file.");
+    }
+    nextBlock = block;
+}
+
+unsigned int FilePerChannelFormatReader::findBlock(int32_t timestamp) {
+    checkOpen();
+
+    // Last block whose first timestamp is <= 'timestamp'
+    unsigned int low = 0, high = numBlocksInFiles;
+    while (low < high) {
+        unsigned int mid = (low + high) / 2;
+        int32_t first;
+        timestampFile->seek(static_cast<uint64_t>(mid) * 4 * SAMPLES_PER_DATA_BLOCK);
+        *timestampFile >> first;
+        if (first <= timestamp) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return (low > 0) ? low - 1 : 0;
+}
+
+void FilePerChannelFormatReader::prefetch(unsigned int firstBlock, unsigned int count) {
+    checkOpen();
+    const uint64_t bytesPerBlock = 2 * SAMPLES_PER_DATA_BLOCK;
+    timestampFile->prefetch(2 * bytesPerBlock * firstBlock, 2 * bytesPerBlock * count);
+    const vector<unique_ptr<BinaryReader>>* fileLists[] = { &amplifierFiles, &auxInputFiles, &supplyFiles, &boardAdcFiles, &digitalInputFiles, &digitalOutputFiles };
+    for (const vector<unique_ptr<BinaryReader>>* files : fileLists) {
+        for (unsigned int i = 0; i < files->size(); ++i) {
+            (*files)[i]->prefetch(bytesPerBlock * firstBlock, bytesPerBlock * count);
+        }
+    }
+}
+
+BinaryReader& FilePerChannelFormatReader::channelFile(SignalType type, unsigned int index) {
+    switch (type) {
+    case AmplifierSignal:
+        return *amplifierFiles.at(index);
+    case AuxInputSignal:
+        return *auxInputFiles.at(index);
+    case SupplyVoltageSignal:
+        return *supplyFiles.at(index);
+    case BoardAdcSignal:
+        return *boardAdcFiles.at(index);
+    case BoardDigInSignal:
+        return *digitalInputFiles.at(index);
+    case BoardDigOutSignal:
+    default:
+        return *digitalOutputFiles.at(index);
+    }
+}
+
+const char* FilePerChannelFormatReader::mappedRange(BinaryReader& file, size_t bytesPerBlock, unsigned int firstBlock, unsigned int count) {
+    checkOpen();
+    const char* mapped = file.mappedData();
+    if (mapped == nullptr) {
+        throw std::runtime_error("File is not memory mapped.");
+    }
+    if (static_cast<uint64_t>(firstBlock) + count > numBlocksInFiles) {
+        throw std::out_of_range("Block range is past the end of the file.");
+    }
+    return mapped + static_cast<uint64_t>(firstBlock) * bytesPerBlock;
+}
+
+SampleView<int32_t> FilePerChannelFormatReader::timestamps(unsigned int firstBlock, unsigned int count) {
+    const size_t bytesPerBlock = 4 * SAMPLES_PER_DATA_BLOCK;
+    return SampleView<int32_t>(mappedRange(*timestampFile, bytesPerBlock, firstBlock, count), bytesPerBlock, SAMPLES_PER_DATA_BLOCK, count);
+}
+
+SampleView<int16_t> FilePerChannelFormatReader::amplifier(unsigned int index, unsigned int firstBlock, unsigned int count) {
+    const size_t bytesPerBlock = 2 * SAMPLES_PER_DATA_BLOCK;
+    return SampleView<int16_t>(mappedRange(*amplifierFiles.at(index), bytesPerBlock, firstBlock, count), bytesPerBlock, SAMPLES_PER_DATA_BLOCK, count);
+}
+
+SampleView<uint16_t> FilePerChannelFormatReader::samples(SignalType type, unsigned int index, unsigned int firstBlock, unsigned int count) {
+    if (type == AmplifierSignal) {
+        throw std::invalid_argument("Amplifier samples are signed in this format; use amplifier().");
+    }
+    const size_t bytesPerBlock = 2 * SAMPLES_PER_DATA_BLOCK;
+    return SampleView<uint16_t>(mappedRange(channelFile(type, index), bytesPerBlock, firstBlock, count), bytesPerBlock, SAMPLES_PER_DATA_BLOCK, count);
+}
+
+const char* FilePerChannelFormatReader::readBlockOf(BinaryReader& file, size_t bytesPerBlock) {
+    uint64_t offset = static_cast<uint64_t>(nextBlock) * bytesPerBlock;
+    const char* mapped = file.mappedData();
+    if (mapped != nullptr) {
+        return mapped + offset;
+    }
+    buffer.resize(bytesPerBlock);
+    file.seek(offset);
+    file.readBytes(buffer.data(), bytesPerBlock);
+    return buffer.data();
+}
+
+void FilePerChannelFormatReader::readBlockInternal(Rhd2000DataBlock &dataBlock, vector<double>&)
+{
+    unsigned int t, i;
+    const char* p;
+    const size_t bytesPerBlock = 2 * SAMPLES_PER_DATA_BLOCK;
+
+    if (nextBlock >= numBlocksInFiles) {
+        throw std::runtime_error("No more data");
+    }
+
+    // Timestamp data
+    p = readBlockOf(*timestampFile, 2 * bytesPerBlock);
+    for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        dataBlock.timeStamp[t] = loadInt32(p + 4 * t);
+    }
+
+    // Amplifier data, saved signed
+    for (i = 0; i < saveList.amplifier.size(); ++i) {
+        p = readBlockOf(*amplifierFiles[i], bytesPerBlock);
+        vector<int>& data = dataBlock.amplifierData[saveList.amplifier.at(i)->boardStream][saveList.amplifier.at(i)->chipChannel];
         for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            *save >> tmpU16;
-            dataBlock.ttlOut[t] = tmpU16;
+            data[t] = static_cast<int16_t>(loadUInt16(p + 2 * t)) + 32768;
+        }
+    }
+
+    // Auxiliary input data (each sample was written 4 times)
+    for (i = 0; i < saveList.auxInput.size(); ++i) {
+        p = readBlockOf(*auxInputFiles[i], bytesPerBlock);
+        vector<int>& auxData = dataBlock.auxiliaryData[saveList.auxInput.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2];
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; t += 4) {
+            auxData[t + saveList.auxInput.at(i)->chipChannel + 1] = loadUInt16(p + 2 * t);
+        }
+    }
+
+    // Supply voltage data (each sample was written 60 times)
+    for (i = 0; i < saveList.supplyVoltage.size(); ++i) {
+        p = readBlockOf(*supplyFiles[i], bytesPerBlock);
+        dataBlock.auxiliaryData[saveList.supplyVoltage.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][28] = loadUInt16(p);
+    }
+
+    // Not saving temperature data in this save format.
+
+    // Board ADC data
+    for (i = 0; i < saveList.boardAdc.size(); ++i) {
+        p = readBlockOf(*boardAdcFiles[i], bytesPerBlock);
+        vector<int>& data = dataBlock.boardAdcData[saveList.boardAdc.at(i)->nativeChannelNumber];
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            data[t] = loadUInt16(p + 2 * t);
+        }
+    }
+
+    // Board digital input data; one file per channel, each holding that channel's bit
+    if (!digitalInputFiles.empty()) {
+        std::fill(dataBlock.ttlIn.begin(), dataBlock.ttlIn.end(), 0);
+    }
+    for (i = 0; i < saveList.boardDigitalIn.size(); ++i) {
+        p = readBlockOf(*digitalInputFiles[i], bytesPerBlock);
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            if (loadUInt16(p + 2 * t) != 0) {
+                dataBlock.ttlIn[t] |= 1 << saveList.boardDigitalIn.at(i)->nativeChannelNumber;
+            }
+        }
+    }
+
+    // Board digital output data
+    if (!digitalOutputFiles.empty()) {
+        std::fill(dataBlock.ttlOut.begin(), dataBlock.ttlOut.end(), 0);
+    }
+    for (i = 0; i < digitalOutputFiles.size(); ++i) {
+        p = readBlockOf(*digitalOutputFiles[i], bytesPerBlock);
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+            if (loadUInt16(p + 2 * t) != 0) {
+                dataBlock.ttlOut[t] |= 1 << i;
+            }
+        }
+    }
+
+    ++nextBlock;
+}
+
+//  ------------------------------------------------------------------------
+
+CompressedSaveFormatReader::CompressedSaveFormatReader() :
+    nextBlock(0),
+    indexWasStored(false)
+{
+    logic.reset(new IntanSaveFormatLogic());
+}
+
+CompressedSaveFormatReader::~CompressedSaveFormatReader() {
+    close();
+}
+
+void CompressedSaveFormatReader::open(const FILENAME& saveFileName) {
+    unique_ptr<InStream> in = openInStream(saveFileName);
+    if (!in) {
+        throw std::runtime_error("Cannot open file for reading.");
+    }
+    save.reset(new BinaryReader(std::move(in)));
+}
+
+void CompressedSaveFormatReader::close() {
+    save.reset();
+    blockIndex.clear();
+    nextBlock = 0;
+}
+
+void CompressedSaveFormatReader::readHeader(SaveFormatHeaderInfo& header) {
+    checkOpen();
+
+    uint32_t magicNumber;
+    uint16_t mainVersion, secondaryVersion;
+    *save >> magicNumber >> mainVersion >> secondaryVersion;
+    if (magicNumber != COMPRESSED_FILE_MAGIC_NUMBER) {
+        throw std::invalid_argument("Invalid file type");
+    }
+    if (mainVersion > COMPRESSED_FILE_MAIN_VERSION_NUMBER) {
+        throw std::invalid_argument("File was saved by a newer version of this program");
+    }
+    readHeaderInternal(*save, header);
+
+    saveList.import(header.boardControl.signalSources);
+    saveList.setDigOutFromChannels(header.boardControl.signalSources);
+    saveList.saveTemp = (numTempSensorsSaved > 0);
+
+    loadBlockIndex(save->position());
+}
+
+// Reads the block index from the end of the file, or, if the file wasn't closed, rebuilds it by walking the blocks
+void CompressedSaveFormatReader::loadBlockIndex(uint64_t dataStart) {
+    blockIndex.clear();
+    indexWasStored = false;
+    uint64_t fileSize = dataStart + save->bytesRemaining();
+
+    if (fileSize >= dataStart + COMPRESSED_TRAILER_SIZE) {
+        uint64_t indexOffset;
+        uint32_t count, magicNumber;
+        save->seek(fileSize - COMPRESSED_TRAILER_SIZE);
+        *save >> indexOffset >> count >> magicNumber;
+        if (magicNumber == COMPRESSED_INDEX_MAGIC_NUMBER && indexOffset >= dataStart &&
+                indexOffset + (uint64_t)COMPRESSED_INDEX_ENTRY_SIZE * count + COMPRESSED_TRAILER_SIZE == fileSize) {
+            save->seek(indexOffset);
+            blockIndex.resize(count);
+            for (unsigned int i = 0; i < count; ++i) {
+                *save >> blockIndex[i].offset >> blockIndex[i].firstTimestamp >> blockIndex[i].length;
+            }
+            indexWasStored = true;
+        }
+    }
+
+    if (!indexWasStored) {
+        // Stop at the first block that's incomplete (e.g., cut short by a crash)
+        uint64_t pos = dataStart;
+        uint8_t start[6];
+        while (pos + 8 <= fileSize) {
+            uint32_t length, checksum;
+            save->seek(pos);
+            *save >> length >> checksum;
+            if (length < 2 || pos + 8 + length > fileSize) {
+                break;
+            }
+            unsigned int startLength = std::min(length, static_cast<uint32_t>(sizeof(start)));
+            save->readBytes(reinterpret_cast<char*>(start), startLength);
+
+            BlockIndexEntry entry;
+            entry.offset = pos;
+            entry.firstTimestamp = static_cast<int32_t>(DeltaCodec::firstSample(start, startLength));
+            entry.length = length;
+            blockIndex.push_back(entry);
+            pos += 8 + length;
+        }
+    }
+
+    save->seek(dataStart);
+    nextBlock = 0;
+}
+
+unsigned int CompressedSaveFormatReader::numBlocksRemaining() {
+    return static_cast<unsigned int>(blockIndex.size()) - nextBlock;
+}
+
+void CompressedSaveFormatReader::seekToBlock(unsigned int block) {
+    if (block > blockIndex.size()) {
+        throw std::out_of_range("Block number is past the end of the file.");
+    }
+    nextBlock = block;
+}
+
+unsigned int CompressedSaveFormatReader::findBlock(int32_t timestamp) const {
+    // Last block whose first timestamp is <= 'timestamp'
+    unsigned int low = 0, high = static_cast<unsigned int>(blockIndex.size());
+    while (low < high) {
+        unsigned int mid = (low + high) / 2;
+        if (blockIndex[mid].firstTimestamp <= timestamp) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return (low > 0) ? low - 1 : 0;
+}
+
+bool CompressedSaveFormatReader::isOpen() const {
+    return save.get() != nullptr;
+}
+
+const uint32_t* CompressedSaveFormatReader::decodeRun(const uint8_t*& in, const uint8_t* end, unsigned int n, uint32_t* out) {
+    in += DeltaCodec::decode(in, end - in, n, out);
+    return out;
+}
+
+void CompressedSaveFormatReader::readBlockInternal(Rhd2000DataBlock &dataBlock, vector<double>& tempAvg)
+{
+    unsigned int t, i;
+
+    if (nextBlock >= blockIndex.size()) {
+        throw std::runtime_error("No more data");
+    }
+    const BlockIndexEntry& entry = blockIndex[nextBlock];
+    uint32_t length, checksum;
+    save->seek(entry.offset);
+    *save >> length >> checksum;
+    if (payload.size() < length) {
+        payload.resize(length);
+    }
+    save->readBytes(reinterpret_cast<char*>(payload.data()), length);
+    if (DeltaCodec::checksum(payload.data(), length) != checksum) {
+        throw std::runtime_error("Checksum mismatch in block " + std::to_string(nextBlock) + "; the file is corrupt.");
+    }
+    ++nextBlock;
+
+    const uint8_t* in = payload.data();
+    const uint8_t* end = in + length;
+    samples.resize(SAMPLES_PER_DATA_BLOCK);
+
+    // Timestamp data
+    decodeRun(in, end, SAMPLES_PER_DATA_BLOCK, reinterpret_cast<uint32_t*>(dataBlock.timeStamp.data()));
+
+    // Amplifier data, decoded in place
+    for (i = 0; i < saveList.amplifier.size(); ++i) {
+        vector<int>& data = dataBlock.amplifierData[saveList.amplifier.at(i)->boardStream][saveList.amplifier.at(i)->chipChannel];
+        decodeRun(in, end, SAMPLES_PER_DATA_BLOCK, reinterpret_cast<uint32_t*>(data.data()));
+    }
+
+    // Auxiliary input data
+    for (i = 0; i < saveList.auxInput.size(); ++i) {
+        decodeRun(in, end, SAMPLES_PER_DATA_BLOCK / 4, samples.data());
+        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; t += 4) {
+            dataBlock.auxiliaryData[saveList.auxInput.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][t + saveList.auxInput.at(i)->chipChannel + 1] = samples[t / 4];
+        }
+    }
+
+    // Supply voltage data
+    decodeRun(in, end, static_cast<unsigned int>(saveList.supplyVoltage.size()), samples.data());
+    for (i = 0; i < saveList.supplyVoltage.size(); ++i) {
+        dataBlock.auxiliaryData[saveList.supplyVoltage.at(i)->boardStream][Rhd2000EvalBoard::AuxCmd2][28] = samples[i];
+    }
+
+    // Temperature sensor data
+    if (saveList.saveTemp) {
+        decodeRun(in, end, static_cast<unsigned int>(saveList.tempSensor.size()), samples.data());
+        for (i = 0; i < saveList.tempSensor.size(); ++i) {
+            tempAvg[saveList.tempSensor.at(i)->boardStream] = static_cast<int16_t>(samples[i]) / 100.0;
+        }
+    }
+
+    // Board ADC data
+    for (i = 0; i < saveList.boardAdc.size(); ++i) {
+        vector<int>& data = dataBlock.boardAdcData[saveList.boardAdc.at(i)->nativeChannelNumber];
+        decodeRun(in, end, SAMPLES_PER_DATA_BLOCK, reinterpret_cast<uint32_t*>(data.data()));
+    }
+
+    // Board digital input data
+    if (saveList.boardDigIn) {
+        decodeRun(in, end, SAMPLES_PER_DATA_BLOCK, reinterpret_cast<uint32_t*>(dataBlock.ttlIn.data()));
+    }
+
+    // Board digital output data
+    if (saveList.boardDigOut) {
+        decodeRun(in, end, SAMPLES_PER_DATA_BLOCK, reinterpret_cast<uint32_t*>(dataBlock.ttlOut.data()));
+    }
+}
+
+//  ------------------------------------------------------------------------
+
+ImpedanceCaptureReader::ImpedanceCaptureReader() :
+    indexWasStored(false)
+{
+}
+
+ImpedanceCaptureReader::~ImpedanceCaptureReader() {
+    close();
+}
+
+void ImpedanceCaptureReader::open(const FILENAME& saveFileName) {
+    unique_ptr<InStream> in = openInStream(saveFileName);
+    if (!in) {
+        throw std::runtime_error("Cannot open file for reading.");
+    }
+    save.reset(new BinaryReader(std::move(in)));
+}
+
+void ImpedanceCaptureReader::close() {
+    save.reset();
+    windowIndex.clear();
+}
+
+void ImpedanceCaptureReader::readHeader(SaveFormatHeaderInfo& header) {
+    checkOpen();
+
+    uint32_t magicNumber;
+    uint16_t mainVersion, secondaryVersion;
+    *save >> magicNumber >> mainVersion >> secondaryVersion;
+    if (magicNumber != IMPEDANCE_CAPTURE_MAGIC_NUMBER) {
+        throw std::invalid_argument("Invalid file type");
+    }
+    if (mainVersion > IMPEDANCE_CAPTURE_MAIN_VERSION_NUMBER) {
+        throw std::invalid_argument("File was saved by a newer version of this program");
+    }
+    readHeaderInternal(*save, header);
+
+    loadWindowIndex(save->position());
+}
+
+// Reads the window index from the end of the file, or, if the file wasn't closed, rebuilds it by walking the windows
+void ImpedanceCaptureReader::loadWindowIndex(uint64_t dataStart) {
+    windowIndex.clear();
+    indexWasStored = false;
+    uint64_t fileSize = dataStart + save->bytesRemaining();
+
+    if (fileSize >= dataStart + IMPEDANCE_CAPTURE_TRAILER_SIZE) {
+        uint64_t indexOffset;
+        uint32_t count, magicNumber;
+        save->seek(fileSize - IMPEDANCE_CAPTURE_TRAILER_SIZE);
+        *save >> indexOffset >> count >> magicNumber;
+        if (magicNumber == IMPEDANCE_CAPTURE_INDEX_MAGIC_NUMBER && indexOffset >= dataStart &&
+                indexOffset + (uint64_t)IMPEDANCE_CAPTURE_INDEX_ENTRY_SIZE * count + IMPEDANCE_CAPTURE_TRAILER_SIZE == fileSize) {
+            save->seek(indexOffset);
+            windowIndex.resize(count);
+            for (unsigned int i = 0; i < count; ++i) {
+                WindowIndexEntry& entry = windowIndex[i];
+                uint8_t reserved8;
+                uint16_t reserved16;
+                *save >> entry.offset >> entry.sweep >> entry.dataSource >> entry.channel >> entry.capRange >> reserved8 >> reserved16 >> entry.numSamples;
+            }
+            indexWasStored = true;
+        }
+    }
+
+    if (!indexWasStored) {
+        // Stop at the first window that's incomplete (e.g., cut short by a crash)
+        uint64_t pos = dataStart;
+        char start[IMPEDANCE_CAPTURE_WINDOW_HEADER_SIZE];
+        while (pos + 8 <= fileSize) {
+            uint32_t length, checksum;
+            save->seek(pos);
+            *save >> length >> checksum;
+            if (length < IMPEDANCE_CAPTURE_WINDOW_HEADER_SIZE || pos + 8 + length > fileSize) {
+                break;
+            }
+            save->readBytes(start, IMPEDANCE_CAPTURE_WINDOW_HEADER_SIZE);
+
+            WindowIndexEntry entry;
+            entry.offset = pos;
+            entry.sweep = static_cast<uint32_t>(loadInt32(start));
+            entry.dataSource = loadUInt16(start + 4);
+            entry.channel = loadUInt16(start + 6);
+            entry.capRange = static_cast<uint8_t>(start[8]);
+            entry.numSamples = static_cast<uint32_t>(loadInt32(start + 68));
+            windowIndex.push_back(entry);
+            pos += 8 + length;
         }
     }
+
+    save->seek(dataStart);
+}
+
+void ImpedanceCaptureReader::readWindow(unsigned int window, ImpedanceWindow& result) {
+    checkOpen();
+    const WindowIndexEntry& entry = windowIndex.at(window);
+    uint32_t length, checksum;
+    save->seek(entry.offset);
+    *save >> length >> checksum;
+    if (length < IMPEDANCE_CAPTURE_WINDOW_HEADER_SIZE) {
+        throw std::runtime_error("Window " + std::to_string(window) + " is truncated; the file is corrupt.");
+    }
+    if (payload.size() < length) {
+        payload.resize(length);
+    }
+    save->readBytes(reinterpret_cast<char*>(payload.data()), length);
+    if (DeltaCodec::checksum(payload.data(), length) != checksum) {
+        throw std::runtime_error("Checksum mismatch in window " + std::to_string(window) + "; the file is corrupt.");
+    }
+
+    const char* p = reinterpret_cast<const char*>(payload.data());
+    result.sweep = static_cast<uint32_t>(loadInt32(p));
+    result.dataSource = loadUInt16(p + 4);
+    result.channel = loadUInt16(p + 6);
+    result.capRange = static_cast<uint8_t>(p[8]);
+    result.timeCaptured = static_cast<int64_t>(loadUInt64(p + 12));
+    result.boardSampleRate = loadDouble(p + 20);
+    result.desiredImpedanceFreq = loadDouble(p + 28);
+    result.actualImpedanceFreq = loadDouble(p + 36);
+    result.startIndex = loadInt32(p + 44);
+    result.endIndex = loadInt32(p + 48);
+    result.amplitude = std::complex<double>(loadDouble(p + 52), loadDouble(p + 60));
+    unsigned int numSamples = static_cast<uint32_t>(loadInt32(p + 68));
+
+    // Raw samples, one run per data block
+    result.samples.resize(numSamples);
+    const uint8_t* in = payload.data() + IMPEDANCE_CAPTURE_WINDOW_HEADER_SIZE;
+    const uint8_t* end = payload.data() + length;
+    for (unsigned int t = 0; t < numSamples; t += SAMPLES_PER_DATA_BLOCK) {
+        unsigned int n = std::min(numSamples - t, static_cast<unsigned int>(SAMPLES_PER_DATA_BLOCK));
+        in += DeltaCodec::decode(in, end - in, n, reinterpret_cast<uint32_t*>(result.samples.data() + t));
+    }
+}
+
+bool ImpedanceCaptureReader::isOpen() const {
+    return save.get() != nullptr;
+}
+
+void ImpedanceCaptureReader::readBlockInternal(Rhd2000DataBlock&, vector<double>&) {
+    throw std::logic_error("An impedance capture file holds measurement windows, not data blocks.");
 }
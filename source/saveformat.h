@@ -27,7 +27,15 @@
 #include <vector>
 #include <deque>
 #include <exception>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <complex>
+#include <chrono>
+#include <cstring>
 #include "streams.h"
+#include "signalchannel.h"
 
 class BoardControl;
 class SignalSources;
@@ -39,7 +47,8 @@ class Rhd2000DataBlock;
 enum SaveFormat {
     SaveFormatIntan,
     SaveFormatFilePerSignalType,
-    SaveFormatFilePerChannel
+    SaveFormatFilePerChannel,
+    SaveFormatIntanCompressed
 };
 
 struct Version {
@@ -109,7 +118,7 @@ public:
     virtual void close() = 0;
     virtual void writeHeader(const SaveFormatHeaderInfo& header) = 0;
 
-    int writeQueueOfBlocks(BoardControl& boardControl, std::deque<std::unique_ptr<Rhd2000DataBlock>> &dataQueue, int timestampOffset, const std::vector<double>& tempAvg);
+    virtual int writeQueueOfBlocks(BoardControl& boardControl, std::deque<std::unique_ptr<Rhd2000DataBlock>> &dataQueue, int timestampOffset, const std::vector<double>& tempAvg);
 
     virtual int writeBlock(const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, const std::vector<double>& tempAvg);
     virtual void flush(const SaveList&) {}
@@ -119,13 +128,14 @@ public:
 protected:
     void writeHeaderInternal(BinaryWriter &outStream, const SaveFormatHeaderInfo& header);
     void checkOpen();
-    static void createFileStream(const FILENAME& fullpath, std::unique_ptr<BinaryWriter>& file, unsigned int bufferSize);
+    static void createFileStream(const FILENAME& fullpath, std::unique_ptr<BinaryWriter>& file, unsigned int bufferSize, unsigned int numBuffers = 1);
     static void makeDirectory(const FILENAME& path);
 
     virtual bool saveTemperature(const SaveList&) { return false; }
     virtual int writeBlockInternal(const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, const std::vector<double>& tempAvg) = 0;
     virtual bool isOpen() const = 0;
     std::unique_ptr<SaveFormatLogic> logic;
+    std::vector<int> scratch; // Reused to gather strided or interleaved samples into one span for a bulk write
 };
 
 //  ------------------------------------------------------------------------
@@ -157,6 +167,143 @@ private:
 };
 
 //  ------------------------------------------------------------------------
+// Same contents as IntanSaveFormat, losslessly compressed (.rhc).  The file is:
+//
+//   uint32 COMPRESSED_FILE_MAGIC_NUMBER, uint16 main version, uint16 secondary version
+//   The same header as a .rhd file
+//   Blocks: uint32 payload length, uint32 Adler-32 checksum of the payload, payload
+//   Block index: per block, uint64 file offset, int32 first timestamp, uint32 payload length
+//   Trailer: uint64 file offset of the block index, uint32 number of blocks, uint32 COMPRESSED_INDEX_MAGIC_NUMBER
+//
+// Each block's payload holds one Rhd2000DataBlock, with the signals in the same order as in a .rhd file; each channel is
+// one DeltaCodec run, and the supply voltages and temperatures (one sample per channel per block) are each one run across
+// channels.  Blocks don't depend on each other, so any block can be decoded on its own.  If the file wasn't closed (so
+// there's no block index), CompressedSaveFormatReader rebuilds the index by walking the blocks.
+class CompressedSaveFormat : public SaveFormatWriter {
+public:
+    std::unique_ptr<BinaryWriter> save;
+
+    CompressedSaveFormat();
+    ~CompressedSaveFormat();
+
+    void open(const FILENAME& saveFileBaseName, const SaveList& saveList) override;
+    void close() override;
+    void writeHeader(const SaveFormatHeaderInfo& header) override;
+
+protected:
+    int writeBlockInternal(const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, const std::vector<double>& tempAvg) override;
+    bool isOpen() const override;
+    bool saveTemperature(const SaveList& saveList) override;
+
+private:
+    struct BlockIndexEntry {
+        uint64_t offset;
+        int32_t firstTimestamp;
+        uint32_t length;
+    };
+
+    std::vector<BlockIndexEntry> blockIndex;
+    std::vector<uint8_t> payload; // Block being encoded; only ever grows
+    size_t payloadLength;
+    std::vector<uint32_t> samples;
+
+    void encodeRun(const uint32_t* values, unsigned int n);
+};
+
+//  ------------------------------------------------------------------------
+// The raw amplifier samples behind impedance measurements (.rhi), so they can be demodulated again later.  The file is:
+//
+//   uint32 IMPEDANCE_CAPTURE_MAGIC_NUMBER, uint16 main version, uint16 secondary version
+//   The same header as a .rhd file
+//   Windows: uint32 payload length, uint32 Adler-32 checksum of the payload, payload
+//   Window index: per window, uint64 file offset, uint32 sweep, uint16 data source, uint16 channel, uint8 Cseries range,
+//                3 bytes reserved, uint32 number of samples
+//   Trailer: uint64 file offset of the window index, uint32 number of windows, uint32 IMPEDANCE_CAPTURE_INDEX_MAGIC_NUMBER
+//
+// A window is one channel of one board run at one Cseries setting.  Its payload is: uint32 sweep, uint16 data source,
+// uint16 channel, uint8 Cseries range, 3 bytes reserved, int64 time captured (ms since epoch), then as doubles the board
+// sample rate, desired and actual impedance frequencies, then int32 startIndex and endIndex, the real and imaginary parts
+// (doubles) of the amplitude measured at the time, uint32 number of samples, and the raw amplifier samples (as in a .rhd
+// file) as one DeltaCodec run per data block.
+//
+// Capturing mustn't slow the measurement down, so captureWindow() drops a window (and counts it) rather than wait, when
+// capturing has already taken more than its share of the time since the sweep began, or when every write buffer is
+// still waiting on the disk.
+class ImpedanceCaptureWriter : public SaveFormatWriter {
+public:
+    std::unique_ptr<BinaryWriter> save;
+
+    ImpedanceCaptureWriter(double overheadBudget_ = 0.05);
+    ~ImpedanceCaptureWriter();
+
+    void open(const FILENAME& saveFileBaseName, const SaveList& saveList) override;
+    void close() override;
+    void writeHeader(const SaveFormatHeaderInfo& header) override;
+
+    // Starts a new sweep (i.e., one call to set up the board and measure); the windows captured until the next call share its number
+    void beginSweep();
+    // Captures one window from the blocks in boardControl.read.dataQueue; returns false if it was dropped to stay within budget,
+    // and throws (like any other write) if the file can't be written
+    bool captureWindow(BoardControl& boardControl, int stream, int chipChannel, unsigned int dataSource, unsigned int channel, int capRange, std::complex<double> amplitude);
+
+    void setOverheadBudget(double fraction) { overheadBudget = fraction; } // Largest share of the elapsed time spent capturing
+    uint64_t windowsCaptured() const { return static_cast<uint64_t>(windowIndex.size()); }
+    uint64_t windowsDropped() const { return dropped; }
+
+protected:
+    int writeBlockInternal(const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, const std::vector<double>& tempAvg) override; // Throws; use captureWindow()
+    bool isOpen() const override;
+
+private:
+    struct WindowIndexEntry {
+        uint64_t offset;
+        uint32_t sweep;
+        uint16_t dataSource;
+        uint16_t channel;
+        uint8_t capRange;
+        uint32_t numSamples;
+    };
+
+    std::vector<WindowIndexEntry> windowIndex;
+    std::vector<uint8_t> payload; // Window being encoded; only ever grows
+    uint32_t sweep;
+    double overheadBudget;
+    double captureSeconds; // Time spent in captureWindow() since the sweep began
+    std::chrono::steady_clock::time_point sweepBegan; // When beginSweep() (or, before the first sweep, open()) was called
+    uint64_t dropped;
+};
+
+//  ------------------------------------------------------------------------
+// A fixed set of worker threads that runs numbered tasks.  run() returns once every task has finished (rethrowing the
+// first exception any of them threw), so callers get a deterministic join point.
+class EncoderPool {
+public:
+    EncoderPool(unsigned int numThreads);
+    ~EncoderPool();
+
+    unsigned int numThreads() const { return static_cast<unsigned int>(workers.size()); }
+    void run(unsigned int numTasks, const std::function<void(unsigned int)>& task);
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable jobReady;
+    std::condition_variable jobDone;
+    const std::function<void(unsigned int)>* job;
+    unsigned int jobTasks;
+    unsigned int nextTask;
+    unsigned int tasksDone;
+    unsigned int generation;
+    bool stopping;
+    std::exception_ptr error;
+
+    void workerLoop();
+};
+
+//  ------------------------------------------------------------------------
+// Writes several files, each of which can be encoded independently of the others.  A queue of blocks is encoded in
+// parallel: the files are split across the workers of an EncoderPool, and each worker encodes every queued block (in
+// order) for the files it owns, so every file gets exactly the bytes a serial writer would have given it.
 class MultiFileFormatWriter : public SaveFormatWriter {
 public:
     MultiFileFormatWriter();
@@ -165,13 +312,37 @@ public:
     void close();
 
     virtual void writeHeader(const SaveFormatHeaderInfo& header) override;
+    int writeQueueOfBlocks(BoardControl& boardControl, std::deque<std::unique_ptr<Rhd2000DataBlock>> &dataQueue, int timestampOffset, const std::vector<double>& tempAvg) override;
+
+    void setNumEncoderThreads(unsigned int numThreads); // 0 (the default) uses one per core; 1 encodes serially
 
 protected:
+    // One output file, and which samples it takes from each block
+    struct Output {
+        enum Kind { Timestamp, Amplifier, AuxInput, SupplyVoltage, BoardAdc, BoardDigitalIn, BoardDigitalOut };
+        Kind kind;
+        unsigned int index; // Index into the matching SaveList vector (or digital output number); unused for files that hold every channel of a kind
+        Output(Kind k, unsigned int i) : kind(k), index(i) {}
+    };
+
     std::unique_ptr<BinaryWriter> infoFile;
     std::unique_ptr<BinaryWriter> timestampFile;
 
     void createTimestampFile(const FILENAME& path);
     void createInfoFile(const FILENAME& filename);
+
+    int writeBlockInternal(const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, const std::vector<double>& tempAvg) override;
+    virtual void listOutputs(const SaveList& saveList, std::vector<Output>& outputs) = 0;
+    // Encodes one block into one output file, using 'scratch' for any gathering.  Returns number of words written.
+    virtual int encodeOutput(const Output& output, const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, std::vector<int>& scratch) = 0;
+    int encodeTimestamps(const Rhd2000DataBlock& dataBlock, int timestampOffset);
+
+private:
+    std::unique_ptr<EncoderPool> encoderPool;
+    unsigned int numEncoderThreads;
+    std::vector<Output> outputs;
+    std::vector<std::vector<int>> workerScratch;
+    std::vector<int> workerWords;
 };
 
 //  ------------------------------------------------------------------------
@@ -192,7 +363,8 @@ public:
     virtual void close();
 
 protected:
-    virtual int writeBlockInternal(const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, const std::vector<double>& tempAvg);
+    void listOutputs(const SaveList& saveList, std::vector<Output>& outputs) override;
+    int encodeOutput(const Output& output, const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, std::vector<int>& scratch) override;
     virtual bool isOpen() const;
 
 private:
@@ -224,7 +396,8 @@ public:
     virtual void close();
 
 protected:
-    virtual int writeBlockInternal(const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, const std::vector<double>& tempAvg);
+    void listOutputs(const SaveList& saveList, std::vector<Output>& outputs) override;
+    int encodeOutput(const Output& output, const SaveList& saveList, const Rhd2000DataBlock& dataBlock, int timestampOffset, std::vector<int>& scratch) override;
     virtual bool isOpen() const;
 
 private:
@@ -240,10 +413,59 @@ public:
     FileNotOpenException(const char* message) : std::logic_error(message) {}
 };
 
+//  ------------------------------------------------------------------------
+// Zero-copy view of one signal's samples over a range of blocks of a memory-mapped file.  Within a block a signal's samples
+// are contiguous, and consecutive blocks are 'blockStride' bytes apart (in a file holding only that signal, that's just the
+// size of one block's samples, so the whole range is contiguous).  Samples are read as stored (little-endian), and the view
+// is only valid while the reader that made it stays open.
+template <typename T>
+class SampleView {
+public:
+    SampleView() : base(nullptr), blockStride(0), samplesPerBlock(0), numBlocks(0) {}
+    SampleView(const char* base_, size_t blockStride_, unsigned int samplesPerBlock_, unsigned int numBlocks_) :
+        base(base_), blockStride(blockStride_), samplesPerBlock(samplesPerBlock_), numBlocks(numBlocks_) {}
+
+    size_t size() const { return static_cast<size_t>(samplesPerBlock) * numBlocks; }
+    unsigned int blocks() const { return numBlocks; }
+    unsigned int samplesInBlock() const { return samplesPerBlock; }
+    bool isContiguous() const { return blockStride == samplesPerBlock * sizeof(T); }
+
+    // Sample 't' of block 'block' of the range
+    T at(unsigned int block, unsigned int t) const {
+        T value;
+        memcpy(&value, base + block * blockStride + t * sizeof(T), sizeof(T)); // Samples needn't be aligned in the file
+        return value;
+    }
+    // Sample 'i' of the range
+    T operator[](size_t i) const { return at(static_cast<unsigned int>(i / samplesPerBlock), static_cast<unsigned int>(i % samplesPerBlock)); }
+
+    // One block's samples, in place
+    const char* blockData(unsigned int block) const { return base + block * blockStride; }
+    // The whole range in place, if it's contiguous and suitably aligned; nullptr otherwise
+    const T* data() const {
+        if (!isContiguous() || reinterpret_cast<uintptr_t>(base) % alignof(T) != 0) {
+            return nullptr;
+        }
+        return reinterpret_cast<const T*>(base);
+    }
+    // Copies the range to 'out', which must have room for size() samples
+    void copyTo(T* out) const {
+        for (unsigned int block = 0; block < numBlocks; ++block) {
+            memcpy(out + block * samplesPerBlock, blockData(block), samplesPerBlock * sizeof(T));
+        }
+    }
+
+private:
+    const char* base;
+    size_t blockStride;
+    unsigned int samplesPerBlock;
+    unsigned int numBlocks;
+};
+
 //  ------------------------------------------------------------------------
 class SaveFormatReader {
 public:
-    SaveFormatReader() : numStreams(0) {
+    SaveFormatReader() : numStreams(0), numTempSensorsSaved(0) {
     }
     virtual ~SaveFormatReader() {}
 
@@ -260,6 +482,7 @@ protected:
     void readHeaderInternal(BinaryReader &inStream, SaveFormatHeaderInfo& header);
     void checkOpen();
     static void createFileStream(const FILENAME& fullpath, std::unique_ptr<BinaryReader>& file);
+    int numTempSensorsSaved; // From the header read by readHeaderInternal() (0 before version 1.1)
     virtual void readBlockInternal(Rhd2000DataBlock& dataBlock, std::vector<double>& tempAvg) = 0;
     virtual bool isOpen() const = 0;
 
@@ -274,17 +497,197 @@ public:
     IntanSaveFormatReader();
     ~IntanSaveFormatReader();
 
+    void open(const FILENAME& saveFileName) override; // Memory mapped if possible
+    void close() override;
+    void readHeader(SaveFormatHeaderInfo& header) override;
+    unsigned int numBlocksRemaining() override;
+
+    // Random access.  Every block is the same size, so block offsets come straight from the header and any block can be
+    // reached without reading those before it.  The views need the file to be memory mapped.
+    bool isMapped();
+    unsigned int numBlocks();
+    void seekToBlock(unsigned int block); // The next readBlock() reads 'block'
+    unsigned int findBlock(int32_t timestamp); // The block holding 'timestamp' (or the nearest one)
+    void prefetch(unsigned int firstBlock, unsigned int count); // Hint that these blocks will be read soon
+    SampleView<int32_t> timestamps(unsigned int firstBlock, unsigned int count);
+    // 'index' is into the matching SaveList vector (ignored for digital inputs and outputs, which are 16 channels per sample)
+    SampleView<uint16_t> samples(SignalType type, unsigned int index, unsigned int firstBlock, unsigned int count);
+    SampleView<int16_t> temperatures(unsigned int index, unsigned int firstBlock, unsigned int count); // Degrees C x 100
+
+protected:
+    SaveList saveList;
+
+    void readBlockInternal(Rhd2000DataBlock& dataBlock, std::vector<double>& tempAvg) override;
+    bool isOpen() const override;
+
+private:
+    // Byte offsets of each signal within a block, from the save list
+    struct BlockLayout {
+        uint64_t amplifier;
+        uint64_t auxInput;
+        uint64_t supplyVoltage;
+        uint64_t temperature;
+        uint64_t boardAdc;
+        uint64_t boardDigIn;
+        uint64_t boardDigOut;
+        uint64_t size;
+    };
+
+    BlockLayout layout;
+    uint64_t dataStart; // Offset of the first block
+    uint64_t fileSize;
+    std::vector<char> buffer; // Holds a block, when the file isn't mapped
+
+    const char* blockRange(unsigned int firstBlock, unsigned int count); // Start of those blocks in the mapping; throws if not mapped or out of range
+};
+
+//  ------------------------------------------------------------------------
+// Reads the files written by FilePerChannelFormat: info.rhd (the header), time.dat, and one file per channel.  Every file
+// holds SAMPLES_PER_DATA_BLOCK samples per block, so block offsets are fixed, and each channel's views are contiguous.
+class FilePerChannelFormatReader : public SaveFormatReader {
+public:
+    FilePerChannelFormatReader();
+    ~FilePerChannelFormatReader();
+
+    void open(const FILENAME& subdirPath) override; // Opens info.rhd; readHeader() opens the data files it lists
+    void close() override;
+    void readHeader(SaveFormatHeaderInfo& header) override;
+    unsigned int numBlocksRemaining() override;
+
+    // Random access, as in IntanSaveFormatReader
+    bool isMapped();
+    unsigned int numBlocks() const { return numBlocksInFiles; }
+    void seekToBlock(unsigned int block);
+    unsigned int findBlock(int32_t timestamp);
+    void prefetch(unsigned int firstBlock, unsigned int count);
+    SampleView<int32_t> timestamps(unsigned int firstBlock, unsigned int count);
+    SampleView<int16_t> amplifier(unsigned int index, unsigned int firstBlock, unsigned int count); // Signed (as saved): raw value - 32768
+    // Any other signal; 'index' is into the matching SaveList vector
+    SampleView<uint16_t> samples(SignalType type, unsigned int index, unsigned int firstBlock, unsigned int count);
+
+protected:
+    SaveList saveList;
+
+    void readBlockInternal(Rhd2000DataBlock& dataBlock, std::vector<double>& tempAvg) override;
+    bool isOpen() const override;
+
+private:
+    FILENAME path;
+    std::unique_ptr<BinaryReader> infoFile;
+    std::unique_ptr<BinaryReader> timestampFile;
+    std::vector<std::unique_ptr<BinaryReader>> amplifierFiles;
+    std::vector<std::unique_ptr<BinaryReader>> auxInputFiles;
+    std::vector<std::unique_ptr<BinaryReader>> supplyFiles;
+    std::vector<std::unique_ptr<BinaryReader>> boardAdcFiles;
+    std::vector<std::unique_ptr<BinaryReader>> digitalInputFiles;
+    std::vector<std::unique_ptr<BinaryReader>> digitalOutputFiles;
+    unsigned int numBlocksInFiles; // Complete blocks in every file
+    unsigned int nextBlock;
+    std::vector<char> buffer; // Holds one file's block, when the files aren't mapped
+
+    void openChannelFiles(const std::vector<SignalChannel*>& channels, std::vector<std::unique_ptr<BinaryReader>>& files);
+    BinaryReader& channelFile(SignalType type, unsigned int index);
+    const char* readBlockOf(BinaryReader& file, size_t bytesPerBlock); // nextBlock's bytes, in place if mapped
+    const char* mappedRange(BinaryReader& file, size_t bytesPerBlock, unsigned int firstBlock, unsigned int count);
+};
+
+//  ------------------------------------------------------------------------
+class CompressedSaveFormatReader : public SaveFormatReader {
+public:
+    std::unique_ptr<BinaryReader> save;
+
+    CompressedSaveFormatReader();
+    ~CompressedSaveFormatReader();
+
     void open(const FILENAME& saveFileName) override;
     void close() override;
     void readHeader(SaveFormatHeaderInfo& header) override;
     unsigned int numBlocksRemaining() override;
 
+    unsigned int numBlocks() const { return static_cast<unsigned int>(blockIndex.size()); }
+    void seekToBlock(unsigned int block); // The next readBlock() reads 'block'
+    unsigned int findBlock(int32_t timestamp) const; // The block holding 'timestamp' (or the nearest one)
+    bool hadBlockIndex() const { return indexWasStored; } // False if the index had to be rebuilt (i.e., the file wasn't closed)
+
 protected:
     SaveList saveList;
 
     void readBlockInternal(Rhd2000DataBlock& dataBlock, std::vector<double>& tempAvg) override;
     bool isOpen() const override;
+
+private:
+    struct BlockIndexEntry {
+        uint64_t offset;
+        int32_t firstTimestamp;
+        uint32_t length;
+    };
+
+    std::vector<BlockIndexEntry> blockIndex;
+    unsigned int nextBlock;
+    bool indexWasStored;
+    std::vector<uint8_t> payload;
+    std::vector<uint32_t> samples;
+
+    void loadBlockIndex(uint64_t dataStart);
+    const uint32_t* decodeRun(const uint8_t*& in, const uint8_t* end, unsigned int n, uint32_t* out);
 };
 
+//  ------------------------------------------------------------------------
+// One window read back from a .rhi file (see ImpedanceCaptureWriter)
+struct ImpedanceWindow {
+    uint32_t sweep;
+    unsigned int dataSource;
+    unsigned int channel;
+    int capRange; // Rhd2000Registers::ZcheckCs
+    int64_t timeCaptured; // ms since epoch
+    double boardSampleRate;
+    double desiredImpedanceFreq;
+    double actualImpedanceFreq;
+    int startIndex; // Range passed to ImpedanceFreq::amplitudeOfFreqComponent()
+    int endIndex;
+    std::complex<double> amplitude; // As measured at the time
+    std::vector<int> samples; // Raw amplifier samples, as in Rhd2000DataBlock::amplifierData
+};
+
+class ImpedanceCaptureReader : public SaveFormatReader {
+public:
+    std::unique_ptr<BinaryReader> save;
+
+    ImpedanceCaptureReader();
+    ~ImpedanceCaptureReader();
+
+    void open(const FILENAME& saveFileName) override;
+    void close() override;
+    void readHeader(SaveFormatHeaderInfo& header) override;
+    unsigned int numBlocksRemaining() override { return 0; } // Holds windows, not data blocks
+
+    unsigned int numWindows() const { return static_cast<unsigned int>(windowIndex.size()); }
+    uint32_t sweepOf(unsigned int window) const { return windowIndex.at(window).sweep; }
+    unsigned int dataSourceOf(unsigned int window) const { return windowIndex.at(window).dataSource; }
+    unsigned int channelOf(unsigned int window) const { return windowIndex.at(window).channel; }
+    int capRangeOf(unsigned int window) const { return windowIndex.at(window).capRange; }
+    void readWindow(unsigned int window, ImpedanceWindow& result);
+    bool hadWindowIndex() const { return indexWasStored; } // False if the index had to be rebuilt (i.e., the file wasn't closed)
+
+protected:
+    void readBlockInternal(Rhd2000DataBlock& dataBlock, std::vector<double>& tempAvg) override;
+    bool isOpen() const override;
+
+private:
+    struct WindowIndexEntry {
+        uint64_t offset;
+        uint32_t sweep;
+        uint16_t dataSource;
+        uint16_t channel;
+        uint8_t capRange;
+        uint32_t numSamples;
+    };
+
+    std::vector<WindowIndexEntry> windowIndex;
+    bool indexWasStored;
+    std::vector<uint8_t> payload;
+
+    void loadWindowIndex(uint64_t dataStart);
+};
 
 #endif // SAVEFORMAT_H
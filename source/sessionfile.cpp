@@ -0,0 +1,316 @@
+#include "sessionfile.h"
+#include "electrodehistory.h"
+#include "globalconstants.h"
+#include "streams.h"
+#include <QtCore>
+#include <vector>
+#include <exception>
+
+#define IS_BIG_ENDIAN (*(uint16_t *)"\0\xff" < 0x100)
+
+using std::unique_ptr;
+using std::vector;
+
+
+/* Save every channel's history to 'filename' */
+bool SessionFile::write(const QString &filename, const ElectrodeHistory &history, QString &errorString)
+{
+    int numChannels = history.getNumChannels();
+
+    //Lay out the file up front, so the index can be written before the columns
+    QVector<quint64> measurementOffsets(numChannels);
+    QVector<quint64> pulseOffsets(numChannels);
+    quint64 offset = HeaderSize + (quint64) IndexEntrySize * numChannels;
+    for (int channel = 0; channel < numChannels; channel++) {
+        measurementOffsets[channel] = offset;
+        offset += 3 * sizeof(double) * (quint64) history.measurementCount(channel);
+        pulseOffsets[channel] = offset;
+        offset += 3 * sizeof(double) * (quint64) history.pulseCount(channel);
+    }
+
+    try {
+        unique_ptr<FileOutStream> fs(new FileOutStream());
+        fs->open(toFileName(filename.toStdWString()));
+        BinaryWriter out(std::move(fs), 256 * KILO);
+
+        //Header
+        out << (uint32_t) SESSION_FILE_MAGIC_NUMBER;
+        out << (uint16_t) SESSION_FILE_MAIN_VERSION_NUMBER;
+        out << (uint16_t) SESSION_FILE_SECONDARY_VERSION_NUMBER;
+        out << (uint32_t) numChannels;
+        out << (uint32_t) 0;
+        out << (int64_t) QDateTime::currentMSecsSinceEpoch();
+        out << (uint64_t) HeaderSize;
+
+        //Channel index
+        for (int channel = 0; channel < numChannels; channel++) {
+            out << (uint64_t) measurementOffsets.at(channel);
+            out << (uint32_t) history.measurementCount(channel);
+            out << (uint32_t) history.pulseCount(channel);
+            out << (uint64_t) pulseOffsets.at(channel);
+            out << (uint64_t) 0;
+        }
+
+        //Columns; a channel's rows aren't contiguous in the history, so gather each column first
+        vector<double> column;
+        for (int channel = 0; channel < numChannels; channel++) {
+            ElectrodeHistory::MeasurementView measurements = history.measurements(channel);
+            column.resize(measurements.size());
+            for (int i = 0; i < measurements.size(); i++)
+                column[i] = measurements.timeAt(i);
+            out.writeDoubles(column.data(), column.size());
+            for (int i = 0; i < measurements.size(); i++)
+                column[i] = measurements.impedanceAt(i).real();
+            out.writeDoubles(column.data(), column.size());
+            for (int i = 0; i < measurements.size(); i++)
+                column[i] = measurements.impedanceAt(i).imag();
+            out.writeDoubles(column.data(), column.size());
+
+            ElectrodeHistory::PulseView pulses = history.pulses(channel);
+            column.resize(pulses.size());
+            for (int i = 0; i < pulses.size(); i++)
+                column[i] = pulses.timeAt(i);
+            out.writeDoubles(column.data(), column.size());
+            for (int i = 0; i < pulses.size(); i++)
+                column[i] = pulses.durationAt(i);
+            out.writeDoubles(column.data(), column.size());
+            for (int i = 0; i < pulses.size(); i++)
+                column[i] = pulses.chargeAt(i);
+            out.writeDoubles(column.data(), column.size());
+        }
+    }
+    catch (std::exception &e) {
+        errorString = e.what();
+        return false;
+    }
+    return true;
+}
+
+
+/* Constructor */
+SessionFileReader::SessionFileReader()
+{
+    fileSize = 0;
+    numChannels = 0;
+    timeSaved = 0;
+}
+
+
+/* Destructor */
+SessionFileReader::~SessionFileReader()
+{
+}
+
+
+/* Public - Open 'filename' (memory mapped if possible) and read its header and channel index */
+bool SessionFileReader::open(const QString &filename)
+{
+    close();
+
+    unique_ptr<InStream> in = openInStream(toFileName(filename.toStdWString()));
+    if (!in) {
+        errorString = "Cannot open session file for reading.";
+        return false;
+    }
+    fileSize = in->bytesRemaining();
+    reader.reset(new BinaryReader(std::move(in)));
+
+    try {
+        if (fileSize < (quint64) SessionFile::HeaderSize)
+            throw std::runtime_error("File is too short to be a session file.");
+
+        uint32_t magicNumber, channels, reserved;
+        uint16_t mainVersion, secondaryVersion;
+        int64_t saved;
+        uint64_t indexOffset;
+        *reader >> magicNumber >> mainVersion >> secondaryVersion >> channels >> reserved >> saved >> indexOffset;
+        if (magicNumber != SESSION_FILE_MAGIC_NUMBER)
+            throw std::runtime_error("Not a session file.");
+        if (mainVersion > SESSION_FILE_MAIN_VERSION_NUMBER)
+            throw std::runtime_error("Session file was saved by a newer version of this program.");
+        if (indexOffset + (quint64) SessionFile::IndexEntrySize * channels > fileSize)
+            throw std::runtime_error("Session file is truncated.");
+
+        numChannels = channels;
+        timeSaved = saved;
+        index.resize(numChannels);
+        reader->seek(indexOffset);
+        for (int channel = 0; channel < numChannels; channel++) {
+            IndexEntry &entry = index[channel];
+            uint64_t measurementOffset, pulseOffset, unused;
+            uint32_t measurements, pulses;
+            *reader >> measurementOffset >> measurements >> pulses >> pulseOffset >> unused;
+            if (measurementOffset + 3 * sizeof(double) * (quint64) measurements > fileSize ||
+                    pulseOffset + 3 * sizeof(double) * (quint64) pulses > fileSize)
+                throw std::runtime_error("Session file is truncated.");
+            entry.measurementOffset = measurementOffset;
+            entry.measurementCount = measurements;
+            entry.pulseCount = pulses;
+            entry.pulseOffset = pulseOffset;
+        }
+    }
+    catch (std::exception &e) {
+        errorString = e.what();
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+/* Public - Close the file */
+void SessionFileReader::close()
+{
+    reader.reset();
+    fileSize = 0;
+    numChannels = 0;
+    timeSaved = 0;
+    index.clear();
+}
+
+
+/* Public - Returns true if the file is memory mapped, so that mappedColumn() can be used */
+bool SessionFileReader::isMapped() const
+{
+    return reader && reader->mappedData() != nullptr;
+}
+
+
+/* Public - Get a description of the last error */
+QString SessionFileReader::getErrorString() const
+{
+    return errorString;
+}
+
+
+/* Public - Get the number of channels in the file */
+int SessionFileReader::getNumChannels() const
+{
+    return numChannels;
+}
+
+
+/* Public - Get the time the file was saved (ms since epoch) */
+qint64 SessionFileReader::getTimeSaved() const
+{
+    return timeSaved;
+}
+
+
+/* Public - Get the number of measurements stored for a channel */
+int SessionFileReader::measurementCount(int channel) const
+{
+    return index.at(channel).measurementCount;
+}
+
+
+/* Public - Get the number of pulses stored for a channel */
+int SessionFileReader::pulseCount(int channel) const
+{
+    return index.at(channel).pulseCount;
+}
+
+
+/* Public - Read one channel's measurements */
+void SessionFileReader::readMeasurements(int channel, QVector<double> &times, QVector<std::complex<double>> &impedances)
+{
+    int count = measurementCount(channel);
+    QVector<double> real(count), imaginary(count);
+    times.resize(count);
+    reader->seek(columnOffset(channel, MeasurementTimeColumn));
+    reader->readDoubles(times.data(), count);
+    reader->readDoubles(real.data(), count);
+    reader->readDoubles(imaginary.data(), count);
+
+    impedances.resize(count);
+    for (int i = 0; i < count; i++) {
+        impedances[i] = std::complex<double>(real.at(i), imaginary.at(i));
+    }
+}
+
+
+/* Public - Read one channel's pulses */
+void SessionFileReader::readPulses(int channel, QVector<double> &times, QVector<double> &durations, QVector<double> &charges)
+{
+    int count = pulseCount(channel);
+    times.resize(count);
+    durations.resize(count);
+    charges.resize(count);
+    reader->seek(columnOffset(channel, PulseTimeColumn));
+    reader->readDoubles(times.data(), count);
+    reader->readDoubles(durations.data(), count);
+    reader->readDoubles(charges.data(), count);
+}
+
+
+/* Public - Get one channel's column in place, or nullptr if the file isn't mapped (or the host isn't little-endian) */
+const double *SessionFileReader::mappedColumn(int channel, Column column) const
+{
+    if (!isMapped() || IS_BIG_ENDIAN)
+        return nullptr;
+    return reinterpret_cast<const double*>(reader->mappedData() + columnOffset(channel, column));
+}
+
+
+/* Public - Replace the contents of 'history' with every channel's measurements and pulses */
+bool SessionFileReader::readAll(ElectrodeHistory &history)
+{
+    if (!reader) {
+        errorString = "No session file is open.";
+        return false;
+    }
+    if (numChannels > history.getNumChannels()) {
+        errorString = QString("Session file has %1 channels, but only %2 are available.").arg(numChannels).arg(history.getNumChannels());
+        return false;
+    }
+
+    int totalMeasurements = 0, totalPulses = 0;
+    for (int channel = 0; channel < numChannels; channel++) {
+        totalMeasurements += measurementCount(channel);
+        totalPulses += pulseCount(channel);
+    }
+    history.clearAll();
+    history.reserve(totalMeasurements, totalPulses);
+
+    try {
+        QVector<double> times, durations, charges;
+        QVector<std::complex<double>> impedances;
+        for (int channel = 0; channel < numChannels; channel++) {
+            readMeasurements(channel, times, impedances);
+            for (int i = 0; i < times.size(); i++) {
+                history.addMeasurement(channel, times.at(i), impedances.at(i));
+            }
+            readPulses(channel, times, durations, charges);
+            for (int i = 0; i < times.size(); i++) {
+                history.addPulse(channel, times.at(i), durations.at(i), charges.at(i));
+            }
+        }
+    }
+    catch (std::exception &e) {
+        errorString = e.what();
+        return false;
+    }
+    return true;
+}
+
+
+/* Private - Get the offset of one channel's column in the file */
+quint64 SessionFileReader::columnOffset(int channel, Column column) const
+{
+    const IndexEntry &entry = index.at(channel);
+    switch (column) {
+    case MeasurementTimeColumn:
+        return entry.measurementOffset;
+    case MeasurementRealColumn:
+        return entry.measurementOffset + sizeof(double) * (quint64) entry.measurementCount;
+    case MeasurementImaginaryColumn:
+        return entry.measurementOffset + 2 * sizeof(double) * (quint64) entry.measurementCount;
+    case PulseTimeColumn:
+        return entry.pulseOffset;
+    case PulseDurationColumn:
+        return entry.pulseOffset + sizeof(double) * (quint64) entry.pulseCount;
+    case PulseChargeColumn:
+    default:
+        return entry.pulseOffset + 2 * sizeof(double) * (quint64) entry.pulseCount;
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef SESSIONFILE_H
+#define SESSIONFILE_H
+
+#include <QString>
+#include <QVector>
+#include <complex>
+#include <memory>
+
+/* SessionFile holds the functions that save an ElectrodeHistory to, and load it from, a binary session file (.eps)
+ *
+ * All values are little-endian. The file is:
+ *
+ * Header (32 bytes): quint32 magic number, quint16 main version, quint16 secondary version, quint32 number of channels,
+ *                    quint32 reserved, qint64 time saved (ms since epoch), quint64 offset of the channel index
+ * Channel index (32 bytes per channel): quint64 offset of the measurement columns, quint32 number of measurements,
+ *                    quint32 number of pulses, quint64 offset of the pulse columns, quint64 reserved
+ * For each channel: measurement time, real, and imaginary columns, then pulse time, duration, and charge columns
+ *                    (each column is one 64-bit double per measurement or pulse)
+ *
+ * Every offset is a multiple of 8, so when the file is memory mapped each column can be used in place as an array of doubles.
+ * SessionFileReader only reads the header and index when it opens a file; a channel's columns are read when asked for. */
+
+class ElectrodeHistory;
+class BinaryReader;
+
+namespace SessionFile {
+    static const int HeaderSize = 32; //Size of the header, in bytes
+    static const int IndexEntrySize = 32; //Size of each channel index entry, in bytes
+
+    bool write(const QString &filename, const ElectrodeHistory &history, QString &errorString); //Save every channel's history to 'filename'
+}
+
+class SessionFileReader
+{
+
+public:
+    /* Column: One of the columns stored for each channel */
+    enum Column {
+        MeasurementTimeColumn,
+        MeasurementRealColumn,
+        MeasurementImaginaryColumn,
+        PulseTimeColumn,
+        PulseDurationColumn,
+        PulseChargeColumn
+    };
+
+    SessionFileReader(); //Constructor
+    ~SessionFileReader(); //Destructor
+
+    bool open(const QString &filename); //Open 'filename' (memory mapped if possible) and read its header and channel index
+    void close(); //Close the file
+    bool isMapped() const; //Returns true if the file is memory mapped, so that mappedColumn() can be used
+    QString getErrorString() const; //Get a description of the last error
+
+    int getNumChannels() const; //Get the number of channels in the file
+    qint64 getTimeSaved() const; //Get the time the file was saved (ms since epoch)
+    int measurementCount(int channel) const; //Get the number of measurements stored for a channel
+    int pulseCount(int channel) const; //Get the number of pulses stored for a channel
+
+    void readMeasurements(int channel, QVector<double> &times, QVector<std::complex<double>> &impedances); //Read one channel's measurements
+    void readPulses(int channel, QVector<double> &times, QVector<double> &durations, QVector<double> &charges); //Read one channel's pulses
+    const double *mappedColumn(int channel, Column column) const; //Get one channel's column in place, or nullptr if the file isn't mapped (or the host isn't little-endian)
+    bool readAll(ElectrodeHistory &history); //Replace the contents of 'history' with every channel's measurements and pulses
+
+private:
+    /* IndexEntry: Where one channel's columns are in the file */
+    struct IndexEntry {
+        quint64 measurementOffset;
+        quint32 measurementCount;
+        quint32 pulseCount;
+        quint64 pulseOffset;
+    };
+
+    quint64 columnOffset(int channel, Column column) const; //Get the offset of one channel's column in the file
+
+    std::unique_ptr<BinaryReader> reader; //File being read
+    quint64 fileSize; //Size of the file, in bytes
+    int numChannels; //Number of channels in the file
+    qint64 timeSaved; //Time the file was saved (ms since epoch)
+    QVector<IndexEntry> index; //Channel index
+    QString errorString; //Description of the last error
+};
+
+#endif // SESSIONFILE_H
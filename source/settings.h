@@ -19,6 +19,15 @@ struct Settings {
     bool channels0to63;
     bool channels64to127;
     bool useTargetImpedance;
+    bool monitorPulses;
+    double chargeLimit;
+    double voltageLimit;
+    int monitorAdcChannel;
+    bool screenBeforePlating;
+    double screenMinMagnitude;
+    double screenMaxMagnitude;
+    double screenMinPhase;
+    double impedanceCacheMaxAge;
     int selected;
     bool displayMagnitudes;
     bool showGrid;
@@ -27,6 +27,11 @@
 #include <queue>
 #include <qmath.h>
 #include <iostream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
 
 //#include "qtincludes.h"
 
@@ -44,6 +49,19 @@ using std::queue;
 using std::unique_ptr;
 using std::vector;
 
+typedef std::chrono::steady_clock Clock;
+
+// Each worker's stage times are kept in their own cache line of workerTiming
+enum WorkerTimingSlot { ScaleTime, FilterTime, AuxTime, TemperatureTime, WorkerTimingStride = 8 };
+
+static double secondsSince(Clock::time_point& start)
+{
+    Clock::time_point now = Clock::now();
+    double seconds = std::chrono::duration<double>(now - start).count();
+    start = now;
+    return seconds;
+}
+
 // The maximum number of Rhd2000DataBlock objects we will need is set by the need
 // to perform electrode impedance measurements at very low frequencies.
 const int maxNumBlocks = 120;
@@ -76,6 +94,22 @@ SignalProcessor::SignalProcessor()
     highpassFilterEnabled = false;
     aHpf = 0.0;
     bHpf = 0.0;
+
+    notchInBank = false;
+    highpassInBank = false;
+
+    numDataStreams = 0;
+    amplifierDecimation = 1;
+    amplifierPostFilterLength = 0;
+    boardSampleCount = 0;
+    decoded = DecodeAll;
+    numThreads = 0;
+    resetTiming();
+}
+
+// Destructor.
+SignalProcessor::~SignalProcessor()
+{
 }
 
 // Allocate memory to store waveform data.
@@ -85,21 +119,27 @@ void SignalProcessor::allocateMemory(int numStreams)
 
     // Allocate vector memory for waveforms from USB interface board and notch filter.
     allocateDoubleArray3D(amplifierPreFilter, numStreams, 32, SAMPLES_PER_DATA_BLOCK * maxNumBlocks);
-    allocateDoubleArray3D(amplifierPostFilter, numStreams, 32, SAMPLES_PER_DATA_BLOCK * maxNumBlocks);
-    allocateDoubleArray2D(highpassFilterState, numStreams, 32);
-    allocateDoubleArray3D(prevAmplifierPreFilter, numStreams, 32, 2);
-    allocateDoubleArray3D(prevAmplifierPostFilter, numStreams, 32, 2);
     allocateDoubleArray3D(auxChannel, numStreams, 3, (SAMPLES_PER_DATA_BLOCK / 4) * maxNumBlocks);
     allocateDoubleArray2D(supplyVoltage, numStreams, maxNumBlocks);
     allocateDoubleArray2D(boardAdc, 8, SAMPLES_PER_DATA_BLOCK * maxNumBlocks);
-    allocateIntArray2D(boardDigIn, 16, SAMPLES_PER_DATA_BLOCK * maxNumBlocks);
-    allocateIntArray2D(boardDigOut, 16, SAMPLES_PER_DATA_BLOCK * maxNumBlocks);
-
-    // Initialize vector memory used in notch filter state.
-    fillZerosDoubleArray3D(amplifierPostFilter);
-    fillZerosDoubleArray3D(prevAmplifierPreFilter);
-    fillZerosDoubleArray3D(prevAmplifierPostFilter);
-    fillZerosDoubleArray2D(highpassFilterState);
+    allocateUInt16Array2D(boardAdcCodes, 8, SAMPLES_PER_DATA_BLOCK * maxNumBlocks);
+    boardDigIn.resize(SAMPLES_PER_DATA_BLOCK * maxNumBlocks);
+    boardDigOut.resize(SAMPLES_PER_DATA_BLOCK * maxNumBlocks);
+    boardSampleCount = 0;
+
+    // Each stream's filters start from zero state.
+    amplifierPostFilterLength = 0;
+    streams.clear();
+    for (int stream = 0; stream < numStreams; ++stream) {
+        streams.push_back(unique_ptr<StreamState>(new StreamState()));
+        streams.back()->filter.setNumChannels(32);
+        streams.back()->postFilter.resize(static_cast<size_t>(streams.back()->filter.stride()) * SAMPLES_PER_DATA_BLOCK * maxNumBlocks);
+        streams.back()->decimationPhase = 0;
+        streams.back()->postFilterLength = 0;
+    }
+    notchInBank = false;
+    highpassInBank = false;
+    updateFilterSections();
 
     temperature.allocateMemory(numStreams);
 }
@@ -133,9 +173,9 @@ void SignalProcessor::allocateDoubleArray2D(QVector<QVector<double> > &array2D,
     }
 }
 
-// Allocates memory for a 2-D array of integers.
-void SignalProcessor::allocateIntArray2D(QVector<QVector<int> > &array2D,
-                                         int xSize, int ySize)
+// Allocates memory for a 2-D array of 16-bit words.
+void SignalProcessor::allocateUInt16Array2D(QVector<QVector<uint16_t> > &array2D,
+                                            int xSize, int ySize)
 {
     int i;
 
@@ -187,38 +227,181 @@ void SignalProcessor::fillZerosDoubleArray2D(
 // Reads numBlocks blocks of raw USB data stored in a queue of Rhd2000DataBlock
 // objects, loads this data into this SignalProcessor object, scaling the raw
 // data to generate waveforms with units of volts or microvolts.
+//
+// The data streams are independent, so each is loaded (see loadStream()) as a
+// separate task, spread across worker threads unless setNumThreads(1) was
+// called; this returns once every stream is done.  The board's ADCs and
+// digital I/O are then loaded on the calling thread.
+//
+// Only the types of signal registered with setDecodedSignals() are decoded;
+// the arrays for the others are left as they were.
 void SignalProcessor::loadAmplifierData(deque<unique_ptr<Rhd2000DataBlock>> &dataQueue)
 {
+    Clock::time_point batchStart = Clock::now();
     int numBlocks = dataQueue.size();
 
-    int indexAmp = 0;
-    int indexAux = 0;
-    int indexSupply = 0;
+    unsigned int threads = numThreads;
+    if (threads == 0) {
+        threads = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    unsigned int numWorkers = std::min(threads, static_cast<unsigned int>(std::max(numDataStreams, 1)));
+    if (workerTiming.size() != numWorkers * WorkerTimingStride) {
+        workerTiming.resize(numWorkers * WorkerTimingStride);
+    } else {
+        workerTiming.fill(0.0);
+    }
+
+    const unsigned int perStream = DecodeAmplifier | DecodeAuxInput | DecodeSupplyVoltage | DecodeTemperature;
+    if ((decoded & perStream) == 0) {
+        // Nothing to decode from the data streams
+        for (unsigned int stream = 0; stream < streams.size(); ++stream) {
+            streams[stream]->postFilterLength = 0;
+        }
+    } else if (numWorkers <= 1 || numBlocks == 0) {
+        for (int stream = 0; stream < numDataStreams; ++stream) {
+            loadStream(dataQueue, stream, workerTiming.data());
+        }
+    } else {
+        if (!workerPool || workerPool->numThreads() != numWorkers) {
+            workerPool.reset(new EncoderPool(numWorkers));
+        }
+        workerPool->run(numWorkers, [&](unsigned int worker) {
+            for (int stream = worker; stream < numDataStreams; stream += numWorkers) {
+                loadStream(dataQueue, stream, workerTiming.data() + worker * WorkerTimingStride);
+            }
+        });
+    }
+
+    for (unsigned int worker = 0; worker < numWorkers; ++worker) {
+        const double* timing = workerTiming.data() + worker * WorkerTimingStride;
+        stageTiming.scaleSeconds += timing[ScaleTime];
+        stageTiming.filterSeconds += timing[FilterTime];
+        stageTiming.auxSeconds += timing[AuxTime];
+        stageTiming.temperatureSeconds += timing[TemperatureTime];
+    }
+
+    Clock::time_point boardStart = Clock::now();
     int indexAdc = 0;
     int indexDig = 0;
+    for (int block = 0; block < numBlocks; ++block) {
+        Rhd2000DataBlock& dataBlock = *dataQueue[block];
+
+        int t, channel;
+
+        // Load and scale USB interface board ADC waveforms
+        // (sampled at amplifier sampling rate)
+        if (decoded & DecodeBoardAdc) {
+            for (channel = 0; channel < 8; ++channel) {
+                const int* codes = dataBlock.boardAdcData[channel].data();
+                uint16_t* raw = boardAdcCodes[channel].data() + indexAdc;
+                double* volts = boardAdc[channel].data() + indexAdc;
+                for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                    raw[t] = static_cast<uint16_t>(codes[t]);
+                    // ADC waveform units = volts
+                    volts[t] = Rhd2000DataBlock::boardADCToVolts(codes[t]);
+                }
+            }
+        }
+        indexAdc += SAMPLES_PER_DATA_BLOCK;
+
+        // Load USB interface board digital input and output waveforms, still
+        // packed 16 bits to a word
+        if (decoded & DecodeBoardDigIn) {
+            for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                boardDigIn[indexDig + t] = static_cast<uint16_t>(dataBlock.ttlIn[t]);
+            }
+        }
+        if (decoded & DecodeBoardDigOut) {
+            for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                boardDigOut[indexDig + t] = static_cast<uint16_t>(dataBlock.ttlOut[t]);
+            }
+        }
+        indexDig += SAMPLES_PER_DATA_BLOCK;
+    }
+    boardSampleCount = indexDig;
+    stageTiming.boardSeconds += secondsSince(boardStart);
+
+    if (!(decoded & DecodeAmplifier) || streams.empty()) {
+        amplifierPostFilterLength = 0;
+    } else {
+        amplifierPostFilterLength = streams[0]->postFilterLength;
+    }
+
+    stageTiming.wallSeconds += secondsSince(batchStart);
+    ++stageTiming.batches;
+    stageTiming.threads = numWorkers;
+}
+
+// Loads one data stream from every block in dataQueue, adding the time each
+// stage takes to 'timing' (indexed by WorkerTimingSlot).
+//
+// Amplifier data is scaled and filtered in the same pass: each block is scaled
+// into amplifierPreFilter and, in the filter bank's channel-interleaved layout,
+// into amplifierPostFilter, where it's filtered in place while it's still in
+// cache.  Decimation then moves the rows it keeps down over the ones it drops,
+// so amplifierPostFilter is never converted to or from another layout.
+void SignalProcessor::loadStream(deque<unique_ptr<Rhd2000DataBlock>> &dataQueue, int stream, double* timing)
+{
+    StreamState& state = *streams[stream];
+    const bool amplifier = (decoded & DecodeAmplifier) != 0;
+    const bool filter = state.filter.numSections() > 0;
+    const size_t stride = state.filter.stride();
+    double* post = state.postFilter.data();
+    int numBlocks = dataQueue.size();
+
+    int indexAmp = 0;
+    int indexPost = 0;
+    int indexAux = 0;
+    Clock::time_point start = Clock::now();
 
     for (int block = 0; block < numBlocks; ++block) {
         Rhd2000DataBlock& dataBlock = *dataQueue[block];
 
-        int t, channel, stream;
+        int t, channel;
 
         // Load and scale RHD2000 amplifier waveforms
         // (sampled at amplifier sampling rate)
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+        if (amplifier) {
+            // This block's rows of amplifierPostFilter (before decimation)
+            double* rows = post + indexAmp * stride;
             for (channel = 0; channel < 32; ++channel) {
-                for (stream = 0; stream < numDataStreams; ++stream) {
-                    // Amplifier waveform units = microvolts
-                    amplifierPreFilter[stream][channel][indexAmp] = 
-                        Rhd2000DataBlock::amplifierADCToMicroVolts(dataBlock.amplifierData[stream][channel][t]);
+                const int* raw = dataBlock.amplifierData[stream][channel].data();
+                double* pre = amplifierPreFilter[stream][channel].data() + indexAmp;
+                double* column = rows + channel;
+                for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
+                    // Amplifier waveform units = microvolts (as Rhd2000DataBlock::amplifierADCToMicroVolts)
+                    double value = 0.195 * (raw[t] - 0x8000);
+                    pre[t] = value;
+                    column[t * stride] = value;
                 }
             }
-            ++indexAmp;
+            indexAmp += SAMPLES_PER_DATA_BLOCK;
+            timing[ScaleTime] += secondsSince(start);
+
+            // Filter this block in place (the filters carry their state across
+            // blocks), and keep every amplifierDecimation'th sample
+            if (filter) {
+                state.filter.process(rows, SAMPLES_PER_DATA_BLOCK);
+            }
+            if (amplifierDecimation > 1) {
+                int kept = 0;
+                for (t = state.decimationPhase; t < SAMPLES_PER_DATA_BLOCK; t += amplifierDecimation) {
+                    // Never moves a row up, so the rows still to be kept aren't overwritten
+                    memmove(post + (indexPost + kept) * stride, rows + t * stride, stride * sizeof(double));
+                    ++kept;
+                }
+                indexPost += kept;
+                state.decimationPhase = (state.decimationPhase + kept * amplifierDecimation) - SAMPLES_PER_DATA_BLOCK;
+            } else {
+                indexPost += SAMPLES_PER_DATA_BLOCK;
+            }
+            timing[FilterTime] += secondsSince(start);
         }
 
         // Load and scale RHD2000 auxiliary input waveforms
         // (sampled at 1/4 amplifier sampling rate)
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; t += 4) {
-            for (stream = 0; stream < numDataStreams; ++stream) {
+        if (decoded & DecodeAuxInput) {
+            for (t = 0; t < SAMPLES_PER_DATA_BLOCK; t += 4) {
                 // Auxiliary input waveform units = volts
                 auxChannel[stream][0][indexAux] =
                     Rhd2000DataBlock::auxADCToVolts(dataBlock.auxiliaryData[stream][Rhd2000EvalBoard::AuxCmd2][t + 1]);
@@ -226,41 +409,27 @@ void SignalProcessor::loadAmplifierData(deque<unique_ptr<Rhd2000DataBlock>> &dat
                     Rhd2000DataBlock::auxADCToVolts(dataBlock.auxiliaryData[stream][Rhd2000EvalBoard::AuxCmd2][t + 2]);
                 auxChannel[stream][2][indexAux] =
                     Rhd2000DataBlock::auxADCToVolts(dataBlock.auxiliaryData[stream][Rhd2000EvalBoard::AuxCmd2][t + 3]);
+                ++indexAux;
             }
-            ++indexAux;
         }
 
-        // Load and scale RHD2000 supply voltage and temperature sensor waveforms
+        // Load and scale RHD2000 supply voltage waveform
         // (sampled at 1/60 amplifier sampling rate)
-        temperature.calculateTemps(dataBlock);
-        for (stream = 0; stream < numDataStreams; ++stream) {
-            // Supply voltage waveform units = volts
-            supplyVoltage[stream][indexSupply] = dataBlock.getSupplyVoltage(stream);
-        }
-        ++indexSupply;
-
-        // Load and scale USB interface board ADC waveforms
-        // (sampled at amplifier sampling rate)
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            for (channel = 0; channel < 8; ++channel) {
-                // ADC waveform units = volts
-                boardAdc[channel][indexAdc] =
-                    Rhd2000DataBlock::boardADCToVolts(dataBlock.boardAdcData[channel][t]);
-            }
-            ++indexAdc;
+        // Supply voltage waveform units = volts
+        if (decoded & DecodeSupplyVoltage) {
+            supplyVoltage[stream][block] = dataBlock.getSupplyVoltage(stream);
+            temperature.pushSupplyVoltage(supplyVoltage[stream][block], stream);
         }
+        timing[AuxTime] += secondsSince(start);
 
-        // Load USB interface board digital input and output waveforms
-        for (t = 0; t < SAMPLES_PER_DATA_BLOCK; ++t) {
-            for (channel = 0; channel < 16; ++channel) {
-                boardDigIn[channel][indexDig] =
-                    (dataBlock.ttlIn[t] & (1 << channel)) != 0;
-                boardDigOut[channel][indexDig] =
-                    (dataBlock.ttlOut[t] & (1 << channel)) != 0;
-            }
-            ++indexDig;
+        // Temperature sensor (also sampled at 1/60 amplifier sampling rate)
+        if (decoded & DecodeTemperature) {
+            temperature.calculateTemp(dataBlock, stream);
         }
+        timing[TemperatureTime] += secondsSince(start);
     }
+
+    state.postFilterLength = indexPost;
 }
 
 // Looks for a trigger on digital input or boardADC triggerChannel with triggerPolarity.  
@@ -273,47 +442,43 @@ int SignalProcessor::findTrigger(int triggerChannel, int triggerPolarity)
 {
     const double AnalogTriggerThreshold = 1.65;
 
-    int maxIter;
-    if (triggerChannel >= 16) {
-        maxIter = boardAdc[triggerChannel - 16].size();
-    } else {
-        maxIter = boardDigIn[triggerChannel].size();
-    }
-
-    for (int t = 0; t < maxIter; ++t) {
+    // triggerPolarity nonzero means trigger on logic low, otherwise on logic high
+    TriggerSearch::Condition condition = triggerPolarity ? TriggerSearch::Low : TriggerSearch::High;
 
-        bool triggerFound;
-
-        // Look for trigger from ADC
-        if (triggerChannel >= 16) {
-            qreal value = boardAdc[triggerChannel - 16][t];
-            if (triggerPolarity) {
-                // Trigger on logic low
-                triggerFound = (value < AnalogTriggerThreshold);
-            } else {
-                // Trigger on logic high
-                triggerFound = (value >= AnalogTriggerThreshold);
-            }
+    TriggerSearch search;
+    if (triggerChannel >= 16) {
+        // Smallest ADC code that scales to at least the threshold voltage
+        unsigned int thresholdCode = static_cast<unsigned int>(ceil(AnalogTriggerThreshold / Rhd2000DataBlock::boardADCToVolts(1)));
+        while (thresholdCode > 0 && Rhd2000DataBlock::boardADCToVolts(thresholdCode - 1) >= AnalogTriggerThreshold) {
+            --thresholdCode;
         }
-
-        // Look for trigger from Digital Inputs
-        if (triggerChannel < 16) {
-            int value = boardDigIn[triggerChannel][t];
-            if (triggerPolarity) {
-                // Trigger on logic low
-                triggerFound = (value == 0);
-            } else {
-                // Trigger on logic high
-                triggerFound = (value == 1);
-            }
+        while (thresholdCode < 65536 && Rhd2000DataBlock::boardADCToVolts(thresholdCode) < AnalogTriggerThreshold) {
+            ++thresholdCode;
         }
+        search.addAnalogInput(triggerChannel - 16, condition, thresholdCode);
+    } else {
+        search.addDigitalInput(triggerChannel, condition);
+    }
+    return findTrigger(search);
+}
 
-        if (triggerFound) {
-            return t;
-        }
+// Looks for the first sample loaded by the last loadAmplifierData() that meets
+// the conditions in 'search' (which works on the packed digital inputs and raw
+// ADC codes directly).  Returns its index, or -1 if no sample does.  Keep the
+// same TriggerSearch from one call to the next so that edges between batches
+// are found.
+int SignalProcessor::findTrigger(TriggerSearch& search)
+{
+    if ((search.usesAnalogInputs() && !(decoded & DecodeBoardAdc)) ||
+        (search.usesDigitalInputs() && !(decoded & DecodeBoardDigIn))) {
+        throw std::logic_error("Trigger inputs aren't being decoded; see SignalProcessor::setDecodedSignals().");
     }
 
-    return -1;
+    const uint16_t* adcCodes[TriggerSearch::NumAnalogInputs];
+    for (int channel = 0; channel < TriggerSearch::NumAnalogInputs; ++channel) {
+        adcCodes[channel] = boardAdcCodes.isEmpty() ? nullptr : boardAdcCodes[channel].constData();
+    }
+    return search.find(boardDigIn.constData(), adcCodes, boardSampleCount);
 }
 
 // Set notch filter parameters.  All filter parameters are given in Hz (or
@@ -333,12 +498,14 @@ void SignalProcessor::setNotchFilter(double notchFreq, double bandwidth,
     b0 = (1 + d * d) / 2.0;
     b1 = a1;
     b2 = b0;
+    updateFilterSections();
 }
 
 // Enables or disables amplifier waveform notch filter.
 void SignalProcessor::setNotchFilterEnabled(bool enable)
 {
     notchFilterEnabled = enable;
+    updateFilterSections();
 }
 
 // Set highpass filter parameters.  All filter parameters are given in Hz (or
@@ -347,152 +514,154 @@ void SignalProcessor::setHighpassFilter(double cutoffFreq, double sampleFreq)
 {
     aHpf = exp(-1.0 * TWO_PI * cutoffFreq / sampleFreq);
     bHpf = 1.0 - aHpf;
+    updateFilterSections();
 }
 
 // Enables or disables amplifier waveform highpass filter.
 void SignalProcessor::setHighpassFilterEnabled(bool enable)
 {
     highpassFilterEnabled = enable;
+    updateFilterSections();
 }
 
-// Runs notch filter only on amplifier channels that are visible
-// on the display (according to channelVisible).
-void SignalProcessor::filterData(int numBlocks,
-                                 const QVector<QVector<bool> > &channelVisible)
-{
-    int t, channel, stream;
-    int length = SAMPLES_PER_DATA_BLOCK * numBlocks;
-
-    // Note: Throughout this function, and elsewhere in this source code, we access
-    // multidimensional 'QVector' containers using the at() function, so instead of
-    // writing:
-    //            x = my3dQVector[i][j][k];
-    // we write:
-    //            x = my3dQVector.at(i).at(j).at(k);
-    //
-    // Web research suggests that using at() instead of [] to access the contents
-    // of a multidimensional QVector results in faster code, and some preliminary
-    // experiments at Intan bear this out.  Web research also suggests that the
-    // opposite could be true of C++ STL (non-Qt) 'vector' containers, so some
-    // experimentation may be needed to optimize the runtime performance of code.
-
-    if (notchFilterEnabled) {
-        for (stream = 0; stream < numDataStreams; ++stream) {
-            for (channel = 0; channel < 32; ++channel) {
-                if (channelVisible.at(stream).at(channel)) {
-                    // Execute biquad IIR notch filter.  The filter "looks backwards" two timesteps,
-                    // so we must use the prevAmplifierPreFilter and prevAmplifierPostFilter
-                    // variables to store the last two samples from the previous block of
-                    // waveform data so that the filter works smoothly across the "seams".
-                    amplifierPostFilter[stream][channel][0] =
-                            b2 * prevAmplifierPreFilter.at(stream).at(channel).at(0) +
-                            b1 * prevAmplifierPreFilter.at(stream).at(channel).at(1) +
-                            b0 * amplifierPreFilter.at(stream).at(channel).at(0) -
-                            a2 * prevAmplifierPostFilter.at(stream).at(channel).at(0) -
-                            a1 * prevAmplifierPostFilter.at(stream).at(channel).at(1);
-                    amplifierPostFilter[stream][channel][1] =
-                            b2 * prevAmplifierPreFilter.at(stream).at(channel).at(1) +
-                            b1 * amplifierPreFilter.at(stream).at(channel).at(0) +
-                            b0 * amplifierPreFilter.at(stream).at(channel).at(1) -
-                            a2 * prevAmplifierPostFilter.at(stream).at(channel).at(1) -
-                            a1 * amplifierPostFilter.at(stream).at(channel).at(0);
-                    for (t = 2; t < length; ++t) {
-                        amplifierPostFilter[stream][channel][t] =
-                                b2 * amplifierPreFilter.at(stream).at(channel).at(t - 2) +
-                                b1 * amplifierPreFilter.at(stream).at(channel).at(t - 1) +
-                                b0 * amplifierPreFilter.at(stream).at(channel).at(t) -
-                                a2 * amplifierPostFilter.at(stream).at(channel).at(t - 2) -
-                                a1 * amplifierPostFilter.at(stream).at(channel).at(t - 1);
-                    }
-                }
-            }
-        }
-    } else {
-        // If the notch filter is disabled, simply copy the data without filtering.
-        for (stream = 0; stream < numDataStreams; ++stream) {
-            for (channel = 0; channel < 32; ++channel) {
-                for (t = 0; t < length; ++t) {
-                    amplifierPostFilter[stream][channel][t] =
-                            amplifierPreFilter.at(stream).at(channel).at(t);
-                }
-            }
-        }
+// Keeps only every factor'th sample in amplifierPostFilter (after filtering, so
+// enable a low-pass or band-pass filter first to avoid aliasing).  A factor of 1
+// keeps every sample.
+void SignalProcessor::setAmplifierDecimation(int factor)
+{
+    amplifierDecimation = (factor < 1) ? 1 : factor;
+    for (unsigned int stream = 0; stream < streams.size(); ++stream) {
+        streams[stream]->decimationPhase = 0;
     }
+}
 
-    // Save the last two data points from each waveform to use in successive IIR filter
-    // calculations.
-    for (stream = 0; stream < numDataStreams; ++stream) {
-        for (channel = 0; channel < 32; ++channel) {
-            prevAmplifierPreFilter[stream][channel][0] =
-                    amplifierPreFilter.at(stream).at(channel).at(length - 2);
-            prevAmplifierPreFilter[stream][channel][1] =
-                    amplifierPreFilter.at(stream).at(channel).at(length - 1);
-            prevAmplifierPostFilter[stream][channel][0] =
-                    amplifierPostFilter.at(stream).at(channel).at(length - 2);
-            prevAmplifierPostFilter[stream][channel][1] =
-                    amplifierPostFilter.at(stream).at(channel).at(length - 1);
-        }
-    }
+// Sets which types of signal loadAmplifierData() decodes, as DecodedSignal
+// flags or'd together.  Consumers should register just what they read: the
+// arrays for any other type are left untouched, and never cost any time.
+void SignalProcessor::setDecodedSignals(unsigned int signals)
+{
+    decoded = signals & DecodeAll;
+}
 
-    // Apply first-order high-pass filter, if selected
-    if (highpassFilterEnabled) {
-        double temp;
-        for (stream = 0; stream < numDataStreams; ++stream) {
-            for (channel = 0; channel < 32; ++channel) {
-                if (channelVisible.at(stream).at(channel)) {
-                    for (t = 0; t < length; ++t) {
-                        temp = amplifierPostFilter[stream][channel][t];
-                        amplifierPostFilter[stream][channel][t] -= highpassFilterState[stream][channel];
-                        highpassFilterState[stream][channel] =
-                                aHpf * highpassFilterState[stream][channel] + bHpf * temp;
-                    }
-                }
+// Decodes just the types of signal that saveList has enabled channels of (see
+// SaveList::import()).
+void SignalProcessor::setDecodedSignals(const SaveList& saveList)
+{
+    unsigned int signals = 0;
+    if (!saveList.amplifier.empty()) signals |= DecodeAmplifier;
+    if (!saveList.auxInput.empty()) signals |= DecodeAuxInput;
+    if (!saveList.supplyVoltage.empty()) signals |= DecodeSupplyVoltage;
+    if (saveList.saveTemp && !saveList.tempSensor.empty()) signals |= DecodeTemperature;
+    if (!saveList.boardAdc.empty()) signals |= DecodeBoardAdc;
+    if (saveList.boardDigIn) signals |= DecodeBoardDigIn;
+    if (saveList.boardDigOut) signals |= DecodeBoardDigOut;
+    setDecodedSignals(signals);
+}
+
+// Sets the number of threads loadAmplifierData() spreads the data streams across.
+void SignalProcessor::setNumThreads(unsigned int threads)
+{
+    numThreads = threads;
+    workerPool.reset();
+}
+
+// Zeros the stage times reported by timing().
+void SignalProcessor::resetTiming()
+{
+    stageTiming.scaleSeconds = 0.0;
+    stageTiming.filterSeconds = 0.0;
+    stageTiming.auxSeconds = 0.0;
+    stageTiming.temperatureSeconds = 0.0;
+    stageTiming.boardSeconds = 0.0;
+    stageTiming.wallSeconds = 0.0;
+    stageTiming.batches = 0;
+    stageTiming.threads = 0;
+}
+
+// Brings every stream's filter bank up to date with the enabled filters and
+// their coefficients.  A filter that stays enabled keeps its state, so changing
+// coefficients or enabling another filter doesn't restart it; a newly enabled
+// filter starts from zero state, as every filter does after allocateMemory().
+void SignalProcessor::updateFilterSections()
+{
+    BiquadBank::Coefficients notch;
+    notch.b0 = b0;
+    notch.b1 = b1;
+    notch.b2 = b2;
+    notch.a1 = a1;
+    notch.a2 = a2;
+
+    for (unsigned int stream = 0; stream < streams.size(); ++stream) {
+        BiquadBank& filter = streams[stream]->filter;
+        unsigned int section = 0;
+        if (notchFilterEnabled) {
+            if (notchInBank) {
+                filter.setBiquad(section, notch);
+            } else {
+                filter.insertBiquad(section, notch);
+            }
+            ++section;
+        } else if (notchInBank) {
+            filter.removeSection(section);
+        }
+        if (highpassFilterEnabled) {
+            if (highpassInBank) {
+                filter.setFirstOrderHighpass(section, aHpf, bHpf);
+            } else {
+                filter.insertFirstOrderHighpass(section, aHpf, bHpf);
             }
+        } else if (highpassInBank) {
+            filter.removeSection(section);
         }
     }
-
+    notchInBank = notchFilterEnabled;
+    highpassInBank = highpassFilterEnabled;
 }
 
 // --------------------------------------------------------------------------------------------------
 void TemperatureStorage::allocateMemory(int numStreams) {
-    // Initialize vector for averaging temperature readings over time.
-    vector<double> zeros(maxNumBlocks, 0);
-    tempRawHistory.resize(numStreams, zeros);
+    // Initialize histories for averaging sensor readings over time.
+    tempHistory.resize(numStreams);
+    supplyHistory.resize(numStreams);
 
-    tempRaw.resize(numStreams);
     tempAvg.resize(numStreams);
     tempHistoryReset(4, numStreams);
 }
 
 void TemperatureStorage::calculateTemps(Rhd2000DataBlock &dataBlock)
 {
-    int numDataStreams = dataBlock.amplifierData.size();
-
-    // Load and scale RHD2000 supply voltage and temperature sensor waveforms
-    // (sampled at 1/60 amplifier sampling rate)
+    // Blocks read while measuring impedances may have a different number of streams than this was allocated for
+    int numDataStreams = std::min(static_cast<int>(dataBlock.amplifierData.size()), numStreams());
 
     for (int stream = 0; stream < numDataStreams; ++stream) {
-        // Temperature sensor waveform units = degrees C
-        tempRaw[stream] = dataBlock.getTemperature(stream);
+        calculateTemp(dataBlock, stream);
+        pushSupplyVoltage(dataBlock.getSupplyVoltage(stream), stream);
     }
+}
 
+void TemperatureStorage::calculateTemp(Rhd2000DataBlock &dataBlock, int stream)
+{
+    // Load and scale RHD2000 temperature sensor waveform
+    // (sampled at 1/60 amplifier sampling rate)
+
+    // Temperature sensor waveform units = degrees C
     // Average multiple temperature readings to improve accuracy
-    tempHistoryPush(numDataStreams);
-    tempHistoryCalcAvg(numDataStreams);
+    tempHistory[stream].push(dataBlock.getTemperature(stream));
+    tempAvg[stream] = tempHistory[stream].average();
+}
+
+// Adds a stream's supply voltage reading (in volts) to its history.
+void TemperatureStorage::pushSupplyVoltage(double volts, int stream)
+{
+    supplyHistory[stream].push(volts);
 }
 
-// Reset the vector and variables used to calculate running average
-// of temperature sensor readings.
+// Reset the histories used to calculate running averages and trends
+// of temperature sensor and supply voltage readings.
 void TemperatureStorage::tempHistoryReset(unsigned int requestedLength, int numDataStreams)
 {
     if (numDataStreams == 0) return;
 
-    // Clear data in raw temperature sensor history vectors.
-    for (int stream = 0; stream < numDataStreams; ++stream) {
-        tempRawHistory[stream].assign(tempRawHistory[stream].size(), 0.0);
-    }
-    tempHistoryLength = 0;
-
     // Set number of samples used to average temperature sensor readings.
     // This number must be at least four, and must be an integer multiple of
     // four.  (See RHD2000 datasheet for details on temperature sensor operation.)
@@ -501,44 +670,93 @@ void TemperatureStorage::tempHistoryReset(unsigned int requestedLength, int numD
 
     if (tempHistoryMaxLength < 4) {
         tempHistoryMaxLength = 4;
-    } else if (tempHistoryMaxLength > tempRawHistory[0].size()) {
-        tempHistoryMaxLength = tempRawHistory[0].size();
+    } else if (tempHistoryMaxLength > static_cast<unsigned int>(maxNumBlocks)) {
+        tempHistoryMaxLength = maxNumBlocks;
     }
 
     int multipleOfFour = 4 * floor(((double)tempHistoryMaxLength) / 4.0);
 
     tempHistoryMaxLength = multipleOfFour;
+
+    // Clear the histories.
+    for (int stream = 0; stream < numDataStreams; ++stream) {
+        tempHistory[stream].reset(tempHistoryMaxLength);
+        supplyHistory[stream].reset(tempHistoryMaxLength);
+        tempAvg[stream] = 0.0;
+    }
 }
 
-// Push raw temperature sensor readings into the queue-like vector that
-// stores the last tempHistoryLength readings.
-void TemperatureStorage::tempHistoryPush(int numDataStreams)
+// --------------------------------------------------------------------------------------------------
+// Neumaier's variant of Kahan summation, which also copes with x being larger than the sum so far
+// (e.g., subtracting a reading that's leaving the history).
+void CompensatedSum::add(double x)
 {
-    int stream, i;
-
-    for (stream = 0; stream < numDataStreams; ++stream) {
-        for (i = tempHistoryLength; i > 0; --i) {
-            tempRawHistory[stream][i] = tempRawHistory[stream][i - 1];
-        }
-        tempRawHistory[stream][0] = tempRaw[stream];
-    }
-    if (tempHistoryLength < tempHistoryMaxLength) {
-        ++tempHistoryLength;
+    double t = sum + x;
+    if (fabs(sum) >= fabs(x)) {
+        compensation += (sum - t) + x;
+    } else {
+        compensation += (x - t) + sum;
     }
+    sum = t;
 }
 
-// Calculate running average of temperature from stored raw sensor readings.
-// Results are stored in the tempAvg vector.
-void TemperatureStorage::tempHistoryCalcAvg(int numDataStreams)
+SensorHistory::SensorHistory() :
+    newest(0),
+    count(0)
 {
-    for (int stream = 0; stream <  numDataStreams; ++stream) {
-        tempAvg[stream] = 0.0;
-        for (unsigned int i = 0; i < tempHistoryLength; ++i) {
-            tempAvg[stream] += tempRawHistory[stream][i];
-        }
-        if (tempHistoryLength > 0) {
-            tempAvg[stream] /= tempHistoryLength;
-        }
+}
+
+void SensorHistory::reset(unsigned int capacity)
+{
+    readings.assign(capacity, 0.0);
+    newest = 0;
+    count = 0;
+    sum = CompensatedSum();
+    ageSum = CompensatedSum();
+}
+
+// Adds a reading, dropping the oldest one if the history is full.
+void SensorHistory::push(double value)
+{
+    const unsigned int capacity = static_cast<unsigned int>(readings.size());
+    if (capacity == 0) return;
+
+    unsigned int slot = (count == 0) ? newest : (newest + 1) % capacity;
+    if (count == capacity) {
+        // The oldest reading is in the slot the new one goes into
+        double oldest = readings[slot];
+        ageSum.add(-static_cast<double>(count - 1) * oldest);
+        sum.add(-oldest);
+        --count;
     }
+
+    // Every reading already here gets one reading older, then the new one joins at age 0
+    ageSum.add(sum.value());
+    sum.add(value);
+    readings[slot] = value;
+    newest = slot;
+    ++count;
 }
 
+double SensorHistory::average() const
+{
+    return (count > 0) ? sum.value() / count : 0.0;
+}
+
+SensorTrend SensorHistory::trend() const
+{
+    SensorTrend t;
+    t.length = count;
+    t.latest = (count > 0) ? readings[newest] : 0.0;
+    t.average = average();
+    t.slope = 0.0;
+    if (count >= 2) {
+        // Least-squares fit against age: slope = -sum((age - mean age) * reading) / sum((age - mean age)^2),
+        // negated because age runs backwards in time
+        double n = count;
+        double meanAge = (n - 1.0) / 2.0;
+        double ageVariance = n * (n * n - 1.0) / 12.0;
+        t.slope = -(ageSum.value() - meanAge * sum.value()) / ageVariance;
+    }
+    return t;
+}
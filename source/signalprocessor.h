@@ -23,61 +23,161 @@
 #define SIGNALPROCESSOR_H
 
 #include "mainwindow.h"
+#include "biquadbank.h"
+#include "triggersearch.h"
 
 #include <queue>
 #include <memory>
+#include <cstdint>
 
 class SignalSources;
 class Rhd2000DataBlock;
+class EncoderPool;
 struct SaveList;
 
+// A sum of doubles that carries its rounding error along, so that adding and later subtracting the same values
+// (as a sliding window does) leaves no drift behind
+struct CompensatedSum {
+    double sum;
+    double compensation;
+
+    CompensatedSum() : sum(0.0), compensation(0.0) {}
+    void add(double x);
+    double value() const { return sum + compensation; }
+};
+
+// Latest reading of a sensor, plus its average and least-squares slope over the readings in its history
+struct SensorTrend {
+    double latest;
+    double average;
+    double slope; // Change per reading (readings are one data block apart); 0 with fewer than 2 readings
+    unsigned int length; // Readings the average and slope are over
+};
+
+// The last few readings of one sensor, in a ring buffer, with running sums so that adding a reading and getting the
+// average and slope take constant time however long the history is
+class SensorHistory {
+public:
+    SensorHistory();
+
+    void reset(unsigned int capacity); // Clears the history, and sets how many readings it keeps
+    void push(double value);
+    SensorTrend trend() const;
+    double average() const;
+    unsigned int length() const { return count; }
+
+private:
+    std::vector<double> readings;
+    unsigned int newest; // Index in readings of the newest reading
+    unsigned int count;
+    CompensatedSum sum; // Of the readings
+    CompensatedSum ageSum; // Of each reading times its age (0 for the newest, count - 1 for the oldest)
+};
+
 class TemperatureStorage {
 public:
     std::vector<double> tempAvg;
 
     void allocateMemory(int numStreams);
     void calculateTemps(Rhd2000DataBlock& dataBlock);
+    void calculateTemp(Rhd2000DataBlock& dataBlock, int stream); // Streams are independent, so may be done on different threads
+    void pushSupplyVoltage(double volts, int stream); // Likewise
     void tempHistoryReset(unsigned int requestedLength, int numDataStreams);
+    int numStreams() const { return static_cast<int>(tempHistory.size()); }
+
+    // Headstage temperature (degrees C) and supply voltage (volts) of each stream, over the same history as tempAvg
+    SensorTrend temperatureTrend(int stream) const { return tempHistory[stream].trend(); }
+    SensorTrend supplyVoltageTrend(int stream) const { return supplyHistory[stream].trend(); }
 
 private:
-    std::vector<double> tempRaw;
-    std::vector<std::vector<double>> tempRawHistory;
+    std::vector<SensorHistory> tempHistory;
+    std::vector<SensorHistory> supplyHistory;
 
-    unsigned int tempHistoryLength;
     unsigned int tempHistoryMaxLength;
+};
 
-    void tempHistoryPush(int numDataStreams);
-    void tempHistoryCalcAvg(int numDataStreams);
+// Time spent in each stage of SignalProcessor::loadAmplifierData(), since the last SignalProcessor::resetTiming().
+// Stages that run on worker threads are summed over the workers, so with N workers they can add up to N times wallSeconds.
+struct SignalProcessorTiming {
+    double scaleSeconds; // Amplifier data to microvolts
+    double filterSeconds; // Filter bank and decimation
+    double auxSeconds; // Auxiliary inputs and supply voltages
+    double temperatureSeconds;
+    double boardSeconds; // Board ADCs and digital inputs and outputs (on the calling thread)
+    double wallSeconds; // Elapsed time in loadAmplifierData()
+    unsigned int batches; // Calls to loadAmplifierData()
+    unsigned int threads; // Threads used by the last call
 };
 
 class SignalProcessor
 {
 public:
+    // Types of signal loadAmplifierData() decodes, to be or'd together; see setDecodedSignals()
+    enum DecodedSignal {
+        DecodeAmplifier = 0x01, // amplifierPreFilter and amplifierPostFilter
+        DecodeAuxInput = 0x02, // auxChannel
+        DecodeSupplyVoltage = 0x04, // supplyVoltage, and temperature's supply voltage trend
+        DecodeTemperature = 0x08, // temperature
+        DecodeBoardAdc = 0x10, // boardAdc and boardAdcCodes
+        DecodeBoardDigIn = 0x20, // boardDigIn
+        DecodeBoardDigOut = 0x40, // boardDigOut
+        DecodeAll = 0x7f
+    };
+
     SignalProcessor();
+    ~SignalProcessor();
 
     void allocateMemory(int numStreams);
     void setNotchFilter(double notchFreq, double bandwidth, double sampleFreq);
     void setNotchFilterEnabled(bool enable);
     void setHighpassFilter(double cutoffFreq, double sampleFreq);
     void setHighpassFilterEnabled(bool enable);
+    void setAmplifierDecimation(int factor);
+    void setDecodedSignals(unsigned int signals); // Initially DecodeAll
+    void setDecodedSignals(const SaveList& saveList); // Just the types saveList has enabled
+    unsigned int decodedSignals() const { return decoded; }
     void loadAmplifierData(std::deque<std::unique_ptr<Rhd2000DataBlock>> &dataQueue);
     int findTrigger(int triggerChannel, int triggerPolarity);
-    void filterData(int numBlocks, const QVector<QVector<bool> > &channelVisible);
+    int findTrigger(TriggerSearch& search);
+    int numBoardSamples() const { return boardSampleCount; }
+    int numAmplifierPostFilterSamples() const { return amplifierPostFilterLength; }
+    // Filtered (and decimated) amplifier waveforms of one stream, left in the filter bank's channel-interleaved layout:
+    // sample t of channel c is at amplifierPostFilter(stream)[t * amplifierPostFilterStride() + c]
+    const double* amplifierPostFilter(int stream) const { return streams[stream]->postFilter.data(); }
+    int amplifierPostFilterStride() const { return streams.empty() ? 0 : streams[0]->filter.stride(); }
+    void setNumThreads(unsigned int numThreads); // 0 (the default) uses one per core, up to one per data stream; 1 runs serially
+    const SignalProcessorTiming& timing() const { return stageTiming; }
+    void resetTiming();
 
     TemperatureStorage temperature;
 
     QVector<QVector<QVector<double> > > amplifierPreFilter;
-    QVector<QVector<QVector<double> > > amplifierPostFilter;
     QVector<QVector<QVector<double> > > auxChannel;
     QVector<QVector<double> > supplyVoltage;
     QVector<QVector<double> > boardAdc;
-    QVector<QVector<int> > boardDigIn;
-    QVector<QVector<int> > boardDigOut;
+    QVector<QVector<uint16_t> > boardAdcCodes; // Raw ADC codes, before scaling into boardAdc
+    QVector<uint16_t> boardDigIn; // Bit b of boardDigIn[t] is digital input b at sample t
+    QVector<uint16_t> boardDigOut;
 
 private:
-    QVector<QVector<QVector<double> > > prevAmplifierPreFilter;
-    QVector<QVector<QVector<double> > > prevAmplifierPostFilter;
-    QVector<QVector<double> > highpassFilterState;
+    // Each data stream is processed on its own (possibly on its own thread), with its own filters and buffers
+    struct StreamState {
+        BiquadBank filter; // Enabled filters, in order: notch, high-pass, across the stream's 32 channels
+        AlignedDoubles postFilter; // Amplifier samples in the filter bank's layout, filtered a block at a time in place
+        int decimationPhase; // Samples to skip before the next one kept, carried across calls
+        int postFilterLength; // Samples per channel written to amplifierPostFilter by the last call
+    };
+
+    std::vector<std::unique_ptr<StreamState>> streams;
+    int amplifierDecimation; // Keep every amplifierDecimation'th filtered sample
+    int amplifierPostFilterLength; // Samples per channel in amplifierPostFilter from the last loadAmplifierData()
+    int boardSampleCount; // Samples in boardAdc, boardDigIn, etc. from the last loadAmplifierData()
+    unsigned int decoded; // DecodedSignal flags
+
+    std::unique_ptr<EncoderPool> workerPool;
+    unsigned int numThreads;
+    AlignedDoubles workerTiming; // Each worker's stage times, one cache line per worker
+    SignalProcessorTiming stageTiming;
 
     int numDataStreams;
     double a1;
@@ -89,13 +189,17 @@ private:
     double aHpf;
     double bHpf;
     bool highpassFilterEnabled;
+    bool notchInBank; // True if the streams' filter banks have a notch section (the first section)
+    bool highpassInBank; // True if they have a high-pass section (after the notch, if any)
 
+    void updateFilterSections();
+    void loadStream(std::deque<std::unique_ptr<Rhd2000DataBlock>> &dataQueue, int stream, double* timing);
     void allocateDoubleArray3D(QVector<QVector<QVector<double> > > &array3D,
                                int xSize, int ySize, int zSize);
     void allocateDoubleArray2D(QVector<QVector<double> > &array2D,
                                int xSize, int ySize);
-    void allocateIntArray2D(QVector<QVector<int> > &array2D,
-                            int xSize, int ySize);
+    void allocateUInt16Array2D(QVector<QVector<uint16_t> > &array2D,
+                               int xSize, int ySize);
     void allocateDoubleArray1D(QVector<double> &array1D, int xSize);
     void fillZerosDoubleArray3D(QVector<QVector<QVector<double> > > &array3D);
     void fillZerosDoubleArray2D(QVector<QVector<double> > &array2D);
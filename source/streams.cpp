@@ -26,6 +26,20 @@
 #include "common.h"
 #include <system_error>
 #include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#if defined(_WIN32)
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
 
 using std::cerr;
 using std::endl;
@@ -72,52 +86,268 @@ int FileOutStream::write(const char* data, int len) {
 }
 
 //  ------------------------------------------------------------------------
-//const unsigned int BUFFERSIZE = ;
-BufferedOutStream::BufferedOutStream(unique_ptr<FileOutStream>&& other_, unsigned int bufferSize_) :
+BufferedOutStream::BufferedOutStream(unique_ptr<FileOutStream>&& other_, unsigned int bufferSize_, unsigned int numBuffers_) :
     other(std::move(other_)),
-    dataStreamBuffer(nullptr),
+    bufferSize(bufferSize_),
+    current(0),
     bufferIndex(0),
-    bufferSize(bufferSize_)
+    writing(false),
+    stopping(false),
+    stalls(0),
+    stallTime(0),
+    written(0),
+    accepted(0)
 {
-    dataStreamBuffer = new char[bufferSize_ + 4 * KILO];
+    unsigned int numBuffers = std::max(numBuffers_, 1u);
+    for (unsigned int i = 0; i < numBuffers; i++) {
+        buffers.push_back(unique_ptr<char[]>(new char[bufferSize]));
+        if (i != 0) {
+            freeBuffers.push_back(i);
+        }
+    }
+    if (numBuffers > 1) {
+        ioThread = std::thread(&BufferedOutStream::ioLoop, this);
+    }
 }
 
 BufferedOutStream::~BufferedOutStream() {
-    flush();
-    delete[] dataStreamBuffer;
+    try {
+        flush();
+    } catch (exception& e) {
+        cerr << "Error writing file: " << e.what() << endl;
+    }
+    if (!ioThread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    bufferReady.notify_one();
+    ioThread.join();
 }
 
 int BufferedOutStream::write(const char* data, int len) {
-    memcpy(&dataStreamBuffer[bufferIndex], data, len);
-    bufferIndex += len;
-    flushIfNecessary();
+    accepted += len;
+    int remaining = len;
+    while (remaining > 0) {
+        unsigned int n = std::min(static_cast<unsigned int>(remaining), bufferSize - bufferIndex);
+        memcpy(buffers[current].get() + bufferIndex, data, n);
+        bufferIndex += n;
+        data += n;
+        remaining -= n;
+        flushIfNecessary();
+    }
     return len;
 }
 
 void BufferedOutStream::flushIfNecessary() {
-    if (bufferIndex > bufferSize) {
-        other->write(dataStreamBuffer, bufferSize);
-        bufferIndex -= bufferSize;
-        memmove(dataStreamBuffer, dataStreamBuffer + bufferSize, bufferIndex);
+    if (bufferIndex >= bufferSize) {
+        submitCurrent();
     }
 }
 
 void BufferedOutStream::flush() {
     if (bufferIndex > 0) {
-        other->write(dataStreamBuffer, bufferIndex);
+        submitCurrent();
+    }
+    if (!ioThread.joinable()) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    bufferFree.wait(lock, [this] { return (fullBuffers.empty() && !writing) || ioError; });
+    rethrowIOError();
+}
+
+void BufferedOutStream::submitCurrent() {
+    if (!ioThread.joinable()) {
+        // Synchronous: write in the caller's thread, so errors are thrown from here directly
+        other->write(buffers[current].get(), bufferIndex);
+        std::lock_guard<std::mutex> lock(mutex);
+        written += bufferIndex;
         bufferIndex = 0;
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    rethrowIOError();
+    fullBuffers.push_back(std::make_pair(current, bufferIndex));
+    bufferReady.notify_one();
+
+    if (freeBuffers.empty()) {
+        // Every buffer is waiting on the disk; this is where a slow disk shows up as backpressure
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bufferFree.wait(lock, [this] { return !freeBuffers.empty() || ioError; });
+        stalls++;
+        stallTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        rethrowIOError();
     }
+    current = freeBuffers.front();
+    freeBuffers.pop_front();
+    bufferIndex = 0;
+}
+
+void BufferedOutStream::rethrowIOError() {
+    if (ioError) {
+        std::exception_ptr e = ioError;
+        ioError = nullptr;
+        std::rethrow_exception(e);
+    }
+}
+
+void BufferedOutStream::ioLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        bufferReady.wait(lock, [this] { return !fullBuffers.empty() || stopping; });
+        if (fullBuffers.empty()) {
+            break; // Stopping, and everything has been written
+        }
+        std::pair<int, unsigned int> buffer = fullBuffers.front();
+        fullBuffers.pop_front();
+        writing = true;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try {
+            other->write(buffers[buffer.first].get(), buffer.second);
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        writing = false;
+        if (error) {
+            if (!ioError) {
+                ioError = error;
+            }
+        } else {
+            written += buffer.second;
+        }
+        freeBuffers.push_back(buffer.first);
+        bufferFree.notify_all();
+    }
+}
+
+unsigned int BufferedOutStream::buffersPending() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<unsigned int>(fullBuffers.size()) + (writing ? 1 : 0);
+}
+
+uint64_t BufferedOutStream::numStalls() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stalls;
+}
+
+double BufferedOutStream::secondsStalled() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stallTime;
+}
+
+uint64_t BufferedOutStream::bytesWritten() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return written;
 }
 
 //  ------------------------------------------------------------------------
-BinaryWriter::BinaryWriter(unique_ptr<FileOutStream>&& other_, unsigned int bufferSize_) :
-    other(std::move(other_), bufferSize_)
+BinaryWriter::BinaryWriter(unique_ptr<FileOutStream>&& other_, unsigned int bufferSize_, unsigned int numBuffers_) :
+    other(std::move(other_), bufferSize_, numBuffers_)
 {
 }
 
 BinaryWriter::~BinaryWriter() {
 }
 
+void BinaryWriter::writeDoubles(const double* values, size_t count) {
+    // Byte-swap (if necessary) through a small buffer, a chunk at a time
+    const size_t perChunk = 4 * KILO / sizeof(double);
+    char data[4 * KILO];
+    while (count > 0) {
+        size_t n = std::min(count, perChunk);
+        if (IS_BIG_ENDIAN) {
+            for (size_t i = 0; i < n; i++) {
+                const char* tmp = reinterpret_cast<const char*>(&values[i]);
+                for (int b = 0; b < 8; b++) {
+                    data[8 * i + b] = tmp[7 - b];
+                }
+            }
+        } else {
+            memcpy(data, values, n * sizeof(double));
+        }
+        other.write(data, static_cast<int>(n * sizeof(double)));
+        values += n;
+        count -= n;
+    }
+}
+
+void BinaryWriter::writeBytes(const char* data, size_t count) {
+    while (count > 0) {
+        int n = static_cast<int>(std::min(count, static_cast<size_t>(64 * KILO * KILO)));
+        other.write(data, n);
+        data += n;
+        count -= n;
+    }
+}
+
+// Converts values to Out (adding offset), little-endian, a stack buffer at a time.  The conversion loop has no branches or
+// calls, so the compiler can vectorize it.
+template <typename Out, typename In>
+static void writeConverted(BufferedOutStream& ostream, const In* values, size_t count, int offset) {
+    const size_t perChunk = 4 * KILO / sizeof(Out);
+    Out data[perChunk];
+    while (count > 0) {
+        size_t n = std::min(count, perChunk);
+        for (size_t i = 0; i < n; i++) {
+            data[i] = static_cast<Out>(values[i] + offset);
+        }
+        if (IS_BIG_ENDIAN) {
+            char* bytes = reinterpret_cast<char*>(data);
+            for (size_t i = 0; i < n; i++) {
+                std::reverse(bytes + i * sizeof(Out), bytes + (i + 1) * sizeof(Out));
+            }
+        }
+        ostream.write(reinterpret_cast<const char*>(data), static_cast<int>(n * sizeof(Out)));
+        values += n;
+        count -= n;
+    }
+}
+
+void BinaryWriter::writeInt16(const int16_t* values, size_t count, int offset) {
+    writeConverted<int16_t>(other, values, count, offset);
+}
+
+void BinaryWriter::writeInt16(const int* values, size_t count, int offset) {
+    writeConverted<int16_t>(other, values, count, offset);
+}
+
+void BinaryWriter::writeUInt16(const uint16_t* values, size_t count, int offset) {
+    writeConverted<uint16_t>(other, values, count, offset);
+}
+
+void BinaryWriter::writeUInt16(const int* values, size_t count, int offset) {
+    writeConverted<uint16_t>(other, values, count, offset);
+}
+
+void BinaryWriter::writeInt32(const int32_t* values, size_t count, int offset) {
+    writeConverted<int32_t>(other, values, count, offset);
+}
+
+void BinaryWriter::writeInt32(const unsigned int* values, size_t count, int offset) {
+    writeConverted<int32_t>(other, values, count, offset);
+}
+
+BinaryWriter& operator<<(BinaryWriter& ostream, int64_t value) {
+    return ostream << static_cast<uint64_t>(value);
+}
+
+BinaryWriter& operator<<(BinaryWriter& ostream, uint64_t value) {
+    char data[8];
+    for (int b = 0; b < 8; b++) {
+        data[b] = (value >> (8 * b)) & 0xff;
+    }
+    ostream.other.write(data, 8);
+    return ostream;
+}
+
 BinaryWriter& operator<<(BinaryWriter& ostream, int32_t value) {
     char data[4];
     data[0] = value & 0x000000ff;
@@ -244,6 +474,15 @@ void FileInStream::close() {
     filestream.reset();
 }
 
+void FileInStream::seek(uint64_t pos) {
+    filestream->clear();
+    filestream->seekg(static_cast<std::streamoff>(pos), filestream->beg);
+}
+
+uint64_t FileInStream::position() {
+    return filestream->tellg();
+}
+
 int FileInStream::read(char* data, int len) {
     filestream->read(data, len);
     if (filestream->fail()) {
@@ -252,6 +491,164 @@ int FileInStream::read(char* data, int len) {
     return static_cast<int>(filestream->gcount());
 }
 
+//  ------------------------------------------------------------------------
+MappedFileInStream::MappedFileInStream() :
+    base(nullptr),
+    length(0),
+    pos(0)
+#if defined(_WIN32)
+    , fileHandle(INVALID_HANDLE_VALUE),
+    mappingHandle(nullptr)
+#endif
+{
+}
+
+MappedFileInStream::~MappedFileInStream() {
+    close();
+}
+
+bool MappedFileInStream::open(const FILENAME& filename) {
+    close();
+#if defined(_WIN32)
+    HANDLE file = CreateFile(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0 || static_cast<uint64_t>(fileSize.QuadPart) > SIZE_MAX) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        CloseHandle(file);
+        return false;
+    }
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (view == nullptr) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    fileHandle = file;
+    mappingHandle = mapping;
+    length = fileSize.QuadPart;
+#else
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0 || static_cast<uint64_t>(info.st_size) > SIZE_MAX) {
+        ::close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // The mapping keeps the file open
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    length = info.st_size;
+#endif
+    base = static_cast<const char*>(view);
+    pos = 0;
+    return true;
+}
+
+void MappedFileInStream::close() {
+    if (base == nullptr) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(base);
+    CloseHandle(mappingHandle);
+    CloseHandle(fileHandle);
+    mappingHandle = nullptr;
+    fileHandle = INVALID_HANDLE_VALUE;
+#else
+    munmap(const_cast<char*>(base), length);
+#endif
+    base = nullptr;
+    length = 0;
+    pos = 0;
+}
+
+int MappedFileInStream::read(char* data, int len) {
+    if (static_cast<uint64_t>(len) > bytesRemaining()) {
+        throw runtime_error("No more data");
+    }
+    memcpy(data, base + pos, len);
+    pos += len;
+    return len;
+}
+
+uint64_t MappedFileInStream::bytesRemaining() {
+    return length - pos;
+}
+
+void MappedFileInStream::seek(uint64_t pos_) {
+    pos = std::min(pos_, length);
+}
+
+uint64_t MappedFileInStream::position() {
+    return pos;
+}
+
+const char* MappedFileInStream::mappedData() {
+    return base;
+}
+
+#if defined(_WIN32)
+// PrefetchVirtualMemory() is only in Windows 8 and later, and only declared when building for them, so it's looked up
+// at run time (once); on older versions, prefetch() does nothing.
+namespace {
+    struct MemoryRangeEntry { // Same layout as WIN32_MEMORY_RANGE_ENTRY
+        PVOID VirtualAddress;
+        SIZE_T NumberOfBytes;
+    };
+    typedef BOOL (WINAPI *PrefetchVirtualMemoryFunction)(HANDLE, ULONG_PTR, MemoryRangeEntry*, ULONG);
+
+    PrefetchVirtualMemoryFunction prefetchVirtualMemory() {
+        static PrefetchVirtualMemoryFunction function = reinterpret_cast<PrefetchVirtualMemoryFunction>(
+                    GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory"));
+        return function;
+    }
+}
+#endif
+
+void MappedFileInStream::prefetch(uint64_t pos_, uint64_t len) {
+    if (base == nullptr || pos_ >= length) {
+        return;
+    }
+    len = std::min(len, length - pos_);
+#if defined(_WIN32)
+    PrefetchVirtualMemoryFunction function = prefetchVirtualMemory();
+    if (function != nullptr) {
+        MemoryRangeEntry range;
+        range.VirtualAddress = const_cast<char*>(base + pos_);
+        range.NumberOfBytes = static_cast<SIZE_T>(len);
+        function(GetCurrentProcess(), 1, &range, 0);
+    }
+#else
+    // madvise() wants a page-aligned start; the mapping itself is page-aligned
+    uint64_t pageSize = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t start = pos_ - (pos_ % pageSize);
+    madvise(const_cast<char*>(base + start), static_cast<size_t>(len + (pos_ - start)), MADV_WILLNEED);
+#endif
+}
+
+unique_ptr<InStream> openInStream(const FILENAME& filename) {
+    unique_ptr<MappedFileInStream> mapped(new MappedFileInStream());
+    if (mapped->open(filename)) {
+        return std::move(mapped);
+    }
+    unique_ptr<FileInStream> fs(new FileInStream());
+    if (fs->open(filename)) {
+        return std::move(fs);
+    }
+    return nullptr;
+}
+
 //  ------------------------------------------------------------------------
 BinaryReader::BinaryReader(unique_ptr<InStream>&& other_) :
     other(std::move(other_))
@@ -261,6 +658,67 @@ BinaryReader::BinaryReader(unique_ptr<InStream>&& other_) :
 BinaryReader::~BinaryReader() {
 }
 
+void BinaryReader::readBytes(char* data, size_t count) {
+    if (count > other->bytesRemaining()) {
+        throw runtime_error("No more data");
+    }
+    const char* mapped = other->mappedData();
+    if (mapped != nullptr) {
+        uint64_t pos = other->position();
+        memcpy(data, mapped + pos, count);
+        other->seek(pos + count);
+        return;
+    }
+    while (count > 0) {
+        int n = static_cast<int>(std::min(count, static_cast<size_t>(64 * KILO * KILO)));
+        if (other->read(data, n) != n) {
+            throw runtime_error("No more data");
+        }
+        data += n;
+        count -= n;
+    }
+}
+
+void BinaryReader::readDoubles(double* values, size_t count) {
+    const char* mapped = other->mappedData();
+    if (mapped != nullptr && !IS_BIG_ENDIAN) {
+        // Copy straight out of the mapping
+        uint64_t pos = other->position();
+        if (count * sizeof(double) > other->bytesRemaining()) {
+            throw runtime_error("No more data");
+        }
+        memcpy(values, mapped + pos, count * sizeof(double));
+        other->seek(pos + count * sizeof(double));
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        unsigned char data[8];
+        other->read(reinterpret_cast<char*>(data), 8);
+        uint64_t bits = 0;
+        for (int b = 0; b < 8; b++) {
+            bits |= static_cast<uint64_t>(data[b]) << (8 * b);
+        }
+        memcpy(&values[i], &bits, sizeof(double));
+    }
+}
+
+BinaryReader& operator>>(BinaryReader& istream, int64_t& value) {
+    uint64_t tmp;
+    istream >> tmp;
+    value = static_cast<int64_t>(tmp);
+    return istream;
+}
+
+BinaryReader& operator>>(BinaryReader& istream, uint64_t& value) {
+    unsigned char data[8];
+    istream.other->read(reinterpret_cast<char*>(data), 8);
+    value = 0;
+    for (int b = 0; b < 8; b++) {
+        value |= static_cast<uint64_t>(data[b]) << (8 * b);
+    }
+    return istream;
+}
+
 BinaryReader& operator>>(BinaryReader& istream, int32_t& value) {
     unsigned char data[4];
     istream.other->read(reinterpret_cast<char*>(data), 4);
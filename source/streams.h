@@ -27,6 +27,12 @@
 #include <cstdint>
 #include <iosfwd>
 #include <istream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
 
 #if defined(_WIN32) && defined(_UNICODE)
     typedef std::wstring FILENAME;
@@ -52,29 +58,83 @@ private:
 //  ------------------------------------------------------------------------
 const unsigned int KILO = 1024;
 
+// Collects writes into a buffer, and writes it to the FileOutStream when it's full.  Writes of any size are accepted; they're
+// split across as many buffers as needed.
+//
+// With one buffer (the default), the write happens in the caller's thread.  With more than one, the stream gets a background
+// I/O thread of its own: each full buffer is handed to it while the caller fills the next one, so a slow disk only holds up
+// the caller once every buffer is waiting to be written.  That costs a thread per stream, so it's only worth it for the few
+// large streams that carry most of the data (e.g., a single-file format's one file), not for one-file-per-channel formats.
+//
+// An error writing to the file (a std::system_error from FileOutStream) is thrown from write() or flush(); with an I/O thread,
+// it's rethrown from the next write() or flush() after it happens.
 class BufferedOutStream {
 public:
-    BufferedOutStream(std::unique_ptr<FileOutStream>&& other_, unsigned int bufferSize_);
+    BufferedOutStream(std::unique_ptr<FileOutStream>&& other_, unsigned int bufferSize_, unsigned int numBuffers_ = 1);
     ~BufferedOutStream();
 
     int write(const char* data, int len);
-    void flushIfNecessary();
-    void flush();
-    
+    void flushIfNecessary(); // Writes the current buffer (or hands it to the I/O thread) if it's full
+    void flush(); // Writes the current buffer (or hands it to the I/O thread), and waits until everything has been written
+
+    // Backpressure accounting
+    unsigned int buffersPending() const; // Number of buffers waiting to be written (or being written)
+    uint64_t numStalls() const; // Number of times write() had to wait for the I/O thread because every buffer was full
+    double secondsStalled() const; // Total time write() has spent waiting for the I/O thread
+    uint64_t bytesWritten() const; // Bytes written to the file so far
+    uint64_t position() const { return accepted; } // Bytes passed to write() so far (the file offset of the next byte written)
+
 private:
     std::unique_ptr<FileOutStream> other;
-    char* dataStreamBuffer;
-    unsigned int bufferIndex;
+    std::vector<std::unique_ptr<char[]>> buffers;
     unsigned int bufferSize;
+    int current; // Buffer being filled
+    unsigned int bufferIndex; // Bytes used in the buffer being filled
+
+    std::thread ioThread; // Only started with more than one buffer
+    mutable std::mutex mutex; // Protects everything below
+    std::condition_variable bufferReady; // Signaled when a full buffer is queued, or when stopping
+    std::condition_variable bufferFree; // Signaled when the I/O thread has written a buffer
+    std::deque<std::pair<int, unsigned int>> fullBuffers; // Buffers (and their lengths) waiting to be written, oldest first
+    std::deque<int> freeBuffers;
+    bool writing; // True while the I/O thread is writing a buffer
+    bool stopping;
+    std::exception_ptr ioError; // First error from the I/O thread, rethrown in the caller's thread
+    uint64_t stalls;
+    double stallTime;
+    uint64_t written;
+    uint64_t accepted; // Only touched by the caller's thread
+
+    void submitCurrent(); // Queues the current buffer, and waits for a free one to fill next
+    void rethrowIOError(); // Must be called with 'mutex' held
+    void ioLoop();
 };
 
 //  ------------------------------------------------------------------------
 class BinaryWriter {
 public:
-    BinaryWriter(std::unique_ptr<FileOutStream>&& other_, unsigned int bufferSize_);
+    BinaryWriter(std::unique_ptr<FileOutStream>&& other_, unsigned int bufferSize_, unsigned int numBuffers_ = 1);
     virtual ~BinaryWriter();
 
+    void writeDoubles(const double* values, size_t count); // Full (64-bit) precision, unlike operator<<(double)
+    void writeBytes(const char* data, size_t count); // Written as-is
+    uint64_t position() const { return other.position(); } // File offset of the next byte written
+
+    // Bulk writes: 'count' values, each with 'offset' added and then converted to the written type (e.g., the - 32768 that
+    // turns unsigned amplifier samples into signed ones), in one pass.  Equivalent to, but much faster than, that many
+    // operator<< calls.
+    void writeInt16(const int16_t* values, size_t count, int offset = 0);
+    void writeInt16(const int* values, size_t count, int offset = 0);
+    void writeUInt16(const uint16_t* values, size_t count, int offset = 0);
+    void writeUInt16(const int* values, size_t count, int offset = 0);
+    void writeInt32(const int32_t* values, size_t count, int offset = 0);
+    void writeInt32(const unsigned int* values, size_t count, int offset = 0);
+    void flush() { other.flush(); } // Waits until everything written so far is in the file
+    const BufferedOutStream& stream() const { return other; } // For backpressure accounting
+
 protected:
+    friend BinaryWriter& operator<<(BinaryWriter& ostream, int64_t value);
+    friend BinaryWriter& operator<<(BinaryWriter& ostream, uint64_t value);
     friend BinaryWriter& operator<<(BinaryWriter& ostream, int32_t value);
     friend BinaryWriter& operator<<(BinaryWriter& ostream, uint32_t value);
     friend BinaryWriter& operator<<(BinaryWriter& ostream, int16_t value);
@@ -96,6 +156,10 @@ public:
 
     virtual int read(char* data, int len) = 0;
     virtual uint64_t bytesRemaining() = 0;
+    virtual void seek(uint64_t pos) = 0; // Moves to absolute byte offset 'pos'
+    virtual uint64_t position() = 0;
+    virtual const char* mappedData() { return nullptr; } // Whole file, if it is memory mapped; nullptr otherwise
+    virtual void prefetch(uint64_t, uint64_t) {} // Hint that bytes [pos, pos + len) will be read soon
 };
 
 //  ------------------------------------------------------------------------
@@ -107,6 +171,8 @@ public:
     virtual bool open(const FILENAME& filename); // Opens with new name
     virtual int read(char* data, int len) override;
     uint64_t bytesRemaining() override;
+    void seek(uint64_t pos) override;
+    uint64_t position() override;
 
 private:
     std::unique_ptr<std::ifstream> filestream;
@@ -115,6 +181,38 @@ private:
     virtual void close();
 };
 
+//  ------------------------------------------------------------------------
+// Reads a file through a read-only memory mapping, so that seeking is free and only the pages actually read are loaded.
+// open() fails (and the caller should fall back to FileInStream) if the file can't be mapped, e.g., if it is larger
+// than the address space of a 32-bit process.
+class MappedFileInStream : public InStream {
+public:
+    MappedFileInStream();
+    ~MappedFileInStream();
+
+    bool open(const FILENAME& filename);
+    int read(char* data, int len) override;
+    uint64_t bytesRemaining() override;
+    void seek(uint64_t pos) override;
+    uint64_t position() override;
+    const char* mappedData() override;
+    void prefetch(uint64_t pos, uint64_t len) override; // Asks the OS to start reading those pages in
+
+private:
+    const char* base;
+    uint64_t length;
+    uint64_t pos;
+#if defined(_WIN32)
+    void* fileHandle;
+    void* mappingHandle;
+#endif
+
+    void close();
+};
+
+// Opens 'filename' memory mapped if possible, otherwise as a regular FileInStream.  Returns nullptr if it can't be opened.
+std::unique_ptr<InStream> openInStream(const FILENAME& filename);
+
 //  ------------------------------------------------------------------------
 class BinaryReader {
 public:
@@ -122,8 +220,17 @@ public:
     virtual ~BinaryReader();
 
     uint64_t bytesRemaining() { return other->bytesRemaining();  }
+    void seek(uint64_t pos) { other->seek(pos); }
+    uint64_t position() { return other->position(); }
+    const char* mappedData() { return other->mappedData(); }
+    void prefetch(uint64_t pos, uint64_t len) { other->prefetch(pos, len); }
+
+    void readDoubles(double* values, size_t count); // Full (64-bit) precision, unlike operator>>(double&)
+    void readBytes(char* data, size_t count); // Read as-is; throws if fewer than 'count' bytes remain
 
 protected:
+    friend BinaryReader& operator>>(BinaryReader& istream, int64_t& value);
+    friend BinaryReader& operator>>(BinaryReader& istream, uint64_t& value);
     friend BinaryReader& operator>>(BinaryReader& istream, int32_t& value);
     friend BinaryReader& operator>>(BinaryReader& istream, uint32_t& value);
     friend BinaryReader& operator>>(BinaryReader& istream, int16_t& value);
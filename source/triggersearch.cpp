@@ -0,0 +1,242 @@
+#include "triggersearch.h"
+#include <algorithm>
+#include <stdexcept>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TRIGGERSEARCH_SSE2
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+    const unsigned int ChunkLength = 256; // Samples whose analog inputs are turned into bits at a time (see analogScratch)
+
+    inline unsigned int countTrailingZeros(unsigned int x) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, x);
+        return index;
+#else
+        return __builtin_ctz(x);
+#endif
+    }
+
+    inline bool isHigh(uint16_t code, unsigned int threshold) {
+        return code >= threshold;
+    }
+}
+
+TriggerSearch::TriggerSearch()
+{
+    clear();
+}
+
+void TriggerSearch::clear()
+{
+    digital.high = digital.low = digital.rising = digital.falling = 0;
+    analog.high = analog.low = analog.rising = analog.falling = 0;
+    std::fill(thresholds, thresholds + NumAnalogInputs, 0u);
+    combine = All;
+    reset();
+}
+
+void TriggerSearch::reset()
+{
+    havePrevious = false;
+    previousDigital = 0;
+    previousAnalog = 0;
+}
+
+void TriggerSearch::addCondition(WordMasks& masks, int bit, Condition condition)
+{
+    uint16_t mask = static_cast<uint16_t>(1u << bit);
+    switch (condition) {
+    case High: masks.high |= mask; break;
+    case Low: masks.low |= mask; break;
+    case Rising: masks.rising |= mask; break;
+    case Falling: masks.falling |= mask; break;
+    }
+}
+
+void TriggerSearch::addDigitalInput(int input, Condition condition)
+{
+    if (input < 0 || input >= NumDigitalInputs) {
+        throw std::invalid_argument("Digital trigger input out of range.");
+    }
+    addCondition(digital, input, condition);
+}
+
+void TriggerSearch::addAnalogInput(int input, Condition condition, unsigned int thresholdCode)
+{
+    if (input < 0 || input >= NumAnalogInputs) {
+        throw std::invalid_argument("Analog trigger input out of range.");
+    }
+    addCondition(analog, input, condition);
+    thresholds[input] = std::min(thresholdCode, 65536u); // 65536 is never reached, so the input is always low
+}
+
+bool TriggerSearch::isEmpty() const
+{
+    return !digital.any() && !analog.any();
+}
+
+bool TriggerSearch::usesDigitalInputs() const
+{
+    return digital.any();
+}
+
+bool TriggerSearch::usesAnalogInputs() const
+{
+    return analog.any();
+}
+
+// Sets analogScratch[t] to the analog inputs' bits at samples start to start + n - 1.
+void TriggerSearch::analogBits(const uint16_t* const* adcCodes, unsigned int start, unsigned int n)
+{
+    const uint16_t used = analog.high | analog.low | analog.rising | analog.falling;
+    std::fill(analogScratch, analogScratch + n, static_cast<uint16_t>(0));
+
+    for (int input = 0; input < NumAnalogInputs; ++input) {
+        if ((used & (1u << input)) == 0) continue;
+        const uint16_t* codes = adcCodes[input] + start;
+        const unsigned int threshold = thresholds[input];
+        const uint16_t bit = static_cast<uint16_t>(1u << input);
+        unsigned int t = 0;
+#if defined(TRIGGERSEARCH_SSE2)
+        if (threshold > 0 && threshold < 65536) {
+            // SSE2 only compares signed 16-bit numbers, so flip the top bit of both sides to compare unsigned ones
+            const __m128i bias = _mm_set1_epi16(static_cast<short>(0x8000));
+            const __m128i below = _mm_set1_epi16(static_cast<short>((threshold - 1) ^ 0x8000));
+            const __m128i bits = _mm_set1_epi16(static_cast<short>(bit));
+            for (; t + 8 <= n; t += 8) {
+                __m128i c = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(codes + t)), bias);
+                __m128i high = _mm_and_si128(_mm_cmpgt_epi16(c, below), bits);
+                __m128i* out = reinterpret_cast<__m128i*>(analogScratch + t);
+                _mm_storeu_si128(out, _mm_or_si128(_mm_loadu_si128(out), high));
+            }
+        }
+#endif
+        for (; t < n; ++t) {
+            if (isHigh(codes[t], threshold)) {
+                analogScratch[t] |= bit;
+            }
+        }
+    }
+}
+
+// Returns true if the digital inputs 'd' and analog input bits 'a' meet the condition, given the previous sample's.
+bool TriggerSearch::matches(uint16_t d, uint16_t previousD, uint16_t a, uint16_t previousA) const
+{
+    uint16_t riseD = d & ~previousD, fallD = ~d & previousD;
+    uint16_t riseA = a & ~previousA, fallA = ~a & previousA;
+
+    if (combine == All) {
+        uint16_t missing = (digital.high & ~d) | (digital.low & d) | (digital.rising & ~riseD) | (digital.falling & ~fallD) |
+                           (analog.high & ~a) | (analog.low & a) | (analog.rising & ~riseA) | (analog.falling & ~fallA);
+        return missing == 0;
+    } else {
+        uint16_t hits = (digital.high & d) | (digital.low & ~d) | (digital.rising & riseD) | (digital.falling & fallD) |
+                        (analog.high & a) | (analog.low & ~a) | (analog.rising & riseA) | (analog.falling & fallA);
+        return hits != 0;
+    }
+}
+
+// Same as find(), on n samples of digital inputs 'd' and analog input bits 'a' (null if no analog inputs are used).
+int TriggerSearch::findInChunk(const uint16_t* d, const uint16_t* a, unsigned int n, uint16_t previousD, uint16_t previousA) const
+{
+    if (n == 0) return -1;
+    if (matches(d[0], previousD, a ? a[0] : 0, previousA)) return 0;
+
+    unsigned int t = 1;
+#if defined(TRIGGERSEARCH_SSE2)
+    // Eight samples at a time: each condition gives a 16-bit lane per sample, which is all ones if the sample meets
+    // it; movemask then has two bits per sample, and the lowest set one gives the first sample that triggers
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i dHigh = _mm_set1_epi16(static_cast<short>(digital.high)), dLow = _mm_set1_epi16(static_cast<short>(digital.low));
+    const __m128i dRising = _mm_set1_epi16(static_cast<short>(digital.rising)), dFalling = _mm_set1_epi16(static_cast<short>(digital.falling));
+    const __m128i aHigh = _mm_set1_epi16(static_cast<short>(analog.high)), aLow = _mm_set1_epi16(static_cast<short>(analog.low));
+    const __m128i aRising = _mm_set1_epi16(static_cast<short>(analog.rising)), aFalling = _mm_set1_epi16(static_cast<short>(analog.falling));
+
+    for (; t + 8 <= n; t += 8) {
+        __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + t));
+        __m128i p = _mm_loadu_si128(reinterpret_cast<const __m128i*>(d + t - 1));
+        __m128i aw = a ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + t)) : zero;
+        __m128i ap = a ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + t - 1)) : zero;
+        __m128i rise = _mm_andnot_si128(p, w), fall = _mm_andnot_si128(w, p);
+        __m128i aRise = _mm_andnot_si128(ap, aw), aFall = _mm_andnot_si128(aw, ap);
+
+        int found;
+        if (combine == All) {
+            __m128i missing = _mm_or_si128(
+                _mm_or_si128(_mm_or_si128(_mm_andnot_si128(w, dHigh), _mm_and_si128(w, dLow)),
+                             _mm_or_si128(_mm_andnot_si128(rise, dRising), _mm_andnot_si128(fall, dFalling))),
+                _mm_or_si128(_mm_or_si128(_mm_andnot_si128(aw, aHigh), _mm_and_si128(aw, aLow)),
+                             _mm_or_si128(_mm_andnot_si128(aRise, aRising), _mm_andnot_si128(aFall, aFalling))));
+            found = _mm_movemask_epi8(_mm_cmpeq_epi16(missing, zero));
+        } else {
+            __m128i hits = _mm_or_si128(
+                _mm_or_si128(_mm_or_si128(_mm_and_si128(w, dHigh), _mm_andnot_si128(w, dLow)),
+                             _mm_or_si128(_mm_and_si128(rise, dRising), _mm_and_si128(fall, dFalling))),
+                _mm_or_si128(_mm_or_si128(_mm_and_si128(aw, aHigh), _mm_andnot_si128(aw, aLow)),
+                             _mm_or_si128(_mm_and_si128(aRise, aRising), _mm_and_si128(aFall, aFalling))));
+            found = ~_mm_movemask_epi8(_mm_cmpeq_epi16(hits, zero)) & 0xffff;
+        }
+        if (found != 0) {
+            return t + countTrailingZeros(found) / 2;
+        }
+    }
+#endif
+    for (; t < n; ++t) {
+        if (matches(d[t], d[t - 1], a ? a[t] : 0, a ? a[t - 1] : 0)) return t;
+    }
+    return -1;
+}
+
+int TriggerSearch::find(const uint16_t* digitalIn, const uint16_t* const* adcCodes, unsigned int length)
+{
+    if (length == 0) return -1;
+
+    const bool useAnalog = usesAnalogInputs();
+    int result = -1;
+    if (!isEmpty()) {
+        uint16_t previousD = previousDigital, previousA = previousAnalog;
+        for (unsigned int start = 0; start < length; start += ChunkLength) {
+            unsigned int n = std::min(ChunkLength, length - start);
+            const uint16_t* a = nullptr;
+            if (useAnalog) {
+                analogBits(adcCodes, start, n);
+                a = analogScratch;
+            }
+            if (start == 0 && !havePrevious) {
+                // No previous sample, so no edge at the first one
+                previousD = digitalIn[0];
+                previousA = a ? a[0] : 0;
+            }
+
+            int found = findInChunk(digitalIn + start, a, n, previousD, previousA);
+            if (found >= 0) {
+                result = start + found;
+                break;
+            }
+            previousD = digitalIn[start + n - 1];
+            previousA = a ? a[n - 1] : 0;
+        }
+    }
+
+    // The last sample is the previous one for the next call's first
+    previousDigital = digitalIn[length - 1];
+    previousAnalog = 0;
+    if (useAnalog) {
+        const uint16_t used = analog.high | analog.low | analog.rising | analog.falling;
+        for (int input = 0; input < NumAnalogInputs; ++input) {
+            if ((used & (1u << input)) != 0 && isHigh(adcCodes[input][length - 1], thresholds[input])) {
+                previousAnalog |= static_cast<uint16_t>(1u << input);
+            }
+        }
+    }
+    havePrevious = true;
+    return result;
+}
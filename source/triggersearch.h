@@ -0,0 +1,73 @@
+#ifndef TRIGGERSEARCH_H
+#define TRIGGERSEARCH_H
+
+#include <cstdint>
+
+// Finds the first sample at which a trigger condition on the interface board's inputs is met.
+//
+// Digital inputs are read as packed words (bit b of digitalIn[t] is input b at sample t, as in Rhd2000DataBlock::ttlIn)
+// and analog inputs as raw 16-bit ADC codes, so nothing needs to be unpacked or scaled first.  Each input can be
+// required to be high or low (level), or to have just gone high or low (edge); an analog input is high when its code is
+// at least that input's threshold.  The inputs' requirements are combined with AND (all of them met at the same sample)
+// or OR (any of them).
+//
+// Edges are found across calls to find(): the first sample of each call is compared to the last sample of the call
+// before (after reset(), the first sample can only be a level, never an edge).  Eight samples are tested at a time with
+// SSE2 when it's available.
+class TriggerSearch {
+public:
+    enum Condition {
+        High, // Level: input is high
+        Low, // Level: input is low
+        Rising, // Edge: input was low at the previous sample, and is high now
+        Falling // Edge: input was high at the previous sample, and is low now
+    };
+
+    enum Combine {
+        All, // Trigger when every input's condition is met
+        Any // Trigger when at least one input's condition is met
+    };
+
+    static const int NumDigitalInputs = 16;
+    static const int NumAnalogInputs = 8;
+
+    TriggerSearch();
+
+    void clear(); // No inputs (find() never triggers), combined with All; also reset()
+    void addDigitalInput(int input, Condition condition);
+    void addAnalogInput(int input, Condition condition, unsigned int thresholdCode); // High is code >= thresholdCode
+    void setCombine(Combine c) { combine = c; }
+    bool isEmpty() const;
+    bool usesDigitalInputs() const;
+    bool usesAnalogInputs() const;
+
+    void reset(); // Forgets the last sample, so the next find() starts afresh
+
+    // Returns the index of the first of 'length' samples that meets the condition, or -1 if none does.  'adcCodes'
+    // points to NumAnalogInputs arrays of codes, and is only read if an analog input was added.
+    int find(const uint16_t* digitalIn, const uint16_t* const* adcCodes, unsigned int length);
+
+private:
+    // Requirements on one 16-bit word of input bits, one mask per Condition
+    struct WordMasks {
+        uint16_t high, low, rising, falling;
+        bool any() const { return (high | low | rising | falling) != 0; }
+    };
+
+    WordMasks digital;
+    WordMasks analog; // Bit i is analog input i
+    unsigned int thresholds[NumAnalogInputs];
+    Combine combine;
+
+    bool havePrevious; // False until the first find() after reset()
+    uint16_t previousDigital;
+    uint16_t previousAnalog;
+    uint16_t analogScratch[256]; // Analog inputs as bits (like digitalIn), for a chunk of samples
+
+    static void addCondition(WordMasks& masks, int bit, Condition condition);
+    void analogBits(const uint16_t* const* adcCodes, unsigned int start, unsigned int n);
+    bool matches(uint16_t d, uint16_t previousD, uint16_t a, uint16_t previousA) const;
+    int findInChunk(const uint16_t* d, const uint16_t* a, unsigned int n, uint16_t previousD, uint16_t previousA) const;
+};
+
+#endif // TRIGGERSEARCH_H
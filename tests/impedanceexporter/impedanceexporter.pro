@@ -0,0 +1,22 @@
+#-------------------------------------------------
+#
+# Checks for ImpedanceExporter (run with 'qmake && make check')
+#
+#-------------------------------------------------
+
+QT       += testlib
+QT       -= gui
+
+TARGET = tst_impedanceexporter
+CONFIG   += console testcase
+CONFIG   -= app_bundle
+TEMPLATE = app
+
+INCLUDEPATH += ../../source
+
+SOURCES += tst_impedanceexporter.cpp \
+    ../../source/impedanceexporter.cpp \
+    ../../source/electrodehistory.cpp
+
+HEADERS += ../../source/impedanceexporter.h \
+    ../../source/electrodehistory.h
@@ -0,0 +1,90 @@
+#include <QtTest>
+#include <QTemporaryDir>
+#include <clocale>
+#include <complex>
+#include "impedanceexporter.h"
+#include "electrodehistory.h"
+
+/* Checks that exported numbers don't depend on the locale the application runs in */
+class TestImpedanceExporter : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void historyUsesDecimalPoint();
+    void latestUsesDecimalPoint();
+
+private:
+    QString readAll(const QString &filename); //Read a whole exported file
+    QTemporaryDir dir; //Where exported files are written
+    ElectrodeHistory history; //One measurement on channel 5: 1.5 s, 100 kOhm - j 100 kOhm
+};
+
+
+/* Switch LC_NUMERIC to a comma-decimal locale (as QCoreApplication would in one), and set up the history */
+void TestImpedanceExporter::initTestCase()
+{
+    const char *locales[] = {"de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8", "fr_FR.utf8", "German_Germany.1252", "French_France.1252"};
+    bool found = false;
+    for (unsigned int i = 0; i < sizeof(locales) / sizeof(locales[0]) && !found; i++)
+        found = (setlocale(LC_NUMERIC, locales[i]) != 0);
+    if (!found)
+        QSKIP("No comma-decimal locale is installed");
+
+    //Make sure the C library really formats with a comma now, or the test proves nothing
+    char check[16];
+    snprintf(check, sizeof(check), "%.1f", 1.5);
+    QCOMPARE(QString(check), QString("1,5"));
+
+    QVERIFY(dir.isValid());
+    history.addMeasurement(5, 1.5, std::complex<double>(100000, -100000));
+}
+
+
+/* Put the C locale back */
+void TestImpedanceExporter::cleanupTestCase()
+{
+    setlocale(LC_NUMERIC, "C");
+}
+
+
+/* Export every measurement; every field must use '.' */
+void TestImpedanceExporter::historyUsesDecimalPoint()
+{
+    QString filename = dir.filePath("history.csv");
+    ImpedanceExporter exporter(ImpedanceExporter::CommaSeparated);
+    QVERIFY(exporter.exportHistory(filename, history));
+
+    QStringList lines = readAll(filename).split('\n', QString::SkipEmptyParts);
+    QCOMPARE(lines.size(), 2);
+    QCOMPARE(lines.at(1), QString("A-005,1.500,1.41e+05,-45,1.00e+05,1.59e-09"));
+}
+
+
+/* Export the latest impedances; every field must use '.' */
+void TestImpedanceExporter::latestUsesDecimalPoint()
+{
+    QString filename = dir.filePath("latest.csv");
+    ImpedanceExporter exporter(ImpedanceExporter::CommaSeparated);
+    QVERIFY(exporter.exportLatest(filename, history));
+
+    QStringList lines = readAll(filename).split('\n', QString::SkipEmptyParts);
+    QCOMPARE(lines.size(), 2);
+    QCOMPARE(lines.at(1), QString("A-005,A-005,Port A,1,1.41e+05,-45,1.00e+05,1.59e-09"));
+}
+
+
+/* Private - Read a whole exported file */
+QString TestImpedanceExporter::readAll(const QString &filename)
+{
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly))
+        return QString();
+    return QString::fromLatin1(file.readAll());
+}
+
+QTEST_GUILESS_MAIN(TestImpedanceExporter)
+
+#include "tst_impedanceexporter.moc"